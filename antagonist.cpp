@@ -0,0 +1,276 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "antagonist.h"
+#include "console.h"
+#include "jconf.h"
+#include "minethd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <intrin.h>
+#else
+#include <mm_malloc.h>
+#include <x86intrin.h>
+#endif // _WIN32
+
+void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id);
+
+bool antagonist::parse(const char* sList, std::vector<spec>& vOut)
+{
+	vOut.clear();
+	while(true)
+	{
+		spec s;
+		const char* sColon = strchr(sList, ':');
+		if(sColon == nullptr)
+			return false;
+
+		size_t iLen = size_t(sColon - sList);
+		if(iLen == 2 && strncmp(sList, "l3", 2) == 0)
+			s.iKind = l3_stream;
+		else if(iLen == 3 && strncmp(sList, "mem", 3) == 0)
+			s.iKind = mem_bw;
+		else if(iLen == 3 && strncmp(sList, "aes", 3) == 0)
+			s.iKind = aes_div;
+		else
+			return false;
+
+		char* pEnd;
+		unsigned long iCpu = strtoul(sColon + 1, &pEnd, 10);
+		if(pEnd == sColon + 1 || iCpu > 0xFFFF)
+			return false;
+		s.iCpu = uint32_t(iCpu);
+		vOut.push_back(s);
+
+		if(*pEnd == '\0')
+			return true;
+		if(*pEnd != ',')
+			return false;
+		sList = pEnd + 1;
+	}
+}
+
+const char* antagonist::name(kind iKind)
+{
+	switch(iKind)
+	{
+	case l3_stream:
+		return "L3 streamer";
+	case mem_bw:
+		return "memory hog";
+	case aes_div:
+		return "AES/div load";
+	}
+	return "unknown";
+}
+
+// cpuid leaf 4 (Intel) and 0x8000001D (AMD) list the caches with the same layout
+size_t antagonist::llc_bytes()
+{
+	int32_t cpu_info[4];
+	char cpustr[13] = {0};
+
+	jconf::cpuid(0, 0, cpu_info);
+	memcpy(cpustr, &cpu_info[1], 4);
+	memcpy(cpustr+4, &cpu_info[3], 4);
+	memcpy(cpustr+8, &cpu_info[2], 4);
+
+	uint32_t leaf;
+	if(strcmp(cpustr, "GenuineIntel") == 0 && cpu_info[0] >= 4)
+		leaf = 4;
+	else if(strcmp(cpustr, "AuthenticAMD") == 0)
+	{
+		jconf::cpuid(0x80000000, 0, cpu_info);
+		if(uint32_t(cpu_info[0]) < 0x8000001D)
+			return 0;
+		leaf = 0x8000001D;
+	}
+	else
+		return 0;
+
+	size_t iMax = 0;
+	for(int32_t i = 0; i < 16; i++)
+	{
+		jconf::cpuid(leaf, i, cpu_info);
+		if((cpu_info[0] & 0x1F) == 0)
+			break;
+
+		// ways * partitions * line size * sets
+		size_t iSize = size_t((uint32_t(cpu_info[1]) >> 22) + 1) * (((uint32_t(cpu_info[1]) >> 12) & 0x3FF) + 1) *
+			((uint32_t(cpu_info[1]) & 0xFFF) + 1) * (uint32_t(cpu_info[2]) + 1);
+		iMax = std::max(iMax, iSize);
+	}
+	return iMax;
+}
+
+bool antagonist::start(const std::vector<spec>& vSpecs, size_t iLlcBytes)
+{
+	stop();
+	bQuit = false;
+	bRun = false;
+	iActiveUsec = 0;
+
+	int32_t cpu_info[4];
+	jconf::cpuid(1, 0, cpu_info);
+	bHaveAes = (cpu_info[2] & (1 << 25)) != 0;
+
+	for(const spec& s : vSpecs)
+	{
+		worker* w = new worker();
+		w->oSpec = s;
+		w->pBuf = nullptr;
+		w->iBytes = 0;
+		w->iWork = 0;
+
+		if(s.iKind != aes_div)
+		{
+			w->iBytes = s.iKind == l3_stream ? iLlcBytes : std::max<size_t>(iLlcBytes * 8, 256 * 1024 * 1024);
+			w->iBytes = (w->iBytes + 4095) & ~size_t(4095);
+			w->pBuf = (uint8_t*)_mm_malloc(w->iBytes, 4096);
+			if(w->pBuf == nullptr)
+			{
+				printer::inst()->print_msg(L0, "Antagonist: failed to allocate %llu MB for the %s.",
+					int_port(w->iBytes / (1024 * 1024)), name(s.iKind));
+				delete w;
+				stop();
+				return false;
+			}
+			memset(w->pBuf, 1, w->iBytes);
+		}
+
+		vWorkers.push_back(w);
+		w->oThd = std::thread(&antagonist::work_main, this, w);
+		thd_setaffinity(w->oThd.native_handle(), s.iCpu);
+	}
+	return true;
+}
+
+void antagonist::resume()
+{
+	if(!bRun.exchange(true))
+		iResumedAt = minethd::get_usec();
+}
+
+void antagonist::pause()
+{
+	if(bRun.exchange(false))
+		iActiveUsec += minethd::get_usec() - iResumedAt;
+}
+
+void antagonist::stop()
+{
+	pause();
+	bQuit = true;
+	for(worker* w : vWorkers)
+	{
+		w->oThd.join();
+		_mm_free(w->pBuf);
+		delete w;
+	}
+	vWorkers.clear();
+}
+
+void antagonist::print_rates()
+{
+	double fSec = double(iActiveUsec) / 1000000.0;
+	for(const worker* w : vWorkers)
+	{
+		double fRate = fSec > 0.0 ? double(w->iWork.load()) / fSec : 0.0;
+		if(w->oSpec.iKind == aes_div)
+			printer::inst()->print_msg(L0, "Antagonist %s on cpu %u: %.1f M AES rounds and divisions/s.", name(w->oSpec.iKind),
+				w->oSpec.iCpu, fRate / 1e6);
+		else
+			printer::inst()->print_msg(L0, "Antagonist %s on cpu %u: %.1f GB/s over %llu MB.", name(w->oSpec.iKind), w->oSpec.iCpu,
+				fRate / 1e9, int_port(w->iBytes / (1024 * 1024)));
+	}
+}
+
+void antagonist::work_main(worker* w)
+{
+	__m128i x = _mm_set_epi64x(0x0123456789ABCDEFULL, 0xFEDCBA9876543210ULL);
+	__m128i k = _mm_set_epi64x(0x5555AAAA5555AAAAULL, 0x3333CCCC3333CCCCULL);
+	uint64_t n = 0xFFFFFFFFFFFFULL, d = 0x12345;
+
+	while(!bQuit.load(std::memory_order_relaxed))
+	{
+		if(!bRun.load(std::memory_order_relaxed))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		switch(w->oSpec.iKind)
+		{
+		case l3_stream:
+			// One dirty word per line, the whole cache has to be written back and refilled
+			for(size_t i = 0; i < w->iBytes && bRun.load(std::memory_order_relaxed); i += 4096)
+			{
+				for(size_t j = 0; j < 4096; j += 64)
+					*(uint64_t*)(w->pBuf + i + j) += 1;
+				w->iWork.fetch_add(4096, std::memory_order_relaxed);
+			}
+			break;
+
+		case mem_bw:
+			// Reads one half and writes the other, like a large memcpy
+			for(size_t i = 0; i < w->iBytes / 2 && bRun.load(std::memory_order_relaxed); i += 4096)
+			{
+				const __m128i* pSrc = (const __m128i*)(w->pBuf + i);
+				__m128i* pDst = (__m128i*)(w->pBuf + w->iBytes / 2 + i);
+				for(size_t j = 0; j < 4096 / 16; j++)
+					_mm_store_si128(pDst + j, _mm_add_epi64(_mm_load_si128(pSrc + j), k));
+				w->iWork.fetch_add(8192, std::memory_order_relaxed);
+			}
+			break;
+
+		case aes_div:
+			// Both chains depend on themselves, so the units stay busy and nothing can be dropped.
+			// Without AES-NI only the divider gets loaded.
+			for(size_t i = 0; i < 1024; i++)
+			{
+				if(bHaveAes)
+				{
+					x = _mm_aesenc_si128(x, k);
+					x = _mm_aesenc_si128(x, k);
+					x = _mm_aesenc_si128(x, k);
+					x = _mm_aesenc_si128(x, k);
+				}
+				n = (n / d) | (uint64_t(_mm_cvtsi128_si64(x)) << 20);
+				d = (n & 0xFFFF) | 0x10001;
+			}
+			w->iWork.fetch_add(bHaveAes ? 5 * 1024 : 1024, std::memory_order_relaxed);
+			break;
+		}
+	}
+
+	// Keeps the compiler from dropping the chains
+	if(_mm_cvtsi128_si64(x) == int64_t(n))
+		printer::inst()->print_msg(L4, "Antagonist: chains met.");
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Threads that take from the miner what a busy neighbour on a shared host would. The L3 streamer
+// dirties a buffer the size of the L3 so our scratchpads get evicted, the memory hog streams
+// through a buffer far larger than any cache to eat the bandwidth, and the AES/div load keeps the
+// AES unit and the divider of a core busy, meant for the hyperthread sibling of a mining thread.
+// The threads are created paused, so a benchmark can measure with and without them.
+class antagonist
+{
+public:
+	enum kind { l3_stream, mem_bw, aes_div };
+
+	struct spec
+	{
+		kind iKind;
+		uint32_t iCpu;
+	};
+
+	// "l3:2,mem:3,aes:1" - kind and CPU of every thread
+	static bool parse(const char* sList, std::vector<spec>& vOut);
+	static const char* name(kind iKind);
+	// Size of the largest cache cpuid tells about, 0 if it doesn't
+	static size_t llc_bytes();
+
+	~antagonist() { stop(); }
+
+	// iLlcBytes - buffer of the L3 streamer, the memory hog uses eight times that and at least 256 MB
+	bool start(const std::vector<spec>& vSpecs, size_t iLlcBytes);
+	void resume();
+	void pause();
+	void stop();
+
+	// Bytes streamed (or AES rounds and divisions done) per second of every thread while it ran
+	void print_rates();
+
+private:
+	struct worker
+	{
+		spec oSpec;
+		uint8_t* pBuf;
+		size_t iBytes;
+		std::atomic<uint64_t> iWork;
+		std::thread oThd;
+	};
+
+	void work_main(worker* w);
+
+	std::vector<worker*> vWorkers;
+	std::atomic<bool> bRun = { false };
+	std::atomic<bool> bQuit = { false };
+	uint64_t iActiveUsec = 0;
+	uint64_t iResumedAt = 0;
+	bool bHaveAes = false;
+};
@@ -1,6 +1,12 @@
 #pragma once
 #include "jconf.h"
 #include "console.h"
+#include "autotune.h"
+#include "cacheprobe.h"
+#include "cgroupLimits.hpp"
+#include "hybridCores.hpp"
+
+#include <algorithm>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -8,6 +14,10 @@
 #include <unistd.h>
 #endif // _WIN32
 
+#ifdef __linux__
+#include "sysfsTopology.hpp"
+#endif
+
 // Mask bits between h and l and return the value
 // This enables us to put in values exactly like in the manual
 // For example EBX[31:22] is get_masked(cpu_info[1], 31, 22)
@@ -21,17 +31,24 @@ class autoAdjust
 {
 public:
 
-	autoAdjust()
+	// bProbeCache measures the capacity of every cache domain instead of trusting its reported size
+	autoAdjust(bool bProbeCache = false) : bProbeCache(bProbeCache)
 	{
 	}
 
 	void printConfig()
 	{
-		printer::inst()->print_str("The configuration for 'cpu_threads_conf' in your config file is 'null'.\n");
+		if(jconf::inst()->NeedsAutoconf())
+			printer::inst()->print_str("The configuration for 'cpu_threads_conf' in your config file is 'null'.\n");
 		printer::inst()->print_str("The miner evaluates your system and prints a suggestion for the section `cpu_threads_conf` to the terminal.\n");
 		printer::inst()->print_str("The values are not optimal, please try to tweak the values based on notes in config.txt.\n");
 		printer::inst()->print_str("Please copy & paste the block within the asterisks to your config.\n\n");
 
+#ifdef __linux__
+		if(printConfigSysfs())
+			return;
+#endif
+
 		if(!detectL3Size() || L3KB_size < 1024 || L3KB_size > 102400)
 		{
 			if(L3KB_size < 1024 || L3KB_size > 102400)
@@ -52,19 +69,27 @@ public:
 		printer::inst()->print_msg(L0, "Autoconf core count detected as %u on %s.", corecnt,
 			linux_layout ? "Linux" : "Windows");
 
+		std::vector<uint32_t> cpus;
+		for(uint32_t i = 0; i < corecnt; i++)
+			cpus.push_back(i);
+		planCgroup(cpus);
+		loadHybrid(cpus);
+		size_t threads = std::min<size_t>(corecnt, threadBudget);
+		L3KB_size = int32_t(std::min<size_t>(size_t(L3KB_size), hashBudget * 2048));
+
 		printer::inst()->print_str("\n**************** Copy&Paste BEGIN ****************\n\n");
 		printer::inst()->print_str("\"cpu_threads_conf\" :\n[\n");
 
 		uint32_t aff_id = 0;
 		char strbuf[256];
-		for(uint32_t i=0; i < corecnt; i++)
+		for(uint32_t i=0; i < threads; i++)
 		{
 			bool double_mode;
 
 			if(L3KB_size <= 0)
 				break;
 
-			double_mode = L3KB_size / 2048 > (int32_t)(corecnt-i);
+			double_mode = L3KB_size / 2048 > (int32_t)(threads-i) && !isEffCore(aff_id);
 
 			snprintf(strbuf, sizeof(strbuf), "   { \"low_power_mode\" : %s, \"no_prefetch\" : true, \"affine_to_cpu\" : %u },\n",
 				double_mode ? "true" : "false", aff_id);
@@ -89,7 +114,344 @@ public:
 		printer::inst()->print_str("],\n\n**************** Copy&Paste END ****************\n");
 	}
 
+	// sysfs knows the real siblings and caches, without it all we know is the L3 size
+	// and the CPU count and the siblings are guessed the same way as the affinities above
+	bool getTopology(std::vector<autotune::cache_domain>& vDomains)
+	{
+#ifdef __linux__
+		std::vector<const sysfsTopology::topo_obj*> tlcs;
+		if(topo.load())
+			findChildrenCaches(topo.machine(), tlcs);
+
+		if(!tlcs.empty())
+		{
+			vDomains.clear();
+			cg.load();
+			hybrid.load(topo.machine().vCpus);
+			for(const sysfsTopology::topo_obj* obj : tlcs)
+			{
+				autotune::cache_domain dom;
+				dom.iCacheSize = getUsableCacheSize(*obj);
+				findChildrenByType(*obj, sysfsTopology::obj_core, [this, &dom](const sysfsTopology::topo_obj& core)
+				{
+					std::vector<uint32_t> pus;
+					for(uint32_t cpu : core.vCpus)
+					{
+						if(cg.hasCpu(cpu))
+							pus.emplace_back(cpu);
+					}
+					if(!pus.empty())
+						dom.vCores.emplace_back(pus);
+				});
+
+				if(!dom.vCores.empty())
+				{
+					orderCores(dom);
+					vDomains.emplace_back(dom);
+				}
+			}
+			return !vDomains.empty();
+		}
+#endif
+
+		if(!detectL3Size() || L3KB_size < 1024 || L3KB_size > 102400)
+			return false;
+
+		detectCPUConf();
+
+		cg.load();
+		std::vector<uint32_t> cpus;
+		for(uint32_t i = 0; i < corecnt; i++)
+			cpus.push_back(i);
+		hybrid.load(cpus);
+
+		autotune::cache_domain dom;
+		dom.iCacheSize = size_t(L3KB_size) * 1024;
+		for(uint32_t i = 0; i < corecnt; i += linux_layout && !old_amd ? 1 : 2)
+		{
+			std::vector<uint32_t> pus;
+			for(uint32_t cpu = i; cpu < corecnt && cpu < i + (linux_layout && !old_amd ? 1 : 2); cpu++)
+			{
+				if(cg.hasCpu(cpu))
+					pus.push_back(cpu);
+			}
+			if(!pus.empty())
+				dom.vCores.push_back(pus);
+		}
+		if(dom.vCores.empty())
+			return false;
+
+		orderCores(dom);
+		vDomains.clear();
+		vDomains.push_back(dom);
+		return true;
+	}
+
 private:
+	static constexpr size_t hashSize = 2 * 1024 * 1024;
+	bool bProbeCache;
+
+	// Containers see the whole host, the cgroup says what we may use of it
+	cgroupLimits cg;
+	size_t threadBudget = size_t(-1);
+	size_t hashBudget = size_t(-1);
+
+	hybridCores hybrid;
+
+	void loadHybrid(const std::vector<uint32_t>& cpus)
+	{
+		if(hybrid.load(cpus))
+			printer::inst()->print_msg(L0, "Autoconf: hybrid CPU with %llu P-core and %llu E-core CPUs (%s), the E-cores get single hashes only.",
+				int_port(hybrid.count(hybridCores::core_perf)), int_port(hybrid.count(hybridCores::core_eff)), hybrid.source());
+	}
+
+	bool isEffCore(uint32_t cpu)
+	{
+		return hybrid.type(cpu) == hybridCores::core_eff;
+	}
+
+	// P-cores first, they get the first threads and with them the double hashes
+	void orderCores(autotune::cache_domain& dom)
+	{
+		dom.vEffCores.clear();
+		if(!hybrid.isHybrid())
+			return;
+
+		std::stable_partition(dom.vCores.begin(), dom.vCores.end(),
+			[this](const std::vector<uint32_t>& core) { return !isEffCore(core[0]); });
+		for(const std::vector<uint32_t>& core : dom.vCores)
+			dom.vEffCores.push_back(isEffCore(core[0]));
+	}
+
+	void planCgroup(const std::vector<uint32_t>& cpus)
+	{
+		if(!cg.load())
+			return;
+
+		size_t allowed = 0;
+		for(uint32_t cpu : cpus)
+			allowed += cg.hasCpu(cpu) ? 1 : 0;
+		if(allowed < cpus.size())
+			printer::inst()->print_msg(L0, "Autoconf: cgroup cpuset allows %llu of %llu CPUs.", int_port(allowed), int_port(cpus.size()));
+		cg.plan(allowed, hashSize, threadBudget, hashBudget);
+	}
+
+	size_t probeCache(const std::vector<uint32_t>& cpus, size_t reported)
+	{
+		cacheprobe::result res = cacheprobe().measure(cpus, reported);
+		if(res.iCapacity == 0)
+		{
+			printer::inst()->print_msg(L0, "Cache probe: no latency cliff on %llu cores, using the reported %llu KB.",
+				int_port(cpus.size()), int_port(reported / 1024));
+			return 0;
+		}
+
+		printer::inst()->print_msg(L0, "Cache probe: %llu cores hold %llu KB (chase %llu KB, cn pattern %llu KB), reported %llu KB.",
+			int_port(cpus.size()), int_port(res.iCapacity / 1024), int_port(res.iChaseBytes / 1024),
+			int_port(res.iCnBytes / 1024), int_port(reported / 1024));
+		return res.iCapacity;
+	}
+
+	// cpuid leaf 4 (Intel) and 0x8000001D (AMD) have the same layout, EDX bit 1 is inclusiveness.
+	// Unknown caches count as exclusive, same as hwloc does without the info.
+	bool isCacheInclusive(uint32_t level)
+	{
+		int32_t cpu_info[4];
+		char cpustr[13] = {0};
+
+		jconf::cpuid(0, 0, cpu_info);
+		memcpy(cpustr, &cpu_info[1], 4);
+		memcpy(cpustr+4, &cpu_info[3], 4);
+		memcpy(cpustr+8, &cpu_info[2], 4);
+
+		uint32_t leaf;
+		if(strcmp(cpustr, "GenuineIntel") == 0 && cpu_info[0] >= 4)
+			leaf = 4;
+		else if(strcmp(cpustr, "AuthenticAMD") == 0)
+		{
+			jconf::cpuid(0x80000000, 0, cpu_info);
+			if(uint32_t(cpu_info[0]) < 0x8000001D)
+				return false;
+			leaf = 0x8000001D;
+		}
+		else
+			return false;
+
+		for(int32_t i = 0; i < 16; i++)
+		{
+			jconf::cpuid(leaf, i, cpu_info);
+			if(get_masked(cpu_info[0], 4, 0) == 0)
+				break;
+
+			// Skip instruction caches
+			if(get_masked(cpu_info[0], 4, 0) != 2 && uint32_t(get_masked(cpu_info[0], 7, 5)) == level)
+				return (cpu_info[3] & 2) != 0;
+		}
+		return false;
+	}
+
+#ifdef __linux__
+	std::vector<uint32_t> results;
+
+	template<typename func>
+	inline void findChildrenByType(const sysfsTopology::topo_obj& obj, sysfsTopology::obj_type type, func lambda)
+	{
+		for(const sysfsTopology::topo_obj& child : obj.vChildren)
+		{
+			if(child.iType == type)
+				lambda(child);
+			else
+				findChildrenByType(child, type, lambda);
+		}
+	}
+
+	inline void findChildrenCaches(const sysfsTopology::topo_obj& obj, std::vector<const sysfsTopology::topo_obj*>& tlcs)
+	{
+		for(const sysfsTopology::topo_obj& child : obj.vChildren)
+		{
+			if(child.iType == sysfsTopology::obj_cache)
+				tlcs.emplace_back(&child);
+			else
+				findChildrenCaches(child, tlcs);
+		}
+	}
+
+	size_t getUsableCacheSize(const sysfsTopology::topo_obj& obj)
+	{
+		if(bProbeCache)
+		{
+			std::vector<uint32_t> cpus;
+			findChildrenByType(obj, sysfsTopology::obj_core, [&cpus](const sysfsTopology::topo_obj& core)
+				{ cpus.emplace_back(core.vCpus[0]); });
+
+			size_t probed = probeCache(cpus, obj.iSize);
+			if(probed != 0)
+				return probed;
+		}
+
+		size_t cacheSize = obj.iSize;
+		if(!isCacheInclusive(obj.iLevel))
+		{
+			for(const sysfsTopology::topo_obj& l2obj : obj.vChildren)
+			{
+				//If L2 is exclusive and greater or equal to 2MB add room for one more hash
+				if(l2obj.iType == sysfsTopology::obj_cache && l2obj.iSize >= hashSize)
+					cacheSize += hashSize;
+			}
+		}
+		return cacheSize;
+	}
+
+	// Same allocation as the hwloc version - PU 0 of every core first, then PU 1 etc.
+	void processTopLevelCache(const sysfsTopology::topo_obj& obj)
+	{
+		size_t PUs = 0;
+		for(uint32_t cpu : obj.vCpus)
+			PUs += cg.hasCpu(cpu) ? 1 : 0;
+		PUs = std::min(PUs, threadBudget);
+		if(PUs == 0)
+			return;
+
+		std::vector<const sysfsTopology::topo_obj*> cores;
+		findChildrenByType(obj, sysfsTopology::obj_core, [&cores](const sysfsTopology::topo_obj& found) { cores.emplace_back(&found); } );
+		// P-cores first on hybrid CPUs, the E-cores take what is left and never double
+		std::stable_partition(cores.begin(), cores.end(),
+			[this](const sysfsTopology::topo_obj* core) { return !isEffCore(core->vCpus[0]); });
+
+		size_t cacheSize = getUsableCacheSize(obj);
+		size_t cacheHashes = std::min((cacheSize + hashSize/2) / hashSize, hashBudget);
+
+		printer::inst()->print_msg(L0, "Autoconf L%u cache of %llu KB on CPUs %s, package %u, node %d.",
+			obj.iLevel, int_port(obj.iSize / 1024), sysfsTopology::formatList(obj.vCpus).c_str(),
+			cores.empty() ? 0 : packageOf(obj.vCpus[0]), obj.iNode);
+
+		size_t pu_id = 0;
+		while(cacheHashes > 0 && PUs > 0)
+		{
+			bool found_pu = false;
+			for(const sysfsTopology::topo_obj* core : cores)
+			{
+				if(core->vChildren.size() <= pu_id)
+					continue;
+
+				// Outside our cpuset, but the next sibling may still be ours
+				uint32_t os_id = core->vChildren[pu_id].iOsIndex;
+				found_pu = true;
+				if(!cg.hasCpu(os_id))
+					continue;
+
+				if(cacheHashes > PUs && !isEffCore(os_id))
+				{
+					cacheHashes -= 2;
+					hashBudget -= 2;
+					os_id |= 0x8000000; //double hash marker bit
+				}
+				else
+				{
+					cacheHashes--;
+					hashBudget--;
+				}
+				PUs--;
+				threadBudget--;
+				results.emplace_back(os_id);
+
+				if(cacheHashes == 0 || PUs == 0)
+					break;
+			}
+
+			if(!found_pu)
+				break;
+
+			pu_id++;
+		}
+	}
+
+	uint32_t packageOf(uint32_t cpu)
+	{
+		for(const sysfsTopology::topo_obj& pkg : topo.machine().vChildren)
+		{
+			if(std::binary_search(pkg.vCpus.begin(), pkg.vCpus.end(), cpu))
+				return pkg.iOsIndex;
+		}
+		return 0;
+	}
+
+	bool printConfigSysfs()
+	{
+		std::vector<const sysfsTopology::topo_obj*> tlcs;
+		if(topo.load())
+			findChildrenCaches(topo.machine(), tlcs);
+
+		if(tlcs.empty())
+		{
+			printer::inst()->print_msg(L0, "Autoconf: no cache topology in %s, falling back to cpuid.", sysfsTopology::root().c_str());
+			return false;
+		}
+
+		results.clear();
+		planCgroup(topo.machine().vCpus);
+		loadHybrid(topo.machine().vCpus);
+		for(const sysfsTopology::topo_obj* obj : tlcs)
+			processTopLevelCache(*obj);
+
+		printer::inst()->print_str("\n**************** Copy&Paste BEGIN ****************\n\n");
+		printer::inst()->print_str("\"cpu_threads_conf\" :\n[\n");
+
+		for(uint32_t id : results)
+		{
+			char str[128];
+			snprintf(str, sizeof(str), "    { \"low_power_mode\" : %s, \"no_prefetch\" : true, \"affine_to_cpu\" : %u },\n",
+				(id & 0x8000000) != 0 ? "true" : "false", id & 0x7FFFFFF);
+			printer::inst()->print_str(str);
+		}
+
+		printer::inst()->print_str("],\n\n**************** Copy&Paste END ****************\n");
+		return true;
+	}
+
+	sysfsTopology topo;
+#endif // __linux__
+
 	bool detectL3Size()
 	{
 		int32_t cpu_info[4];
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "console.h"
+#include "jconf.h"
+#include "autotune.h"
+#include "cacheprobe.h"
+#include "cgroupLimits.hpp"
+#include "hybridCores.hpp"
 #include <hwloc.h>
 #include <stdio.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -14,13 +20,15 @@ class autoAdjust
 {
 public:
 
-	autoAdjust()
+	// bProbeCache measures the capacity of every cache domain instead of trusting its reported size
+	autoAdjust(bool bProbeCache = false) : bProbeCache(bProbeCache)
 	{
 	}
 
 	void printConfig()
 	{
-		printer::inst()->print_str("The configuration for 'cpu_threads_conf' in your config file is 'null'.\n");
+		if(jconf::inst()->NeedsAutoconf())
+			printer::inst()->print_str("The configuration for 'cpu_threads_conf' in your config file is 'null'.\n");
 		printer::inst()->print_str("The miner evaluates your system and prints a suggestion for the section `cpu_threads_conf` to the terminal.\n");
 		printer::inst()->print_str("The values are not optimal, please try to tweak the values based on notes in config.txt.\n");
 		printer::inst()->print_str("Please copy & paste the block within the asterisks to your config.\n\n");
@@ -41,6 +49,11 @@ public:
 			if(tlcs.size() == 0)
 				throw(std::runtime_error("The CPU doesn't seem to have a cache."));
 
+			std::vector<uint32_t> cpus;
+			findChildrenByType(hwloc_get_root_obj(topology), HWLOC_OBJ_PU, [&cpus](hwloc_obj_t found) { cpus.emplace_back(found->os_index); } );
+			planCgroup(cpus);
+			loadHybrid(cpus);
+
 			for(hwloc_obj_t obj : tlcs)
 				proccessTopLevelCache(obj);
 
@@ -71,8 +84,105 @@ public:
 		hwloc_topology_destroy(topology);
 	}
 
+	// Same walk as printConfig, but the caches and cores are returned for the autotuner
+	bool getTopology(std::vector<autotune::cache_domain>& vDomains)
+	{
+		hwloc_topology_t topology;
+		hwloc_topology_init(&topology);
+		hwloc_topology_load(topology);
+
+		vDomains.clear();
+		cg.load();
+		try
+		{
+			std::vector<hwloc_obj_t> tlcs;
+			findChildrenCaches(hwloc_get_root_obj(topology),
+				[&tlcs](hwloc_obj_t found) { tlcs.emplace_back(found); } );
+
+			if(tlcs.size() == 0)
+				throw(std::runtime_error("The CPU doesn't seem to have a cache."));
+
+			std::vector<uint32_t> cpus;
+			findChildrenByType(hwloc_get_root_obj(topology), HWLOC_OBJ_PU, [&cpus](hwloc_obj_t found) { cpus.emplace_back(found->os_index); } );
+			hybrid.load(cpus);
+
+			for(hwloc_obj_t obj : tlcs)
+				collectTopLevelCache(obj, vDomains);
+		}
+		catch(const std::runtime_error& err)
+		{
+			printer::inst()->print_msg(L0, "Autoconf FAILED: %s", err.what());
+			vDomains.clear();
+		}
+
+		hwloc_topology_destroy(topology);
+		return !vDomains.empty();
+	}
+
 private:
 	static constexpr size_t hashSize = 2 * 1024 * 1024;
+	bool bProbeCache;
+
+	// Containers see the whole host, the cgroup says what we may use of it
+	cgroupLimits cg;
+	size_t threadBudget = size_t(-1);
+	size_t hashBudget = size_t(-1);
+
+	hybridCores hybrid;
+
+	void loadHybrid(const std::vector<uint32_t>& cpus)
+	{
+		if(hybrid.load(cpus))
+			printer::inst()->print_msg(L0, "Autoconf: hybrid CPU with %llu P-core and %llu E-core CPUs (%s), the E-cores get single hashes only.",
+				int_port(hybrid.count(hybridCores::core_perf)), int_port(hybrid.count(hybridCores::core_eff)), hybrid.source());
+	}
+
+	bool isEffCore(uint32_t cpu)
+	{
+		return hybrid.type(cpu) == hybridCores::core_eff;
+	}
+
+	// P-cores first, they get the first threads and with them the double hashes
+	void orderCores(autotune::cache_domain& dom)
+	{
+		dom.vEffCores.clear();
+		if(!hybrid.isHybrid())
+			return;
+
+		std::stable_partition(dom.vCores.begin(), dom.vCores.end(),
+			[this](const std::vector<uint32_t>& core) { return !isEffCore(core[0]); });
+		for(const std::vector<uint32_t>& core : dom.vCores)
+			dom.vEffCores.push_back(isEffCore(core[0]));
+	}
+
+	void planCgroup(const std::vector<uint32_t>& cpus)
+	{
+		if(!cg.load())
+			return;
+
+		size_t allowed = 0;
+		for(uint32_t cpu : cpus)
+			allowed += cg.hasCpu(cpu) ? 1 : 0;
+		if(allowed < cpus.size())
+			printer::inst()->print_msg(L0, "Autoconf: cgroup cpuset allows %llu of %llu CPUs.", int_port(allowed), int_port(cpus.size()));
+		cg.plan(allowed, hashSize, threadBudget, hashBudget);
+	}
+
+	size_t probeCache(const std::vector<uint32_t>& cpus, size_t reported)
+	{
+		cacheprobe::result res = cacheprobe().measure(cpus, reported);
+		if(res.iCapacity == 0)
+		{
+			printer::inst()->print_msg(L0, "Cache probe: no latency cliff on %llu cores, using the reported %llu KB.",
+				int_port(cpus.size()), int_port(reported / 1024));
+			return 0;
+		}
+
+		printer::inst()->print_msg(L0, "Cache probe: %llu cores hold %llu KB (chase %llu KB, cn pattern %llu KB), reported %llu KB.",
+			int_port(cpus.size()), int_port(res.iCapacity / 1024), int_port(res.iChaseBytes / 1024),
+			int_port(res.iCnBytes / 1024), int_port(reported / 1024));
+		return res.iCapacity;
+	}
 	std::vector<uint32_t> results;
 
 	template<typename func>
@@ -114,6 +224,73 @@ private:
 		return value == nullptr || value[0] != '1';
 	}
 
+	size_t getUsableCacheSize(hwloc_obj_t obj)
+	{
+		if(bProbeCache)
+		{
+			std::vector<uint32_t> cpus;
+			findChildrenByType(obj, HWLOC_OBJ_CORE, [&cpus](hwloc_obj_t core)
+			{
+				if(core->arity > 0 && core->children[0]->type == HWLOC_OBJ_PU)
+					cpus.emplace_back(core->children[0]->os_index);
+			});
+
+			size_t probed = probeCache(cpus, obj->attr->cache.size);
+			if(probed != 0)
+				return probed;
+		}
+
+		size_t cacheSize = obj->attr->cache.size;
+		if(isCacheExclusive(obj))
+		{
+			for(size_t i=0; i < obj->arity; i++)
+			{
+				hwloc_obj_t l2obj = obj->children[i];
+				//If L2 is exclusive and greater or equal to 2MB add room for one more hash
+				if(isCacheObject(l2obj) && l2obj->attr != nullptr && l2obj->attr->cache.size >= hashSize)
+					cacheSize += hashSize;
+			}
+		}
+		return cacheSize;
+	}
+
+	void collectTopLevelCache(hwloc_obj_t obj, std::vector<autotune::cache_domain>& vDomains)
+	{
+		if(obj->attr == nullptr)
+			throw(std::runtime_error("Cache object hasn't got attributes."));
+
+		if(obj->attr->cache.size == 0)
+		{
+			for(size_t i=0; i < obj->arity; i++)
+			{
+				if(isCacheObject(obj->children[i]))
+					collectTopLevelCache(obj->children[i], vDomains);
+			}
+			return;
+		}
+
+		autotune::cache_domain dom;
+		dom.iCacheSize = getUsableCacheSize(obj);
+		findChildrenByType(obj, HWLOC_OBJ_CORE, [this, &dom](hwloc_obj_t core)
+		{
+			std::vector<uint32_t> pus;
+			for(size_t i=0; i < core->arity; i++)
+			{
+				if(core->children[i]->type == HWLOC_OBJ_PU && cg.hasCpu(core->children[i]->os_index))
+					pus.emplace_back(core->children[i]->os_index);
+			}
+
+			if(!pus.empty())
+				dom.vCores.emplace_back(pus);
+		});
+
+		if(!dom.vCores.empty())
+		{
+			orderCores(dom);
+			vDomains.emplace_back(dom);
+		}
+	}
+
 	// Top level cache isn't shared with other cores on the same package
 	// This will usually be 1 x L3, but can be 2 x L2 per package
 	void proccessTopLevelCache(hwloc_obj_t obj)
@@ -122,9 +299,11 @@ private:
 			throw(std::runtime_error("Cache object hasn't got attributes."));
 
 		size_t PUs = 0;
-		findChildrenByType(obj, HWLOC_OBJ_PU, [&PUs](hwloc_obj_t found) { PUs++; } );
+		findChildrenByType(obj, HWLOC_OBJ_PU, [this, &PUs](hwloc_obj_t found) { PUs += cg.hasCpu(found->os_index) ? 1 : 0; } );
+		PUs = std::min(PUs, threadBudget);
 
 		//Strange case, but we will handle it silently, surely there must be one PU somewhere?
+		//Or all of them are outside our cpuset or quota.
 		if(PUs == 0)
 			return;
 
@@ -140,53 +319,53 @@ private:
 			return;
 		}
 
-		size_t cacheSize = obj->attr->cache.size;
-		if(isCacheExclusive(obj))
-		{
-			for(size_t i=0; i < obj->arity; i++)
-			{
-				hwloc_obj_t l2obj = obj->children[i];
-				//If L2 is exclusive and greater or equal to 2MB add room for one more hash
-				if(isCacheObject(l2obj) && l2obj->attr != nullptr && l2obj->attr->cache.size >= hashSize)
-					cacheSize += hashSize;
-			}
-		}
+		size_t cacheSize = getUsableCacheSize(obj);
 
 		std::vector<hwloc_obj_t> cores;
 		cores.reserve(16);
 		findChildrenByType(obj, HWLOC_OBJ_CORE, [&cores](hwloc_obj_t found) { cores.emplace_back(found); } );
+		// P-cores first on hybrid CPUs, the E-cores take what is left and never double
+		std::stable_partition(cores.begin(), cores.end(), [this](hwloc_obj_t core)
+			{ return core->arity == 0 || !isEffCore(core->children[0]->os_index); });
 
-		size_t cacheHashes = (cacheSize + hashSize/2) / hashSize;
+		size_t cacheHashes = std::min((cacheSize + hashSize/2) / hashSize, hashBudget);
 
 		//Firstly allocate PU 0 of every CORE, then PU 1 etc.
 		size_t pu_id = 0;
 		while(cacheHashes > 0 && PUs > 0)
 		{
-			bool allocated_pu = false;
+			bool found_pu = false;
 			for(hwloc_obj_t core : cores)
 			{
 				if(core->arity <= pu_id || core->children[pu_id]->type != HWLOC_OBJ_PU)
 					continue;
 
+				// Outside our cpuset, but the next sibling may still be ours
 				size_t os_id = core->children[pu_id]->os_index;
+				found_pu = true;
+				if(!cg.hasCpu(uint32_t(os_id)))
+					continue;
 
-				if(cacheHashes > PUs)
+				if(cacheHashes > PUs && !isEffCore(uint32_t(os_id)))
 				{
 					cacheHashes -= 2;
+					hashBudget -= 2;
 					os_id |= 0x8000000; //double hash marker bit
 				}
 				else
+				{
 					cacheHashes--;
+					hashBudget--;
+				}
 				PUs--;
-
-				allocated_pu = true;
+				threadBudget--;
 				results.emplace_back(os_id);
 
-				if(cacheHashes == 0)
+				if(cacheHashes == 0 || PUs == 0)
 					break;
 			}
 
-			if(!allocated_pu)
+			if(!found_pu)
 				throw(std::runtime_error("Failed to allocate a PU."));
 
 			pu_id++;
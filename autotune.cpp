@@ -0,0 +1,449 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "autotune.h"
+#include "minethd.h"
+#include "energy.h"
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+void autotune::make_layout(const candidate& c, std::vector<jconf::thd_cfg>& vOut)
+{
+	vOut.clear();
+	for(const cache_domain& dom : vDomains)
+	{
+		// Cores first takes PU 0 of every core, then PU 1 etc. - the order autoconf uses
+		std::vector<uint32_t> vPUs;
+		std::vector<bool> vEff;
+		if(c.bSmtFirst)
+		{
+			for(size_t n = 0; n < dom.vCores.size(); n++)
+			{
+				vPUs.insert(vPUs.end(), dom.vCores[n].begin(), dom.vCores[n].end());
+				vEff.insert(vEff.end(), dom.vCores[n].size(), !dom.vEffCores.empty() && dom.vEffCores[n]);
+			}
+		}
+		else
+		{
+			for(size_t pu = 0; vPUs.size() < c.iThreads; pu++)
+			{
+				bool bFound = false;
+				for(size_t n = 0; n < dom.vCores.size(); n++)
+				{
+					if(pu < dom.vCores[n].size())
+					{
+						vPUs.push_back(dom.vCores[n][pu]);
+						vEff.push_back(!dom.vEffCores.empty() && dom.vEffCores[n]);
+						bFound = true;
+					}
+				}
+
+				if(!bFound)
+					break;
+			}
+		}
+
+		// The E-cores never double, their L2 is shared by four of them
+		size_t iThreads = std::min(c.iThreads, vPUs.size());
+		size_t iDoubles = c.iHashes > iThreads ? std::min(c.iHashes - iThreads, iThreads) : 0;
+		for(size_t i = 0; i < iThreads; i++)
+		{
+			jconf::thd_cfg cfg;
+			cfg.bDoubleMode = !vEff[i] && iDoubles > 0;
+			cfg.bAdaptive = false;
+			cfg.iVariant = jconf::inst()->GetVariant();
+			cfg.iAsmVersion = vEff[i] && c.iEffAsm >= 0 ? c.iEffAsm : c.iAsmVersion;
+			cfg.iCpuAff = vPUs[i];
+			iDoubles -= cfg.bDoubleMode ? 1 : 0;
+			vOut.push_back(cfg);
+		}
+	}
+}
+
+bool autotune::is_eff_cpu(uint32_t iCpu)
+{
+	for(const cache_domain& dom : vDomains)
+	{
+		for(size_t n = 0; n < dom.vEffCores.size(); n++)
+		{
+			if(dom.vEffCores[n] && std::find(dom.vCores[n].begin(), dom.vCores[n].end(), iCpu) != dom.vCores[n].end())
+				return true;
+		}
+	}
+	return false;
+}
+
+// Sum of the thread hashrates between two samples, the counters are
+// only updated every few hashes so each one comes with its own timestamp
+static double sample_hps(const std::vector<minethd*>& vThreads, std::vector<uint64_t>& vCount, std::vector<uint64_t>& vStamp, bool bFirst)
+{
+	double fHps = 0.0;
+	for(size_t i = 0; i < vThreads.size(); i++)
+	{
+		uint64_t iCount = vThreads[i]->iHashCount.load();
+		uint64_t iStamp = vThreads[i]->iTimestamp.load();
+
+		if(!bFirst && iStamp > vStamp[i])
+			fHps += (iCount - vCount[i]) * 1000.0 / (iStamp - vStamp[i]);
+
+		if(bFirst)
+		{
+			vCount[i] = iCount;
+			vStamp[i] = iStamp;
+		}
+	}
+	return fHps;
+}
+
+bool autotune::measure(candidate& c, double fBest)
+{
+	std::vector<jconf::thd_cfg> vCfg;
+	make_layout(c, vCfg);
+	jconf::inst()->SetThreadConfig(vCfg);
+
+	// The constructor copies the whole job id, a short literal would be read past its end
+	char sJobId[sizeof(minethd::miner_work::sJobID)] = "autotune";
+	uint8_t work[76] = {0};
+	minethd::miner_work oWork = minethd::miner_work(sJobId, work, sizeof(work), 0, 0, false, 0);
+	oWork.iVariant = iVariant;
+	std::vector<minethd*>* pvThreads = minethd::thread_starter(oWork);
+	minethd::set_duty_cycle(c.iDuty);
+
+	std::vector<uint64_t> vCount(pvThreads->size()), vStamp(pvThreads->size());
+	std::this_thread::sleep_for(std::chrono::milliseconds(iWarmupMs));
+	sample_hps(*pvThreads, vCount, vStamp, true);
+	double fJoules = energymeter::inst()->read_joules();
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(iProbeMs));
+	c.fHps = sample_hps(*pvThreads, vCount, vStamp, false);
+	c.fWatts = (energymeter::inst()->read_joules() - fJoules) * 1000.0 / iProbeMs;
+	c.bPruned = fBest > 0.0 && score(c) < fBest * fPruneRatio;
+
+	if(!c.bPruned)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(iMeasureMs));
+		c.fHps = sample_hps(*pvThreads, vCount, vStamp, false);
+		c.fWatts = (energymeter::inst()->read_joules() - fJoules) * 1000.0 / (iProbeMs + iMeasureMs);
+	}
+
+	minethd::thread_stopper(pvThreads);
+	jconf::inst()->ClearThreadConfig();
+
+	if(bEnergy)
+		printer::inst()->print_msg(L0, "Autotune: %s - %.1f H/S, %.1f W, %.2f H/J%s", describe(c).c_str(), c.fHps, c.fWatts,
+			score(c), c.bPruned ? ", pruned" : "");
+	else
+		printer::inst()->print_msg(L0, "Autotune: %s - %.1f H/S%s", describe(c).c_str(), c.fHps, c.bPruned ? ", pruned" : "");
+	vResults.push_back(c);
+	return !c.bPruned;
+}
+
+std::string autotune::describe(const candidate& c)
+{
+	char sBuf[128];
+	snprintf(sBuf, sizeof(sBuf), "%llu hashes on %llu threads%s, %s, asm %d", int_port(c.iHashes), int_port(c.iThreads),
+		vDomains.size() > 1 ? " per cache" : "", c.bSmtFirst ? "siblings first" : "cores first", c.iAsmVersion);
+	if(c.iEffAsm >= 0)
+		snprintf(sBuf + strlen(sBuf), sizeof(sBuf) - strlen(sBuf), ", E-cores asm %d", c.iEffAsm);
+	if(c.iDuty != 100)
+		snprintf(sBuf + strlen(sBuf), sizeof(sBuf) - strlen(sBuf), ", duty %u%%", c.iDuty);
+	return sBuf;
+}
+
+bool autotune::run(const std::vector<cache_domain>& vDomains, const char* sConfigFile, bool bEnergy)
+{
+	this->vDomains = vDomains;
+	this->bEnergy = bEnergy;
+	vResults.clear();
+
+	if(bEnergy && energymeter::inst()->get_source() == energymeter::src_none)
+	{
+		printer::inst()->print_msg(L0, "Autotune failed: no RAPL energy counters, set cpu_tdp in the config for an estimate.");
+		return false;
+	}
+
+	if(vDomains.empty() || vDomains[0].vCores.empty())
+	{
+		printer::inst()->print_msg(L0, "Autotune failed: no CPU topology.");
+		return false;
+	}
+
+	// Domains of one CPU are normally alike, the first one is the model for all of them
+	const cache_domain& dom = vDomains[0];
+	size_t iPUs = 0;
+	bool bSmt = false;
+	for(const std::vector<uint32_t>& core : dom.vCores)
+	{
+		iPUs += core.size();
+		bSmt |= core.size() > 1;
+	}
+
+	// Big caches on small VMs can take more hashes than we have threads for
+	size_t iGuess = std::max<size_t>((dom.iCacheSize + iHashSize / 2) / iHashSize, 1);
+	iGuess = std::min(iGuess, iPUs * 2);
+
+	// The variant of the jobs picks the kernels, auto means whatever Monero currently uses
+	iVariant = jconf::inst()->GetVariant();
+	if(iVariant < 0)
+		iVariant = 2;
+
+	int iAsm = jconf::inst()->GetAsmVersion();
+	std::vector<candidate> vLayouts;
+	for(size_t iHashes : { iGuess, iGuess - 1, iGuess + 1 })
+	{
+		if(iHashes == 0 || iHashes > iPUs * 2)
+			continue;
+
+		for(size_t iThreads = std::min(iHashes, iPUs); iThreads * 2 >= iHashes && iThreads > 0; iThreads--)
+		{
+			vLayouts.push_back({ iHashes, iThreads, false, iAsm, -1, 100, 0.0, 0.0, false });
+
+			// Both patterns give the same layout once every PU is in use
+			if(bSmt && iThreads > 1 && iThreads < iPUs)
+				vLayouts.push_back({ iHashes, iThreads, true, iAsm, -1, 100, 0.0, 0.0, false });
+		}
+	}
+
+	printer::inst()->print_msg(L0, "Autotune: %llu cache domains, %llu KB and %llu logical CPUs in the first one, %llu layouts to try.",
+		int_port(vDomains.size()), int_port(dom.iCacheSize / 1024), int_port(iPUs), int_port(vLayouts.size()));
+
+	// The first candidate is the autoconf guess, it gives the pruning a good reference early on
+	candidate best = { 0, 0, false, iAsm, -1, 100, 0.0, 0.0, true };
+	for(candidate& c : vLayouts)
+	{
+		if(measure(c, score(best)) && score(c) > score(best))
+			best = c;
+	}
+
+	// Kernels are tried on the best layout only, the asm ones only exist for variants 1 and 2
+	std::vector<int> vAsm;
+	if(iVariant == 2 && jconf::inst()->HaveHardwareAes())
+		vAsm = { 0, 1, 2, 3 };
+	else if(iVariant == 1 || iVariant == 2)
+		vAsm = { 0, 1 };
+
+	candidate layout = best;
+	for(int i : vAsm)
+	{
+		if(i == layout.iAsmVersion)
+			continue;
+
+		candidate c = layout;
+		c.iAsmVersion = i;
+		if(measure(c, score(best)) && score(c) > score(best))
+			best = c;
+	}
+
+	// Whatever kernel the P-cores like, the E-cores have other AES and division latencies
+	std::vector<jconf::thd_cfg> vCfg;
+	make_layout(best, vCfg);
+	bool bEffThreads = false;
+	for(const jconf::thd_cfg& cfg : vCfg)
+		bEffThreads |= is_eff_cpu(uint32_t(cfg.iCpuAff));
+
+	layout = best;
+	for(int i : vAsm)
+	{
+		if(!bEffThreads || i == layout.iAsmVersion)
+			continue;
+
+		candidate c = layout;
+		c.iEffAsm = i;
+		if(measure(c, score(best)) && score(c) > score(best))
+			best = c;
+	}
+
+	// Clocks go up when the cores get hot less often, but the uncore and the memory draw
+	// their share either way - so lower duty cycles only pay off on some CPUs
+	if(bEnergy)
+	{
+		layout = best;
+		for(uint32_t iDuty : { 75, 50 })
+		{
+			candidate c = layout;
+			c.iDuty = iDuty;
+			if(measure(c, score(best)) && score(c) > score(best))
+				best = c;
+		}
+		minethd::set_duty_cycle(jconf::inst()->GetDutyCycle());
+	}
+
+	if(best.iThreads == 0)
+	{
+		printer::inst()->print_msg(L0, "Autotune failed: no candidate got a hashrate.");
+		return false;
+	}
+
+	std::stable_sort(vResults.begin(), vResults.end(), [this](const candidate& a, const candidate& b)
+		{ return a.bPruned != b.bPruned ? !a.bPruned : score(a) > score(b); });
+
+	if(bEnergy)
+		printer::inst()->print_msg(L0, "Autotune: best is %s at %.1f H/S, %.2f H/J.", describe(best).c_str(), best.fHps, score(best));
+	else
+		printer::inst()->print_msg(L0, "Autotune: best is %s at %.1f H/S.", describe(best).c_str(), best.fHps);
+	return write_config(sConfigFile, best);
+}
+
+// Position of the line that starts with sKey, the examples in the comments start with a '*'
+static size_t find_key_line(const std::string& sText, const char* sKey)
+{
+	size_t iLine = 0;
+	while(iLine < sText.size())
+	{
+		size_t iPos = sText.find_first_not_of(" \t", iLine);
+		if(iPos != std::string::npos && sText.compare(iPos, strlen(sKey), sKey) == 0)
+			return iLine;
+
+		iLine = sText.find('\n', iLine);
+		if(iLine == std::string::npos)
+			break;
+		iLine++;
+	}
+	return std::string::npos;
+}
+
+static void replace_number(std::string& sText, const char* sKey, uint32_t iVal)
+{
+	size_t iKey = find_key_line(sText, sKey);
+	size_t iNum = iKey == std::string::npos ? iKey : sText.find(':', iKey);
+	if(iNum != std::string::npos)
+	{
+		char sBuf[16];
+		iNum = sText.find_first_not_of(" \t", iNum + 1);
+		size_t iNumEnd = sText.find_first_not_of("0123456789", iNum);
+		snprintf(sBuf, sizeof(sBuf), "%u", iVal);
+		sText.replace(iNum, iNumEnd - iNum, sBuf);
+	}
+}
+
+bool autotune::write_config(const char* sConfigFile, const candidate& best)
+{
+	FILE* f = fopen(sConfigFile, "rb");
+	if(f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Autotune: failed to open %s.", sConfigFile);
+		return false;
+	}
+
+	std::string sText;
+	char sBuf[4096];
+	size_t iRead;
+	while((iRead = fread(sBuf, 1, sizeof(sBuf), f)) > 0)
+		sText.append(sBuf, iRead);
+	fclose(f);
+
+	std::string sOrig = sText;
+	const char* sNl = sText.find("\r\n") != std::string::npos ? "\r\n" : "\n";
+
+	size_t iKey = find_key_line(sText, "\"cpu_threads_conf\"");
+	size_t iValue = iKey == std::string::npos ? iKey : sText.find(':', iKey);
+	if(iValue != std::string::npos)
+		iValue = sText.find_first_not_of(" \t\r\n", iValue + 1);
+
+	size_t iValueEnd = std::string::npos;
+	if(iValue != std::string::npos && sText.compare(iValue, 4, "null") == 0)
+		iValueEnd = iValue + 4;
+	else if(iValue != std::string::npos && sText[iValue] == '[')
+	{
+		iValueEnd = sText.find(']', iValue);
+		if(iValueEnd != std::string::npos)
+			iValueEnd++;
+	}
+
+	if(iValueEnd == std::string::npos)
+	{
+		printer::inst()->print_msg(L0, "Autotune: can't find cpu_threads_conf in %s.", sConfigFile);
+		return false;
+	}
+
+	std::vector<jconf::thd_cfg> vCfg;
+	make_layout(best, vCfg);
+
+	std::string sValue = std::string("[") + sNl;
+	for(const jconf::thd_cfg& cfg : vCfg)
+	{
+		char sAsm[32] = "";
+		if(cfg.iAsmVersion != best.iAsmVersion)
+			snprintf(sAsm, sizeof(sAsm), ", \"asm_version\" : %d", cfg.iAsmVersion);
+		snprintf(sBuf, sizeof(sBuf), "\t{ \"low_power_mode\" : %s, \"no_prefetch\" : true, \"affine_to_cpu\" : %llu%s },%s",
+			cfg.bDoubleMode ? "true" : "false", int_port(cfg.iCpuAff), sAsm, sNl);
+		sValue += sBuf;
+	}
+	sValue += "]";
+	sText.replace(iValue, iValueEnd - iValue, sValue);
+
+	// The results of the last run replace the ones of the run before
+	std::string sComment = std::string("/*") + sNl + " * Autotune results, " + (bEnergy ? "H/S, W and H/J" : "H/S") +
+		" of every candidate, best first" + sNl;
+	for(const candidate& c : vResults)
+	{
+		if(bEnergy)
+			snprintf(sBuf, sizeof(sBuf), " * %9.1f %7.1f %7.2f  %s%s%s", c.fHps, c.fWatts, score(c), describe(c).c_str(), c.bPruned ? " (pruned)" : "", sNl);
+		else
+			snprintf(sBuf, sizeof(sBuf), " * %9.1f  %s%s%s", c.fHps, describe(c).c_str(), c.bPruned ? " (pruned)" : "", sNl);
+		sComment += sBuf;
+	}
+	sComment += std::string(" */") + sNl;
+
+	size_t iCommentEnd = iKey > 0 ? sText.find_last_not_of(" \t\r\n", iKey - 1) : std::string::npos;
+	size_t iCommentStart = iCommentEnd != std::string::npos && iCommentEnd > 0 && sText.compare(iCommentEnd - 1, 2, "*/") == 0 ?
+		sText.rfind("/*", iCommentEnd) : std::string::npos;
+	if(iCommentStart != std::string::npos &&
+		sText.compare(iCommentStart, 2 + strlen(sNl) + 19, std::string("/*") + sNl + " * Autotune results") == 0)
+		sText.replace(iCommentStart, iKey - iCommentStart, sComment);
+	else
+		sText.insert(iKey, sComment);
+
+	replace_number(sText, "\"asm_version\"", best.iAsmVersion);
+	if(bEnergy)
+		replace_number(sText, "\"duty_cycle\"", best.iDuty);
+
+	std::string sBackup = std::string(sConfigFile) + ".bak";
+	f = fopen(sBackup.c_str(), "wb");
+	if(f == nullptr || fwrite(sOrig.data(), 1, sOrig.size(), f) != sOrig.size())
+	{
+		if(f != nullptr)
+			fclose(f);
+		printer::inst()->print_msg(L0, "Autotune: failed to write %s, config not changed.", sBackup.c_str());
+		return false;
+	}
+	fclose(f);
+
+	f = fopen(sConfigFile, "wb");
+	if(f == nullptr || fwrite(sText.data(), 1, sText.size(), f) != sText.size())
+	{
+		if(f != nullptr)
+			fclose(f);
+		printer::inst()->print_msg(L0, "Autotune: failed to write %s, the old one is in %s.", sConfigFile, sBackup.c_str());
+		return false;
+	}
+	fclose(f);
+
+	printer::inst()->print_msg(L0, "Autotune: %s updated, the old one is in %s.", sConfigFile, sBackup.c_str());
+	return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "jconf.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Searches the thread layout by measuring it. Every candidate runs for a few seconds on the real
+// mining threads, the ones that fall clearly behind the best so far are dropped after the first
+// measurement. The winner is written to cpu_threads_conf (and asm_version) of the config file
+// together with a comment listing what every candidate did. The energy objective ranks the
+// candidates by hashes per joule instead and also tries lower duty cycles on the best layout.
+// On hybrid CPUs the E-core threads try the kernels on their own after the P-cores picked one.
+class autotune
+{
+public:
+	// A cache that isn't shared with other cores of the package and the cores below it,
+	// each core is the list of its logical CPUs. On hybrid CPUs the P-cores come first.
+	struct cache_domain
+	{
+		size_t iCacheSize;
+		std::vector<std::vector<uint32_t>> vCores;
+		std::vector<bool> vEffCores; // E-core flag of every core, empty if the CPU isn't hybrid
+	};
+
+	bool run(const std::vector<cache_domain>& vDomains, const char* sConfigFile, bool bEnergy = false);
+
+private:
+	struct candidate
+	{
+		size_t iHashes;  // scratchpads per cache domain
+		size_t iThreads; // threads per cache domain, iHashes - iThreads of them run in double mode
+		bool bSmtFirst;  // fill all siblings of a core before moving to the next one
+		int iAsmVersion;
+		int iEffAsm;     // kernel of the E-core threads on hybrid CPUs, -1 the same as iAsmVersion
+		uint32_t iDuty;  // percent
+		double fHps;
+		double fWatts;   // 0 without an energy source
+		bool bPruned;
+	};
+
+	static constexpr size_t iHashSize = 2 * 1024 * 1024;
+	static constexpr uint64_t iWarmupMs = 2000;
+	static constexpr uint64_t iProbeMs = 4000;   // first measurement, decides the pruning
+	static constexpr uint64_t iMeasureMs = 8000; // added for the candidates that survived
+	static constexpr double fPruneRatio = 0.9;
+
+	double score(const candidate& c) { return bEnergy ? (c.fWatts > 0.0 ? c.fHps / c.fWatts : 0.0) : c.fHps; }
+	void make_layout(const candidate& c, std::vector<jconf::thd_cfg>& vOut);
+	bool is_eff_cpu(uint32_t iCpu);
+	bool measure(candidate& c, double fBest);
+	std::string describe(const candidate& c);
+	bool write_config(const char* sConfigFile, const candidate& best);
+
+	std::vector<cache_domain> vDomains;
+	std::vector<candidate> vResults;
+	int iVariant;
+	bool bEnergy;
+};
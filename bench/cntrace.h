@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Scratchpad access trace as xmr-stak-trace writes it and xmr-stak-cachesim reads it. After the
+// header comes one record per access of the main loop, in program order, so the two ways of a
+// double hash are interleaved the way the kernel does it:
+//   bit 31     - way (scratchpad) of a double hash
+//   bits 30-29 - cn_trace_kind
+//   bits 28-0  - offset in the scratchpad in 16 byte units
+// Everything is little endian, the byte order of the machines the kernels run on.
+struct cn_trace_header
+{
+	char sMagic[8];         // "CNTRACE1"
+	uint32_t iVariant;
+	uint32_t iWays;
+	uint64_t iMemory;       // bytes of every scratchpad
+	uint64_t iIterations;   // of the main loop per hash
+	uint64_t iHashes;       // per way
+	uint64_t iRecords;
+
+	static constexpr const char* sMagicV1 = "CNTRACE1";
+
+	bool valid() const { return memcmp(sMagic, sMagicV1, sizeof(sMagic)) == 0 && iWays >= 1 && iWays <= 2; }
+};
+
+inline uint32_t cn_trace_pack(uint32_t iWay, uint32_t iKind, uint64_t iOffset)
+{
+	return (iWay << 31) | (iKind << 29) | uint32_t(iOffset >> 4);
+}
+
+inline uint32_t cn_trace_way(uint32_t iRec) { return iRec >> 31; }
+inline uint32_t cn_trace_kind_of(uint32_t iRec) { return (iRec >> 29) & 3; }
+inline uint64_t cn_trace_offset(uint32_t iRec) { return uint64_t(iRec & 0x1FFFFFFF) << 4; }
@@ -0,0 +1,428 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+// Every kernel the miner has, measured one after the other on a single thread: the variants of
+// both scratchpad profiles with hard and soft AES, every asm_version, single and double hashes,
+// on huge and on normal pages. Nothing is read from or written to config.txt, the kernels the CPU
+// can't run and the asm versions that fall back to a kernel already in the list are left out.
+// With antagonists every kernel is measured again while they run, and the ranking is by that
+// noisy hashrate, which picks the kernel that holds up best next to busy neighbours.
+
+#include "../minethd.h"
+#include "../antagonist.h"
+#include "../jconf.h"
+#include "../console.h"
+#include "../cgroupLimits.hpp"
+#include "../hostFingerprint.hpp"
+#include "../latencyHist.hpp"
+#include "../crypto/cryptonight.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id);
+
+struct bench_cell
+{
+	minethd::cn_profile iProfile;
+	int iVariant;
+	bool bSoftAes;
+	int iAsm;
+	uint32_t iWays;
+	bool bHuge;
+	uintptr_t iFun; // minethd::cn_hash_fun or cn_hash_fun_dbl, depending on iWays
+	double fHps;
+	double fNoisyHps; // with the antagonists running, 0 without antagonists
+	bool bWrong;      // the hash differs from the one of the C kernel
+	double fLatMs[4]; // p50, p99, p99.9 and max of a call of the ranked run, two hashes with 2 ways
+};
+
+struct bench_cpu
+{
+	bool bAes;
+	bool bSse41;
+};
+
+static const char* profile_name(minethd::cn_profile iProfile)
+{
+	return iProfile == minethd::cn_profile_lite ? "lite" : "full";
+}
+
+static std::string kernel_name(const bench_cell& c)
+{
+	char sBuf[128];
+	snprintf(sBuf, sizeof(sBuf), "variant %d %s, %s aes, asm %d, %u way, %s pages", c.iVariant, profile_name(c.iProfile),
+		c.bSoftAes ? "soft" : "hard", c.iAsm, c.iWays, c.bHuge ? "huge" : "normal");
+	return sBuf;
+}
+
+static bench_cpu check_cpu()
+{
+	int32_t cpu_info[4];
+	jconf::cpuid(1, 0, cpu_info);
+	return { (cpu_info[2] & (1 << 25)) != 0, (cpu_info[2] & (1 << 19)) != 0 };
+}
+
+// The asm kernels are plain SSE2 except for the AES instructions and the pinsrq/pextrq of the
+// Bulldozer one
+static bool can_run(const bench_cpu& cpu, const bench_cell& c)
+{
+	if(!c.bSoftAes && !cpu.bAes)
+		return false;
+	if(!c.bSoftAes && c.iVariant == 2 && c.iAsm == 3 && c.iWays == 1 && c.iProfile == minethd::cn_profile_full)
+		return cpu.bSse41;
+	return true;
+}
+
+static std::vector<bench_cell> list_kernels(const bench_cpu& cpu, int iOnlyVariant, int iOnlyProfile, bool bHuge)
+{
+	std::vector<bench_cell> vOut;
+	for(uint32_t p = 0; p < minethd::cn_profile_cnt; p++)
+	{
+		if(iOnlyProfile >= 0 && uint32_t(iOnlyProfile) != p)
+			continue;
+
+		for(int v = 0; v < minethd::iVariantCnt; v++)
+		{
+			if(iOnlyVariant >= 0 && iOnlyVariant != v)
+				continue;
+
+			std::vector<uintptr_t> vSeen;
+			for(int s = 0; s < 2; s++)
+			{
+				for(int iAsm = 0; iAsm <= 3; iAsm++)
+				{
+					for(uint32_t iWays = 1; iWays <= 2; iWays++)
+					{
+						bench_cell c = { minethd::cn_profile(p), v, s != 0, iAsm, iWays, false, 0, 0.0, 0.0, false, {} };
+						if(iWays == 1)
+							c.iFun = reinterpret_cast<uintptr_t>(minethd::func_selector(!c.bSoftAes, v, iAsm, c.iProfile));
+						else
+							c.iFun = reinterpret_cast<uintptr_t>(minethd::func_dbl_selector(!c.bSoftAes, v, iAsm, c.iProfile));
+
+						if(std::find(vSeen.begin(), vSeen.end(), c.iFun) != vSeen.end() || !can_run(cpu, c))
+							continue;
+						vSeen.push_back(c.iFun);
+
+						if(bHuge)
+						{
+							c.bHuge = true;
+							vOut.push_back(c);
+						}
+						c.bHuge = false;
+						vOut.push_back(c);
+					}
+				}
+			}
+		}
+	}
+	return vOut;
+}
+
+static void hash_once(const bench_cell& c, const uint8_t* bBlob, size_t iLen, uint8_t* bOut, cryptonight_ctx** ctx)
+{
+	if(c.iWays == 1)
+		reinterpret_cast<minethd::cn_hash_fun>(c.iFun)(bBlob, iLen, bOut, ctx[0]);
+	else
+		reinterpret_cast<minethd::cn_hash_fun_dbl>(c.iFun)(bBlob, iLen, bOut, bBlob + iLen, iLen, bOut + 32, ctx[0], ctx[1]);
+}
+
+// The double kernels hash the blob twice, the nonces of the timed hashes count up from 0
+static double measure(bench_cell& c, const uint8_t* bBlob, size_t iLen, const uint8_t* bRef, cryptonight_ctx** ctx, uint64_t iUsec)
+{
+	latencyHist oLat;
+	uint8_t bWork[2 * 128];
+	uint8_t bOut[64];
+	memcpy(bWork, bBlob, iLen);
+	memcpy(bWork + iLen, bBlob, iLen);
+	hash_once(c, bWork, iLen, bOut, ctx);
+	c.bWrong |= memcmp(bOut, bRef, 32) != 0 || (c.iWays == 2 && memcmp(bOut + 32, bRef, 32) != 0);
+
+	uint64_t iHashes = 0;
+	uint32_t iNonce = 0;
+	uint64_t iStart = minethd::get_usec();
+	uint64_t iNow = iStart;
+	while(iNow - iStart < iUsec)
+	{
+		memcpy(bWork + 39, &iNonce, 4);
+		iNonce++;
+		memcpy(bWork + iLen + 39, &iNonce, 4);
+		iNonce++;
+		hash_once(c, bWork, iLen, bOut, ctx);
+		iHashes += c.iWays;
+		uint64_t iLast = iNow;
+		iNow = minethd::get_usec();
+		oLat.record(iNow - iLast);
+	}
+	minethd::restore_rounding();
+
+	latencyHist::merged h;
+	h.add(oLat);
+	c.fLatMs[0] = h.percentile(0.5) / 1000.0;
+	c.fLatMs[1] = h.percentile(0.99) / 1000.0;
+	c.fLatMs[2] = h.percentile(0.999) / 1000.0;
+	c.fLatMs[3] = h.iMax / 1000.0;
+	return double(iHashes) * 1000000.0 / double(iNow - iStart);
+}
+
+static void print_matrix(std::vector<bench_cell>& vCells, bool bNoisy)
+{
+	std::stable_sort(vCells.begin(), vCells.end(), [bNoisy](const bench_cell& a, const bench_cell& b) {
+		if(a.iProfile != b.iProfile)
+			return a.iProfile < b.iProfile;
+		if(a.iVariant != b.iVariant)
+			return a.iVariant < b.iVariant;
+		if(a.bWrong != b.bWrong)
+			return b.bWrong;
+		return bNoisy ? a.fNoisyHps > b.fNoisyHps : a.fHps > b.fHps;
+	});
+
+	char sBuf[256];
+	std::string sOut;
+	size_t iGroup = 0; // first cell of the variant, the fastest correct one unless all are wrong
+	for(size_t i = 0; i < vCells.size(); i++)
+	{
+		const bench_cell& c = vCells[i];
+		if(i == 0 || vCells[iGroup].iProfile != c.iProfile || vCells[iGroup].iVariant != c.iVariant)
+		{
+			iGroup = i;
+			snprintf(sBuf, sizeof(sBuf), "\nVARIANT %d, %s scratchpad\n", c.iVariant, profile_name(c.iProfile));
+			sOut += sBuf;
+			if(bNoisy)
+				sOut += "|  # |  AES | asm | ways | pages  |    quiet |    noisy |   loss | of best | p99 ms |\n";
+			else
+				sOut += "|  # |  AES | asm | ways | pages  |      H/s | of best | p99 ms |\n";
+		}
+
+		int iLen = snprintf(sBuf, sizeof(sBuf), "| %2llu | %4s | %3d | %4u | %-6s | %8.1f |", int_port(i - iGroup + 1),
+			c.bSoftAes ? "soft" : "hard", c.iAsm, c.iWays, c.bHuge ? "huge" : "normal", c.fHps);
+		double fRank = bNoisy ? c.fNoisyHps : c.fHps;
+		double fBest = bNoisy ? vCells[iGroup].fNoisyHps : vCells[iGroup].fHps;
+		if(bNoisy)
+		{
+			iLen += snprintf(sBuf + iLen, sizeof(sBuf) - iLen, " %8.1f | %5.1f%% |", c.fNoisyHps,
+				c.fHps > 0.0 ? (1.0 - c.fNoisyHps / c.fHps) * 100.0 : 0.0);
+		}
+		snprintf(sBuf + iLen, sizeof(sBuf) - iLen, " %6.1f%% | %6.2f |%s\n", fBest > 0.0 ? fRank / fBest * 100.0 : 0.0,
+			c.fLatMs[1], c.bWrong ? " WRONG HASH" : "");
+		sOut += sBuf;
+	}
+	printer::inst()->print_str(sOut.c_str());
+}
+
+static void print_usage(const char* sName)
+{
+	printf("Usage: %s [options]\n\n", sName);
+	printf("Measures every cryptonight kernel of the miner on one thread and ranks them per variant.\n\n");
+	printf("  --time SECONDS        measuring time of every kernel (default 2)\n");
+	printf("  --variant N           only the kernels of variant N\n");
+	printf("  --profile full|lite   only the kernels of one scratchpad size\n");
+	printf("  --cpu N               pin the measuring thread to CPU N\n");
+	printf("  --no-huge-pages       only measure on normal pages\n");
+	printf("  --antagonist LIST     measure every kernel again next to these threads and rank by\n");
+	printf("                        that, KIND:CPU pairs, e.g. l3:2,mem:3,aes:1\n");
+	printf("                          l3  - dirties a buffer the size of the L3\n");
+	printf("                          mem - streams through a buffer far larger than the caches\n");
+	printf("                          aes - AES and division chains, for the sibling of --cpu\n");
+	printf("  --antagonist-mb MB    buffer of the l3 antagonist instead of the L3 size\n");
+}
+
+static bool parse_int(int argc, char *argv[], int& i, int64_t& iOut)
+{
+	if(i + 1 >= argc)
+		return false;
+
+	char* pEnd;
+	iOut = strtoll(argv[++i], &pEnd, 10);
+	return *pEnd == '\0' && iOut >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t iSeconds = 2;
+	int64_t iVariant = -1;
+	int64_t iProfile = -1;
+	int64_t iCpu = -1;
+	bool bTryHuge = true;
+	int64_t iLlcMb = 0;
+	std::vector<antagonist::spec> vNoise;
+
+	for(int i = 1; i < argc; i++)
+	{
+		bool bOk = true;
+		if(strcmp(argv[i], "--time") == 0)
+			bOk = parse_int(argc, argv, i, iSeconds) && iSeconds > 0;
+		else if(strcmp(argv[i], "--variant") == 0)
+			bOk = parse_int(argc, argv, i, iVariant) && iVariant < minethd::iVariantCnt;
+		else if(strcmp(argv[i], "--cpu") == 0)
+			bOk = parse_int(argc, argv, i, iCpu);
+		else if(strcmp(argv[i], "--no-huge-pages") == 0)
+			bTryHuge = false;
+		else if(strcmp(argv[i], "--antagonist") == 0)
+			bOk = i + 1 < argc && antagonist::parse(argv[++i], vNoise);
+		else if(strcmp(argv[i], "--antagonist-mb") == 0)
+			bOk = parse_int(argc, argv, i, iLlcMb) && iLlcMb > 0;
+		else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			i++;
+			if(strcmp(argv[i], "full") == 0)
+				iProfile = minethd::cn_profile_full;
+			else if(strcmp(argv[i], "lite") == 0)
+				iProfile = minethd::cn_profile_lite;
+			else
+				bOk = false;
+		}
+		else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		else
+			bOk = false;
+
+		if(!bOk)
+		{
+			printer::inst()->print_msg(L0, "Invalid argument: %s", argv[i]);
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bench_cpu cpu = check_cpu();
+	hostFingerprint oHost;
+	oHost.collect();
+	printer::inst()->print_msg(L0, "%s, microcode %s, %s, %s AES, SSE4.1 %s", oHost.sCpu.c_str(), oHost.sMicrocode.c_str(),
+		oHost.sKernel.c_str(), cpu.bAes ? "hard" : "soft", cpu.bSse41 ? "yes" : "no");
+
+	minethd::init_variant1_table();
+
+	// Normal pages always work, huge ones need reserved pages and room in the hugetlb limit of the cgroup
+	alloc_msg msg = { 0 };
+	cryptonight_ctx* ctxNormal[2] = { cryptonight_alloc_ctx(0, 0, &msg), cryptonight_alloc_ctx(0, 0, &msg) };
+	cryptonight_ctx* ctxHuge[2] = { nullptr, nullptr };
+	if(bTryHuge && cgroupLimits::hugetlbRoom(MEMORY) >= 2)
+	{
+		ctxHuge[0] = cryptonight_alloc_ctx(1, 0, &msg);
+		ctxHuge[1] = ctxHuge[0] != nullptr ? cryptonight_alloc_ctx(1, 0, &msg) : nullptr;
+		if(ctxHuge[1] == nullptr)
+		{
+			printer::inst()->print_msg(L0, "No huge pages (%s), measuring on normal pages only.", msg.warning != nullptr ? msg.warning : "unknown error");
+			if(ctxHuge[0] != nullptr)
+				cryptonight_free_ctx(ctxHuge[0]);
+			ctxHuge[0] = nullptr;
+		}
+	}
+	else if(bTryHuge)
+		printer::inst()->print_msg(L0, "hugetlb limit of the cgroup reached, measuring on normal pages only.");
+
+	std::vector<bench_cell> vCells = list_kernels(cpu, int(iVariant), int(iProfile), ctxHuge[1] != nullptr);
+	printer::inst()->print_msg(L0, "Measuring %llu kernels for %llu seconds each.", int_port(vCells.size()), int_port(iSeconds));
+
+	antagonist oNoise;
+	if(!vNoise.empty())
+	{
+		size_t iLlc = iLlcMb > 0 ? size_t(iLlcMb) * 1024 * 1024 : antagonist::llc_bytes();
+		if(iLlc == 0)
+		{
+			printer::inst()->print_msg(L0, "Unknown L3 size, the l3 antagonist uses 32 MB, see --antagonist-mb.");
+			iLlc = 32 * 1024 * 1024;
+		}
+		if(iCpu < 0)
+			printer::inst()->print_msg(L0, "WARNING: without --cpu the kernels can run on the CPUs of the antagonists.");
+		for(const antagonist::spec& n : vNoise)
+		{
+			if(int64_t(n.iCpu) == iCpu)
+				printer::inst()->print_msg(L0, "WARNING: the %s shares cpu %u with the kernels.", antagonist::name(n.iKind), n.iCpu);
+		}
+		if(!oNoise.start(vNoise, iLlc))
+			return 1;
+	}
+
+	std::atomic<bool> bPinned(false);
+	std::thread thd([&]() {
+		while(!bPinned.load())
+			std::this_thread::yield();
+
+		// The reference of every profile and variant is the C kernel, with hard AES if we have it
+		const size_t iLen = 76;
+		uint8_t bBlob[iLen];
+		for(size_t i = 0; i < iLen; i++)
+			bBlob[i] = uint8_t(i);
+
+		uint8_t bRef[32];
+		for(size_t i = 0; i < vCells.size(); i++)
+		{
+			bench_cell& c = vCells[i];
+			if(i == 0 || vCells[i - 1].iProfile != c.iProfile || vCells[i - 1].iVariant != c.iVariant)
+				minethd::func_selector(cpu.bAes, c.iVariant, 0, c.iProfile)(bBlob, iLen, bRef, ctxNormal[0]);
+
+			c.fHps = measure(c, bBlob, iLen, bRef, c.bHuge ? ctxHuge : ctxNormal, uint64_t(iSeconds) * 1000000);
+			if(!vNoise.empty())
+			{
+				// The streamers need a moment until they own the cache
+				oNoise.resume();
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+				c.fNoisyHps = measure(c, bBlob, iLen, bRef, c.bHuge ? ctxHuge : ctxNormal, uint64_t(iSeconds) * 1000000);
+				oNoise.pause();
+			}
+
+			if(vNoise.empty())
+				printer::inst()->print_msg(L1, "%s: %.1f H/s, p50 %.2f ms, p99 %.2f, p99.9 %.2f, max %.2f%s", kernel_name(c).c_str(),
+					c.fHps, c.fLatMs[0], c.fLatMs[1], c.fLatMs[2], c.fLatMs[3], c.bWrong ? " WRONG HASH" : "");
+			else
+				printer::inst()->print_msg(L1, "%s: %.1f H/s, noisy %.1f H/s, p50 %.2f ms, p99 %.2f, p99.9 %.2f, max %.2f%s",
+					kernel_name(c).c_str(), c.fHps, c.fNoisyHps, c.fLatMs[0], c.fLatMs[1], c.fLatMs[2], c.fLatMs[3],
+					c.bWrong ? " WRONG HASH" : "");
+		}
+	});
+	if(iCpu >= 0)
+		thd_setaffinity(thd.native_handle(), uint64_t(iCpu));
+	bPinned = true;
+	thd.join();
+
+	if(!vNoise.empty())
+	{
+		oNoise.print_rates();
+		oNoise.stop();
+	}
+	print_matrix(vCells, !vNoise.empty());
+
+	for(cryptonight_ctx* ctx : { ctxNormal[0], ctxNormal[1], ctxHuge[0], ctxHuge[1] })
+	{
+		if(ctx != nullptr)
+			cryptonight_free_ctx(ctx);
+	}
+
+	bool bWrong = std::any_of(vCells.begin(), vCells.end(), [](const bench_cell& c) { return c.bWrong; });
+	if(bWrong)
+		printer::inst()->print_msg(L0, "Some kernels computed a wrong hash.");
+	return bWrong ? 1 : 0;
+}
@@ -0,0 +1,504 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+// Replays scratchpad traces of xmr-stak-trace against a cache and TLB geometry. Every trace is a
+// thread with its own L1, L2 and TLBs, the L3 is shared by all of them. The placement decides
+// where the scratchpads of the threads and ways live: back to back with an optional gap (which
+// shifts their cache colour) or the ways of a thread interleaved in chunks. Pages map to random
+// physical frames unless --linear-frames is given, the cache sets are taken from the physical
+// address. Before every hash the explode phase writes the whole scratchpad, those accesses warm
+// the caches but don't count.
+
+#include "cntrace.h"
+#include "../console.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class set_cache
+{
+public:
+	// Entries are lines for a cache and pages for a TLB
+	void init(uint64_t iEntries, uint32_t iWays)
+	{
+		this->iWays = iWays;
+		iSets = iEntries / iWays;
+		vTags.assign(iSets * iWays, uint64_t(-1));
+		vStamps.assign(iSets * iWays, 0);
+		iClock = iAccesses = iMisses = 0;
+	}
+
+	// LRU, a miss replaces the oldest entry of the set
+	bool access(uint64_t iTag, bool bCount = true)
+	{
+		uint64_t* pTags = &vTags[(iTag % iSets) * iWays];
+		uint64_t* pStamps = &vStamps[(iTag % iSets) * iWays];
+		iClock++;
+		if(bCount)
+			iAccesses++;
+
+		uint32_t iOldest = 0;
+		for(uint32_t i = 0; i < iWays; i++)
+		{
+			if(pTags[i] == iTag)
+			{
+				pStamps[i] = iClock;
+				return true;
+			}
+			if(pStamps[i] < pStamps[iOldest])
+				iOldest = i;
+		}
+
+		if(bCount)
+			iMisses++;
+		pTags[iOldest] = iTag;
+		pStamps[iOldest] = iClock;
+		return false;
+	}
+
+	uint64_t iAccesses;
+	uint64_t iMisses;
+
+private:
+	uint32_t iWays;
+	uint64_t iSets;
+	uint64_t iClock;
+	std::vector<uint64_t> vTags;
+	std::vector<uint64_t> vStamps;
+};
+
+struct geometry
+{
+	uint64_t iKb;     // entries for the TLBs
+	uint32_t iWays;
+};
+
+struct sim_cfg
+{
+	geometry l1, l2, l3, dtlb, stlb;
+	uint64_t iPageBytes;
+	uint64_t iGapBytes;        // between the scratchpads
+	uint64_t iInterleave;      // chunk of the interleaved ways, 0 for back to back scratchpads
+	uint32_t iCopies;          // threads per trace, each one starts at another point of it
+	bool bLinearFrames;
+	bool bExplode;
+	uint64_t iSeed;
+};
+
+struct sim_thread
+{
+	FILE* f;
+	std::string sFile;
+	cn_trace_header hdr;
+	uint64_t iStart;    // record the replay starts at
+	uint64_t iDone;
+	uint64_t iBase;     // virtual address of the first scratchpad
+	std::vector<uint32_t> vBuf;
+	size_t iBufPos;
+	set_cache l1, l2, dtlb, stlb;
+	uint64_t iKindAccesses[4];
+	uint64_t iKindL3Misses[4];
+};
+
+class simulator
+{
+public:
+	bool run(const sim_cfg& cfg, const std::vector<const char*>& vFiles);
+
+private:
+	bool open(sim_thread& t, const char* sFile, uint32_t iCopy);
+	bool next(sim_thread& t, uint32_t& iRec);
+	uint64_t virt_addr(const sim_thread& t, uint32_t iWay, uint64_t iOffset) const;
+	uint64_t phys_addr(uint64_t iVirt) const;
+	void access(sim_thread& t, uint64_t iVirt, uint32_t iKind, bool bCount);
+	void print_results();
+
+	sim_cfg oCfg;
+	std::vector<sim_thread*> vThreads;
+	set_cache l3;
+	uint64_t iPageWalks = 0;
+	uint64_t iHashes = 0;
+};
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+bool simulator::open(sim_thread& t, const char* sFile, uint32_t iCopy)
+{
+	t.sFile = sFile;
+	t.f = fopen(sFile, "rb");
+	t.iDone = t.iStart = 0;
+	if(t.f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Cachesim: can't open %s.", sFile);
+		return false;
+	}
+
+	if(fread(&t.hdr, sizeof(t.hdr), 1, t.f) != 1 || !t.hdr.valid() || t.hdr.iRecords == 0 || t.hdr.iHashes == 0)
+	{
+		printer::inst()->print_msg(L0, "Cachesim: %s is not a trace of xmr-stak-trace.", sFile);
+		return false;
+	}
+
+	// The copies start at an even split of the hashes, so they don't walk in lockstep
+	uint64_t iPerHash = t.hdr.iRecords / t.hdr.iHashes;
+	t.iStart = (t.hdr.iHashes * iCopy / oCfg.iCopies) * iPerHash;
+	t.iDone = 0;
+	t.iBufPos = 0;
+	t.vBuf.clear();
+	memset(t.iKindAccesses, 0, sizeof(t.iKindAccesses));
+	memset(t.iKindL3Misses, 0, sizeof(t.iKindL3Misses));
+	return fseek(t.f, long(sizeof(t.hdr) + t.iStart * sizeof(uint32_t)), SEEK_SET) == 0;
+}
+
+bool simulator::next(sim_thread& t, uint32_t& iRec)
+{
+	if(t.iDone == t.hdr.iRecords)
+		return false;
+
+	if(t.iBufPos == t.vBuf.size())
+	{
+		uint64_t iPos = (t.iStart + t.iDone) % t.hdr.iRecords;
+		if(iPos == 0 && fseek(t.f, long(sizeof(t.hdr)), SEEK_SET) != 0)
+			return false;
+
+		// Up to the end of the file or the record the replay started at
+		uint64_t iLeft = std::min(t.hdr.iRecords - iPos, t.hdr.iRecords - t.iDone);
+		t.vBuf.resize(size_t(std::min<uint64_t>(iLeft, 1 << 20)));
+		if(fread(t.vBuf.data(), sizeof(uint32_t), t.vBuf.size(), t.f) != t.vBuf.size())
+		{
+			printer::inst()->print_msg(L0, "Cachesim: %s is truncated.", t.sFile.c_str());
+			t.iDone = t.hdr.iRecords;
+			return false;
+		}
+		t.iBufPos = 0;
+	}
+
+	iRec = t.vBuf[t.iBufPos++];
+	t.iDone++;
+	return true;
+}
+
+uint64_t simulator::virt_addr(const sim_thread& t, uint32_t iWay, uint64_t iOffset) const
+{
+	if(oCfg.iInterleave == 0)
+		return t.iBase + iWay * (t.hdr.iMemory + oCfg.iGapBytes) + iOffset;
+
+	uint64_t iChunk = iOffset / oCfg.iInterleave;
+	return t.iBase + (iChunk * t.hdr.iWays + iWay) * oCfg.iInterleave + iOffset % oCfg.iInterleave;
+}
+
+uint64_t simulator::phys_addr(uint64_t iVirt) const
+{
+	if(oCfg.bLinearFrames)
+		return iVirt;
+
+	uint64_t iPage = iVirt / oCfg.iPageBytes;
+	uint64_t iFrame = splitmix64(iPage ^ oCfg.iSeed) & ((uint64_t(1) << 36) - 1);
+	return iFrame * oCfg.iPageBytes + iVirt % oCfg.iPageBytes;
+}
+
+void simulator::access(sim_thread& t, uint64_t iVirt, uint32_t iKind, bool bCount)
+{
+	uint64_t iPage = iVirt / oCfg.iPageBytes;
+	if(!t.dtlb.access(iPage, bCount) && !t.stlb.access(iPage, bCount) && bCount)
+		iPageWalks++;
+
+	uint64_t iLine = phys_addr(iVirt) / 64;
+	if(bCount)
+		t.iKindAccesses[iKind]++;
+	if(t.l1.access(iLine, bCount) || t.l2.access(iLine, bCount))
+		return;
+	if(!l3.access(iLine, bCount) && bCount)
+		t.iKindL3Misses[iKind]++;
+}
+
+bool simulator::run(const sim_cfg& cfg, const std::vector<const char*>& vFiles)
+{
+	oCfg = cfg;
+	l3.init(cfg.l3.iKb * 1024 / 64, cfg.l3.iWays);
+
+	uint64_t iBase = 0;
+	bool bOk = true;
+	for(size_t i = 0; i < vFiles.size() && bOk; i++)
+	{
+		for(uint32_t c = 0; c < cfg.iCopies && bOk; c++)
+		{
+			sim_thread* t = new sim_thread();
+			vThreads.push_back(t);
+			bOk = open(*t, vFiles[i], c);
+			if(!bOk)
+				break;
+
+			t->iBase = iBase;
+			iBase += t->hdr.iWays * (t->hdr.iMemory + cfg.iGapBytes);
+			t->l1.init(cfg.l1.iKb * 1024 / 64, cfg.l1.iWays);
+			t->l2.init(cfg.l2.iKb * 1024 / 64, cfg.l2.iWays);
+			t->dtlb.init(cfg.dtlb.iKb, cfg.dtlb.iWays);
+			t->stlb.init(cfg.stlb.iKb, cfg.stlb.iWays);
+			iHashes += t->hdr.iHashes * t->hdr.iWays;
+		}
+	}
+
+	// One access of every thread in turn, the way cores sharing an L3 would interleave
+	bool bAny = bOk;
+	while(bAny)
+	{
+		bAny = false;
+		for(sim_thread* t : vThreads)
+		{
+			uint64_t iPerHash = t->hdr.iRecords / t->hdr.iHashes;
+			if(oCfg.bExplode && t->iDone < t->hdr.iRecords && (t->iStart + t->iDone) % iPerHash == 0)
+			{
+				for(uint32_t w = 0; w < t->hdr.iWays; w++)
+				{
+					for(uint64_t o = 0; o < t->hdr.iMemory; o += 64)
+						access(*t, virt_addr(*t, w, o), 0, false);
+				}
+			}
+
+			uint32_t iRec;
+			if(!next(*t, iRec))
+				continue;
+			bAny = true;
+
+			uint32_t iWay = cn_trace_way(iRec);
+			if(iWay >= t->hdr.iWays)
+				continue;
+			access(*t, virt_addr(*t, iWay, cn_trace_offset(iRec)), cn_trace_kind_of(iRec), true);
+		}
+	}
+
+	if(bOk)
+		print_results();
+	for(sim_thread* t : vThreads)
+	{
+		if(t->f != nullptr)
+			fclose(t->f);
+		delete t;
+	}
+	vThreads.clear();
+	return bOk;
+}
+
+void simulator::print_results()
+{
+	uint64_t iL1Acc = 0, iL1Miss = 0, iL2Acc = 0, iL2Miss = 0, iTlbAcc = 0, iTlbMiss = 0;
+	uint64_t iKindAcc[4] = { 0 }, iKindMiss[4] = { 0 };
+	for(const sim_thread* t : vThreads)
+	{
+		iL1Acc += t->l1.iAccesses;
+		iL1Miss += t->l1.iMisses;
+		iL2Acc += t->l2.iAccesses;
+		iL2Miss += t->l2.iMisses;
+		iTlbAcc += t->dtlb.iAccesses;
+		iTlbMiss += t->dtlb.iMisses;
+		for(size_t k = 0; k < 4; k++)
+		{
+			iKindAcc[k] += t->iKindAccesses[k];
+			iKindMiss[k] += t->iKindL3Misses[k];
+		}
+	}
+
+	auto row = [this](std::string& sOut, const char* sName, uint64_t iAcc, uint64_t iMiss) {
+		char sBuf[128];
+		snprintf(sBuf, sizeof(sBuf), "| %-10s | %12llu | %12llu | %7.3f%% | %10.1f |\n", sName, int_port(iAcc), int_port(iMiss),
+			iAcc > 0 ? double(iMiss) / double(iAcc) * 100.0 : 0.0, iHashes > 0 ? double(iMiss) / double(iHashes) : 0.0);
+		sOut += sBuf;
+	};
+
+	char sBuf[256];
+	std::string sOut;
+	if(oCfg.iInterleave > 0)
+		snprintf(sBuf, sizeof(sBuf), "ways interleaved by %llu bytes", int_port(oCfg.iInterleave));
+	else
+		snprintf(sBuf, sizeof(sBuf), "scratchpads %llu KB apart", int_port(oCfg.iGapBytes / 1024));
+	std::string sPlacement = sBuf;
+
+	snprintf(sBuf, sizeof(sBuf), "CACHE SIMULATION, %llu threads, %llu hashes, %llu KB pages (%s frames), %s\n",
+		int_port(vThreads.size()), int_port(iHashes), int_port(oCfg.iPageBytes / 1024), oCfg.bLinearFrames ? "linear" : "random",
+		sPlacement.c_str());
+	sOut += sBuf;
+	snprintf(sBuf, sizeof(sBuf), "L1 %llu KB %u-way, L2 %llu KB %u-way, L3 %llu KB %u-way shared, dTLB %llu %u-way, STLB %llu %u-way\n",
+		int_port(oCfg.l1.iKb), oCfg.l1.iWays, int_port(oCfg.l2.iKb), oCfg.l2.iWays, int_port(oCfg.l3.iKb), oCfg.l3.iWays,
+		int_port(oCfg.dtlb.iKb), oCfg.dtlb.iWays, int_port(oCfg.stlb.iKb), oCfg.stlb.iWays);
+	sOut += sBuf;
+	sOut += "| Level      |     Accesses |       Misses | Miss rate | Miss/hash |\n";
+	row(sOut, "L1", iL1Acc, iL1Miss);
+	row(sOut, "L2", iL2Acc, iL2Miss);
+	row(sOut, "L3", l3.iAccesses, l3.iMisses);
+	row(sOut, "dTLB", iTlbAcc, iTlbMiss);
+	row(sOut, "STLB walks", iTlbMiss, iPageWalks);
+	sOut += "L3 misses by access (of all accesses of the kind)\n";
+	const char* sKinds[3] = { "aes", "mul", "shuffle" };
+	for(size_t k = 0; k < 3; k++)
+	{
+		if(iKindAcc[k] > 0)
+			row(sOut, sKinds[k], iKindAcc[k], iKindMiss[k]);
+	}
+	printer::inst()->print_str(sOut.c_str());
+}
+
+static bool parse_geometry(const char* sArg, geometry& g)
+{
+	char* pEnd;
+	g.iKb = strtoull(sArg, &pEnd, 10);
+	if(pEnd == sArg || *pEnd != ':' || g.iKb == 0)
+		return false;
+	const char* sWays = pEnd + 1;
+	g.iWays = uint32_t(strtoul(sWays, &pEnd, 10));
+	return pEnd != sWays && *pEnd == '\0' && g.iWays > 0 && g.iWays <= 64;
+}
+
+static bool parse_uint(int argc, char *argv[], int& i, uint64_t& iOut)
+{
+	if(i + 1 >= argc)
+		return false;
+
+	char* pEnd;
+	iOut = strtoull(argv[++i], &pEnd, 10);
+	return *pEnd == '\0';
+}
+
+static void print_usage(const char* sName)
+{
+	printf("Usage: %s [options] TRACE...\n\n", sName);
+	printf("Replays scratchpad traces of xmr-stak-trace, one thread per trace, and predicts the miss\n");
+	printf("rates of a cache and TLB geometry for a scratchpad placement.\n\n");
+	printf("  --l1 KB:WAYS          L1 data cache of every thread (default 32:8)\n");
+	printf("  --l2 KB:WAYS          L2 of every thread (default 1024:16)\n");
+	printf("  --l3 KB:WAYS          L3 shared by all threads (default 16384:16)\n");
+	printf("  --dtlb ENTRIES:WAYS   first level data TLB (default 64:4)\n");
+	printf("  --stlb ENTRIES:WAYS   second level TLB (default 1536:12)\n");
+	printf("  --page-kb KB          page size, 4 or 2048 for huge pages (default 2048)\n");
+	printf("  --linear-frames       physical pages follow the virtual ones instead of random frames\n");
+	printf("  --gap KB              space between the scratchpads, shifts their cache colour (default 0)\n");
+	printf("  --interleave BYTES    interleave the ways of a double hash in chunks of BYTES\n");
+	printf("  --copies N            threads per trace, each one starts at another hash of it if the\n");
+	printf("                        trace has enough of them (default 1)\n");
+	printf("  --no-explode          don't warm the caches with the explode phase before every hash\n");
+	printf("  --seed N              seed of the random frames\n");
+}
+
+int main(int argc, char *argv[])
+{
+	sim_cfg cfg;
+	cfg.l1 = { 32, 8 };
+	cfg.l2 = { 1024, 16 };
+	cfg.l3 = { 16384, 16 };
+	cfg.dtlb = { 64, 4 };
+	cfg.stlb = { 1536, 12 };
+	cfg.iPageBytes = 2048 * 1024;
+	cfg.iGapBytes = 0;
+	cfg.iInterleave = 0;
+	cfg.iCopies = 1;
+	cfg.bLinearFrames = false;
+	cfg.bExplode = true;
+	cfg.iSeed = 1;
+
+	std::vector<const char*> vFiles;
+	for(int i = 1; i < argc; i++)
+	{
+		bool bOk = true;
+		uint64_t iVal;
+		if(strcmp(argv[i], "--l1") == 0)
+			bOk = i + 1 < argc && parse_geometry(argv[++i], cfg.l1);
+		else if(strcmp(argv[i], "--l2") == 0)
+			bOk = i + 1 < argc && parse_geometry(argv[++i], cfg.l2);
+		else if(strcmp(argv[i], "--l3") == 0)
+			bOk = i + 1 < argc && parse_geometry(argv[++i], cfg.l3);
+		else if(strcmp(argv[i], "--dtlb") == 0)
+			bOk = i + 1 < argc && parse_geometry(argv[++i], cfg.dtlb);
+		else if(strcmp(argv[i], "--stlb") == 0)
+			bOk = i + 1 < argc && parse_geometry(argv[++i], cfg.stlb);
+		else if(strcmp(argv[i], "--page-kb") == 0)
+		{
+			bOk = parse_uint(argc, argv, i, iVal) && iVal >= 4 && (iVal & (iVal - 1)) == 0;
+			cfg.iPageBytes = iVal * 1024;
+		}
+		else if(strcmp(argv[i], "--gap") == 0)
+		{
+			bOk = parse_uint(argc, argv, i, iVal);
+			cfg.iGapBytes = iVal * 1024;
+		}
+		else if(strcmp(argv[i], "--interleave") == 0)
+		{
+			bOk = parse_uint(argc, argv, i, iVal) && iVal >= 16 && (iVal & 15) == 0;
+			cfg.iInterleave = iVal;
+		}
+		else if(strcmp(argv[i], "--copies") == 0)
+		{
+			bOk = parse_uint(argc, argv, i, iVal) && iVal > 0 && iVal <= 256;
+			cfg.iCopies = uint32_t(iVal);
+		}
+		else if(strcmp(argv[i], "--seed") == 0)
+			bOk = parse_uint(argc, argv, i, cfg.iSeed);
+		else if(strcmp(argv[i], "--linear-frames") == 0)
+			cfg.bLinearFrames = true;
+		else if(strcmp(argv[i], "--no-explode") == 0)
+			cfg.bExplode = false;
+		else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		else if(argv[i][0] != '-')
+			vFiles.push_back(argv[i]);
+		else
+			bOk = false;
+
+		if(!bOk)
+		{
+			printer::inst()->print_msg(L0, "Invalid argument: %s", argv[i]);
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Every set needs all of its ways
+	if(cfg.l1.iKb * 16 < cfg.l1.iWays || cfg.l2.iKb * 16 < cfg.l2.iWays || cfg.l3.iKb * 16 < cfg.l3.iWays ||
+		cfg.dtlb.iKb < cfg.dtlb.iWays || cfg.stlb.iKb < cfg.stlb.iWays)
+	{
+		printer::inst()->print_msg(L0, "Cachesim: a cache or TLB has fewer entries than ways.");
+		return 1;
+	}
+
+	if(vFiles.empty())
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	simulator sim;
+	return sim.run(cfg, vFiles) ? 0 : 1;
+}
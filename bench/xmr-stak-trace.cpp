@@ -0,0 +1,225 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+// The generic kernels built with a tracer that records every scratchpad access of the main loop.
+// Only the addresses matter, so the kernel runs with hard AES where the CPU has it and with soft
+// AES elsewhere, the traces are the same. xmr-stak-cachesim replays them.
+
+#include "cntrace.h"
+#include "../minethd.h"
+#include "../jconf.h"
+#include "../console.h"
+#include "../crypto/cryptonight_aesni.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+struct trace_recorder
+{
+	static std::vector<uint32_t> vRecords;
+
+	static FORCEINLINE void access(uint32_t iWay, cn_trace_kind iKind, uint64_t iOffset)
+	{
+		vRecords.push_back(cn_trace_pack(iWay, iKind, iOffset));
+	}
+};
+
+std::vector<uint32_t> trace_recorder::vRecords;
+
+typedef void (*traced_fun)(const void*, size_t, void*, const void*, size_t, void*, cryptonight_ctx*, cryptonight_ctx*);
+
+// The single and double kernels behind one signature, the single one ignores the second way
+template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT>
+void traced_single(const void* input1, size_t len1, void* output1, const void*, size_t, void*, cryptonight_ctx* ctx0, cryptonight_ctx*)
+{
+	cryptonight_hash<ITERATIONS, MEM, SOFT_AES, VARIANT, trace_recorder>(input1, len1, output1, ctx0);
+}
+
+template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT>
+void traced_double(const void* input1, size_t len1, void* output1, const void* input2, size_t len2, void* output2,
+	cryptonight_ctx* ctx0, cryptonight_ctx* ctx1)
+{
+	cryptonight_double_hash<ITERATIONS, MEM, SOFT_AES, VARIANT, trace_recorder>(input1, len1, output1, input2, len2, output2, ctx0, ctx1);
+}
+
+template<size_t ITERATIONS, size_t MEM, bool SOFT_AES>
+traced_fun select_variant(int iVariant, uint32_t iWays)
+{
+	static const traced_fun func_table[8] = {
+		traced_single<ITERATIONS, MEM, SOFT_AES, 0>,
+		traced_single<ITERATIONS, MEM, SOFT_AES, 1>,
+		traced_single<ITERATIONS, MEM, SOFT_AES, 2>,
+		traced_single<ITERATIONS, MEM, SOFT_AES, 3>,
+
+		traced_double<ITERATIONS, MEM, SOFT_AES, 0>,
+		traced_double<ITERATIONS, MEM, SOFT_AES, 1>,
+		traced_double<ITERATIONS, MEM, SOFT_AES, 2>,
+		traced_double<ITERATIONS, MEM, SOFT_AES, 3>,
+	};
+
+	return func_table[iVariant + (iWays == 2 ? 4 : 0)];
+}
+
+static traced_fun select_traced(bool bHaveAes, int iVariant, uint32_t iWays, bool bLite)
+{
+	if(bLite)
+		return bHaveAes ? select_variant<0x40000, MEMORY_LITE, false>(iVariant, iWays) : select_variant<0x40000, MEMORY_LITE, true>(iVariant, iWays);
+	return bHaveAes ? select_variant<0x80000, MEMORY, false>(iVariant, iWays) : select_variant<0x80000, MEMORY, true>(iVariant, iWays);
+}
+
+static void print_usage(const char* sName)
+{
+	printf("Usage: %s --out FILE [options]\n\n", sName);
+	printf("Records the scratchpad addresses of the cryptonight main loop for xmr-stak-cachesim.\n\n");
+	printf("  --out FILE            trace file to write\n");
+	printf("  --variant N           cryptonight variant (default 2)\n");
+	printf("  --profile full|lite   scratchpad size (default full)\n");
+	printf("  --ways 1|2            single or double hashes (default 1)\n");
+	printf("  --hashes N            hashes per way (default 1)\n");
+}
+
+static bool parse_int(int argc, char *argv[], int& i, int64_t& iOut)
+{
+	if(i + 1 >= argc)
+		return false;
+
+	char* pEnd;
+	iOut = strtoll(argv[++i], &pEnd, 10);
+	return *pEnd == '\0' && iOut >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char* sOut = nullptr;
+	int64_t iVariant = 2;
+	int64_t iWays = 1;
+	int64_t iHashes = 1;
+	bool bLite = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		bool bOk = true;
+		if(strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			sOut = argv[++i];
+		else if(strcmp(argv[i], "--variant") == 0)
+			bOk = parse_int(argc, argv, i, iVariant) && iVariant < minethd::iVariantCnt;
+		else if(strcmp(argv[i], "--ways") == 0)
+			bOk = parse_int(argc, argv, i, iWays) && (iWays == 1 || iWays == 2);
+		else if(strcmp(argv[i], "--hashes") == 0)
+			bOk = parse_int(argc, argv, i, iHashes) && iHashes > 0;
+		else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			i++;
+			bLite = strcmp(argv[i], "lite") == 0;
+			bOk = bLite || strcmp(argv[i], "full") == 0;
+		}
+		else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		else
+			bOk = false;
+
+		if(!bOk)
+		{
+			printer::inst()->print_msg(L0, "Invalid argument: %s", argv[i]);
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(sOut == nullptr)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	int32_t cpu_info[4];
+	jconf::cpuid(1, 0, cpu_info);
+	bool bHaveAes = (cpu_info[2] & (1 << 25)) != 0;
+	minethd::init_variant1_table();
+
+	alloc_msg msg = { 0 };
+	cryptonight_ctx* ctx[2] = { cryptonight_alloc_ctx(0, 0, &msg), cryptonight_alloc_ctx(0, 0, &msg) };
+
+	FILE* f = fopen(sOut, "wb");
+	if(f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Trace: can't open %s.", sOut);
+		return 1;
+	}
+
+	cn_trace_header hdr;
+	memcpy(hdr.sMagic, cn_trace_header::sMagicV1, sizeof(hdr.sMagic));
+	hdr.iVariant = uint32_t(iVariant);
+	hdr.iWays = uint32_t(iWays);
+	hdr.iMemory = bLite ? MEMORY_LITE : MEMORY;
+	hdr.iIterations = bLite ? 0x40000 : 0x80000;
+	hdr.iHashes = uint64_t(iHashes);
+	hdr.iRecords = 0;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	// Every hash of a way gets its own nonce, the blob is the one of xmr-stak-bench
+	traced_fun hash_fun = select_traced(bHaveAes, int(iVariant), uint32_t(iWays), bLite);
+	uint8_t bBlob[2][76];
+	uint8_t bOut[64];
+	for(size_t i = 0; i < 76; i++)
+		bBlob[0][i] = bBlob[1][i] = uint8_t(i);
+
+	bool bOk = true;
+	for(uint64_t h = 0; h < uint64_t(iHashes) && bOk; h++)
+	{
+		uint32_t iNonce[2] = { uint32_t(h * 2), uint32_t(h * 2 + 1) };
+		memcpy(bBlob[0] + 39, &iNonce[0], 4);
+		memcpy(bBlob[1] + 39, &iNonce[1], 4);
+
+		trace_recorder::vRecords.clear();
+		trace_recorder::vRecords.reserve(hdr.iIterations * (iVariant == 2 ? 4 : 2) * iWays);
+		hash_fun(bBlob[0], 76, bOut, bBlob[1], 76, bOut + 32, ctx[0], ctx[1]);
+
+		const std::vector<uint32_t>& v = trace_recorder::vRecords;
+		bOk = fwrite(v.data(), sizeof(uint32_t), v.size(), f) == v.size();
+		hdr.iRecords += v.size();
+	}
+
+	// The record count is only known at the end
+	bOk = bOk && fseek(f, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+	bOk = fclose(f) == 0 && bOk;
+	cryptonight_free_ctx(ctx[0]);
+	cryptonight_free_ctx(ctx[1]);
+
+	if(!bOk)
+	{
+		printer::inst()->print_msg(L0, "Trace: writing %s failed.", sOut);
+		return 1;
+	}
+
+	printer::inst()->print_msg(L0, "Trace: %llu accesses of %llu hashes (%s), variant %d, %llu KB scratchpad, written to %s.",
+		int_port(hdr.iRecords), int_port(hdr.iHashes * hdr.iWays), iWays == 2 ? "double" : "single", int(iVariant),
+		int_port(hdr.iMemory / 1024), sOut);
+	return 0;
+}
@@ -0,0 +1,742 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "benchmark.h"
+#include "minethd.h"
+#include "energy.h"
+#include "console.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+benchmark::stats benchmark::calc_stats(const std::vector<double>& vSamples)
+{
+	// Two sided 95% quantiles of Student's t for 1 to 30 degrees of freedom
+	static const double aT95[30] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+	stats s = { 0.0, 0.0, 0.0, 0.0 };
+	size_t n = vSamples.size();
+	if(n == 0)
+		return s;
+
+	for(double f : vSamples)
+		s.fMean += f;
+	s.fMean /= n;
+
+	std::vector<double> vSorted = vSamples;
+	std::sort(vSorted.begin(), vSorted.end());
+	s.fMedian = n % 2 != 0 ? vSorted[n / 2] : (vSorted[n / 2 - 1] + vSorted[n / 2]) / 2.0;
+
+	if(n < 2)
+		return s;
+
+	double fVar = 0.0;
+	for(double f : vSamples)
+		fVar += (f - s.fMean) * (f - s.fMean);
+	s.fStdDev = sqrt(fVar / (n - 1));
+	s.fCi95 = (n - 1 <= 30 ? aT95[n - 2] : 1.96) * s.fStdDev / sqrt(double(n));
+	return s;
+}
+
+// One sided p-value of the Mann-Whitney U test for "the values of a tend to be smaller than the
+// ones of b". Small samples get the exact distribution of U, bigger ones the normal approximation.
+double benchmark::mann_whitney_less(const std::vector<double>& a, const std::vector<double>& b)
+{
+	size_t n1 = a.size(), n2 = b.size();
+	if(n1 == 0 || n2 == 0)
+		return 1.0;
+
+	// U counts the pairs where the value of a is the bigger one, ties count half
+	double fU = 0.0;
+	for(double x : a)
+	{
+		for(double y : b)
+			fU += x > y ? 1.0 : x == y ? 0.5 : 0.0;
+	}
+
+	if(n1 <= 20 && n2 <= 20)
+	{
+		// f(i, j, u) - orderings of i values of a and j of b with U = u. The biggest value is either
+		// from a, then it beats all j values of b, or from b and adds nothing.
+		size_t iMax = n1 * n2;
+		auto idx = [n2, iMax](size_t i, size_t j, size_t u) { return (i * (n2 + 1) + j) * (iMax + 1) + u; };
+		std::vector<double> f((n1 + 1) * (n2 + 1) * (iMax + 1), 0.0);
+		for(size_t i = 0; i <= n1; i++)
+		{
+			for(size_t j = 0; j <= n2; j++)
+			{
+				if(i == 0 || j == 0)
+				{
+					f[idx(i, j, 0)] = 1.0;
+					continue;
+				}
+				for(size_t u = 0; u <= i * j; u++)
+					f[idx(i, j, u)] = (u >= j ? f[idx(i - 1, j, u - j)] : 0.0) + f[idx(i, j - 1, u)];
+			}
+		}
+
+		double fBelow = 0.0, fAll = 0.0;
+		for(size_t u = 0; u <= iMax; u++)
+		{
+			fAll += f[idx(n1, n2, u)];
+			if(double(u) <= fU)
+				fBelow += f[idx(n1, n2, u)];
+		}
+		return fBelow / fAll;
+	}
+
+	double fMean = n1 * n2 / 2.0;
+	double fSigma = sqrt(n1 * n2 * (n1 + n2 + 1) / 12.0);
+	return 0.5 * erfc(-(fU + 0.5 - fMean) / fSigma / sqrt(2.0));
+}
+
+// The smallest p the exact test can give, a below all of b is one of C(n1 + n2, n1) orderings.
+// With 3 repetitions on either side that is 0.05, no p-value of such a row can get below 0.05.
+static double min_p_value(size_t n1, size_t n2)
+{
+	if(n1 > 20 || n2 > 20)
+		return 0.0;
+	double fOrders = 1.0;
+	for(size_t k = 1; k <= n1; k++)
+		fOrders = fOrders * double(n2 + k) / double(k);
+	return 1.0 / fOrders;
+}
+
+static int hex_value(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool benchmark::load_blobs(const char* sFile)
+{
+	FILE* f = fopen(sFile, "r");
+	if(f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Benchmark: failed to open %s.", sFile);
+		return false;
+	}
+
+	// Lines starting with a '#' are comments, every other one is a hashing blob in hex
+	char sLine[512];
+	size_t iLine = 0;
+	while(fgets(sLine, sizeof(sLine), f) != nullptr)
+	{
+		iLine++;
+		size_t iLen = strlen(sLine);
+		while(iLen > 0 && (sLine[iLen - 1] == '\n' || sLine[iLen - 1] == '\r' || sLine[iLen - 1] == ' '))
+			sLine[--iLen] = '\0';
+		if(iLen == 0 || sLine[0] == '#')
+			continue;
+
+		std::vector<uint8_t> vBlob;
+		bool bOk = iLen % 2 == 0 && iLen / 2 >= minethd::iDefaultNonceOffset + 4 && iLen / 2 <= sizeof(minethd::miner_work::bWorkBlob);
+		for(size_t i = 0; bOk && i < iLen; i += 2)
+		{
+			int hi = hex_value(sLine[i]), lo = hex_value(sLine[i + 1]);
+			bOk = hi >= 0 && lo >= 0;
+			vBlob.push_back(uint8_t(hi << 4 | lo));
+		}
+
+		if(!bOk)
+		{
+			printer::inst()->print_msg(L0, "Benchmark: line %llu of %s is no blob of %u to %u hex bytes.", int_port(iLine), sFile,
+				uint32_t(minethd::iDefaultNonceOffset + 4), uint32_t(sizeof(minethd::miner_work::bWorkBlob)));
+			fclose(f);
+			return false;
+		}
+		vBlobs.push_back(vBlob);
+	}
+	fclose(f);
+
+	if(vBlobs.empty())
+	{
+		printer::inst()->print_msg(L0, "Benchmark: no blobs in %s.", sFile);
+		return false;
+	}
+	return true;
+}
+
+static void appendf(std::string& sOut, const char* fmt, ...)
+{
+	char sBuf[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(sBuf, sizeof(sBuf), fmt, args);
+	va_end(args);
+	sOut += sBuf;
+}
+
+// Whatever kernels the thread ran, the benchmark keeps them fixed
+static latencyHist::merged thread_latency(const minethd* thd)
+{
+	latencyHist::merged out;
+	for(uint32_t p = 0; p < minethd::cn_profile_cnt; p++)
+	{
+		for(int v = 0; v < minethd::iVariantCnt; v++)
+		{
+			thd->get_latency(minethd::cn_profile(p), v, false, out);
+			thd->get_latency(minethd::cn_profile(p), v, true, out);
+		}
+	}
+	return out;
+}
+
+bool benchmark::run(const bench_cfg& cfg)
+{
+	using namespace std::chrono;
+	oCfg = cfg;
+	oHost.collect();
+	vBlobs.clear();
+	vThdCfg.clear();
+
+	if(cfg.sBlobFile != nullptr && !load_blobs(cfg.sBlobFile))
+		return false;
+	if(vBlobs.empty())
+		vBlobs.push_back(std::vector<uint8_t>(76, 0));
+
+	// Auto means whatever Monero currently uses, the zero blob alone would pick variant 0
+	iVariant = cfg.iVariant != iVariantConfig ? cfg.iVariant : jconf::inst()->GetVariant();
+	if(iVariant < 0)
+		iVariant = 2;
+
+	size_t iConfThreads = jconf::inst()->GetThreadCount();
+	for(size_t i = 0; i < (cfg.vThreads.empty() ? iConfThreads : cfg.vThreads.size()); i++)
+	{
+		size_t id = cfg.vThreads.empty() ? i : cfg.vThreads[i];
+		jconf::thd_cfg thd;
+		if(id >= iConfThreads || !jconf::inst()->GetThreadConfig(id, thd))
+		{
+			printer::inst()->print_msg(L0, "Benchmark: there is no thread %llu in cpu_threads_conf.", int_port(id));
+			return false;
+		}
+		if(cfg.iVariant != iVariantConfig)
+			thd.iVariant = iVariant;
+		vThdCfg.push_back(thd);
+	}
+
+	printer::inst()->print_msg(L0, "Running a benchmark of %llu threads, %llu seconds warmup and %u repetitions of %llu seconds on %llu blobs...",
+		int_port(vThdCfg.size()), int_port(cfg.iWarmupSec), cfg.iReps, int_port(cfg.iSeconds), int_port(vBlobs.size()));
+	printer::inst()->print_msg(L0, "Host: %s, microcode %s, %s, huge pages %llu of %llu free, THP %s.", oHost.sCpu.c_str(),
+		oHost.sMicrocode.c_str(), oHost.sKernel.c_str(), int_port(oHost.iHugeFree), int_port(oHost.iHugePages), oHost.sThp.c_str());
+
+	jconf::inst()->SetThreadConfig(vThdCfg);
+	uint64_t iCtxStart = minethd::iCtxCount.load();
+	uint64_t iHugeStart = minethd::iHugeCtxCount.load();
+
+	auto make_work = [this](size_t iRep)
+	{
+		// The constructor copies the whole job id, a short literal would be read past its end
+		char sJobId[sizeof(minethd::miner_work::sJobID)] = {};
+		snprintf(sJobId, sizeof(sJobId), "benchmark %llu", int_port(iRep));
+		const std::vector<uint8_t>& blob = vBlobs[iRep % vBlobs.size()];
+		minethd::miner_work oWork = minethd::miner_work(sJobId, blob.data(), uint32_t(blob.size()), 0, 0, false, 0);
+		oWork.iVariant = iVariant;
+		return oWork;
+	};
+
+	minethd::miner_work oWork = make_work(0);
+	std::vector<minethd*>* pvThreads = minethd::thread_starter(oWork);
+	size_t iCnt = pvThreads->size();
+
+	std::this_thread::sleep_for(seconds(cfg.iWarmupSec));
+	iCtx = minethd::iCtxCount.load() - iCtxStart;
+	iHugeCtx = minethd::iHugeCtxCount.load() - iHugeStart;
+
+	vThreadReps.assign(iCnt, std::vector<double>());
+	vTotalReps.clear();
+	double fJoules = energymeter::inst()->read_joules();
+	uint64_t iStart = minethd::get_usec();
+
+	vThreadLat.clear();
+	for(size_t i = 0; i < iCnt; i++)
+		vThreadLat.push_back(thread_latency(pvThreads->at(i)));
+
+	vPerf.assign(iCnt, perfCounters::sample());
+	vPerfHashes.assign(iCnt, 0);
+	std::vector<bool> vHavePerf(iCnt);
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		vHavePerf[i] = pvThreads->at(i)->read_perf(vPerf[i]);
+		vPerfHashes[i] = pvThreads->at(i)->iHashCount.load();
+	}
+
+	// The counters are only updated every few hashes, each one comes with its own timestamp
+	std::vector<uint64_t> vCount(iCnt), vStamp(iCnt);
+	for(uint32_t rep = 0; rep < cfg.iReps; rep++)
+	{
+		if(rep > 0 && vBlobs.size() > 1)
+		{
+			oWork = make_work(rep);
+			minethd::switch_work(oWork);
+			minethd::sync_work();
+		}
+
+		for(size_t i = 0; i < iCnt; i++)
+		{
+			vCount[i] = pvThreads->at(i)->iHashCount.load();
+			vStamp[i] = pvThreads->at(i)->iTimestamp.load();
+		}
+
+		std::this_thread::sleep_for(seconds(cfg.iSeconds));
+
+		double fTotal = 0.0;
+		for(size_t i = 0; i < iCnt; i++)
+		{
+			uint64_t iCount = pvThreads->at(i)->iHashCount.load();
+			uint64_t iStamp = pvThreads->at(i)->iTimestamp.load();
+			double fHps = iStamp > vStamp[i] ? (iCount - vCount[i]) * 1000.0 / (iStamp - vStamp[i]) : 0.0;
+			vThreadReps[i].push_back(fHps);
+			fTotal += fHps;
+		}
+		vTotalReps.push_back(fTotal);
+		printer::inst()->print_msg(L1, "Benchmark: repetition %u of %u - %.1f H/S", rep + 1, cfg.iReps, fTotal);
+	}
+
+	double fSec = (minethd::get_usec() - iStart) / 1000000.0;
+	fJoules = energymeter::inst()->read_joules() - fJoules;
+	fWatts = fSec > 0.0 ? fJoules / fSec : 0.0;
+
+	oTotalLat = latencyHist::merged();
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		latencyHist::merged oWarm = vThreadLat[i];
+		vThreadLat[i] = thread_latency(pvThreads->at(i));
+		vThreadLat[i].sub(oWarm);
+		oTotalLat.add(vThreadLat[i]);
+	}
+	fTickUsec = minethd::tick_usec();
+
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		perfCounters::sample oEnd;
+		if(vHavePerf[i] && pvThreads->at(i)->read_perf(oEnd))
+		{
+			vPerf[i] = perfCounters::delta(vPerf[i], oEnd);
+			vPerfHashes[i] = pvThreads->at(i)->iHashCount.load() - vPerfHashes[i];
+		}
+		else
+			vPerfHashes[i] = 0;
+	}
+
+	minethd::thread_stopper(pvThreads);
+	jconf::inst()->ClearThreadConfig();
+
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		stats s = calc_stats(vThreadReps[i]);
+		printer::inst()->print_msg(L0, "Thread %llu (CPU %lld, %s): mean %.1f H/S, median %.1f, sd %.1f, 95%% CI +-%.1f",
+			int_port(cfg.vThreads.empty() ? i : cfg.vThreads[i]), (long long)vThdCfg[i].iCpuAff,
+			vThdCfg[i].bDoubleMode ? "double" : "single", s.fMean, s.fMedian, s.fStdDev, s.fCi95);
+		const latencyHist::merged& h = vThreadLat[i];
+		printer::inst()->print_msg(L0, "Thread %llu latency: p50 %.0f us, p99 %.0f, p99.9 %.0f, max %.0f (%llu hashes)",
+			int_port(cfg.vThreads.empty() ? i : cfg.vThreads[i]), h.percentile(0.5) * fTickUsec, h.percentile(0.99) * fTickUsec,
+			h.percentile(0.999) * fTickUsec, h.iMax * fTickUsec, int_port(h.iCount));
+
+		if(vPerfHashes[i] != 0)
+		{
+			std::string sPerf;
+			const perfCounters::sample& d = vPerf[i];
+			if(d.aHave[perfCounters::cycles] && d.aHave[perfCounters::instructions] && d.aVal[perfCounters::cycles] != 0)
+				appendf(sPerf, " IPC %.2f,", double(d.aVal[perfCounters::instructions]) / d.aVal[perfCounters::cycles]);
+			for(size_t c = 0; c < perfCounters::counter_cnt; c++)
+			{
+				if(d.aHave[c])
+					appendf(sPerf, " %s %.1f,", perfCounters::name(perfCounters::counter(c)), double(d.aVal[c]) / vPerfHashes[i]);
+			}
+			sPerf.pop_back();
+			printer::inst()->print_msg(L0, "Thread %llu per hash:%s", int_port(cfg.vThreads.empty() ? i : cfg.vThreads[i]), sPerf.c_str());
+		}
+	}
+
+	stats s = calc_stats(vTotalReps);
+	printer::inst()->print_msg(L0, "Total: mean %.1f H/S, median %.1f, sd %.1f, 95%% CI +-%.1f (%.2f%%)", s.fMean, s.fMedian,
+		s.fStdDev, s.fCi95, s.fMean > 0.0 ? s.fCi95 * 100.0 / s.fMean : 0.0);
+	printer::inst()->print_msg(L0, "Latency: p50 %.0f us, p99 %.0f, p99.9 %.0f, max %.0f", oTotalLat.percentile(0.5) * fTickUsec,
+		oTotalLat.percentile(0.99) * fTickUsec, oTotalLat.percentile(0.999) * fTickUsec, oTotalLat.iMax * fTickUsec);
+	printer::inst()->print_msg(L0, "Scratchpads: %llu of %llu on huge pages.", int_port(iHugeCtx), int_port(iCtx));
+	if(energymeter::inst()->get_source() != energymeter::src_none && fWatts > 0.0)
+		printer::inst()->print_msg(L0, "Power: %.1f W, %.2f H/J (%s)", fWatts, s.fMean / fWatts, energymeter::inst()->get_source_name());
+
+	if(cfg.sOutFile != nullptr)
+	{
+		size_t iLen = strlen(cfg.sOutFile);
+		bool bJson = iLen >= 5 && strcmp(cfg.sOutFile + iLen - 5, ".json") == 0;
+		if(!(bJson ? write_json(cfg.sOutFile) : write_csv(cfg.sOutFile)))
+		{
+			printer::inst()->print_msg(L0, "Benchmark: failed to write %s.", cfg.sOutFile);
+			return false;
+		}
+		printer::inst()->print_msg(L0, "Benchmark: results written to %s.", cfg.sOutFile);
+	}
+
+	if(cfg.sBaseline != nullptr && !compare_baseline(cfg.sBaseline))
+	{
+		if(cfg.sSaveBaseline != nullptr)
+			printer::inst()->print_msg(L0, "Baseline: a slower run doesn't replace the baseline, %s not changed.", cfg.sSaveBaseline);
+		return false;
+	}
+
+	return cfg.sSaveBaseline == nullptr || save_baseline(cfg.sSaveBaseline);
+}
+
+static bool read_file(const char* sFile, std::string& sOut)
+{
+	FILE* f = fopen(sFile, "rb");
+	if(f == nullptr)
+		return false;
+
+	char sBuf[4096];
+	size_t iRead;
+	sOut.clear();
+	while((iRead = fread(sBuf, 1, sizeof(sBuf), f)) > 0)
+		sOut.append(sBuf, iRead);
+	fclose(f);
+	return true;
+}
+
+// A baseline store is { "results" : [ ... ] } with the objects --bench-out writes,
+// a single --bench-out file works as a store with one result
+static bool parse_store(const std::string& sText, const char* sFile, rapidjson::Document& doc, std::vector<const rapidjson::Value*>& vResults)
+{
+	using namespace rapidjson;
+	doc.Parse<kParseCommentsFlag|kParseTrailingCommasFlag>(sText.c_str());
+	if(doc.HasParseError())
+	{
+		printer::inst()->print_msg(L0, "Baseline: %s is no valid JSON, offset %llu: %s", sFile,
+			int_port(doc.GetErrorOffset()), GetParseError_En(doc.GetParseError()));
+		return false;
+	}
+
+	vResults.clear();
+	if(doc.IsObject() && doc.HasMember("results") && doc["results"].IsArray())
+	{
+		for(const Value& r : doc["results"].GetArray())
+		{
+			if(r.IsObject())
+				vResults.push_back(&r);
+		}
+	}
+	else if(doc.IsObject() && doc.HasMember("host"))
+		vResults.push_back(&doc);
+	else
+	{
+		printer::inst()->print_msg(L0, "Baseline: %s has no benchmark results.", sFile);
+		return false;
+	}
+	return true;
+}
+
+static bool get_reps(const rapidjson::Value& obj, std::vector<double>& vOut)
+{
+	vOut.clear();
+	if(!obj.IsObject() || !obj.HasMember("reps") || !obj["reps"].IsArray())
+		return false;
+	for(const rapidjson::Value& v : obj["reps"].GetArray())
+	{
+		if(v.IsNumber())
+			vOut.push_back(v.GetDouble());
+	}
+	return !vOut.empty();
+}
+
+bool benchmark::is_same_run(const rapidjson::Value& r)
+{
+	return r.HasMember("host") && r["host"].IsObject() && r["host"].HasMember("key") && r["host"]["key"].IsString() &&
+		oHost.key() == r["host"]["key"].GetString() && r.HasMember("kernel") && r["kernel"].IsString() &&
+		kernel_key() == r["kernel"].GetString();
+}
+
+bool benchmark::compare_baseline(const char* sFile)
+{
+	using namespace rapidjson;
+	std::string sText;
+	if(!read_file(sFile, sText))
+	{
+		printer::inst()->print_msg(L0, "Baseline: %s not found, nothing to compare.", sFile);
+		return true;
+	}
+
+	Document doc;
+	std::vector<const Value*> vResults;
+	if(!parse_store(sText, sFile, doc, vResults))
+		return false;
+
+	// The last result of the host and kernel is the baseline
+	const Value* pBase = nullptr;
+	for(const Value* r : vResults)
+	{
+		if(is_same_run(*r))
+			pBase = r;
+	}
+
+	if(pBase == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Baseline: no result for %s, %s in %s, nothing to compare.", oHost.key().c_str(), kernel_key().c_str(), sFile);
+		return true;
+	}
+
+	struct row { std::string sName; const std::vector<double>* pCur; std::vector<double> vBase; };
+	std::vector<row> vRows;
+	vRows.push_back({ "total", &vTotalReps, {} });
+	if(pBase->HasMember("total"))
+		get_reps((*pBase)["total"], vRows.back().vBase);
+
+	for(size_t i = 0; i < vThreadReps.size(); i++)
+	{
+		vRows.push_back({ row_name(i), &vThreadReps[i], {} });
+		if(!pBase->HasMember("threads") || !(*pBase)["threads"].IsArray())
+			continue;
+
+		for(const Value& t : (*pBase)["threads"].GetArray())
+		{
+			if(t.IsObject() && t.HasMember("name") && t["name"].IsString() && vRows.back().sName == t["name"].GetString())
+				get_reps(t, vRows.back().vBase);
+		}
+	}
+
+	char sBuf[256];
+	bool bSlower = false;
+	bool bBlind = false;
+	std::string sOut;
+	snprintf(sBuf, sizeof(sBuf), "BASELINE %s, %s\nSlower means p < %.2f and the median down by more than %.1f%%\n",
+		oHost.key().c_str(), kernel_key().c_str(), fAlpha, oCfg.fThreshold);
+	sOut += sBuf;
+	sOut += "| Kernel                           | Baseline |  Current |   Diff |      p |\n";
+	for(const row& r : vRows)
+	{
+		if(r.vBase.empty())
+		{
+			snprintf(sBuf, sizeof(sBuf), "| %-32s |     (na) | %8.1f |   (na) |   (na) | not in the baseline\n",
+				r.sName.c_str(), calc_stats(*r.pCur).fMedian);
+			sOut += sBuf;
+			continue;
+		}
+
+		double fBase = calc_stats(r.vBase).fMedian;
+		double fCur = calc_stats(*r.pCur).fMedian;
+		double fDiff = fBase > 0.0 ? (fCur / fBase - 1.0) * 100.0 : 0.0;
+		double fP = mann_whitney_less(*r.pCur, r.vBase);
+		bool bRowSlower = fP < fAlpha && -fDiff > oCfg.fThreshold;
+		bool bRowBlind = min_p_value(r.pCur->size(), r.vBase.size()) >= fAlpha;
+		bSlower |= bRowSlower;
+		bBlind |= bRowBlind;
+
+		snprintf(sBuf, sizeof(sBuf), "| %-32s | %8.1f | %8.1f | %+5.1f%% | %6.4f |%s\n", r.sName.c_str(), fBase, fCur, fDiff, fP,
+			bRowSlower ? " SLOWER" : bRowBlind ? " too few repetitions" : "");
+		sOut += sBuf;
+	}
+	printer::inst()->print_str(sOut.c_str());
+
+	if(bBlind)
+		printer::inst()->print_msg(L0, "Baseline: WARNING, rows with too few repetitions can't reach p < %.2f and are never slower, raise --bench-reps.", fAlpha);
+
+	if(bSlower)
+		printer::inst()->print_msg(L0, "Baseline: performance regression against %s.", sFile);
+	else
+		printer::inst()->print_msg(L0, "Baseline: no regression against %s.", sFile);
+	return !bSlower;
+}
+
+bool benchmark::save_baseline(const char* sFile)
+{
+	using namespace rapidjson;
+	std::string sText;
+	Document doc;
+	std::vector<const Value*> vResults;
+	if(read_file(sFile, sText) && !parse_store(sText, sFile, doc, vResults))
+		return false;
+
+	// Other hosts and kernels stay, a result of ours replaces the one before
+	std::string sOut = "{\n\t\"results\" : [\n";
+	for(const Value* r : vResults)
+	{
+		if(is_same_run(*r))
+			continue;
+
+		StringBuffer buf;
+		Writer<StringBuffer> writer(buf);
+		r->Accept(writer);
+		sOut += std::string("\t\t") + buf.GetString() + ",\n";
+	}
+	sOut += "\t\t" + json_result("\t\t") + "\n\t]\n}\n";
+
+	FILE* f = fopen(sFile, "wb");
+	if(f == nullptr || fwrite(sOut.data(), 1, sOut.size(), f) != sOut.size())
+	{
+		if(f != nullptr)
+			fclose(f);
+		printer::inst()->print_msg(L0, "Baseline: failed to write %s.", sFile);
+		return false;
+	}
+	fclose(f);
+
+	printer::inst()->print_msg(L0, "Baseline: result saved to %s.", sFile);
+	return true;
+}
+
+// Threads are matched by what they ran, not by their position in the config
+std::string benchmark::row_name(size_t i)
+{
+	char sBuf[96];
+	snprintf(sBuf, sizeof(sBuf), "thread %llu cpu %lld %s asm %d", int_port(oCfg.vThreads.empty() ? i : oCfg.vThreads[i]),
+		(long long)vThdCfg[i].iCpuAff, vThdCfg[i].bDoubleMode ? "double" : "single", vThdCfg[i].iAsmVersion);
+	return sBuf;
+}
+
+std::string benchmark::kernel_key()
+{
+	char sBuf[64];
+	snprintf(sBuf, sizeof(sBuf), "variant %d, %s aes, asm %d", iVariant, jconf::inst()->HaveHardwareAes() ? "hard" : "soft",
+		jconf::inst()->GetAsmVersion());
+	return sBuf;
+}
+
+std::string benchmark::json_latency(const latencyHist::merged& h)
+{
+	std::string sOut;
+	appendf(sOut, "\"latency_us\" : { \"p50\" : %.1f, \"p99\" : %.1f, \"p999\" : %.1f, \"max\" : %.1f, \"hashes\" : %llu }",
+		h.percentile(0.5) * fTickUsec, h.percentile(0.99) * fTickUsec, h.percentile(0.999) * fTickUsec, h.iMax * fTickUsec,
+		int_port(h.iCount));
+	return sOut;
+}
+
+// Nothing if the thread had no counters, otherwise the counters it had, each one per hash
+std::string benchmark::json_perf(size_t i)
+{
+	std::string sOut;
+	if(vPerfHashes[i] == 0)
+		return sOut;
+
+	sOut = ", \"perf_per_hash\" : { ";
+	bool bFirst = true;
+	for(size_t c = 0; c < perfCounters::counter_cnt; c++)
+	{
+		if(!vPerf[i].aHave[c])
+			continue;
+		appendf(sOut, "%s\"%s\" : %.2f", bFirst ? "" : ", ", perfCounters::name(perfCounters::counter(c)),
+			double(vPerf[i].aVal[c]) / vPerfHashes[i]);
+		bFirst = false;
+	}
+	sOut += " }";
+	return sOut;
+}
+
+// One result as a JSON object, every line but the first starts with sInd
+std::string benchmark::json_result(const char* sInd)
+{
+	std::string sOut = "{\n";
+	appendf(sOut, "%s\t\"host\" : { \"cpu\" : \"%s\", \"microcode\" : \"%s\", \"kernel\" : \"%s\", \"cpus\" : %u, \"thp\" : \"%s\", \"huge_pages\" : %llu, \"huge_pages_free\" : %llu, \"key\" : \"%s\" },\n",
+		sInd, oHost.sCpu.c_str(), oHost.sMicrocode.c_str(), oHost.sKernel.c_str(), oHost.iCpus, oHost.sThp.c_str(),
+		int_port(oHost.iHugePages), int_port(oHost.iHugeFree), oHost.key().c_str());
+	appendf(sOut, "%s\t\"kernel\" : \"%s\",\n%s\t\"variant\" : %d,\n%s\t\"asm_version\" : %d,\n%s\t\"aes\" : \"%s\",\n",
+		sInd, kernel_key().c_str(), sInd, iVariant, sInd, jconf::inst()->GetAsmVersion(), sInd, jconf::inst()->HaveHardwareAes() ? "hard" : "soft");
+	appendf(sOut, "%s\t\"blobs\" : %llu,\n%s\t\"warmup_sec\" : %llu,\n%s\t\"rep_sec\" : %llu,\n%s\t\"reps\" : %u,\n",
+		sInd, int_port(vBlobs.size()), sInd, int_port(oCfg.iWarmupSec), sInd, int_port(oCfg.iSeconds), sInd, oCfg.iReps);
+	appendf(sOut, "%s\t\"scratchpads\" : %llu,\n%s\t\"scratchpads_huge\" : %llu,\n%s\t\"energy_source\" : \"%s\",\n%s\t\"watts\" : %.2f,\n",
+		sInd, int_port(iCtx), sInd, int_port(iHugeCtx), sInd, energymeter::inst()->get_source_name(), sInd, fWatts);
+
+	auto append_stats = [&sOut](const std::vector<double>& vReps)
+	{
+		stats s = calc_stats(vReps);
+		appendf(sOut, "\"mean\" : %.2f, \"median\" : %.2f, \"stddev\" : %.2f, \"ci95\" : %.2f, \"reps\" : [", s.fMean, s.fMedian, s.fStdDev, s.fCi95);
+		for(size_t i = 0; i < vReps.size(); i++)
+			appendf(sOut, i == 0 ? "%.2f" : ", %.2f", vReps[i]);
+		sOut += "]";
+	};
+
+	appendf(sOut, "%s\t\"total\" : { ", sInd);
+	append_stats(vTotalReps);
+	appendf(sOut, ", %s },\n%s\t\"threads\" : [\n", json_latency(oTotalLat).c_str(), sInd);
+	for(size_t i = 0; i < vThreadReps.size(); i++)
+	{
+		appendf(sOut, "%s\t\t{ \"name\" : \"%s\", \"id\" : %llu, \"cpu\" : %lld, \"ways\" : %u, \"asm_version\" : %d, ",
+			sInd, row_name(i).c_str(), int_port(oCfg.vThreads.empty() ? i : oCfg.vThreads[i]), (long long)vThdCfg[i].iCpuAff,
+			vThdCfg[i].bDoubleMode ? 2 : 1, vThdCfg[i].iAsmVersion);
+		append_stats(vThreadReps[i]);
+		appendf(sOut, ", %s%s }%s\n", json_latency(vThreadLat[i]).c_str(), json_perf(i).c_str(), i + 1 < vThreadReps.size() ? "," : "");
+	}
+	appendf(sOut, "%s\t]\n%s}", sInd, sInd);
+	return sOut;
+}
+
+bool benchmark::write_json(const char* sOutFile)
+{
+	FILE* f = fopen(sOutFile, "w");
+	if(f == nullptr)
+		return false;
+
+	std::string sOut = json_result("") + "\n";
+	fwrite(sOut.data(), 1, sOut.size(), f);
+	return fclose(f) == 0;
+}
+
+bool benchmark::write_csv(const char* sOutFile)
+{
+	FILE* f = fopen(sOutFile, "w");
+	if(f == nullptr)
+		return false;
+
+	// One row per thread and one for the total, the host goes into every row so files can be concatenated
+	fprintf(f, "host_key,cpu,microcode,kernel,thp,variant,scratchpads,scratchpads_huge,thread,cpu_id,ways,asm_version,mean,median,stddev,ci95,p50_us,p99_us,p999_us,max_us,reps\n");
+	auto print_row = [this, f](const char* sThread, long long iCpu, uint32_t iWays, int iAsm, const std::vector<double>& vReps,
+		const latencyHist::merged& h)
+	{
+		stats s = calc_stats(vReps);
+		fprintf(f, "%s,%s,%s,%s,%s,%d,%llu,%llu,%s,%lld,%u,%d,%.2f,%.2f,%.2f,%.2f,", oHost.key().c_str(), oHost.sCpu.c_str(),
+			oHost.sMicrocode.c_str(), oHost.sKernel.c_str(), oHost.sThp.c_str(), iVariant, int_port(iCtx), int_port(iHugeCtx),
+			sThread, iCpu, iWays, iAsm, s.fMean, s.fMedian, s.fStdDev, s.fCi95);
+		fprintf(f, "%.1f,%.1f,%.1f,%.1f,", h.percentile(0.5) * fTickUsec, h.percentile(0.99) * fTickUsec,
+			h.percentile(0.999) * fTickUsec, h.iMax * fTickUsec);
+		for(size_t i = 0; i < vReps.size(); i++)
+			fprintf(f, i == 0 ? "%.2f" : " %.2f", vReps[i]);
+		fprintf(f, "\n");
+	};
+
+	for(size_t i = 0; i < vThreadReps.size(); i++)
+	{
+		std::string sId = std::to_string(oCfg.vThreads.empty() ? i : oCfg.vThreads[i]);
+		print_row(sId.c_str(), (long long)vThdCfg[i].iCpuAff, vThdCfg[i].bDoubleMode ? 2 : 1, vThdCfg[i].iAsmVersion, vThreadReps[i], vThreadLat[i]);
+	}
+	print_row("total", -1, 0, jconf::inst()->GetAsmVersion(), vTotalReps, oTotalLat);
+
+	return fclose(f) == 0;
+}
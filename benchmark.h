@@ -0,0 +1,83 @@
+#pragma once
+#include "jconf.h"
+#include "hostFingerprint.hpp"
+#include "latencyHist.hpp"
+#include "perfCounters.hpp"
+#include "rapidjson/fwd.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Runs the configured threads on a fixed job and reports the hashrate with its spread. After a
+// warmup the time is split into repetitions, each one gives a hashrate per thread, so the mean
+// comes with a median, a standard deviation and a 95% confidence interval. With a blob corpus
+// the repetitions go round the blobs. The results can be written as JSON or CSV together with
+// the host fingerprint, that's what makes runs on other machines or builds comparable.
+// A baseline store keeps one result per host and kernel. A run compared to it fails when the
+// Mann-Whitney test on the repetitions says the run is slower and the median lost more than the
+// threshold, for the total or any thread. Every run also reports the tail of the per-hash
+// latency (p50, p99, p99.9 and max) of every thread and of all of them together, and with
+// perf_counters set what the performance counters of every thread counted per hash.
+class benchmark
+{
+public:
+	struct bench_cfg
+	{
+		uint64_t iSeconds;     // of every repetition
+		uint64_t iWarmupSec;
+		uint32_t iReps;
+		int iVariant;          // -2 for the one of the config
+		const char* sBlobFile; // hex blobs, one per line, nullptr for the all zero one
+		std::vector<uint32_t> vThreads; // ids in cpu_threads_conf, empty for all of them
+		const char* sOutFile;  // .json or CSV, nullptr for the console only
+		const char* sBaseline; // store to compare the run to, nullptr for none
+		const char* sSaveBaseline; // store the run is saved to, nullptr for none
+		double fThreshold;     // percent the median may drop before a significant slowdown fails the run
+	};
+
+	struct stats
+	{
+		double fMean;
+		double fMedian;
+		double fStdDev;
+		double fCi95; // half width of the interval around the mean
+	};
+
+	static constexpr int iVariantConfig = -2;
+	static constexpr double fAlpha = 0.05;
+
+	static stats calc_stats(const std::vector<double>& vSamples);
+	static double mann_whitney_less(const std::vector<double>& a, const std::vector<double>& b);
+
+	bool run(const bench_cfg& cfg);
+
+private:
+	bool load_blobs(const char* sFile);
+	bool write_json(const char* sOutFile);
+	bool write_csv(const char* sOutFile);
+	std::string json_result(const char* sInd);
+	std::string json_latency(const latencyHist::merged& h);
+	std::string json_perf(size_t i);
+	std::string row_name(size_t i);
+	std::string kernel_key();
+	bool is_same_run(const rapidjson::Value& r);
+	bool compare_baseline(const char* sFile);
+	bool save_baseline(const char* sFile);
+
+	bench_cfg oCfg;
+	hostFingerprint oHost;
+	std::vector<std::vector<uint8_t>> vBlobs;
+	std::vector<jconf::thd_cfg> vThdCfg;
+	std::vector<std::vector<double>> vThreadReps; // H/s of every thread in every repetition
+	std::vector<double> vTotalReps;
+	std::vector<latencyHist::merged> vThreadLat; // TSC ticks of the hashes in the repetitions
+	latencyHist::merged oTotalLat;
+	double fTickUsec;
+	std::vector<perfCounters::sample> vPerf; // counted during the repetitions
+	std::vector<uint64_t> vPerfHashes;       // 0 if the thread has no counters
+	double fWatts;
+	uint64_t iCtx;
+	uint64_t iHugeCtx;
+	int iVariant;
+};
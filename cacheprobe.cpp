@@ -0,0 +1,211 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "cacheprobe.h"
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <mm_malloc.h>
+#include <sys/mman.h>
+#endif // _WIN32
+
+void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id);
+
+static inline uint64_t now_ns()
+{
+	using namespace std::chrono;
+	return time_point_cast<nanoseconds>(steady_clock::now()).time_since_epoch().count();
+}
+
+// Sattolo's shuffle makes a single cycle, so the chase visits every line before it repeats
+static double run_chase(uint8_t* pBuf, size_t iBytes, uint64_t iSteps, uint64_t iSeed)
+{
+	size_t iLines = iBytes / 64;
+	std::vector<uint32_t> vNext(iLines);
+	std::iota(vNext.begin(), vNext.end(), 0);
+
+	std::mt19937_64 rng(iSeed);
+	for(size_t i = iLines - 1; i > 0; i--)
+		std::swap(vNext[i], vNext[rng() % i]);
+
+	for(size_t i = 0; i < iLines; i++)
+		*(uint8_t**)(pBuf + i * 64) = pBuf + size_t(vNext[i]) * 64;
+
+	uint8_t* p = pBuf;
+	for(size_t i = 0; i < iLines; i++)
+		p = *(uint8_t**)p;
+
+	uint64_t iStart = now_ns();
+	for(uint64_t i = 0; i < iSteps; i++)
+		p = *(uint8_t**)p;
+	uint64_t iTime = now_ns() - iStart;
+
+	// Keeps the compiler from dropping the chase
+	if(p == nullptr)
+		printer::inst()->print_msg(L4, "Cache probe: chase ended at null.");
+
+	return double(iTime) / iSteps;
+}
+
+// Same shape as the CryptoNight main loop: read 16 bytes at an address made from the last
+// result, mix, write them back and take the next address from what we read
+static double run_cn(uint8_t* pBuf, size_t iBytes, uint64_t iSteps, uint64_t iSeed)
+{
+	uint64_t iSlots = iBytes / 16;
+	std::mt19937_64 rng(iSeed);
+	for(size_t i = 0; i < iBytes / 8; i++)
+		((uint64_t*)pBuf)[i] = rng();
+
+	uint64_t a = rng(), b = rng();
+	for(int pass = 0; pass < 2; pass++)
+	{
+		uint64_t iCnt = pass == 0 ? iSlots : iSteps;
+		uint64_t iStart = now_ns();
+		for(uint64_t i = 0; i < iCnt; i++)
+		{
+			uint64_t* p = (uint64_t*)(pBuf + (a % iSlots) * 16);
+			uint64_t c0 = p[0] ^ b;
+			uint64_t c1 = p[1] + a;
+			p[0] = a;
+			p[1] = b;
+			b = c0;
+			a = c0 * 0x9E3779B97F4A7C15ULL + c1;
+		}
+
+		if(pass == 1)
+			return double(now_ns() - iStart) / iSteps;
+	}
+	return 0.0;
+}
+
+cacheprobe::result cacheprobe::measure(const std::vector<uint32_t>& vCpus, size_t iReported)
+{
+	result res = { 0, 0, 0 };
+	size_t iThreads = std::max<size_t>(vCpus.size(), 1);
+
+	// From a quarter of the cache to four times it, in quarter octaves
+	size_t iFirst = std::max<size_t>(iReported / 4, 256 * 1024);
+	size_t iLast = std::min<size_t>(std::max<size_t>(iReported * 4, iFirst * 2), iMaxFootprint);
+	std::vector<sample> vSamples;
+	for(double f = double(iFirst); f <= double(iLast) * 1.001; f *= 1.189207115)
+		vSamples.push_back({ size_t(f) & ~size_t(4095), 0.0, 0.0 });
+
+	size_t iPerThread = (vSamples.back().iBytes / iThreads + 4095) & ~size_t(4095);
+	std::vector<uint8_t*> vBufs(iThreads, nullptr);
+	for(size_t i = 0; i < iThreads; i++)
+	{
+		vBufs[i] = (uint8_t*)_mm_malloc(iPerThread, 2 * 1024 * 1024);
+		if(vBufs[i] == nullptr)
+		{
+			printer::inst()->print_msg(L0, "Cache probe: failed to allocate %llu KB.", int_port(iPerThread / 1024));
+			for(uint8_t* p : vBufs)
+				_mm_free(p);
+			return res;
+		}
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+		// 4k pages would add TLB misses long before the cache runs out
+		madvise(vBufs[i], iPerThread, MADV_HUGEPAGE);
+#endif
+		memset(vBufs[i], 0, iPerThread);
+	}
+
+	for(sample& s : vSamples)
+	{
+		size_t iBytes = std::max<size_t>((s.iBytes / iThreads) & ~size_t(63), 4096);
+		std::vector<double> vChase(iThreads), vCn(iThreads);
+		std::vector<std::thread> vThds;
+		std::atomic<size_t> iPinned(0);
+
+		// Every core of the domain runs at once, so the footprint is shared the way the miner shares it
+		for(size_t i = 0; i < iThreads; i++)
+		{
+			vThds.emplace_back([&, i]() {
+				while(iPinned.load() < iThreads)
+					std::this_thread::yield();
+				vChase[i] = run_chase(vBufs[i], iBytes, iChaseSteps, i + 1);
+				vCn[i] = run_cn(vBufs[i], iBytes, iCnSteps, i + 1);
+			});
+
+			if(!vCpus.empty())
+				thd_setaffinity(vThds.back().native_handle(), vCpus[i]);
+			iPinned++;
+		}
+
+		for(std::thread& thd : vThds)
+			thd.join();
+
+		s.fChaseNs = *std::max_element(vChase.begin(), vChase.end());
+		s.fCnNs = *std::max_element(vCn.begin(), vCn.end());
+		printer::inst()->print_msg(L1, "Cache probe: %llu KB - chase %.1f ns, cn pattern %.1f ns",
+			int_port(s.iBytes / 1024), s.fChaseNs, s.fCnNs);
+	}
+
+	for(uint8_t* p : vBufs)
+		_mm_free(p);
+
+	res.iChaseBytes = find_cliff(vSamples, true);
+	res.iCnBytes = find_cliff(vSamples, false);
+	if(res.iChaseBytes != 0 && res.iCnBytes != 0)
+		res.iCapacity = std::min(res.iChaseBytes, res.iCnBytes);
+	else
+		res.iCapacity = std::max(res.iChaseBytes, res.iCnBytes);
+	return res;
+}
+
+// The cliff is where the latency has gone 35% of the way from the smallest footprint to
+// the memory latency at the biggest one. The smallest can still sit in L2, but L3 latency
+// is well below that mark on everything we know of.
+size_t cacheprobe::find_cliff(const std::vector<sample>& vSamples, bool bChase)
+{
+	auto lat = [bChase](const sample& s) { return bChase ? s.fChaseNs : s.fCnNs; };
+
+	double fLow = lat(vSamples.front());
+	double fHigh = lat(vSamples.back());
+
+	// No clear step - a VM with a made up cache size or a cache bigger than what we tried
+	if(vSamples.size() < 2 || fHigh < fLow * 1.3)
+		return 0;
+
+	double fLimit = fLow + (fHigh - fLow) * 0.35;
+	for(size_t i = 1; i < vSamples.size(); i++)
+	{
+		if(lat(vSamples[i]) < fLimit)
+			continue;
+
+		double f0 = lat(vSamples[i - 1]), f1 = lat(vSamples[i]);
+		double fPos = f1 > f0 ? (fLimit - f0) / (f1 - f0) : 0.0;
+		return vSamples[i - 1].iBytes + size_t(fPos * (vSamples[i].iBytes - vSamples[i - 1].iBytes));
+	}
+	return vSamples.back().iBytes;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Measures how much data a cache domain really holds. The reported sizes say nothing about
+// victim caches, non-inclusive L3s or an L3 split between chiplets, so we walk growing buffers
+// on every core of the domain at once and look for the footprint where the latency falls off
+// towards memory speed. Two patterns are used: a pointer chase for the plain load latency and
+// the CryptoNight access shape, a 16 byte read-modify-write at an address taken from the data.
+class cacheprobe
+{
+public:
+	struct result
+	{
+		size_t iChaseBytes;
+		size_t iCnBytes;
+		size_t iCapacity; // the smaller of the two, 0 if no cliff was found
+	};
+
+	// vCpus - one logical CPU per core of the domain, iReported - the cache size we were told about
+	result measure(const std::vector<uint32_t>& vCpus, size_t iReported);
+
+private:
+	static constexpr size_t iMaxFootprint = 256 * 1024 * 1024;
+	static constexpr uint64_t iChaseSteps = 1 << 20;
+	static constexpr uint64_t iCnSteps = 1 << 20;
+
+	struct sample
+	{
+		size_t iBytes;
+		double fChaseNs;
+		double fCnNs;
+	};
+
+	static size_t find_cliff(const std::vector<sample>& vSamples, bool bChase);
+};
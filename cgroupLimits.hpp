@@ -0,0 +1,280 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "console.h"
+
+#ifdef __linux__
+#include "sysfsTopology.hpp"
+#include <sys/stat.h>
+#endif
+
+// CPU and memory limits of the cgroup we run in (Linux, v2 or the v1 controllers). A container
+// sees every CPU and all memory of the host, but gets throttled past its CPU quota, can't run on
+// CPUs outside its cpuset and has its hugetlb mmaps fail (or worse, faults killed) past the
+// hugetlb limit. --cgroup-root reads the limits of another machine from a copy of its /sys/fs/cgroup.
+class cgroupLimits
+{
+public:
+	static std::string& root()
+	{
+		static std::string sRoot = "/sys/fs/cgroup";
+		return sRoot;
+	}
+
+	double fCpuQuota = 0.0;       // CPUs worth of time per period, 0 if unlimited
+	std::vector<uint32_t> vCpus;  // effective cpuset, empty if unknown
+	uint64_t iMemLimit = 0;       // bytes, 0 if unlimited
+	uint64_t iMemUsage = 0;
+	uint64_t iHugeLimit = 0;      // 2 MB hugetlb pages, bytes, 0 if unlimited
+	uint64_t iHugeUsage = 0;
+
+	// False if there is no cgroup file system at all
+	bool load()
+	{
+#ifndef __linux__
+		return false;
+#else
+		bV2 = isFile(root() + "/cgroup.controllers");
+		if(!bV2 && !isDir(root() + "/cpu") && !isDir(root() + "/memory"))
+			return false;
+
+		// Limits of the parents apply too, the tightest one wins
+		std::string sDir = dirOf("cpu");
+		for(std::string sUp = sDir; ; sUp = parentOf(sUp, "cpu"))
+		{
+			uint64_t iQuota = 0, iPeriod = 0;
+			if(bV2)
+			{
+				char sMax[32] = { 0 };
+				FILE* f = fopen((sUp + "/cpu.max").c_str(), "r");
+				if(f != nullptr)
+				{
+					unsigned long long iP = 0;
+					if(fscanf(f, "%31s %llu", sMax, &iP) == 2 && strcmp(sMax, "max") != 0)
+						iQuota = strtoull(sMax, nullptr, 10), iPeriod = iP;
+					fclose(f);
+				}
+			}
+			else
+			{
+				// -1 is no quota, which fails the unsigned read
+				readValue(sUp + "/cpu.cfs_quota_us", iQuota);
+				readValue(sUp + "/cpu.cfs_period_us", iPeriod);
+			}
+
+			if(iQuota != 0 && iPeriod != 0 && (fCpuQuota == 0.0 || double(iQuota) / iPeriod < fCpuQuota))
+				fCpuQuota = double(iQuota) / iPeriod;
+			if(sUp.size() <= controllerRoot("cpu").size())
+				break;
+		}
+
+		sDir = dirOf("memory");
+		readValue(sDir + (bV2 ? "/memory.current" : "/memory.usage_in_bytes"), iMemUsage);
+		for(std::string sUp = sDir; ; sUp = parentOf(sUp, "memory"))
+		{
+			uint64_t iVal = 0;
+			if(readValue(sUp + (bV2 ? "/memory.max" : "/memory.limit_in_bytes"), iVal) && iVal < iNoLimit &&
+				(iMemLimit == 0 || iVal < iMemLimit))
+				iMemLimit = iVal;
+			if(sUp.size() <= controllerRoot("memory").size())
+				break;
+		}
+
+		sDir = dirOf("hugetlb");
+		readValue(sDir + (bV2 ? "/hugetlb.2MB.current" : "/hugetlb.2MB.usage_in_bytes"), iHugeUsage);
+		for(std::string sUp = sDir; ; sUp = parentOf(sUp, "hugetlb"))
+		{
+			uint64_t iVal = 0;
+			if(readValue(sUp + (bV2 ? "/hugetlb.2MB.max" : "/hugetlb.2MB.limit_in_bytes"), iVal) && iVal < iNoLimit &&
+				(iHugeLimit == 0 || iVal < iHugeLimit))
+				iHugeLimit = iVal;
+			if(sUp.size() <= controllerRoot("hugetlb").size())
+				break;
+		}
+
+		sDir = dirOf("cpuset");
+		// A list we can't parse doesn't restrict us, half of one would
+		if(!sysfsTopology::readList(sDir + (bV2 ? "/cpuset.cpus.effective" : "/cpuset.effective_cpus"), vCpus))
+			vCpus.clear();
+		return true;
+#endif
+	}
+
+	bool hasCpu(uint32_t iCpu) const
+	{
+		if(vCpus.empty())
+			return true;
+		for(uint32_t cpu : vCpus)
+		{
+			if(cpu == iCpu)
+				return true;
+		}
+		return false;
+	}
+
+	bool isLimited() const { return fCpuQuota != 0.0 || iMemLimit != 0 || iHugeLimit != 0; }
+
+	// Scheduler periods so far and how many of them ran out of quota
+	bool readThrottling(uint64_t& iPeriods, uint64_t& iThrottled, double& fThrottledSec)
+	{
+#ifndef __linux__
+		return false;
+#else
+		FILE* f = fopen((dirOf("cpu") + "/cpu.stat").c_str(), "r");
+		if(f == nullptr)
+			return false;
+
+		char sLine[128];
+		unsigned long long iVal;
+		iPeriods = iThrottled = 0;
+		fThrottledSec = 0.0;
+		while(fgets(sLine, sizeof(sLine), f) != nullptr)
+		{
+			if(sscanf(sLine, "nr_periods %llu", &iVal) == 1)
+				iPeriods = iVal;
+			else if(sscanf(sLine, "nr_throttled %llu", &iVal) == 1)
+				iThrottled = iVal;
+			else if(sscanf(sLine, "throttled_usec %llu", &iVal) == 1)
+				fThrottledSec = iVal / 1000000.0;
+			else if(sscanf(sLine, "throttled_time %llu", &iVal) == 1)
+				fThrottledSec = iVal / 1000000000.0;
+		}
+		fclose(f);
+		return true;
+#endif
+	}
+
+	// Threads and scratchpads of iHashBytes the limits leave room for, out of iCpus logical CPUs.
+	// A thread beyond the quota only adds throttling, so the budget is the quota rounded down.
+	void plan(size_t iCpus, size_t iHashBytes, size_t& iMaxThreads, size_t& iMaxHashes)
+	{
+		iMaxThreads = iCpus;
+		iMaxHashes = size_t(-1);
+		if(fCpuQuota != 0.0 && iCpus > fCpuQuota)
+		{
+			iMaxThreads = std::min(iCpus, std::max<size_t>(size_t(fCpuQuota), 1));
+			printer::inst()->print_msg(L0, "Autoconf: cgroup CPU quota of %.2f CPUs, %llu threads would be throttled %.0f%% of the time, using %llu.",
+				fCpuQuota, int_port(iCpus), (1.0 - fCpuQuota / iCpus) * 100.0, int_port(iMaxThreads));
+		}
+
+		// Leave some room for everything else the miner needs
+		if(iMemLimit != 0)
+		{
+			uint64_t iRoom = iMemLimit > iMemUsage + iMemHeadroom ? iMemLimit - iMemUsage - iMemHeadroom : 0;
+			iMaxHashes = std::max<size_t>(size_t(iRoom / iHashBytes), 1);
+			printer::inst()->print_msg(L0, "Autoconf: cgroup memory limit of %llu MB, %llu MB in use, room for %llu scratchpads.",
+				int_port(iMemLimit >> 20), int_port(iMemUsage >> 20), int_port(iMaxHashes));
+		}
+
+		if(iHugeLimit != 0)
+		{
+			uint64_t iPages = iHugeLimit > iHugeUsage ? (iHugeLimit - iHugeUsage) / iHashBytes : 0;
+			printer::inst()->print_msg(L0, "Autoconf: cgroup hugetlb limit of %llu MB, scratchpads past the first %llu can't get huge pages.",
+				int_port(iHugeLimit >> 20), int_port(iPages));
+		}
+	}
+
+	// Hugetlb page allocations of iBytes the limit still has room for, size_t(-1) if we can't tell
+	static size_t hugetlbRoom(uint64_t iBytes)
+	{
+		cgroupLimits cg;
+		if(!cg.load() || cg.iHugeLimit == 0)
+			return size_t(-1);
+		return cg.iHugeLimit > cg.iHugeUsage ? size_t((cg.iHugeLimit - cg.iHugeUsage) / iBytes) : 0;
+	}
+
+private:
+	static constexpr uint64_t iNoLimit = uint64_t(1) << 60;
+	static constexpr uint64_t iMemHeadroom = 64 * 1024 * 1024;
+	bool bV2 = false;
+
+#ifdef __linux__
+	std::string controllerRoot(const char* sController)
+	{
+		return bV2 ? root() : root() + "/" + sController;
+	}
+
+	// Our group of the controller from /proc/self/cgroup. A cgroup namespace or a copy of
+	// the tree doesn't have that path, then the root is our group.
+	std::string dirOf(const char* sController)
+	{
+		std::string sBase = controllerRoot(sController);
+		FILE* f = fopen("/proc/self/cgroup", "r");
+		if(f == nullptr)
+			return sBase;
+
+		char sLine[512];
+		std::string sPath;
+		while(fgets(sLine, sizeof(sLine), f) != nullptr)
+		{
+			char* p1 = strchr(sLine, ':');
+			char* p2 = p1 != nullptr ? strchr(p1 + 1, ':') : nullptr;
+			if(p2 == nullptr)
+				continue;
+
+			*p2 = '\0';
+			std::string sList = p1 + 1;
+			bool bMatch = bV2 ? sList.empty() : false;
+			for(size_t pos = 0; !bV2 && pos <= sList.size(); )
+			{
+				size_t end = sList.find(',', pos);
+				if(end == std::string::npos)
+					end = sList.size();
+				bMatch |= sList.compare(pos, end - pos, sController) == 0;
+				pos = end + 1;
+			}
+
+			if(bMatch)
+			{
+				sPath = p2 + 1;
+				while(!sPath.empty() && (sPath.back() == '\n' || sPath.back() == '/'))
+					sPath.pop_back();
+			}
+		}
+		fclose(f);
+
+		return !sPath.empty() && isDir(sBase + sPath) ? sBase + sPath : sBase;
+	}
+
+	std::string parentOf(const std::string& sDir, const char* sController)
+	{
+		size_t pos = sDir.rfind('/');
+		std::string sBase = controllerRoot(sController);
+		return pos == std::string::npos || pos < sBase.size() ? sBase : sDir.substr(0, pos);
+	}
+
+	static bool isFile(const std::string& sPath)
+	{
+		struct stat st;
+		return stat(sPath.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	static bool isDir(const std::string& sPath)
+	{
+		struct stat st;
+		return stat(sPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+	// "max" and v1's -1 fail the read, both mean no limit
+	static bool readValue(const std::string& sFile, uint64_t& iOut)
+	{
+		FILE* f = fopen(sFile.c_str(), "r");
+		if(f == nullptr)
+			return false;
+
+		char sVal[32] = { 0 };
+		bool bOk = fscanf(f, "%31s", sVal) == 1 && sVal[0] >= '0' && sVal[0] <= '9';
+		fclose(f);
+		if(bOk)
+			iOut = strtoull(sVal, nullptr, 10);
+		return bOk;
+	}
+#endif // __linux__
+};
@@ -23,6 +23,13 @@
 
 #include "minethd.h"
 #include "jconf.h"
+#include "jobsim.h"
+#include "autotune.h"
+#include "sweep.h"
+#include "benchmark.h"
+#include "energy.h"
+#include "executor.h"
+#include "mockpool.h"
 #include "console.h"
 #include "donate-level.h"
 #ifndef CONF_NO_HWLOC
@@ -64,7 +71,97 @@ void win_exit()
 void win_exit() { return; }
 #endif // _WIN32
 
-void do_benchmark();
+bool do_benchmark(benchmark::bench_cfg& cfg);
+
+void print_usage(const char* sName)
+{
+	printf("Usage: %s [options]\n\n", sName);
+	printf("Without options the miner runs the self-test and mines on the configured pools.\n\n");
+	printf("  --benchmark           benchmark the configured threads instead, all --bench-*\n");
+	printf("                        options imply it\n");
+	printf("  --bench-time SECONDS  length of every repetition (default 12)\n");
+	printf("  --bench-warmup SECONDS  time before the first repetition (default 5)\n");
+	printf("  --bench-reps N        number of repetitions (default 5)\n");
+	printf("  --bench-variant N     cryptonight variant to run instead of the configured one\n");
+	printf("  --bench-blobs FILE    hex blobs, one per line, the repetitions go round them\n");
+	printf("  --bench-threads LIST  ids of the cpu_threads_conf entries to run, e.g. 0,2,3\n");
+	printf("  --bench-out FILE      write the statistics and the host fingerprint to FILE\n");
+	printf("                        (.json or CSV)\n");
+	printf("  --bench-baseline FILE compare to the result of this host and kernel in a baseline\n");
+	printf("                        store or --bench-out JSON file, exit with 1 if it is slower\n");
+	printf("  --bench-threshold PCT drop of the median a significant slowdown needs to fail the\n");
+	printf("                        comparison (default 2)\n");
+	printf("  --bench-save-baseline FILE  add the result to a baseline store, replacing the one of\n");
+	printf("                        this host and kernel, unless the comparison failed\n");
+	printf("  --autotune            measure thread layouts and kernels, then write the best one\n");
+	printf("                        to cpu_threads_conf and asm_version of config.txt\n");
+	printf("  --autotune-energy     as --autotune, but for the most hashes per joule, duty cycles\n");
+	printf("                        included\n");
+	printf("  --sweep FILE          measure the configured kernel on 1 to N threads in single and\n");
+	printf("                        double mode, write the scaling to FILE (.json or CSV)\n");
+	printf("  --sweep-time SECONDS  measuring time of every sweep step (default 10)\n");
+	printf("  --autoconf            print the suggested cpu_threads_conf and exit\n");
+	printf("  --cache-probe         size the autoconf suggestion by measured cache capacity,\n");
+	printf("                        --autotune always does this\n");
+#if defined(CONF_NO_HWLOC) && defined(__linux__)
+	printf("  --sysfs-root DIR      read the CPU topology and core types from a copy of /sys in DIR\n");
+#endif
+#ifdef __linux__
+	printf("  --powercap-root DIR   read the RAPL energy counters from a copy of /sys in DIR\n");
+	printf("  --cgroup-root DIR     read the cgroup limits from a copy of /sys/fs/cgroup in DIR\n");
+#endif
+	printf("\n");
+	printf("Job simulator:\n");
+	printf("  --replay FILE         replay a recorded job stream\n");
+	printf("  --simulate SECONDS    replay a synthetic job stream of the given length\n");
+	printf("  --job-interval MS     mean time between synthetic jobs (default 2000)\n");
+	printf("  --burst PCT LEN       chance of a burst of LEN clean jobs after a job (default 10 4)\n");
+	printf("  --stall PCT MS        chance of a pool outage of MS instead of a job (default 2 3000)\n");
+	printf("  --difficulty N        share difficulty of synthetic jobs (default 5000)\n");
+	printf("  --seed N              seed of the synthetic stream\n");
+	printf("  --record FILE         save the synthetic stream for later replays\n");
+	printf("  --split W0,W1,..      mine one synthetic stream per weight at the same time and\n");
+	printf("                        report how the hashes were shared (up to 4 weights)\n");
+	printf("  --partition           split by giving each job its own threads, not by time slices\n\n");
+	printf("Mock pool:\n");
+	printf("  --mock-pool PORT      run a local test pool instead of mining, uses --job-interval,\n");
+	printf("                        --difficulty and --seed from above\n");
+	printf("  --latency MS          delay everything the mock pool sends by MS (default 0)\n");
+	printf("  --duration SECONDS    stop the mock pool after SECONDS (default 0, run until killed)\n");
+}
+
+static bool parse_uint(int argc, char *argv[], int& i, uint64_t& iOut)
+{
+	if(i + 1 >= argc)
+		return false;
+
+	char* pEnd;
+	iOut = strtoull(argv[++i], &pEnd, 10);
+	return *pEnd == '\0';
+}
+
+static bool parse_uint_list(int argc, char *argv[], int& i, std::vector<uint32_t>& vOut)
+{
+	if(i + 1 >= argc)
+		return false;
+
+	vOut.clear();
+	const char* sList = argv[++i];
+	while(true)
+	{
+		char* pEnd;
+		unsigned long iVal = strtoul(sList, &pEnd, 10);
+		if(pEnd == sList || iVal > 0xFFFF)
+			return false;
+		vOut.push_back((uint32_t)iVal);
+
+		if(*pEnd == '\0')
+			return true;
+		if(*pEnd != ',')
+			return false;
+		sList = pEnd + 1;
+	}
+}
 
 int main(int argc, char *argv[])
 {
@@ -81,11 +178,220 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	minethd::self_test();
-	do_benchmark();
+	const char* sReplay = nullptr;
+	const char* sRecord = nullptr;
+	bool bSimulate = false;
+	bool bBenchmark = false;
+	bool bAutotune = false;
+	bool bAutotuneEnergy = false;
+	bool bAutoconf = false;
+	bool bCacheProbe = false;
+	const char* sSweep = nullptr;
+	uint64_t iSweepTime = 10;
+	bool bMockPool = false;
+	bool bPartition = false;
+	std::vector<uint32_t> vSplit;
+	benchmark::bench_cfg bench = { 12, 5, 5, benchmark::iVariantConfig, nullptr, {}, nullptr, nullptr, nullptr, 2.0 };
+	jobsim::synth_cfg synth = { 60, 2000, 10, 4, 2, 3000, 5000, (uint64_t)time(nullptr) };
+	mockpool::mock_cfg mock = { 3333, 0, 0, 0, 0, 0 };
+
+	for(int i = 1; i < argc; i++)
+	{
+		uint64_t iVal, iVal2;
+		bool bOk = true;
+
+		if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			sReplay = argv[++i];
+		else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			sRecord = argv[++i];
+		else if(strcmp(argv[i], "--simulate") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			bSimulate = true, synth.iSeconds = iVal;
+		else if(strcmp(argv[i], "--job-interval") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			synth.iMeanIntervalMs = iVal;
+		else if(strcmp(argv[i], "--burst") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && parse_uint(argc, argv, i, iVal2)))
+			synth.iBurstPct = (uint32_t)iVal, synth.iBurstLen = (uint32_t)iVal2;
+		else if(strcmp(argv[i], "--stall") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && parse_uint(argc, argv, i, iVal2)))
+			synth.iStallPct = (uint32_t)iVal, synth.iStallMs = iVal2;
+		else if(strcmp(argv[i], "--difficulty") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			synth.iDifficulty = iVal;
+		else if(strcmp(argv[i], "--seed") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			synth.iSeed = iVal;
+		else if(strcmp(argv[i], "--split") == 0)
+			bOk = parse_uint_list(argc, argv, i, vSplit);
+		else if(strcmp(argv[i], "--partition") == 0)
+			bPartition = true;
+		else if(strcmp(argv[i], "--benchmark") == 0)
+			bBenchmark = true;
+		else if(strcmp(argv[i], "--bench-time") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal > 0))
+			bBenchmark = true, bench.iSeconds = iVal;
+		else if(strcmp(argv[i], "--bench-warmup") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			bBenchmark = true, bench.iWarmupSec = iVal;
+		else if(strcmp(argv[i], "--bench-reps") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal > 0 && iVal <= 1000))
+			bBenchmark = true, bench.iReps = (uint32_t)iVal;
+		else if(strcmp(argv[i], "--bench-variant") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal < minethd::iVariantCnt))
+			bBenchmark = true, bench.iVariant = (int)iVal;
+		else if(strcmp(argv[i], "--bench-blobs") == 0 && i + 1 < argc)
+			bBenchmark = true, bench.sBlobFile = argv[++i];
+		else if(strcmp(argv[i], "--bench-threads") == 0)
+			bBenchmark = bOk = parse_uint_list(argc, argv, i, bench.vThreads);
+		else if(strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc)
+			bBenchmark = true, bench.sOutFile = argv[++i];
+		else if(strcmp(argv[i], "--bench-baseline") == 0 && i + 1 < argc)
+			bBenchmark = true, bench.sBaseline = argv[++i];
+		else if(strcmp(argv[i], "--bench-save-baseline") == 0 && i + 1 < argc)
+			bBenchmark = true, bench.sSaveBaseline = argv[++i];
+		else if(strcmp(argv[i], "--bench-threshold") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal <= 100))
+			bBenchmark = true, bench.fThreshold = double(iVal);
+		else if(strcmp(argv[i], "--autotune") == 0)
+			bAutotune = true;
+		else if(strcmp(argv[i], "--autotune-energy") == 0)
+			bAutotune = bAutotuneEnergy = true;
+		else if(strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+			sSweep = argv[++i];
+		else if(strcmp(argv[i], "--sweep-time") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal > 0))
+			iSweepTime = iVal;
+		else if(strcmp(argv[i], "--autoconf") == 0)
+			bAutoconf = true;
+		else if(strcmp(argv[i], "--cache-probe") == 0)
+			bCacheProbe = true;
+#if defined(CONF_NO_HWLOC) && defined(__linux__)
+		else if(strcmp(argv[i], "--sysfs-root") == 0 && i + 1 < argc)
+			sysfsTopology::root() = hybridCores::root() = argv[++i];
+#endif
+#ifdef __linux__
+		else if(strcmp(argv[i], "--powercap-root") == 0 && i + 1 < argc)
+			energymeter::root() = argv[++i];
+		else if(strcmp(argv[i], "--cgroup-root") == 0 && i + 1 < argc)
+			cgroupLimits::root() = argv[++i];
+#endif
+		else if(strcmp(argv[i], "--mock-pool") == 0 && (bOk = parse_uint(argc, argv, i, iVal) && iVal <= 0xFFFF))
+			bMockPool = true, mock.iPort = (uint16_t)iVal;
+		else if(strcmp(argv[i], "--latency") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			mock.iLatencyMs = iVal;
+		else if(strcmp(argv[i], "--duration") == 0 && (bOk = parse_uint(argc, argv, i, iVal)))
+			mock.iSeconds = iVal;
+		else
+			bOk = false;
+
+		if(!bOk)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// A kernel that hashes wrong only produces rejected shares, don't mine, tune or benchmark with it.
+	// The mock pool checks shares with the same kernels, and the self-test sets up their tables.
+	if(!minethd::self_test())
+	{
+		win_exit();
+		return 1;
+	}
+
+	if(bMockPool)
+	{
+		mock.iJobIntervalMs = synth.iMeanIntervalMs;
+		mock.iDifficulty = synth.iDifficulty;
+		mock.iSeed = synth.iSeed;
+		return mockpool().run(mock) ? 0 : 1;
+	}
+
+	if(energymeter::inst()->init(jconf::inst()->GetCpuTdp()) == energymeter::src_tdp)
+		printer::inst()->print_msg(L1, "No RAPL energy counters, power is estimated from cpu_tdp.");
+
+	if(bAutotune)
+	{
+		std::vector<autotune::cache_domain> vDomains;
+		if(!autoAdjust(true).getTopology(vDomains))
+		{
+			printer::inst()->print_msg(L0, "Autotune failed: couldn't detect the CPU topology.");
+			win_exit();
+			return 1;
+		}
+
+		bool bOk = autotune().run(vDomains, "config.txt", bAutotuneEnergy);
+		win_exit();
+		return bOk ? 0 : 1;
+	}
+
+	if(sSweep != nullptr)
+	{
+		std::vector<autotune::cache_domain> vDomains;
+		if(!autoAdjust().getTopology(vDomains))
+		{
+			printer::inst()->print_msg(L0, "Sweep failed: couldn't detect the CPU topology.");
+			win_exit();
+			return 1;
+		}
+
+		bool bOk = sweep().run(vDomains, sSweep, iSweepTime);
+		win_exit();
+		return bOk ? 0 : 1;
+	}
+
+	if(bAutoconf || jconf::inst()->NeedsAutoconf())
+	{
+		autoAdjust adjust(bCacheProbe);
+		adjust.printConfig();
+		win_exit();
+		return 0;
+	}
+
+	if(sReplay != nullptr || bSimulate)
+	{
+		jobsim sim;
+		if((!vSplit.empty() || bPartition) && !sim.set_split(vSplit.empty() ? std::vector<uint32_t>(1, 1) : vSplit, bPartition))
+			return 1;
+		if(sReplay != nullptr && !sim.load_stream(sReplay))
+			return 1;
+		if(sReplay == nullptr)
+			sim.make_synthetic(synth);
+		if(sRecord != nullptr && !sim.save_stream(sRecord))
+			return 1;
+		return sim.run() ? 0 : 1;
+	}
+
+	if(bBenchmark)
+	{
+		bool bOk = do_benchmark(bench);
 #ifndef PERFORMANCE_TUNING
-	win_exit();
+		win_exit();
+#endif
+		return bOk ? 0 : 1;
+	}
+
+#ifndef CONF_NO_TLS
+	SSL_library_init();
+	SSL_load_error_strings();
+	ERR_load_crypto_strings();
+	OpenSSL_add_all_digests();
+#endif
+
+#ifndef CONF_NO_HTTPD
+	if(jconf::inst()->GetHttpdPort() != 0)
+	{
+		if (!httpd::inst()->start_daemon())
+		{
+			win_exit();
+			return 0;
+		}
+	}
 #endif
+
+	// The duty cycle lets SMT siblings rest together, it needs to know which CPUs share a core,
+	// the watchdog which ones share a cache
+	std::vector<autotune::cache_domain> vDomains;
+	if(autoAdjust().getTopology(vDomains))
+	{
+		std::vector<std::vector<uint32_t>> vCores;
+		for(const autotune::cache_domain& dom : vDomains)
+			vCores.insert(vCores.end(), dom.vCores.begin(), dom.vCores.end());
+		minethd::set_core_map(vCores);
+		executor::inst()->set_topology(vDomains);
+	}
+
+	executor::inst()->ex_main();
+	win_exit();
 	return 0;
 }
 
@@ -93,12 +399,10 @@ int main(int argc, char *argv[])
 extern uint64_t min_cycles;
 #endif
 
-void do_benchmark()
+bool do_benchmark(benchmark::bench_cfg& cfg)
 {
-	int benchmark_time = 60;
-	using namespace std::chrono;
-
 #ifdef PERFORMANCE_TUNING
+	using namespace std::chrono;
 	uint64_t t1, t2;
 	t1 = time_point_cast<nanoseconds>(high_resolution_clock::now()).time_since_epoch().count();
 	uint64_t tsc1 = __rdtsc();
@@ -110,38 +414,14 @@ void do_benchmark()
 	} while (t2 - t1 < 1000000000);
 	double rdtsc_speed = static_cast<double>(tsc2 - tsc1) / (t2 - t1);
 	printer::inst()->print_msg(L0, "rdtsc speed: %.3f GHz", rdtsc_speed);
-	benchmark_time = 10;
+	cfg.iSeconds = std::min<uint64_t>(cfg.iSeconds, 2);
 	min_cycles = uint64_t(-1);
 #endif
 
-	using namespace std::chrono;
-	std::vector<minethd*>* pvThreads;
-
-	printer::inst()->print_msg(L0, "Running a %d second benchmark...", benchmark_time);
-
-	uint8_t work[76] = {0};
-	minethd::miner_work oWork = minethd::miner_work("", work, sizeof(work), 0, 0, false, 0);
-	pvThreads = minethd::thread_starter(oWork);
-
-	uint64_t iStartStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
-
-	std::this_thread::sleep_for(std::chrono::seconds(benchmark_time));
-
-	oWork = minethd::miner_work();
-	minethd::switch_work(oWork);
-
-	double fTotalHps = 0.0;
-	for (uint32_t i = 0; i < pvThreads->size(); i++)
-	{
-		double fHps = pvThreads->at(i)->iHashCount;
-		fHps /= (pvThreads->at(i)->iTimestamp - iStartStamp) / 1000.0;
-
-		printer::inst()->print_msg(L0, "Thread %u: %.1f H/S", i, fHps);
-		fTotalHps += fHps;
-	}
+	bool bOk = benchmark().run(cfg);
 
-	printer::inst()->print_msg(L0, "Total: %.1f H/S", fTotalHps);
 #ifdef PERFORMANCE_TUNING
 	printer::inst()->print_msg(L0, "%.2f ns per iteration", min_cycles / 524288.0 / rdtsc_speed);
 #endif
+	return bOk;
 }
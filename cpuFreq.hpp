@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <powrprof.h>
+#pragma comment(lib, "powrprof.lib")
+#endif
+
+// Current clock of every logical CPU. On x86 recent Linux kernels derive both scaling_cur_freq
+// and the "cpu MHz" of /proc/cpuinfo from APERF/MPERF over the last few milliseconds, so this is
+// the clock the core really ran at - AVX offsets and thermal or power throttling included.
+// VMs without cpufreq usually report the nominal clock only, which still tells threads apart
+// by hashrate per GHz but not by throttling.
+class cpuFreq
+{
+public:
+	// vMhz gets one entry per logical CPU up to its size, 0 where the clock is unknown
+	static void sample(std::vector<uint32_t>& vMhz)
+	{
+		std::fill(vMhz.begin(), vMhz.end(), 0);
+#if defined(__linux__)
+		bool bCpufreq = false;
+		for(size_t cpu = 0; cpu < vMhz.size(); cpu++)
+		{
+			char sFile[96];
+			unsigned long iKhz;
+			snprintf(sFile, sizeof(sFile), "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq", (unsigned int)cpu);
+			FILE* f = fopen(sFile, "r");
+			if(f == nullptr)
+				continue;
+			if(fscanf(f, "%lu", &iKhz) == 1)
+			{
+				vMhz[cpu] = uint32_t(iKhz / 1000);
+				bCpufreq = true;
+			}
+			fclose(f);
+		}
+
+		if(!bCpufreq)
+			readCpuinfo(vMhz);
+#elif defined(_WIN32)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		std::vector<PROCESSOR_POWER_INFORMATION> vInfo(info.dwNumberOfProcessors);
+		if(CallNtPowerInformation(ProcessorInformation, nullptr, 0, vInfo.data(),
+			ULONG(vInfo.size() * sizeof(PROCESSOR_POWER_INFORMATION))) != 0)
+			return;
+
+		for(const PROCESSOR_POWER_INFORMATION& cpu : vInfo)
+		{
+			if(cpu.Number < vMhz.size())
+				vMhz[cpu.Number] = cpu.CurrentMhz;
+		}
+#endif
+	}
+
+private:
+#if defined(__linux__)
+	static void readCpuinfo(std::vector<uint32_t>& vMhz)
+	{
+		FILE* f = fopen("/proc/cpuinfo", "r");
+		if(f == nullptr)
+			return;
+
+		char sLine[256];
+		unsigned int iCpu = 0;
+		double fMhz;
+		while(fgets(sLine, sizeof(sLine), f) != nullptr)
+		{
+			if(sscanf(sLine, "processor : %u", &iCpu) == 1)
+				continue;
+			if(sscanf(sLine, "cpu MHz : %lf", &fMhz) == 1 && iCpu < vMhz.size())
+				vMhz[iCpu] = uint32_t(fMhz);
+		}
+		fclose(f);
+	}
+#endif
+};
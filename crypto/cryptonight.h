@@ -9,6 +9,7 @@ extern "C" {
 #include <inttypes.h>
 
 #define MEMORY  2097152
+#define MEMORY_LITE  1048576
 
 typedef struct {
 	uint8_t hash_state[224]; // Need only 200, explicit align
@@ -151,12 +151,17 @@ static inline void aes_round(__m128i key, __m128i* x0, __m128i* x1, __m128i* x2,
 	*x7 = _mm_aesenc_si128(*x7, key);
 }
 
+// The state goes through memcpy, the callers keep it in __m128i arrays and with uint32_t
+// stores GCC is free to read the array before soft_aes_round wrote it
 static FORCEINLINE void soft_aesenc(void* __restrict ptr, const void* __restrict key, const uint32_t* __restrict t)
 {
-	uint32_t x0 = ((const uint32_t*)(ptr))[0];
-	uint32_t x1 = ((const uint32_t*)(ptr))[1];
-	uint32_t x2 = ((const uint32_t*)(ptr))[2];
-	uint32_t x3 = ((const uint32_t*)(ptr))[3];
+	uint32_t x[4], k[4];
+	memcpy(x, ptr, sizeof(x));
+	memcpy(k, key, sizeof(k));
+	uint32_t x0 = x[0];
+	uint32_t x1 = x[1];
+	uint32_t x2 = x[2];
+	uint32_t x3 = x[3];
 
 	uint32_t y0 = t[x0 & 0xff]; x0 >>= 8;
 	uint32_t y1 = t[x1 & 0xff]; x1 >>= 8;
@@ -181,10 +186,11 @@ static FORCEINLINE void soft_aesenc(void* __restrict ptr, const void* __restrict
 	y2 ^= t[x1];
 	y3 ^= t[x2];
 
-	((uint32_t*) ptr)[0] = y0 ^ ((uint32_t*) key)[0];
-	((uint32_t*) ptr)[1] = y1 ^ ((uint32_t*) key)[1];
-	((uint32_t*) ptr)[2] = y2 ^ ((uint32_t*) key)[2];
-	((uint32_t*) ptr)[3] = y3 ^ ((uint32_t*) key)[3];
+	x[0] = y0 ^ k[0];
+	x[1] = y1 ^ k[1];
+	x[2] = y2 ^ k[2];
+	x[3] = y3 ^ k[3];
+	memcpy(ptr, x, sizeof(x));
 }
 
 static FORCEINLINE __m128i soft_aesenc(const void* __restrict ptr, const __m128i key, const uint32_t* __restrict t)
@@ -457,9 +463,21 @@ extern uint64_t t1, t2;
 
 extern ALIGN(64) uint8_t variant1_table[256];
 
-template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT>
+// Scratchpad accesses of the main loop: the one at the AES step, the one at the multiplication and
+// (variant 2) the shuffle of the other three chunks of the 64 byte line. xmr-stak-trace passes a
+// tracer that records them, the default one is empty and leaves the kernels as they were.
+enum cn_trace_kind : uint32_t { cn_trace_aes, cn_trace_mul, cn_trace_shuffle };
+
+struct cn_no_trace
+{
+	static FORCEINLINE void access(uint32_t, cn_trace_kind, uint64_t) { }
+};
+
+template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT, typename TRACER = cn_no_trace>
 void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_ctx* ctx0)
 {
+	constexpr size_t MASK = (MEM - 1) & ~size_t(0xF);
+
 	keccak((const uint8_t *)input, len, ctx0->hash_state, 200);
 
 	// Optim - 99% time boundary
@@ -474,7 +492,7 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 	__m128i bx1 = _mm_set_epi64x(h0[9] ^ h0[11], h0[8] ^ h0[10]);
 
 	uint64_t idx0 = h0[0] ^ h0[4];
-	uint64_t idx1 = idx0 & 0x1FFFF0;
+	uint64_t idx1 = idx0 & MASK;
 
 	uint64_t tweak1_2;
 	__m128i division_result_xmm;
@@ -514,6 +532,7 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 	{
 		__m128i cx;
 		cx = _mm_load_si128((__m128i *)&l0[idx1]);
+		TRACER::access(0, cn_trace_aes, idx1);
 
 		const __m128i ax0 = _mm_set_epi64x(ah0, al0);
 		if(SOFT_AES)
@@ -523,6 +542,7 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 
 		if (VARIANT == 2)
 		{
+			TRACER::access(0, cn_trace_shuffle, idx1);
 			const __m128i chunk1 = _mm_load_si128((__m128i *)&l0[idx1 ^ 0x10]);
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l0[idx1 ^ 0x20]);
 			const __m128i chunk3 = _mm_load_si128((__m128i *)&l0[idx1 ^ 0x30]);
@@ -543,11 +563,12 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 		}
 
 		idx0 = _mm_cvtsi128_si64(cx);
-		idx1 = idx0 & 0x1FFFF0;
+		idx1 = idx0 & MASK;
 
 		uint64_t hi, lo, cl, ch;
 		cl = ((uint64_t*)&l0[idx1])[0];
 		ch = ((uint64_t*)&l0[idx1])[1];
+		TRACER::access(0, cn_trace_mul, idx1);
 
 		if (VARIANT == 2)
 		{
@@ -577,6 +598,7 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 		// Shuffle the other 3x16 byte chunks in the current 64-byte cache line
 		if (VARIANT == 2)
 		{
+			TRACER::access(0, cn_trace_shuffle, idx1);
 			const __m128i chunk1 = _mm_xor_si128(_mm_load_si128((__m128i *)&l0[idx1 ^ 0x10]), _mm_set_epi64x(lo, hi));
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l0[idx1 ^ 0x20]);
 			hi ^= ((uint64_t*)&l0[idx1 ^ 0x20])[0];
@@ -594,7 +616,7 @@ void cryptonight_hash(const void* input, size_t len, void* output, cryptonight_c
 		ah0 ^= ch;
 		al0 ^= cl;
 		idx0 = al0;
-		idx1 = idx0 & 0x1FFFF0;
+		idx1 = idx0 & MASK;
 
 		if (VARIANT == 2)
 		{
@@ -661,9 +683,11 @@ static FORCEINLINE void int_math_v2_double_hash(__m128i& division_result, __m128
 	sqrt_result = _mm_set_epi64x(r1, r0);
 }
 
-template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT>
+template<size_t ITERATIONS, size_t MEM, bool SOFT_AES, int VARIANT, typename TRACER = cn_no_trace>
 void cryptonight_double_hash(const void* input1, size_t len1, void* output1, const void* input2, size_t len2, void* output2, cryptonight_ctx* __restrict ctx0, cryptonight_ctx* __restrict ctx1)
 {
+	constexpr size_t MASK = (MEM - 1) & ~size_t(0xF);
+
 	keccak((const uint8_t *)input1, len1, ctx0->hash_state, 200);
 	keccak((const uint8_t *)input2, len2, ctx1->hash_state, 200);
 
@@ -687,8 +711,8 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 
 	uint64_t idx00 = h0[0] ^ h0[4];
 	uint64_t idx10 = h1[0] ^ h1[4];
-	uint64_t idx01 = idx00 & 0x1FFFF0;
-	uint64_t idx11 = idx10 & 0x1FFFF0;
+	uint64_t idx01 = idx00 & MASK;
+	uint64_t idx11 = idx10 & MASK;
 
 	uint64_t tweak1_2_0, tweak1_2_1;
 	__m128i division_result_xmm, sqrt_result_xmm;
@@ -719,6 +743,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 	for (size_t i = 0; i < ITERATIONS; i++)
 	{
 		__m128i cx0 = _mm_load_si128((__m128i *)&l0[idx01]);
+		TRACER::access(0, cn_trace_aes, idx01);
 		const __m128i ax0 = _mm_set_epi64x(axh0, axl0);
 		if (SOFT_AES)
 		{
@@ -731,6 +756,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 
 		if (VARIANT == 2)
 		{
+			TRACER::access(0, cn_trace_shuffle, idx01);
 			uint32_t k = idx01 ^ 0x10;
 			const __m128i chunk1 = _mm_load_si128((__m128i *)&l0[k]); k ^= 0x30;
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l0[k]);
@@ -752,9 +778,10 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 		}
 
 		idx00 = _mm_cvtsi128_si64(cx0);
-		idx01 = idx00 & 0x1FFFF0;
+		idx01 = idx00 & MASK;
 
 		__m128i cx1 = _mm_load_si128((__m128i *)&l1[idx11]);
+		TRACER::access(1, cn_trace_aes, idx11);
 		const __m128i ax1 = _mm_set_epi64x(axh1, axl1);
 		if (SOFT_AES)
 		{
@@ -767,6 +794,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 
 		if (VARIANT == 2)
 		{
+			TRACER::access(1, cn_trace_shuffle, idx11);
 			uint32_t k = idx11 ^ 0x10;
 			const __m128i chunk1 = _mm_load_si128((__m128i *)&l1[k]); k ^= 0x30;
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l1[k]);
@@ -788,11 +816,12 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 		}
 
 		idx10 = _mm_cvtsi128_si64(cx1);
-		idx11 = idx10 & 0x1FFFF0;
+		idx11 = idx10 & MASK;
 
 		uint64_t hi, lo, cl, ch;
 		cl = ((uint64_t*)&l0[idx01])[0];
 		ch = ((uint64_t*)&l0[idx01])[1];
+		TRACER::access(0, cn_trace_mul, idx01);
 
 		if (VARIANT == 2)
 		{
@@ -804,6 +833,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 
 		if (VARIANT == 2)
 		{
+			TRACER::access(0, cn_trace_shuffle, idx01);
 			uint32_t k = idx01 ^ 0x10;
 			const __m128i chunk1 = _mm_xor_si128(_mm_load_si128((__m128i *)&l0[k]), _mm_set_epi64x(lo, hi)); k ^= 0x30;
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l0[k]);
@@ -822,10 +852,11 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 		axh0 ^= ch;
 		axl0 ^= cl;
 		idx00 = axl0;
-		idx01 = idx00 & 0x1FFFF0;
+		idx01 = idx00 & MASK;
 
 		cl = ((uint64_t*)&l1[idx11])[0];
 		ch = ((uint64_t*)&l1[idx11])[1];
+		TRACER::access(1, cn_trace_mul, idx11);
 
 		if (VARIANT == 2)
 		{
@@ -838,6 +869,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 
 		if (VARIANT == 2)
 		{
+			TRACER::access(1, cn_trace_shuffle, idx11);
 			uint32_t k = idx11 ^ 0x10;
 			const __m128i chunk1 = _mm_xor_si128(_mm_load_si128((__m128i *)&l1[k]), _mm_set_epi64x(lo, hi)); k ^= 0x30;
 			const __m128i chunk2 = _mm_load_si128((__m128i *)&l1[k]);
@@ -857,7 +889,7 @@ void cryptonight_double_hash(const void* input1, size_t len1, void* output1, con
 		axh1 ^= ch;
 		axl1 ^= cl;
 		idx10 = axl1;
-		idx11 = idx10 & 0x1FFFF0;
+		idx11 = idx10 & MASK;
 
 		if (VARIANT == 2)
 		{
@@ -0,0 +1,167 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "energy.h"
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/resource.h>
+#endif
+
+energymeter* energymeter::oInst = nullptr;
+
+bool energymeter::read_uint64(const std::string& sFile, uint64_t& iOut)
+{
+	FILE* f = fopen(sFile.c_str(), "r");
+	if(f == nullptr)
+		return false;
+
+	unsigned long long iVal = 0;
+	bool bOk = fscanf(f, "%llu", &iVal) == 1;
+	fclose(f);
+	if(bOk)
+		iOut = iVal;
+	return bOk;
+}
+
+energymeter::source energymeter::init(double fTdpWatts)
+{
+	std::lock_guard<std::mutex> lck(mtx);
+	vZones.clear();
+	iSource = src_none;
+	this->fTdpWatts = fTdpWatts;
+
+#ifndef _WIN32
+	// Package zones are intel-rapl:N (AMD CPUs use the same driver), their
+	// subzones intel-rapl:N:M are parts of the package and already included
+	std::string sDir = root() + "/class/powercap";
+	DIR* dir = opendir(sDir.c_str());
+	if(dir != nullptr)
+	{
+		std::vector<std::string> vNames;
+		struct dirent* ent;
+		while((ent = readdir(dir)) != nullptr)
+		{
+			const char* p = strstr(ent->d_name, "-rapl:");
+			if(p != nullptr && strchr(p + 6, ':') == nullptr)
+				vNames.push_back(ent->d_name);
+		}
+		closedir(dir);
+		std::sort(vNames.begin(), vNames.end());
+
+		for(const std::string& sName : vNames)
+		{
+			std::string sZone = sDir + "/" + sName;
+			char sType[64] = { 0 };
+			FILE* f = fopen((sZone + "/name").c_str(), "r");
+			if(f == nullptr)
+				continue;
+			bool bPackage = fgets(sType, sizeof(sType), f) != nullptr && strncmp(sType, "package", 7) == 0;
+			fclose(f);
+
+			rapl_zone zone;
+			zone.sFile = sZone + "/energy_uj";
+			zone.iWraps = 0;
+			if(!bPackage || !read_uint64(zone.sFile, zone.iFirst) || !read_uint64(sZone + "/max_energy_range_uj", zone.iMaxRange))
+				continue;
+
+			zone.iLast = zone.iFirst;
+			vZones.push_back(zone);
+		}
+	}
+#endif
+
+	if(!vZones.empty())
+		iSource = src_rapl;
+	else if(fTdpWatts > 0.0)
+		iSource = src_tdp;
+
+	fCpuStart = process_cpu_sec();
+	return iSource;
+}
+
+const char* energymeter::get_source_name()
+{
+	switch(iSource)
+	{
+	case src_rapl:
+		return "rapl";
+	case src_tdp:
+		return "tdp estimate";
+	default:
+		return "none";
+	}
+}
+
+double energymeter::read_joules()
+{
+	std::lock_guard<std::mutex> lck(mtx);
+
+	if(iSource == src_tdp)
+	{
+		// The package draws its TDP with every CPU busy, we take our share of that
+		double fCpus = double(std::max<unsigned int>(std::thread::hardware_concurrency(), 1));
+		return fTdpWatts * (process_cpu_sec() - fCpuStart) / fCpus;
+	}
+
+	double fJoules = 0.0;
+	for(rapl_zone& zone : vZones)
+	{
+		uint64_t iVal;
+		if(read_uint64(zone.sFile, iVal))
+		{
+			// Counters wrap every few minutes under load, so this has to be called more often than that
+			if(iVal < zone.iLast)
+				zone.iWraps++;
+			zone.iLast = iVal;
+		}
+
+		fJoules += (zone.iWraps * (zone.iMaxRange + 1) + zone.iLast - zone.iFirst) / 1000000.0;
+	}
+	return fJoules;
+}
+
+double energymeter::process_cpu_sec()
+{
+#ifdef _WIN32
+	FILETIME ftCreate, ftExit, ftKernel, ftUser;
+	if(!GetProcessTimes(GetCurrentProcess(), &ftCreate, &ftExit, &ftKernel, &ftUser))
+		return 0.0;
+	uint64_t iKernel = (uint64_t(ftKernel.dwHighDateTime) << 32) | ftKernel.dwLowDateTime;
+	uint64_t iUser = (uint64_t(ftUser.dwHighDateTime) << 32) | ftUser.dwLowDateTime;
+	return (iKernel + iUser) / 10000000.0;
+#else
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0.0;
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+#endif
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Energy used by the CPU packages. Linux exposes the RAPL counters of Intel and AMD (Zen) CPUs
+// under class/powercap, the package zones are summed up. Without them the energy is estimated
+// from cpu_tdp and the CPU time of the process - good enough to compare layouts on one machine,
+// not to read a power bill from. --powercap-root moves root() to a copied /sys.
+class energymeter
+{
+public:
+	static energymeter* inst()
+	{
+		if (oInst == nullptr) oInst = new energymeter;
+		return oInst;
+	};
+
+	enum source { src_none, src_rapl, src_tdp };
+
+	static std::string& root()
+	{
+		static std::string sRoot = "/sys";
+		return sRoot;
+	}
+
+	// Looks for RAPL first, fTdpWatts 0 means no estimate
+	source init(double fTdpWatts);
+	source get_source() { return iSource; }
+	const char* get_source_name();
+
+	// Joules since init, thread safe
+	double read_joules();
+
+	// User and system time of the process so far
+	static double process_cpu_sec();
+
+private:
+	energymeter() : iSource(src_none), fTdpWatts(0.0), fCpuStart(0.0) {}
+	static energymeter* oInst;
+
+	struct rapl_zone
+	{
+		std::string sFile;
+		uint64_t iMaxRange; // the counter wraps at this value
+		uint64_t iFirst;
+		uint64_t iLast;
+		uint64_t iWraps;
+	};
+
+	static bool read_uint64(const std::string& sFile, uint64_t& iOut);
+
+	source iSource;
+	double fTdpWatts;
+	double fCpuStart;
+	std::vector<rapl_zone> vZones;
+	std::mutex mtx;
+};
@@ -0,0 +1,1315 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "executor.h"
+#include "jpsock.h"
+#include "minethd.h"
+#include "jconf.h"
+#include "energy.h"
+#include "console.h"
+#include "version.h"
+#include "webdesign.h"
+#include "hostPressure.hpp"
+#include "cpuFreq.hpp"
+#include "hostCpus.hpp"
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+executor* executor::oInst = nullptr;
+
+executor::executor() : fHighestHps(0.0), iTickCount(0), iNextTickUsec(0), pActivePool(nullptr),
+	pvThreads(nullptr), telem(nullptr), bWaysTrial(false), iWaysThread(0), iWaysStamp(0), fWaysBase(0.0),
+	iCoexistStart(0), iCoexistLast(0), iCoexistStamp(0), fTradedHashes(0.0), fParkedSec(0.0), fOthersAvg(0.0), iPowerStamp(0), fPowerJoules(0.0), fPowerWatts(NAN), iSubmitCnt(0), iSubmitDropped(0), bRunning(false)
+{
+}
+
+void executor::push_event(ex_event&& ev)
+{
+	if(!bRunning.load(std::memory_order_relaxed))
+		return;
+
+	std::unique_lock<std::mutex> lck(mEventLock);
+	vEvents.push_back(std::move(ev));
+	lck.unlock();
+	oPoller.wake();
+}
+
+void executor::get_http_report(ex_event_name ev_id, std::string& data)
+{
+	std::promise<std::string> oPromise;
+	std::future<std::string> oFuture = oPromise.get_future();
+
+	std::unique_lock<std::mutex> lck(mEventLock);
+	if(!bRunning.load(std::memory_order_relaxed))
+	{
+		data.clear();
+		return;
+	}
+
+	http_request req = { ev_id, &oPromise };
+	vHttpRequests.push_back(req);
+	lck.unlock();
+
+	oPoller.wake();
+	data = oFuture.get();
+}
+
+void executor::ex_main()
+{
+#ifndef _WIN32
+	// A pool closing the connection under our feet is reported by send, not by a signal
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	sock_init();
+
+	if(!oPoller.init())
+	{
+		printer::inst()->print_msg(L0, "Failed to set up the network event loop.");
+		return;
+	}
+
+	minethd::miner_work oWork;
+	pvThreads = minethd::thread_starter(oWork);
+	telem = new telemetry(pvThreads->size(), iTickTime);
+	int64_t iMaxCpu = -1;
+	for(minethd* thd : *pvThreads)
+		iMaxCpu = std::max(iMaxCpu, thd->get_affinity());
+	vClockMhz.assign(size_t(iMaxCpu + 1), 0);
+	vHealth.assign(pvThreads->size(), { 0.0, 0, false, -1, 0, iWatchdogHoldSec });
+	vPerf.assign(pvThreads->size(), perf_state());
+
+	bCgroupQuota = oCgroup.load() && oCgroup.fCpuQuota != 0.0 &&
+		oCgroup.readThrottling(iThrottleBasePeriods, iThrottleBaseCount, fThrottleBaseSec);
+	if(bCgroupQuota && pvThreads->size() > oCgroup.fCpuQuota)
+		printer::inst()->print_msg(L0, "WARNING: %llu threads on a cgroup CPU quota of %.2f CPUs, they will be throttled.",
+			int_port(pvThreads->size()), oCgroup.fCpuQuota);
+	vWaysNext.assign(pvThreads->size(), minethd::get_usec() + iWaysPeriodSec * 1000000);
+	vWaysPeriod.assign(pvThreads->size(), uint64_t(iWaysPeriodSec));
+	vParkHps.assign(pvThreads->size(), 0.0);
+	iCoexistStart = iCoexistLast = iCoexistStamp = minethd::get_usec();
+
+	jconf::pool_cfg cfg;
+	for(size_t i = 0; i < jconf::inst()->GetPoolCount(); i++)
+	{
+		jconf::inst()->GetPoolConfig(i, cfg);
+		pools.push_back(new jpsock(i, cfg, jconf::inst()->TlsSecureAlgos()));
+		vPollMask.push_back(0);
+	}
+
+	bRunning = true;
+	if(!jconf::inst()->DaemonMode())
+		std::thread(&executor::key_loop, this).detach();
+
+	sock_poller::event evs[sock_poller::iMaxEvents];
+	iNextTickUsec = minethd::get_usec();
+	while(true)
+	{
+		uint64_t iNow = minethd::get_usec();
+		int iTimeout = iNow >= iNextTickUsec ? 0 : int((iNextTickUsec - iNow + 999) / 1000);
+
+		int n = oPoller.wait(evs, iTimeout);
+		for(int i = 0; i < n; i++)
+		{
+			jpsock* pool = (jpsock*)evs[i].pData;
+			if(pool->on_sock_event(evs[i].iEvents))
+				update_poller(pool);
+			else
+				on_sock_error(pool);
+		}
+
+		process_events();
+
+		iNow = minethd::get_usec();
+		if(iNow >= iNextTickUsec)
+		{
+			iNextTickUsec = iNow + iTickTime * 1000;
+			on_timer(iNow);
+
+			uint64_t iGiveUp = jconf::inst()->GetGiveUpLimit();
+			bool bGiveUp = iGiveUp != 0;
+			for(jpsock* pool : pools)
+				bGiveUp = bGiveUp && pool->iFailCount >= iGiveUp;
+
+			if(bGiveUp)
+			{
+				printer::inst()->print_msg(L0, "Give up limit reached on every pool, exiting.");
+				break;
+			}
+		}
+
+		update_active_pool();
+	}
+
+	oWork = minethd::miner_work();
+	minethd::switch_work(oWork);
+
+	// Nobody fulfils a request queued after the last round, it gets the empty answer
+	// get_http_report gives once we stopped
+	std::vector<http_request> vReq;
+	std::unique_lock<std::mutex> lck(mEventLock);
+	bRunning = false;
+	vReq.swap(vHttpRequests);
+	lck.unlock();
+
+	for(http_request& req : vReq)
+		req.pResult->set_value(std::string());
+}
+
+void executor::update_poller(jpsock* pool)
+{
+	size_t id = pool->get_pool_id();
+	if(pool->get_socket() == INVALID_SOCKET)
+		return;
+
+	uint32_t iMask = sock_poller::ev_read | (pool->want_write() ? sock_poller::ev_write : sock_poller::ev_none);
+	if(iMask != vPollMask[id])
+	{
+		oPoller.modify(pool->get_socket(), pool, iMask);
+		vPollMask[id] = iMask;
+	}
+}
+
+void executor::on_sock_error(jpsock* pool)
+{
+	printer::inst()->print_msg(L1, "SOCKET ERROR - [%s] %s", pool->get_pool_addr(), pool->get_error());
+
+	if(pool->get_socket() != INVALID_SOCKET)
+		oPoller.remove(pool->get_socket());
+	vPollMask[pool->get_pool_id()] = 0;
+
+	pool->disconnect();
+	pool->iFailCount++;
+	pool->iRetryStamp = minethd::get_usec() + jconf::inst()->GetNetRetry() * 1000000;
+}
+
+void executor::on_timer(uint64_t iNowUsec)
+{
+	iTickCount++;
+
+	if(iTickCount % iClockTicks == 1)
+	{
+		cpuFreq::sample(vClockMhz);
+		minethd::calibrate_clock();
+	}
+
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		int64_t iCpu = pvThreads->at(i)->get_affinity();
+		telem->push_perf_value(i, pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed),
+			pvThreads->at(i)->iTimestamp.load(std::memory_order_relaxed),
+			iCpu >= 0 && size_t(iCpu) < vClockMhz.size() ? vClockMhz[iCpu] : 0);
+	}
+
+	adapt_ways(iNowUsec);
+	if(jconf::inst()->GetCoexistMode() >= jconf::coexist_park)
+		coexist_tick(iNowUsec);
+	if(jconf::inst()->ThreadWatchdog() && iTickCount % sec_to_ticks(iWatchdogCheckSec) == 0)
+		watchdog_tick(iNowUsec);
+	if(energymeter::inst()->get_source() != energymeter::src_none && iTickCount % sec_to_ticks(iPowerSec) == 0)
+		power_tick(iNowUsec);
+	if(jconf::inst()->PerfCounters() && iTickCount % sec_to_ticks(iPerfSec) == 0)
+		perf_tick();
+
+	uint64_t iGiveUp = jconf::inst()->GetGiveUpLimit();
+	uint64_t iTimeout = jconf::inst()->GetCallTimeout() * 1000000;
+	for(jpsock* pool : pools)
+	{
+		if(pool->get_state() == jpsock::net_disconnected)
+		{
+			if(iNowUsec < pool->iRetryStamp || (iGiveUp != 0 && pool->iFailCount >= iGiveUp))
+				continue;
+
+			printer::inst()->print_msg(L1, "Connecting to pool %s ...", pool->get_pool_addr());
+			if(!pool->connect())
+			{
+				on_sock_error(pool);
+				continue;
+			}
+
+			vPollMask[pool->get_pool_id()] = sock_poller::ev_read | sock_poller::ev_write;
+			oPoller.add(pool->get_socket(), pool, vPollMask[pool->get_pool_id()]);
+		}
+		else if(!pool->check_call_timeout(iNowUsec, iTimeout))
+			on_sock_error(pool);
+	}
+
+	uint64_t iPrintTime = jconf::inst()->GetAutohashTime();
+	if(jconf::inst()->GetVerboseLevel() >= 4 && iPrintTime != 0 && sec_to_ticks(iPrintTime) != 0 &&
+		iTickCount % sec_to_ticks(iPrintTime) == 0)
+	{
+		std::string out;
+		hashrate_report(out);
+		printer::inst()->print_str(out.c_str());
+	}
+}
+
+void executor::power_tick(uint64_t iNowUsec)
+{
+	double fJoules = energymeter::inst()->read_joules();
+	if(iPowerStamp != 0 && iNowUsec > iPowerStamp)
+		fPowerWatts = (fJoules - fPowerJoules) * 1000000.0 / (iNowUsec - iPowerStamp);
+	fPowerJoules = fJoules;
+	iPowerStamp = iNowUsec;
+}
+
+// Sum over all threads, NaN until every one of them has a full window of telemetry
+double executor::total_hps(size_t iWindowMs)
+{
+	double fTotal = 0.0;
+	for(size_t i = 0; i < pvThreads->size(); i++)
+		fTotal += telem->calc_telemetry_data(iWindowMs, i);
+	return fTotal;
+}
+
+void executor::adapt_ways(uint64_t iNowUsec)
+{
+	size_t iCnt = pvThreads->size();
+	if(!bWaysTrial)
+	{
+		if(iNowUsec < iWaysStamp)
+			return;
+
+		size_t iThd = iCnt;
+		for(size_t i = 0; i < iCnt && iThd == iCnt; i++)
+		{
+			size_t n = (iWaysThread + i) % iCnt;
+			if(pvThreads->at(n)->bAdaptive && iNowUsec >= vWaysNext[n])
+				iThd = n;
+		}
+
+		// No job or not enough history yet, try again on the next tick
+		double fHps = total_hps(iWaysWindowMs);
+		if(iThd == iCnt || !std::isnormal(fHps))
+			return;
+
+		minethd* thd = pvThreads->at(iThd);
+		thd->bDoubleMode = !thd->bDoubleMode;
+		fWaysBase = fHps;
+		iWaysThread = iThd;
+		iWaysStamp = iNowUsec;
+		bWaysTrial = true;
+		return;
+	}
+
+	if(iNowUsec - iWaysStamp < (iWaysSettleMs + iWaysWindowMs) * 1000)
+		return;
+
+	// The window starts after the settle time, so it only has hashes of the new mode
+	double fHps = total_hps(iWaysWindowMs);
+	minethd* thd = pvThreads->at(iWaysThread);
+	bool bKeep = std::isnormal(fHps) && fHps > fWaysBase * (1.0 + fWaysHysteresis);
+	const char* sMode = thd->bDoubleMode ? "double" : "single";
+
+	if(bKeep)
+	{
+		printer::inst()->print_msg(L1, "Thread %llu switched to %s mode, %.1f H/s -> %.1f H/s.",
+			int_port(iWaysThread), sMode, fWaysBase, fHps);
+		vWaysPeriod[iWaysThread] = iWaysPeriodSec;
+	}
+	else
+	{
+		printer::inst()->print_msg(L2, "Thread %llu stays out of %s mode, %.1f H/s -> %.1f H/s.",
+			int_port(iWaysThread), sMode, fWaysBase, fHps);
+		thd->bDoubleMode = !thd->bDoubleMode;
+		vWaysPeriod[iWaysThread] = std::min(vWaysPeriod[iWaysThread] * 2, uint64_t(iWaysMaxPeriodSec));
+	}
+
+	// Whatever happens next needs a baseline window without a trial in it
+	vWaysNext[iWaysThread] = iNowUsec + vWaysPeriod[iWaysThread] * 1000000;
+	iWaysStamp = iNowUsec + (iWaysSettleMs + iWaysWindowMs) * 1000;
+	iWaysThread = (iWaysThread + 1) % iCnt;
+	bWaysTrial = false;
+}
+
+void executor::coexist_tick(uint64_t iNowUsec)
+{
+	size_t iCnt = pvThreads->size();
+	size_t iActive = 0;
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		if(pvThreads->at(i)->bParked.load(std::memory_order_relaxed))
+		{
+			fParkedSec += (iNowUsec - iCoexistLast) / 1000000.0;
+			fTradedHashes += vParkHps[i] * (iNowUsec - iCoexistLast) / 1000000.0;
+		}
+		else
+			iActive++;
+	}
+	iCoexistLast = iNowUsec;
+
+	double fCpu = 0.0, fMem = 0.0;
+	uint32_t iRunning = 0;
+	hostPressure::readPsi("cpu", fCpu);
+	hostPressure::readPsi("memory", fMem);
+	bool bRunQueue = hostPressure::readRunQueue(iRunning);
+
+	// The run queue counts us too - this thread and the mining threads that aren't parked. A single
+	// sample is mostly noise, short lived tasks would park us all the time.
+	double fCpus = double(std::max<unsigned int>(std::thread::hardware_concurrency(), 1));
+	size_t iOthers = iRunning > iActive + 1 ? iRunning - iActive - 1 : 0;
+	fOthersAvg += (double(iOthers) - fOthersAvg) * 0.1;
+	bool bHigh = fCpu > fCoexistCpuHigh || fMem > fCoexistMemHigh || (bRunQueue && fOthersAvg + iActive > fCpus + 0.5);
+	bool bLow = fCpu < fCoexistCpuLow && fMem < fCoexistMemLow && (!bRunQueue || fOthersAvg + iActive + 1 <= fCpus + 0.25);
+
+	if(bHigh && iActive > 0 && iNowUsec - iCoexistStamp >= iCoexistParkMs * 1000)
+	{
+		size_t i = iCnt;
+		while(pvThreads->at(--i)->bParked.load(std::memory_order_relaxed)) {}
+
+		double fHps = telem->calc_telemetry_data(10000, i);
+		vParkHps[i] = std::isnormal(fHps) ? fHps : 0.0;
+		pvThreads->at(i)->bParked = true;
+		iCoexistStamp = iNowUsec;
+		printer::inst()->print_msg(L2, "Coexist: cpu pressure %.1f%%, memory %.1f%%, %.1f other runnable - parked thread %llu.",
+			fCpu, fMem, fOthersAvg, int_port(i));
+	}
+	else if(bLow && iActive < iCnt && iNowUsec - iCoexistStamp >= iCoexistUnparkMs * 1000)
+	{
+		size_t i = 0;
+		while(!pvThreads->at(i)->bParked.load(std::memory_order_relaxed))
+			i++;
+
+		pvThreads->at(i)->bParked = false;
+		iCoexistStamp = iNowUsec;
+		printer::inst()->print_msg(L2, "Coexist: cpu pressure %.1f%%, memory %.1f%%, %.1f other runnable - unparked thread %llu.",
+			fCpu, fMem, fOthersAvg, int_port(i));
+	}
+}
+
+// Least busy CPU near iFrom that no thread is pinned to - first in the same cache domain, then in
+// the same NUMA node. bIdleCore also wants the other PUs of its core free of our threads. On
+// hybrid CPUs the thread stays on its core type, its double mode and kernel were picked for it.
+int64_t executor::watchdog_target(uint32_t iFrom, bool bIdleCore)
+{
+	std::vector<bool> vUsed;
+	for(minethd* thd : *pvThreads)
+	{
+		int64_t iCpu = thd->get_affinity();
+		if(iCpu < 0)
+			continue;
+		if(size_t(iCpu) >= vUsed.size())
+			vUsed.resize(size_t(iCpu) + 1, false);
+		vUsed[iCpu] = true;
+	}
+	auto used = [&vUsed](uint32_t iCpu) { return iCpu < vUsed.size() && vUsed[iCpu]; };
+
+	const autotune::cache_domain* pHome = nullptr;
+	for(const autotune::cache_domain& dom : vDomains)
+	{
+		for(const std::vector<uint32_t>& core : dom.vCores)
+		{
+			if(std::find(core.begin(), core.end(), iFrom) != core.end())
+				pHome = &dom;
+		}
+	}
+
+	int32_t iNode = hostCpus::numaNode(iFrom);
+	bool bEff = is_eff_cpu(iFrom);
+	for(int pass = 0; pass < 2; pass++)
+	{
+		int64_t iBest = -1;
+		double fBestLoad = 2.0;
+		for(const autotune::cache_domain& dom : vDomains)
+		{
+			if((pass == 0) != (&dom == pHome))
+				continue;
+
+			for(size_t n = 0; n < dom.vCores.size(); n++)
+			{
+				const std::vector<uint32_t>& core = dom.vCores[n];
+				if((!dom.vEffCores.empty() && dom.vEffCores[n]) != bEff)
+					continue;
+
+				bool bCoreFree = true;
+				for(uint32_t cpu : core)
+					bCoreFree &= !used(cpu);
+				if(bIdleCore && !bCoreFree)
+					continue;
+
+				for(uint32_t cpu : core)
+				{
+					if(used(cpu) || cpu == iFrom || !hostCpus::isOnline(cpu))
+						continue;
+					if(pass == 1 && (iNode < 0 || hostCpus::numaNode(cpu) != iNode))
+						continue;
+
+					double fLoad = cpu < vCpuLoad.size() ? vCpuLoad[cpu] : -1.0;
+					if(bIdleCore && fLoad > fWatchdogIdle)
+						continue;
+					if(fLoad < fBestLoad)
+					{
+						iBest = cpu;
+						fBestLoad = fLoad;
+					}
+				}
+			}
+		}
+
+		if(iBest >= 0)
+			return iBest;
+	}
+	return -1;
+}
+
+bool executor::is_eff_cpu(int64_t iCpu)
+{
+	for(const autotune::cache_domain& dom : vDomains)
+	{
+		for(size_t n = 0; n < dom.vEffCores.size(); n++)
+		{
+			if(dom.vEffCores[n] && std::find(dom.vCores[n].begin(), dom.vCores[n].end(), iCpu) != dom.vCores[n].end())
+				return true;
+		}
+	}
+	return false;
+}
+
+void executor::watchdog_tick(uint64_t iNowUsec)
+{
+	std::vector<uint64_t> vBusy, vTotal;
+	vCpuLoad.clear();
+	if(hostCpus::readTimes(vBusy, vTotal))
+	{
+		vCpuLoad.assign(vBusy.size(), -1.0);
+		for(size_t i = 0; i < vBusy.size() && i < vCpuBusy.size(); i++)
+		{
+			if(vTotal[i] > vCpuTotal[i])
+				vCpuLoad[i] = double(vBusy[i] - vCpuBusy[i]) / (vTotal[i] - vCpuTotal[i]);
+		}
+		vCpuBusy.swap(vBusy);
+		vCpuTotal.swap(vTotal);
+	}
+
+	size_t iCnt = pvThreads->size();
+	std::vector<double> vHps(iCnt);
+	for(size_t i = 0; i < iCnt; i++)
+		vHps[i] = telem->calc_telemetry_data(iWatchdogWindowMs, i);
+
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		minethd* thd = pvThreads->at(i);
+		thd_health& h = vHealth[i];
+		int64_t iCpu = thd->get_affinity();
+		if(iCpu < 0)
+			continue;
+
+		// The kernel breaks the affinity of threads on an offline CPU, they would run anywhere
+		if(!hostCpus::isOnline(uint32_t(iCpu)))
+		{
+			int64_t iTo = watchdog_target(uint32_t(iCpu), false);
+			if(iTo < 0)
+			{
+				printer::inst()->print_msg(L1, "Watchdog: CPU %llu of thread %llu is offline and no free CPU is left, the thread runs unpinned.",
+					int_port(iCpu), int_port(i));
+				continue;
+			}
+
+			if(h.iHome < 0)
+				h.iHome = iCpu;
+			thd->repin(uint32_t(iTo));
+			h.iStrikes = 0;
+			h.iHoldUsec = iNowUsec + iWatchdogHoldSec * 1000000;
+			printer::inst()->print_msg(L0, "Watchdog: CPU %llu of thread %llu went offline, moved to CPU %llu.",
+				int_port(iCpu), int_port(i), int_port(iTo));
+			continue;
+		}
+
+		if(h.iHome >= 0 && h.iHome != iCpu && hostCpus::isOnline(uint32_t(h.iHome)))
+		{
+			bool bFree = true;
+			for(minethd* other : *pvThreads)
+				bFree &= other->get_affinity() != h.iHome;
+			if(bFree)
+			{
+				thd->repin(uint32_t(h.iHome));
+				h.iStrikes = 0;
+				h.iHoldUsec = iNowUsec + iWatchdogHoldSec * 1000000;
+				printer::inst()->print_msg(L0, "Watchdog: CPU %llu is online again, thread %llu moved back from CPU %llu.",
+					int_port(h.iHome), int_port(i), int_port(iCpu));
+				h.iHome = -1;
+				continue;
+			}
+		}
+
+		// Parked threads, a ways trial or a new mode - nothing to compare
+		bool bDouble = thd->bDoubleMode.load(std::memory_order_relaxed);
+		if(bDouble != h.bDoubleMode)
+		{
+			h.bDoubleMode = bDouble;
+			h.fBaseline = 0.0;
+			h.iStrikes = 0;
+			continue;
+		}
+		if(thd->bParked.load(std::memory_order_relaxed) || (bWaysTrial && iWaysThread == i) || !std::isnormal(vHps[i]))
+		{
+			h.iStrikes = 0;
+			continue;
+		}
+
+		// An E-core is no peer of a P-core
+		std::vector<double> vPeers;
+		bool bEff = is_eff_cpu(iCpu);
+		for(size_t n = 0; n < iCnt; n++)
+		{
+			if(n != i && std::isnormal(vHps[n]) && pvThreads->at(n)->bDoubleMode.load(std::memory_order_relaxed) == bDouble &&
+				is_eff_cpu(pvThreads->at(n)->get_affinity()) == bEff)
+				vPeers.push_back(vHps[n]);
+		}
+		std::sort(vPeers.begin(), vPeers.end());
+		double fPeers = vPeers.empty() ? 0.0 : vPeers[vPeers.size() / 2];
+
+		// Everybody slower is the job or the host, not this core - the baseline follows
+		bool bLagOwn = h.fBaseline > 0.0 && vHps[i] < h.fBaseline * fWatchdogLag;
+		bool bLagPeers = vPeers.empty() ? bLagOwn : vHps[i] < fPeers * fWatchdogLag;
+		if(!bLagOwn || !bLagPeers)
+		{
+			if(!bLagPeers)
+				h.fBaseline = h.fBaseline > 0.0 ? h.fBaseline + (vHps[i] - h.fBaseline) * 0.2 : vHps[i];
+			if(iNowUsec >= h.iHoldUsec + h.iHoldSec * 1000000)
+				h.iHoldSec = iWatchdogHoldSec;
+			h.iStrikes = 0;
+			continue;
+		}
+
+		if(iNowUsec < h.iHoldUsec || ++h.iStrikes < iWatchdogStrikes)
+			continue;
+
+		h.iStrikes = 0;
+		h.iHoldUsec = iNowUsec + h.iHoldSec * 1000000;
+		h.iHoldSec = std::min(h.iHoldSec * 2, uint64_t(iWatchdogMaxHoldSec));
+
+		int64_t iTo = watchdog_target(uint32_t(iCpu), true);
+		if(iTo < 0)
+		{
+			printer::inst()->print_msg(L1, "Watchdog: thread %llu at %.1f H/s (baseline %.1f, peers %.1f) but there is no idle core to move it to.",
+				int_port(i), vHps[i], h.fBaseline, fPeers);
+			continue;
+		}
+
+		thd->repin(uint32_t(iTo));
+		printer::inst()->print_msg(L0, "Watchdog: thread %llu at %.1f H/s (baseline %.1f, peers %.1f) - moved from CPU %llu to %llu.",
+			int_port(i), vHps[i], h.fBaseline, fPeers, int_port(iCpu), int_port(iTo));
+	}
+}
+
+void executor::update_active_pool()
+{
+	// The first pool in config order that can give us a job wins
+	jpsock* pNewPool = nullptr;
+	for(jpsock* pool : pools)
+	{
+		if(pool->is_ready() && pool->have_job())
+		{
+			pNewPool = pool;
+			break;
+		}
+	}
+
+	bool bSwitched = pNewPool != pActivePool;
+	if(bSwitched)
+	{
+		if(pNewPool != nullptr && pActivePool != nullptr)
+			printer::inst()->print_msg(L1, "Switching from pool %s to %s.", pActivePool->get_pool_addr(), pNewPool->get_pool_addr());
+		else if(pNewPool != nullptr)
+			printer::inst()->print_msg(L1, "Mining on pool %s.", pNewPool->get_pool_addr());
+		else
+			printer::inst()->print_msg(L1, "No pool has a job for us, mining stopped.");
+
+		pActivePool = pNewPool;
+	}
+
+	minethd::miner_work oWork;
+	if(pActivePool == nullptr)
+	{
+		if(bSwitched)
+			minethd::switch_work(oWork);
+		return;
+	}
+
+	if(!bSwitched && !pActivePool->have_new_job())
+		return;
+
+	pActivePool->get_job(oWork);
+	printer::inst()->print_msg(L3, "New block detected, difficulty %llu.", int_port(pActivePool->iJobDiff));
+	minethd::switch_work(oWork);
+}
+
+void executor::on_miner_result(size_t iPoolId, job_result& oResult)
+{
+	if(iPoolId >= pools.size() || !pools[iPoolId]->is_ready())
+	{
+		iSubmitDropped++;
+		printer::inst()->print_msg(L1, "Result dropped, the pool it was found for is not connected.");
+		return;
+	}
+
+	jpsock* pool = pools[iPoolId];
+	if(pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult))
+	{
+		iSubmitCnt++;
+		update_poller(pool);
+	}
+	else
+		on_sock_error(pool);
+}
+
+void executor::process_events()
+{
+	std::vector<ex_event> vEv;
+	std::vector<http_request> vReq;
+
+	std::unique_lock<std::mutex> lck(mEventLock);
+	vEv.swap(vEvents);
+	vReq.swap(vHttpRequests);
+	lck.unlock();
+
+	for(ex_event& ev : vEv)
+	{
+		std::string out;
+		switch(ev.iName)
+		{
+		case EV_MINER_HAVE_RESULT:
+			on_miner_result(ev.iPoolId, ev.oJobResult);
+			break;
+
+		case EV_USR_HASHRATE:
+			hashrate_report(out);
+			break;
+
+		case EV_USR_RESULTS:
+			result_report(out);
+			break;
+
+		case EV_USR_CONNSTAT:
+			connection_report(out);
+			break;
+
+		default:
+			break;
+		}
+
+		if(!out.empty())
+			printer::inst()->print_str(out.c_str());
+	}
+
+	for(http_request& req : vReq)
+	{
+		std::string out;
+		if(req.iName == EV_HTML_JSON)
+			json_report(out);
+		else
+			http_report(req.iName, out);
+		req.pResult->set_value(std::move(out));
+	}
+}
+
+void executor::key_loop()
+{
+	while(true)
+	{
+		int iKey = get_key();
+		switch(iKey)
+		{
+		case 'h':
+			push_event(ex_event(EV_USR_HASHRATE));
+			break;
+		case 'r':
+			push_event(ex_event(EV_USR_RESULTS));
+			break;
+		case 'c':
+			push_event(ex_event(EV_USR_CONNSTAT));
+			break;
+		case '+':
+		case '-':
+		{
+			int iPct = int(minethd::get_duty_cycle()) + (iKey == '+' ? 10 : -10);
+			iPct = std::min(std::max(iPct, 10), 100);
+			minethd::set_duty_cycle(uint32_t(iPct));
+			printer::inst()->print_msg(L0, "Duty cycle set to %d%%.", iPct);
+			break;
+		}
+		case EOF:
+			return; //No console to read from
+		default:
+			break;
+		}
+	}
+}
+
+inline const char* hps_format(double h, char* buf, size_t l)
+{
+	if(std::isnormal(h) || h == 0.0)
+	{
+		snprintf(buf, l, " %03.1f", h);
+		return buf;
+	}
+	else
+		return " (na)";
+}
+
+void executor::hashrate_report(std::string& out)
+{
+	char num[32];
+	size_t nthd = pvThreads->size();
+	double fTotal[3] = { 0.0 };
+
+	out.reserve(256 + nthd * 64);
+	out.append("HASHRATE REPORT\n");
+	out.append("| ID |  10s |  60s |  15m |\n");
+
+	for(size_t i = 0; i < nthd; i++)
+	{
+		double fHps[3];
+		fHps[0] = telem->calc_telemetry_data(10000, i);
+		fHps[1] = telem->calc_telemetry_data(60000, i);
+		fHps[2] = telem->calc_telemetry_data(900000, i);
+
+		snprintf(num, sizeof(num), "| %2u |", (unsigned int)i);
+		out.append(num);
+		for(size_t j = 0; j < 3; j++)
+		{
+			out.append(hps_format(fHps[j], num, sizeof(num)));
+			out.append(" |");
+			fTotal[j] += fHps[j];
+		}
+		out.append("\n");
+	}
+
+	if(std::isnormal(fTotal[0]) && fTotal[0] > fHighestHps)
+		fHighestHps = fTotal[0];
+
+	out.append("-----------------------------------------------------\n");
+	out.append("Totals:  ");
+	for(size_t j = 0; j < 3; j++)
+		out.append(hps_format(fTotal[j], num, sizeof(num)));
+	out.append(" H/s\nHighest: ");
+	out.append(hps_format(fHighestHps, num, sizeof(num)));
+	out.append(" H/s\n");
+
+	if(energymeter::inst()->get_source() != energymeter::src_none)
+	{
+		char buffer[128];
+		out.append("Power:   ");
+		out.append(hps_format(fPowerWatts, num, sizeof(num)));
+		out.append(" W   ");
+		// Both over the last 10 seconds
+		out.append(hps_format(fPowerWatts > 0.0 ? fTotal[0] / fPowerWatts : NAN, num, sizeof(num)));
+		snprintf(buffer, sizeof(buffer), " H/J (%s)\n", energymeter::inst()->get_source_name());
+		out.append(buffer);
+	}
+
+	if(jconf::inst()->GetCoexistMode() >= jconf::coexist_park)
+	{
+		char buffer[256];
+		size_t iParked = 0;
+		for(minethd* thd : *pvThreads)
+			iParked += thd->bParked.load(std::memory_order_relaxed) ? 1 : 0;
+
+		double fTime = (minethd::get_usec() - iCoexistStart) / 1000000.0;
+		snprintf(buffer, sizeof(buffer), "Coexist: %u of %u threads parked, %.1f%% of thread time, ~%.1f H/s given to the host\n",
+			(unsigned int)iParked, (unsigned int)nthd, fTime > 0.0 ? fParkedSec * 100.0 / fTime / nthd : 0.0,
+			fTime > 0.0 ? fTradedHashes / fTime : 0.0);
+		out.append(buffer);
+	}
+
+	uint64_t iPeriods, iThrottled;
+	double fThrottledSec;
+	if(bCgroupQuota && oCgroup.readThrottling(iPeriods, iThrottled, fThrottledSec) && iPeriods > iThrottleBasePeriods)
+	{
+		char buffer[192];
+		snprintf(buffer, sizeof(buffer), "Cgroup:  quota of %.2f CPUs, throttled in %.1f%% of the periods, %.1f s in total\n",
+			oCgroup.fCpuQuota, (iThrottled - iThrottleBaseCount) * 100.0 / (iPeriods - iThrottleBasePeriods),
+			fThrottledSec - fThrottleBaseSec);
+		out.append(buffer);
+	}
+
+	clock_report(out);
+	perf_report(out);
+}
+
+void executor::perf_tick()
+{
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		perf_state& p = vPerf[i];
+		perfCounters::sample oNow;
+		if(!pvThreads->at(i)->read_perf(oNow))
+		{
+			p.bLast = false;
+			p.iDeltaHashes = 0;
+			continue;
+		}
+
+		uint64_t iHashes = pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed);
+		if(p.bLast)
+		{
+			p.oDelta = perfCounters::delta(p.oLast, oNow);
+			p.iDeltaHashes = iHashes - p.iLastHashes;
+		}
+		p.oLast = oNow;
+		p.iLastHashes = iHashes;
+		p.bLast = true;
+	}
+}
+
+// Counts per hash with a k or M suffix, they range from a fraction to millions
+static void perf_format(std::string& out, const perfCounters::sample& d, perfCounters::counter c, uint64_t iHashes)
+{
+	char buf[32];
+	if(!d.aHave[c] || iHashes == 0)
+		snprintf(buf, sizeof(buf), " %7s |", "(na)");
+	else
+	{
+		double f = double(d.aVal[c]) / iHashes;
+		if(f >= 10000000.0)
+			snprintf(buf, sizeof(buf), " %6.0fM |", f / 1000000.0);
+		else if(f >= 10000.0)
+			snprintf(buf, sizeof(buf), " %6.0fk |", f / 1000.0);
+		else
+			snprintf(buf, sizeof(buf), " %7.2f |", f);
+	}
+	out.append(buf);
+}
+
+void executor::perf_report(std::string& out)
+{
+	bool bAny = false;
+	for(const perf_state& p : vPerf)
+		bAny |= p.iDeltaHashes != 0;
+	if(!bAny)
+		return;
+
+	static const perfCounters::counter aCols[] = { perfCounters::cycles, perfCounters::instructions, perfCounters::stalled_front,
+		perfCounters::stalled_back, perfCounters::l1d_miss, perfCounters::llc_miss, perfCounters::dtlb_miss, perfCounters::itlb_miss,
+		perfCounters::page_faults, perfCounters::ctx_switches };
+
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "PERF COUNTERS (per hash, %us)\n", (unsigned int)iPerfSec);
+	out.append(buffer);
+	out.append("| ID |  IPC |  cycles |   instr | stall F | stall B |     L1D |     LLC |    dTLB |    iTLB |  faults |     csw |\n");
+	for(size_t i = 0; i < vPerf.size(); i++)
+	{
+		const perf_state& p = vPerf[i];
+		const perfCounters::sample& d = p.oDelta;
+		bool bIpc = p.iDeltaHashes != 0 && d.aHave[perfCounters::cycles] && d.aHave[perfCounters::instructions] &&
+			d.aVal[perfCounters::cycles] != 0;
+		if(bIpc)
+			snprintf(buffer, sizeof(buffer), "| %2u | %4.2f |", (unsigned int)i,
+				double(d.aVal[perfCounters::instructions]) / d.aVal[perfCounters::cycles]);
+		else
+			snprintf(buffer, sizeof(buffer), "| %2u | (na) |", (unsigned int)i);
+		out.append(buffer);
+
+		for(perfCounters::counter c : aCols)
+			perf_format(out, d, c, p.iDeltaHashes);
+		out.append("\n");
+	}
+}
+
+// Cycles per hash at the clock the core really ran at. A thread slower than its peers at the same
+// clock loses to memory or to a busy sibling, one with a lower clock is throttled.
+void executor::clock_report(std::string& out)
+{
+	size_t nthd = pvThreads->size();
+	std::vector<double> vMhz(nthd), vHpg(nthd);
+	std::vector<bool> vEff(nthd);
+	bool bAny = false;
+	for(size_t i = 0; i < nthd; i++)
+	{
+		vMhz[i] = telem->calc_clock_mhz(60000, i);
+		double fHps = telem->calc_telemetry_data(60000, i);
+		vHpg[i] = std::isnormal(vMhz[i]) && std::isnormal(fHps) ? fHps * 1000.0 / vMhz[i] : nan("");
+		vEff[i] = is_eff_cpu(pvThreads->at(i)->get_affinity());
+		bAny |= std::isnormal(vMhz[i]);
+	}
+
+	if(!bAny)
+		return;
+
+	// The peers of a thread on a hybrid CPU are the ones on the same core type
+	auto median = [&vEff, nthd](const std::vector<double>& vVal, bool bEff, size_t& iPeers)
+	{
+		std::vector<double> vSorted;
+		for(size_t n = 0; n < nthd; n++)
+		{
+			if(vEff[n] == bEff && std::isnormal(vVal[n]))
+				vSorted.push_back(vVal[n]);
+		}
+		iPeers = vSorted.size();
+		std::sort(vSorted.begin(), vSorted.end());
+		return vSorted.empty() ? 0.0 : vSorted[vSorted.size() / 2];
+	};
+
+	char buffer[128];
+	bool bFlagged = false;
+	out.append("CLOCKS (60s)\n");
+	out.append("| ID |  MHz | H/s per GHz | Mcycles per hash |\n");
+	for(size_t i = 0; i < nthd; i++)
+	{
+		if(!std::isnormal(vMhz[i]))
+		{
+			snprintf(buffer, sizeof(buffer), "| %2u | (na) |        (na) |             (na) |\n", (unsigned int)i);
+			out.append(buffer);
+			continue;
+		}
+
+		snprintf(buffer, sizeof(buffer), "| %2u | %4.0f |", (unsigned int)i, vMhz[i]);
+		out.append(buffer);
+		if(std::isnormal(vHpg[i]))
+			snprintf(buffer, sizeof(buffer), " %11.2f | %16.1f |", vHpg[i], 1000.0 / vHpg[i]);
+		else
+			snprintf(buffer, sizeof(buffer), "        (na) |             (na) |");
+		out.append(buffer);
+
+		// Only with peers to compare to
+		size_t iMhzPeers, iHpgPeers;
+		double fMedianMhz = median(vMhz, vEff[i], iMhzPeers);
+		double fMedianHpg = median(vHpg, vEff[i], iHpgPeers);
+		if(iMhzPeers > 1 && vMhz[i] < fMedianMhz * (1.0 - fClockDeviation))
+		{
+			snprintf(buffer, sizeof(buffer), " clock %.0f%% below peers", (1.0 - vMhz[i] / fMedianMhz) * 100.0);
+			out.append(buffer);
+			bFlagged = true;
+		}
+		else if(iHpgPeers > 1 && std::isnormal(vHpg[i]) && vHpg[i] < fMedianHpg * (1.0 - fClockDeviation))
+		{
+			snprintf(buffer, sizeof(buffer), " %.0f%% less per GHz than peers", (1.0 - vHpg[i] / fMedianHpg) * 100.0);
+			out.append(buffer);
+			bFlagged = true;
+		}
+		out.append("\n");
+	}
+
+	if(bFlagged)
+		out.append("Clock below peers: throttled (heat, power or AVX). Less per GHz: memory or a busy sibling.\n");
+}
+
+void executor::result_report(std::string& out)
+{
+	char buffer[512];
+	uint64_t iGood = 0, iTotal = 0, iRttSum = 0, iRttCnt = 0, iRttMax = 0;
+
+	for(jpsock* pool : pools)
+	{
+		iGood += pool->iSharesGood;
+		iTotal += pool->iSharesGood + pool->iSharesBad;
+		iRttSum += pool->iRttSumUsec;
+		iRttCnt += pool->iRttCnt;
+		if(pool->iRttMaxUsec > iRttMax)
+			iRttMax = pool->iRttMaxUsec;
+	}
+
+	out.append("RESULT REPORT\n");
+	snprintf(buffer, sizeof(buffer), "Difficulty       : %llu\n", int_port(pActivePool != nullptr ? pActivePool->iJobDiff : 0));
+	out.append(buffer);
+	snprintf(buffer, sizeof(buffer), "Good results     : %llu / %llu (%.1f %%)\n", int_port(iGood), int_port(iTotal),
+		iTotal != 0 ? 100.0 * iGood / iTotal : 0.0);
+	out.append(buffer);
+	snprintf(buffer, sizeof(buffer), "Submitted        : %llu (%llu waiting for a reply, %llu dropped)\n",
+		int_port(iSubmitCnt), int_port(iSubmitCnt - iTotal), int_port(iSubmitDropped));
+	out.append(buffer);
+	snprintf(buffer, sizeof(buffer), "Submit round trip: %.1f ms avg, %.1f ms max\n",
+		iRttCnt != 0 ? iRttSum / 1000.0 / iRttCnt : 0.0, iRttMax / 1000.0);
+	out.append(buffer);
+
+	for(jpsock* pool : pools)
+	{
+		if(pool->sLastReject.empty())
+			continue;
+
+		snprintf(buffer, sizeof(buffer), "Last rejection   : [%s] %s\n", pool->get_pool_addr(), pool->sLastReject.c_str());
+		out.append(buffer);
+	}
+}
+
+void executor::connection_report(std::string& out)
+{
+	static const char* sStateNames[] = { "disconnected", "connecting", "TLS handshake", "logging in", "standby" };
+	char buffer[512];
+
+	out.append("CONNECTION REPORT\n");
+	for(jpsock* pool : pools)
+	{
+		const char* sState = pool == pActivePool ? "active" : sStateNames[pool->get_state()];
+		snprintf(buffer, sizeof(buffer), "Pool address    : %s (%s)\n", pool->get_pool_addr(), sState);
+		out.append(buffer);
+
+		if(pool->is_ready())
+		{
+			char sTime[32];
+			time_t stamp = (time_t)pool->iConnectStamp;
+			strftime(sTime, sizeof(sTime), "%F %T", localtime(&stamp));
+			snprintf(buffer, sizeof(buffer), "Connected since : %s\n", sTime);
+		}
+		else
+			snprintf(buffer, sizeof(buffer), "Connected since : <not connected>\n");
+		out.append(buffer);
+
+		snprintf(buffer, sizeof(buffer), "Pool ping time  : %.1f ms\n",
+			pool->iRttCnt != 0 ? pool->iRttSumUsec / 1000.0 / pool->iRttCnt : 0.0);
+		out.append(buffer);
+		snprintf(buffer, sizeof(buffer), "Jobs received   : %llu\n", int_port(pool->iJobCnt));
+		out.append(buffer);
+
+		if(pool->get_error()[0] != '\0')
+		{
+			snprintf(buffer, sizeof(buffer), "Last error      : %s\n", pool->get_error());
+			out.append(buffer);
+		}
+	}
+}
+
+static void append_escaped(std::string& out, const std::string& in, bool bJson)
+{
+	for(char c : in)
+	{
+		if(bJson && (c == '"' || c == '\\'))
+		{
+			out.push_back('\\');
+			out.push_back(c);
+		}
+		else if(bJson && (unsigned char)c < 0x20)
+			out.push_back(' ');
+		else if(!bJson && c == '<')
+			out.append("&lt;");
+		else if(!bJson && c == '>')
+			out.append("&gt;");
+		else if(!bJson && c == '&')
+			out.append("&amp;");
+		else
+			out.push_back(c);
+	}
+}
+
+void executor::http_report(ex_event_name ev_id, std::string& out)
+{
+	std::string sReport;
+	const char* sTitle;
+	char buffer[1024];
+
+	switch(ev_id)
+	{
+	case EV_HTML_HASHRATE:
+		sTitle = "Hashrate Report";
+		hashrate_report(sReport);
+		break;
+	case EV_HTML_RESULTS:
+		sTitle = "Result Report";
+		result_report(sReport);
+		break;
+	case EV_HTML_CONNSTAT:
+		sTitle = "Connection Report";
+		connection_report(sReport);
+		break;
+	default:
+		return;
+	}
+
+	snprintf(buffer, sizeof(buffer), sHtmlCommonHeader, sTitle);
+	out.append(buffer);
+	append_escaped(out, sReport, false);
+	out.append(sHtmlCommonFooter);
+}
+
+static inline void json_number(std::string& out, double f)
+{
+	char num[32];
+	if(std::isnormal(f) || f == 0.0)
+	{
+		snprintf(num, sizeof(num), "%.1f", f);
+		out.append(num);
+	}
+	else
+		out.append("null");
+}
+
+static void json_latency_entry(std::string& out, const char* sKernel, const latencyHist::merged& h, double fTickUsec)
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "\"kernel\":\"%s\",\"hashes\":%llu,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+		sKernel, int_port(h.iCount), h.percentile(0.5) * fTickUsec, h.percentile(0.99) * fTickUsec,
+		h.percentile(0.999) * fTickUsec, h.iMax * fTickUsec);
+	out.append(buffer);
+}
+
+void executor::json_latency(std::string& out)
+{
+	static const char* sProfiles[minethd::cn_profile_cnt] = { "cn", "cn-lite" };
+	double fTickUsec = minethd::tick_usec();
+	char buffer[64];
+
+	out.append("\"latency\":{\"unit\":\"us\",\"threads\":[");
+	std::string sKernels;
+	bool bFirst = true, bFirstKernel = true;
+	for(uint32_t p = 0; p < minethd::cn_profile_cnt; p++)
+	{
+		for(int v = 0; v < minethd::iVariantCnt; v++)
+		{
+			for(int w = 0; w < 2; w++)
+			{
+				char sKernel[32];
+				snprintf(sKernel, sizeof(sKernel), "%s v%d x%d", sProfiles[p], v, w + 1);
+
+				latencyHist::merged oKernel;
+				for(size_t i = 0; i < pvThreads->size(); i++)
+				{
+					latencyHist::merged h;
+					if(!pvThreads->at(i)->get_latency(minethd::cn_profile(p), v, w != 0, h))
+						continue;
+
+					snprintf(buffer, sizeof(buffer), "%s{\"thread\":%llu,", bFirst ? "" : ",", int_port(i));
+					out.append(buffer);
+					json_latency_entry(out, sKernel, h, fTickUsec);
+					oKernel.add(h);
+					bFirst = false;
+				}
+
+				if(oKernel.iCount == 0)
+					continue;
+				sKernels.append(bFirstKernel ? "{" : ",{");
+				json_latency_entry(sKernels, sKernel, oKernel, fTickUsec);
+				bFirstKernel = false;
+			}
+		}
+	}
+	out.append("],\"kernels\":[");
+	out.append(sKernels);
+	out.append("]}");
+}
+
+void executor::json_perf(std::string& out)
+{
+	char buffer[96];
+	snprintf(buffer, sizeof(buffer), "\"perf\":{\"window_sec\":%u,\"threads\":[", (unsigned int)iPerfSec);
+	out.append(buffer);
+	for(size_t i = 0; i < vPerf.size(); i++)
+	{
+		const perf_state& p = vPerf[i];
+		snprintf(buffer, sizeof(buffer), "%s{\"thread\":%llu,\"hashes\":%llu,\"per_hash\":{", i == 0 ? "" : ",",
+			int_port(i), int_port(p.iDeltaHashes));
+		out.append(buffer);
+		for(size_t c = 0; c < perfCounters::counter_cnt; c++)
+		{
+			snprintf(buffer, sizeof(buffer), "%s\"%s\":", c == 0 ? "" : ",", perfCounters::name(perfCounters::counter(c)));
+			out.append(buffer);
+			if(p.oDelta.aHave[c] && p.iDeltaHashes != 0)
+			{
+				snprintf(buffer, sizeof(buffer), "%.2f", double(p.oDelta.aVal[c]) / p.iDeltaHashes);
+				out.append(buffer);
+			}
+			else
+				out.append("null");
+		}
+		out.append("}}");
+	}
+	out.append("]}");
+}
+
+void executor::json_report(std::string& out)
+{
+	char buffer[512];
+	double fTotal[3] = { 0.0 };
+
+	out.append("{\"version\":\"" XMR_STAK_NAME "/" XMR_STAK_VERSION "\",\"hashrate\":{\"threads\":[");
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		out.append(i == 0 ? "[" : ",[");
+		for(size_t j = 0; j < 3; j++)
+		{
+			static const size_t iWindows[3] = { 10000, 60000, 900000 };
+			double fHps = telem->calc_telemetry_data(iWindows[j], i);
+			fTotal[j] += fHps;
+			if(j != 0)
+				out.append(",");
+			json_number(out, fHps);
+		}
+		out.append("]");
+	}
+
+	out.append("],\"total\":[");
+	for(size_t j = 0; j < 3; j++)
+	{
+		if(j != 0)
+			out.append(",");
+		json_number(out, fTotal[j]);
+	}
+	out.append("],\"highest\":");
+	json_number(out, fHighestHps);
+	out.append(",\"clocks_mhz\":[");
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		if(i != 0)
+			out.append(",");
+		json_number(out, telem->calc_clock_mhz(60000, i));
+	}
+	out.append("]");
+	out.append(",\"watts\":");
+	json_number(out, fPowerWatts);
+	out.append(",\"hps_per_joule\":");
+	json_number(out, fPowerWatts > 0.0 ? fTotal[0] / fPowerWatts : NAN);
+	out.append(",\"energy_source\":\"");
+	out.append(energymeter::inst()->get_source_name());
+	out.append("\"");
+
+	uint64_t iGood = 0, iTotal = 0;
+	for(jpsock* pool : pools)
+	{
+		iGood += pool->iSharesGood;
+		iTotal += pool->iSharesGood + pool->iSharesBad;
+	}
+
+	snprintf(buffer, sizeof(buffer), "},\"results\":{\"diff_current\":%llu,\"shares_good\":%llu,\"shares_total\":%llu,\"dropped\":%llu},\"connection\":[",
+		int_port(pActivePool != nullptr ? pActivePool->iJobDiff : 0), int_port(iGood), int_port(iTotal), int_port(iSubmitDropped));
+	out.append(buffer);
+
+	for(size_t i = 0; i < pools.size(); i++)
+	{
+		jpsock* pool = pools[i];
+		out.append(i == 0 ? "{\"pool\":\"" : ",{\"pool\":\"");
+		append_escaped(out, pool->get_pool_addr(), true);
+		snprintf(buffer, sizeof(buffer), "\",\"active\":%s,\"ready\":%s,\"ping\":%.1f,\"jobs\":%llu,\"error\":\"",
+			pool == pActivePool ? "true" : "false", pool->is_ready() ? "true" : "false",
+			pool->iRttCnt != 0 ? pool->iRttSumUsec / 1000.0 / pool->iRttCnt : 0.0, int_port(pool->iJobCnt));
+		out.append(buffer);
+		append_escaped(out, pool->get_error(), true);
+		out.append("\"}");
+	}
+	out.append("],");
+	json_latency(out);
+	if(jconf::inst()->PerfCounters())
+	{
+		out.append(",");
+		json_perf(out);
+	}
+	out.append("}");
+}
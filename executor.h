@@ -0,0 +1,192 @@
+#pragma once
+#include "msgstruct.h"
+#include "sockpoll.hpp"
+#include "autotune.h"
+#include "cgroupLimits.hpp"
+#include "perfCounters.hpp"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class jpsock;
+class minethd;
+class telemetry;
+
+/* The executor owns the network side of the miner. A single thread runs the event loop: it
+   drives every pool connection, hands the jobs to the mining threads and submits their results.
+   All configured pools stay connected - the first one (in config order) that has a job is the
+   one we mine for, the others are hot standby. Other threads only talk to us through push_event. */
+class executor
+{
+public:
+	static executor* inst()
+	{
+		if (oInst == nullptr) oInst = new executor;
+		return oInst;
+	};
+
+	// Cache domains of the host, the watchdog moves threads inside them
+	void set_topology(const std::vector<autotune::cache_domain>& vDomains) { this->vDomains = vDomains; }
+
+	// Starts the mining threads and runs the event loop, returns only if we gave up on every pool
+	void ex_main();
+
+	// Thread safe, events pushed before the loop is running are dropped
+	void push_event(ex_event&& ev);
+
+	// Called from the http daemon threads, the report itself is made by the event loop
+	void get_http_report(ex_event_name ev_id, std::string& data);
+
+private:
+	executor();
+	static executor* oInst;
+
+	struct http_request
+	{
+		ex_event_name iName;
+		std::promise<std::string>* pResult;
+	};
+
+	void on_sock_error(jpsock* pool);
+	void on_miner_result(size_t iPoolId, job_result& oResult);
+	void on_timer(uint64_t iNowUsec);
+	void adapt_ways(uint64_t iNowUsec);
+	void coexist_tick(uint64_t iNowUsec);
+	void power_tick(uint64_t iNowUsec);
+	void watchdog_tick(uint64_t iNowUsec);
+	int64_t watchdog_target(uint32_t iFrom, bool bIdleCore);
+	bool is_eff_cpu(int64_t iCpu);
+	double total_hps(size_t iWindowMs);
+	void update_active_pool();
+	void update_poller(jpsock* pool);
+	void process_events();
+	void key_loop();
+
+	inline size_t sec_to_ticks(size_t sec) { return (sec * 1000) / iTickTime; }
+
+	void hashrate_report(std::string& out);
+	void result_report(std::string& out);
+	void connection_report(std::string& out);
+	void http_report(ex_event_name ev_id, std::string& out);
+	void json_report(std::string& out);
+
+	double fHighestHps;
+
+	constexpr static size_t iTickTime = 500;
+	uint64_t iTickCount;
+	uint64_t iNextTickUsec;
+
+	sock_poller oPoller;
+	std::vector<jpsock*> pools;
+	std::vector<uint32_t> vPollMask; // events each pool socket is registered for
+	jpsock* pActivePool;
+	std::vector<minethd*>* pvThreads;
+	telemetry* telem;
+
+	// Adaptive ways - one thread at a time runs the other mode for a while, the switch is kept
+	// if the total hashrate (neighbours on the same cache included) went up by the hysteresis.
+	// A thread whose trial failed waits twice as long for the next one.
+	constexpr static uint64_t iWaysSettleMs = 5000;
+	constexpr static uint64_t iWaysWindowMs = 20000;
+	constexpr static uint64_t iWaysPeriodSec = 120;
+	constexpr static uint64_t iWaysMaxPeriodSec = 1920;
+	constexpr static double fWaysHysteresis = 0.03;
+	bool bWaysTrial;
+	size_t iWaysThread;   // thread on trial, or where the search for the next one starts
+	uint64_t iWaysStamp;  // start of the trial, or the earliest start of the next one
+	double fWaysBase;
+	std::vector<uint64_t> vWaysNext;   // per thread, earliest start of its next trial
+	std::vector<uint64_t> vWaysPeriod; // per thread, seconds between its trials
+
+	// Coexist mode - threads are parked from the end of the list while the host is under
+	// pressure and come back from the front once it calmed down. Unparking waits longer
+	// than parking, the PSI averages need a while to follow what we did.
+	constexpr static double fCoexistCpuHigh = 20.0; // PSI "some avg10", percent
+	constexpr static double fCoexistCpuLow = 5.0;
+	constexpr static double fCoexistMemHigh = 5.0;
+	constexpr static double fCoexistMemLow = 1.0;
+	constexpr static uint64_t iCoexistParkMs = 3000;
+	constexpr static uint64_t iCoexistUnparkMs = 15000;
+	uint64_t iCoexistStart;
+	uint64_t iCoexistLast;   // last tick, for the traded hashes
+	uint64_t iCoexistStamp;  // last park or unpark
+	double fTradedHashes;    // what the parked threads would have done at their last hashrate
+	double fParkedSec;       // thread seconds spent parked
+	double fOthersAvg;       // runnable tasks that aren't ours, averaged over a few seconds
+	std::vector<double> vParkHps;
+
+	// Clocks of the CPUs the threads are pinned to, sampled every few ticks and stored with the
+	// hash counters, so the hashrate per GHz of a thread can be compared to the others
+	constexpr static size_t iClockTicks = 4;
+	constexpr static double fClockDeviation = 0.1;
+	std::vector<uint32_t> vClockMhz; // per logical CPU
+	void clock_report(std::string& out);
+
+	// Per-hash latency of every thread and kernel for the JSON API, merged over the threads per kernel
+	void json_latency(std::string& out);
+
+	// Perf counters of every thread, read every iPerfSec with perf_counters set. The
+	// reports show what the last interval counted divided by the hashes of the interval.
+	constexpr static size_t iPerfSec = 10;
+	struct perf_state
+	{
+		perfCounters::sample oLast;
+		uint64_t iLastHashes;
+		bool bLast;
+		perfCounters::sample oDelta;
+		uint64_t iDeltaHashes; // 0 until the thread had a full interval
+	};
+	std::vector<perf_state> vPerf;
+	void perf_tick();
+	void perf_report(std::string& out);
+	void json_perf(std::string& out);
+
+	// Watchdog - a pinned thread that stays below fWatchdogLag of its own baseline and of the
+	// median of its peers for iWatchdogStrikes checks in a row is moved to the least busy idle
+	// core of its cache domain (or NUMA node). Every move doubles the time until the next one
+	// of that thread may happen, so a host without a better core doesn't get threads bouncing.
+	constexpr static uint64_t iWatchdogCheckSec = 10;
+	constexpr static size_t iWatchdogWindowMs = 20000;
+	constexpr static uint32_t iWatchdogStrikes = 3;
+	constexpr static double fWatchdogLag = 0.75;
+	constexpr static double fWatchdogIdle = 0.2;  // max share of a target CPU other tasks may use
+	constexpr static uint64_t iWatchdogHoldSec = 60;
+	constexpr static uint64_t iWatchdogMaxHoldSec = 1920;
+	struct thd_health
+	{
+		double fBaseline;   // EWMA of the hashrate while the thread was fine
+		uint32_t iStrikes;
+		bool bDoubleMode;   // mode the baseline was taken in
+		int64_t iHome;      // CPU the thread left because it went offline, -1 if none
+		uint64_t iHoldUsec; // no lag checks before this
+		uint64_t iHoldSec;
+	};
+	std::vector<autotune::cache_domain> vDomains;
+	std::vector<thd_health> vHealth;
+	std::vector<uint64_t> vCpuBusy, vCpuTotal; // host times at the last check
+	std::vector<double> vCpuLoad;              // busy share of every CPU since then, -1 unknown
+
+	// Throttling by the CPU quota of our cgroup since the start
+	cgroupLimits oCgroup;
+	bool bCgroupQuota;
+	uint64_t iThrottleBasePeriods;
+	uint64_t iThrottleBaseCount;
+	double fThrottleBaseSec;
+
+	// Power over the last interval, from the energy meter
+	constexpr static size_t iPowerSec = 10;
+	uint64_t iPowerStamp;
+	double fPowerJoules;
+	double fPowerWatts;      // NaN until the first interval is over
+
+	uint64_t iSubmitCnt;
+	uint64_t iSubmitDropped;
+
+	std::atomic<bool> bRunning;
+	std::mutex mEventLock;
+	std::vector<ex_event> vEvents;
+	std::vector<http_request> vHttpRequests;
+};
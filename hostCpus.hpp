@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+// State of the logical CPUs of the host as Linux reports it. Everything answers "don't know"
+// (online, node -1, no times) where the kernel has no such file, so callers fall back to what
+// they knew from the topology at start.
+class hostCpus
+{
+public:
+	// CPUs can be taken offline by hotplug, cpu0 often can't and has no online file
+	static bool isOnline(uint32_t iCpu)
+	{
+#ifdef __linux__
+		char sFile[96];
+		int iOnline = 1;
+		snprintf(sFile, sizeof(sFile), "/sys/devices/system/cpu/cpu%u/online", iCpu);
+		FILE* f = fopen(sFile, "r");
+		if(f == nullptr)
+			return true;
+		if(fscanf(f, "%d", &iOnline) != 1)
+			iOnline = 1;
+		fclose(f);
+		return iOnline != 0;
+#else
+		return true;
+#endif
+	}
+
+	// NUMA node of a CPU, -1 if unknown
+	static int32_t numaNode(uint32_t iCpu)
+	{
+#ifdef __linux__
+		char sDir[64];
+		snprintf(sDir, sizeof(sDir), "/sys/devices/system/cpu/cpu%u", iCpu);
+		DIR* dir = opendir(sDir);
+		if(dir == nullptr)
+			return -1;
+
+		int32_t iNode = -1;
+		struct dirent* ent;
+		while(iNode < 0 && (ent = readdir(dir)) != nullptr)
+		{
+			int iVal;
+			char cEnd;
+			if(sscanf(ent->d_name, "node%d%c", &iVal, &cEnd) == 1)
+				iNode = iVal;
+		}
+		closedir(dir);
+		return iNode;
+#else
+		return -1;
+#endif
+	}
+
+	// Busy and total time of every CPU since boot in ticks, index is the CPU number
+	static bool readTimes(std::vector<uint64_t>& vBusy, std::vector<uint64_t>& vTotal)
+	{
+#ifdef __linux__
+		FILE* f = fopen("/proc/stat", "r");
+		if(f == nullptr)
+			return false;
+
+		vBusy.clear();
+		vTotal.clear();
+		char sLine[512];
+		while(fgets(sLine, sizeof(sLine), f) != nullptr)
+		{
+			unsigned int iCpu;
+			unsigned long long t[8] = { 0 };
+			// The first line is the sum of all CPUs
+			if(strncmp(sLine, "cpu", 3) != 0 || sLine[3] < '0' || sLine[3] > '9' || sscanf(sLine, "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu", &iCpu,
+				&t[0], &t[1], &t[2], &t[3], &t[4], &t[5], &t[6], &t[7]) < 5)
+				continue;
+
+			if(iCpu >= vBusy.size())
+			{
+				vBusy.resize(iCpu + 1, 0);
+				vTotal.resize(iCpu + 1, 0);
+			}
+
+			// idle and iowait are the 4th and 5th field
+			uint64_t iTotal = 0;
+			for(unsigned long long v : t)
+				iTotal += v;
+			vTotal[iCpu] = iTotal;
+			vBusy[iCpu] = iTotal - t[3] - t[4];
+		}
+		fclose(f);
+		return !vBusy.empty();
+#else
+		return false;
+#endif
+	}
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "jconf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/utsname.h>
+#endif
+
+// What a benchmark result depends on besides the code - the CPU, its microcode, the kernel and
+// the huge pages the system had for us. Two results are only comparable with the same key.
+class hostFingerprint
+{
+public:
+	std::string sCpu;
+	std::string sMicrocode; // "unknown" where the OS doesn't tell
+	std::string sKernel;
+	std::string sThp;       // transparent huge page mode, "unknown" outside Linux
+	uint32_t iCpus;
+	uint64_t iHugePages;    // reserved 2 MB pages and the free ones at the time of collect()
+	uint64_t iHugeFree;
+
+	void collect()
+	{
+		int32_t cpu_info[4];
+		char sBrand[49] = {0};
+		jconf::cpuid(0x80000000, 0, cpu_info);
+		if(uint32_t(cpu_info[0]) >= 0x80000004)
+		{
+			for(uint32_t i = 0; i < 3; i++)
+			{
+				jconf::cpuid(0x80000002 + i, 0, cpu_info);
+				memcpy(sBrand + i * 16, cpu_info, 16);
+			}
+		}
+		sCpu = clean(sBrand);
+		iCpus = std::thread::hardware_concurrency();
+
+		sMicrocode = "unknown";
+		sKernel = "unknown";
+		sThp = "unknown";
+		iHugePages = iHugeFree = 0;
+
+#ifdef _WIN32
+		sKernel = "Windows";
+#else
+		struct utsname name;
+		if(uname(&name) == 0)
+			sKernel = std::string(name.sysname) + " " + name.release;
+#endif
+
+#ifdef __linux__
+		char sLine[256];
+		FILE* f = fopen("/proc/cpuinfo", "r");
+		if(f != nullptr)
+		{
+			while(fgets(sLine, sizeof(sLine), f) != nullptr)
+			{
+				const char* p = strchr(sLine, ':');
+				if(strncmp(sLine, "microcode", 9) == 0 && p != nullptr)
+				{
+					sMicrocode = clean(p + 1);
+					break;
+				}
+			}
+			fclose(f);
+		}
+
+		// "always [madvise] never" - the mode in use is the one in brackets
+		f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+		if(f != nullptr)
+		{
+			if(fgets(sLine, sizeof(sLine), f) != nullptr)
+			{
+				const char* p = strchr(sLine, '[');
+				const char* e = p != nullptr ? strchr(p, ']') : nullptr;
+				if(e != nullptr)
+					sThp = std::string(p + 1, e);
+			}
+			fclose(f);
+		}
+
+		f = fopen("/proc/meminfo", "r");
+		if(f != nullptr)
+		{
+			while(fgets(sLine, sizeof(sLine), f) != nullptr)
+			{
+				unsigned long long iVal;
+				if(sscanf(sLine, "HugePages_Total: %llu", &iVal) == 1)
+					iHugePages = iVal;
+				else if(sscanf(sLine, "HugePages_Free: %llu", &iVal) == 1)
+					iHugeFree = iVal;
+			}
+			fclose(f);
+		}
+#endif
+	}
+
+	// The parts that make results comparable, the free huge pages change from run to run
+	std::string key() const
+	{
+		return sCpu + "|" + sMicrocode + "|" + sKernel;
+	}
+
+private:
+	// Trimmed and without characters that would need quoting in JSON or CSV
+	static std::string clean(const char* s)
+	{
+		std::string sOut;
+		for(; *s != '\0'; s++)
+		{
+			if(*s == '"' || *s == '\\' || *s == ',' || *s == '|' || (unsigned char)*s < ' ')
+				continue;
+			if(*s == ' ' && (sOut.empty() || sOut.back() == ' '))
+				continue;
+			sOut += *s;
+		}
+		while(!sOut.empty() && sOut.back() == ' ')
+			sOut.pop_back();
+		return sOut;
+	}
+};
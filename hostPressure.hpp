@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// What the co-tenants of the host are asking for, as Linux reports it. PSI "some" is the share of
+// the last 10 seconds in which at least one task waited for the resource - with our threads on
+// SCHED_IDLE that is mostly us being pushed aside, which is exactly the signal to back off.
+// Everything returns false where the kernel has no such file (other systems, PSI disabled).
+class hostPressure
+{
+public:
+	// sResource is "cpu" or "memory", fSome10 the "some avg10" percentage
+	static bool readPsi(const char* sResource, double& fSome10)
+	{
+#ifdef __linux__
+		char sFile[64], sLine[256];
+		snprintf(sFile, sizeof(sFile), "/proc/pressure/%s", sResource);
+		FILE* f = fopen(sFile, "r");
+		if(f == nullptr)
+			return false;
+
+		bool bOk = false;
+		while(!bOk && fgets(sLine, sizeof(sLine), f) != nullptr)
+			bOk = sscanf(sLine, "some avg10=%lf", &fSome10) == 1;
+		fclose(f);
+		return bOk;
+#else
+		return false;
+#endif
+	}
+
+	// Runnable tasks on the whole host right now, ours included
+	static bool readRunQueue(uint32_t& iRunning)
+	{
+#ifdef __linux__
+		char sLine[256];
+		FILE* f = fopen("/proc/stat", "r");
+		if(f == nullptr)
+			return false;
+
+		bool bOk = false;
+		while(!bOk && fgets(sLine, sizeof(sLine), f) != nullptr)
+			bOk = sscanf(sLine, "procs_running %u", &iRunning) == 1;
+		fclose(f);
+		return bOk;
+#else
+		return false;
+#endif
+	}
+};
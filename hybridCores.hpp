@@ -0,0 +1,135 @@
+#pragma once
+
+#include "jconf.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include "sysfsTopology.hpp"
+#endif
+
+void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id);
+
+// Core types of hybrid CPUs (Alder Lake and later). The E-cores have a fraction of the L2 per
+// core of the P-cores and slower AES and division, so they get single hashes and their own
+// kernel. Linux lists the CPUs of each type as a PMU, cpu_core for the P-cores and cpu_atom for
+// the E-cores. Without those we ask cpuid leaf 0x1A, it answers for the core it runs on. The
+// root follows --sysfs-root together with sysfsTopology.
+class hybridCores
+{
+public:
+	enum core_type { core_unknown, core_perf, core_eff };
+
+	static std::string& root()
+	{
+		static std::string sRoot = "/sys";
+		return sRoot;
+	}
+
+	// vCpus - the CPUs cpuid gets asked on, false if the CPU isn't hybrid
+	bool load(const std::vector<uint32_t>& vCpus)
+	{
+		vTypes.clear();
+		sSource = "none";
+#ifdef __linux__
+		std::vector<uint32_t> vPerf, vEff;
+		if(sysfsTopology::readList(root() + "/devices/cpu_core/cpus", vPerf) &&
+			sysfsTopology::readList(root() + "/devices/cpu_atom/cpus", vEff))
+		{
+			for(uint32_t cpu : vPerf)
+				set(cpu, core_perf);
+			for(uint32_t cpu : vEff)
+				set(cpu, core_eff);
+			sSource = "sysfs";
+			return isHybrid();
+		}
+
+		// A copy of /sys is another machine, our cpuid says nothing about it
+		if(root() != "/sys")
+			return false;
+#endif
+		if(!cpuidHybrid())
+			return false;
+
+		for(uint32_t cpu : vCpus)
+		{
+			int32_t cpu_info[4] = { 0 };
+			std::atomic<bool> bPinned(false);
+			std::thread thd([&cpu_info, &bPinned]() {
+				while(!bPinned.load())
+					std::this_thread::yield();
+				jconf::cpuid(0x1A, 0, cpu_info);
+			});
+			thd_setaffinity(thd.native_handle(), cpu);
+			bPinned = true;
+			thd.join();
+
+			// EAX[31:24] - 0x20 is an Atom, 0x40 a Core
+			uint32_t iType = uint32_t(cpu_info[0]) >> 24;
+			set(cpu, iType == 0x40 ? core_perf : iType == 0x20 ? core_eff : core_unknown);
+		}
+		sSource = "cpuid";
+		return isHybrid();
+	}
+
+	core_type type(uint32_t cpu) const
+	{
+		return cpu < vTypes.size() ? core_type(vTypes[cpu]) : core_unknown;
+	}
+
+	// Both types were found, a hybrid CPU with all E-cores disabled is a plain one to us
+	bool isHybrid() const
+	{
+		bool bPerf = false, bEff = false;
+		for(uint8_t t : vTypes)
+		{
+			bPerf |= t == core_perf;
+			bEff |= t == core_eff;
+		}
+		return bPerf && bEff;
+	}
+
+	size_t count(core_type t) const
+	{
+		size_t n = 0;
+		for(uint8_t i : vTypes)
+			n += i == t ? 1 : 0;
+		return n;
+	}
+
+	const char* source() const { return sSource; }
+
+private:
+	std::vector<uint8_t> vTypes;
+	const char* sSource = "none";
+
+	void set(uint32_t cpu, core_type t)
+	{
+		if(cpu >= vTypes.size())
+			vTypes.resize(cpu + 1, core_unknown);
+		vTypes[cpu] = uint8_t(t);
+	}
+
+	// cpuid 7 EDX bit 15 is the hybrid flag, leaf 0x1A only means something with it
+	static bool cpuidHybrid()
+	{
+		int32_t cpu_info[4];
+		char cpustr[13] = {0};
+
+		jconf::cpuid(0, 0, cpu_info);
+		memcpy(cpustr, &cpu_info[1], 4);
+		memcpy(cpustr+4, &cpu_info[3], 4);
+		memcpy(cpustr+8, &cpu_info[2], 4);
+
+		if(strcmp(cpustr, "GenuineIntel") != 0 || cpu_info[0] < 0x1A)
+			return false;
+
+		jconf::cpuid(7, 0, cpu_info);
+		return (cpu_info[3] & (1 << 15)) != 0;
+	}
+};
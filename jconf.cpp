@@ -45,8 +45,8 @@ using namespace rapidjson;
 /*
  * This enum needs to match index in oConfigValues, otherwise we will get a runtime error
  */
-enum configEnum { aCpuThreadsConf, sUseSlowMem, bNiceHashMode, iVariant, iAsmVersion, bAesOverride,
-	bTlsMode, bTlsSecureAlgo, sTlsFingerprint, sPoolAddr, sWalletAddr, sPoolPwd,
+enum configEnum { aCpuThreadsConf, sUseSlowMem, sCoexistMode, iDutyCycle, bThreadWatchdog, bPerfCounters, fCpuTdp, bNiceHashMode, iVariant, iAsmVersion, bAesOverride,
+	bTlsMode, bTlsSecureAlgo, sTlsFingerprint, sPoolAddr, sWalletAddr, sPoolPwd, aFailoverPools,
 	iCallTimeout, iNetRetry, iGiveUpLimit, iVerboseLevel, iAutohashTime,
 	bDaemonMode, sOutputFile, iHttpdPort, bPreferIpv4 };
 
@@ -61,6 +61,11 @@ struct configVal {
 configVal oConfigValues[] = {
 	{ aCpuThreadsConf, "cpu_threads_conf", kNullType },
 	{ sUseSlowMem, "use_slow_memory", kStringType },
+	{ sCoexistMode, "coexist_mode", kStringType },
+	{ iDutyCycle, "duty_cycle", kNumberType },
+	{ bThreadWatchdog, "thread_watchdog", kTrueType },
+	{ bPerfCounters, "perf_counters", kTrueType },
+	{ fCpuTdp, "cpu_tdp", kNumberType },
 	{ bNiceHashMode, "nicehash_nonce", kTrueType },
 	{ iVariant, "variant", kNumberType },
 	{ iAsmVersion, "asm_version", kNumberType },
@@ -71,6 +76,7 @@ configVal oConfigValues[] = {
 	{ sPoolAddr, "pool_address", kStringType },
 	{ sWalletAddr, "wallet_address", kStringType },
 	{ sPoolPwd, "pool_password", kStringType },
+	{ aFailoverPools, "failover_pools", kArrayType },
 	{ iCallTimeout, "call_timeout", kNumberType },
 	{ iNetRetry, "retry_time", kNumberType },
 	{ iGiveUpLimit, "giveup_limit", kNumberType },
@@ -102,6 +108,8 @@ struct jconf::opaque_private
 {
 	Document jsonDoc;
 	const Value* configValues[iConfigCnt]; //Compile time constant
+	std::vector<jconf::thd_cfg> vThdOverride;
+	bool bThdOverride = false;
 
 	opaque_private()
 	{
@@ -115,8 +123,28 @@ jconf::jconf()
 	prv = new opaque_private();
 }
 
+void jconf::SetThreadConfig(const std::vector<thd_cfg>& vCfg)
+{
+	prv->vThdOverride = vCfg;
+	prv->bThdOverride = true;
+}
+
+void jconf::ClearThreadConfig()
+{
+	prv->vThdOverride.clear();
+	prv->bThdOverride = false;
+}
+
 bool jconf::GetThreadConfig(size_t id, thd_cfg &cfg)
 {
+	if(prv->bThdOverride)
+	{
+		if(id >= prv->vThdOverride.size())
+			return false;
+		cfg = prv->vThdOverride[id];
+		return true;
+	}
+
 	if(!prv->configValues[aCpuThreadsConf]->IsArray())
 		return false;
 
@@ -135,7 +163,7 @@ bool jconf::GetThreadConfig(size_t id, thd_cfg &cfg)
 	if(mode == nullptr || aff == nullptr)
 		return false;
 
-	if(!mode->IsBool())
+	if(!mode->IsBool() && !(mode->IsString() && strcasecmp(mode->GetString(), "auto") == 0))
 		return false;
 
 	if(!aff->IsNumber() && !aff->IsBool())
@@ -144,10 +172,21 @@ bool jconf::GetThreadConfig(size_t id, thd_cfg &cfg)
 	if(aff->IsNumber() && aff->GetInt64() < 0)
 		return false;
 
-	cfg.bDoubleMode = mode->GetBool();
+	// Adaptive threads start in single mode, the first trial happens once the hashrate settled
+	cfg.bAdaptive = mode->IsString();
+	cfg.bDoubleMode = mode->IsBool() && mode->GetBool();
 	cfg.iVariant = prv->configValues[iVariant]->GetInt();
 	cfg.iAsmVersion = prv->configValues[iAsmVersion]->GetInt();
 
+	// Hybrid CPUs can run another kernel on the E-cores than on the P-cores
+	const Value* asmv = GetObjectMember(oThdConf, "asm_version");
+	if(asmv != nullptr)
+	{
+		if(!asmv->IsInt() || asmv->GetInt() < 0 || asmv->GetInt() > 3)
+			return false;
+		cfg.iAsmVersion = asmv->GetInt();
+	}
+
 	if(aff->IsNumber())
 		cfg.iCpuAff = aff->GetInt64();
 	else
@@ -172,6 +211,42 @@ jconf::slow_mem_cfg jconf::GetSlowMemSetting()
 		return unknown_value;
 }
 
+jconf::coexist_cfg jconf::GetCoexistMode()
+{
+	const char* opt = prv->configValues[sCoexistMode]->GetString();
+
+	if(strcasecmp(opt, "off") == 0)
+		return coexist_off;
+	else if(strcasecmp(opt, "idle") == 0)
+		return coexist_idle;
+	else if(strcasecmp(opt, "park") == 0)
+		return coexist_park;
+	else if(strcasecmp(opt, "release") == 0)
+		return coexist_release;
+	else
+		return coexist_unknown;
+}
+
+uint32_t jconf::GetDutyCycle()
+{
+	return prv->configValues[iDutyCycle]->GetUint();
+}
+
+bool jconf::ThreadWatchdog()
+{
+	return prv->configValues[bThreadWatchdog]->GetBool();
+}
+
+bool jconf::PerfCounters()
+{
+	return prv->configValues[bPerfCounters]->GetBool();
+}
+
+double jconf::GetCpuTdp()
+{
+	return prv->configValues[fCpuTdp]->GetDouble();
+}
+
 bool jconf::GetTlsSetting()
 {
 	return prv->configValues[bTlsMode]->GetBool();
@@ -202,6 +277,62 @@ const char* jconf::GetWalletAddress()
 	return prv->configValues[sWalletAddr]->GetString();
 }
 
+size_t jconf::GetPoolCount()
+{
+	return prv->configValues[aFailoverPools]->Size() + 1;
+}
+
+bool jconf::GetPoolConfig(size_t id, pool_cfg& cfg)
+{
+	// Pool 0 is the main pool, failover entries fall back to its settings
+	cfg.sPoolAddr = GetPoolAddress();
+	cfg.sWalletAddr = GetWalletAddress();
+	cfg.sPoolPwd = GetPoolPwd();
+	cfg.bTlsMode = GetTlsSetting();
+	cfg.sTlsFingerprint = GetTlsFingerprint();
+
+	if(id == 0)
+		return true;
+
+	if(id >= GetPoolCount())
+		return false;
+
+	const Value& oPoolConf = prv->configValues[aFailoverPools]->GetArray()[id - 1];
+	if(!oPoolConf.IsObject())
+		return false;
+
+	const Value *addr, *wallet, *pwd, *tls, *fp;
+	addr = GetObjectMember(oPoolConf, "pool_address");
+	wallet = GetObjectMember(oPoolConf, "wallet_address");
+	pwd = GetObjectMember(oPoolConf, "pool_password");
+	tls = GetObjectMember(oPoolConf, "use_tls");
+	fp = GetObjectMember(oPoolConf, "tls_fingerprint");
+
+	if(addr == nullptr || !addr->IsString())
+		return false;
+	cfg.sPoolAddr = addr->GetString();
+
+	if(wallet != nullptr && !wallet->IsString())
+		return false;
+	if(pwd != nullptr && !pwd->IsString())
+		return false;
+	if(tls != nullptr && !tls->IsBool())
+		return false;
+	if(fp != nullptr && !fp->IsString())
+		return false;
+
+	if(wallet != nullptr)
+		cfg.sWalletAddr = wallet->GetString();
+	if(pwd != nullptr)
+		cfg.sPoolPwd = pwd->GetString();
+	if(tls != nullptr)
+		cfg.bTlsMode = tls->GetBool();
+	if(fp != nullptr)
+		cfg.sTlsFingerprint = fp->GetString();
+
+	return true;
+}
+
 bool jconf::PreferIpv4()
 {
 	return prv->configValues[bPreferIpv4]->GetBool();
@@ -209,6 +340,9 @@ bool jconf::PreferIpv4()
 
 size_t jconf::GetThreadCount()
 {
+	if(prv->bThdOverride)
+		return prv->vThdOverride.size();
+
 	if(prv->configValues[aCpuThreadsConf]->IsArray())
 		return prv->configValues[aCpuThreadsConf]->Size();
 	else
@@ -220,6 +354,16 @@ bool jconf::NeedsAutoconf()
 	return !prv->configValues[aCpuThreadsConf]->IsArray();
 }
 
+int jconf::GetVariant()
+{
+	return prv->configValues[iVariant]->GetInt();
+}
+
+int jconf::GetAsmVersion()
+{
+	return prv->configValues[iAsmVersion]->GetInt();
+}
+
 uint64_t jconf::GetCallTimeout()
 {
 	return prv->configValues[iCallTimeout]->GetUint64();
@@ -401,9 +545,9 @@ bool jconf::parse_config(const char* sFilename)
 		}
 	}
 
-	if(NiceHashMode() && GetThreadCount() >= 32)
+	if(!prv->configValues[iVariant]->IsInt() || GetVariant() < -1 || GetVariant() > 3)
 	{
-		printer::inst()->print_msg(L0, "You need to use less than 32 threads in NiceHash mode.");
+		printer::inst()->print_msg(L0, "Invalid config file. variant has to be in the range -1 to 3.");
 		return false;
 	}
 
@@ -414,6 +558,25 @@ bool jconf::parse_config(const char* sFilename)
 		return false;
 	}
 
+	if(GetCoexistMode() == coexist_unknown)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. coexist_mode must be \"off\", \"idle\", \"park\" or \"release\"");
+		return false;
+	}
+
+	if(!prv->configValues[iDutyCycle]->IsUint() || GetDutyCycle() < 1 || GetDutyCycle() > 100)
+	{
+		printer::inst()->print_msg(L0, "Invalid config file. duty_cycle has to be in the range 1 to 100.");
+		return false;
+	}
+
+	if(GetCpuTdp() < 0.0)
+	{
+		printer::inst()->print_msg(L0, "Invalid config file. cpu_tdp can't be negative.");
+		return false;
+	}
+
 	if(!prv->configValues[iCallTimeout]->IsUint64() ||
 		!prv->configValues[iNetRetry]->IsUint64() ||
 		!prv->configValues[iGiveUpLimit]->IsUint64())
@@ -437,14 +600,24 @@ bool jconf::parse_config(const char* sFilename)
 		return false;
 	}
 
-#ifdef CONF_NO_TLS
-	if(prv->configValues[bTlsMode]->GetBool())
+	pool_cfg pc;
+	for(size_t i=0; i < GetPoolCount(); i++)
 	{
-		printer::inst()->print_msg(L0,
-			"Invalid config file. TLS enabled while the application has been compiled without TLS support.");
-		return false;
-	}
+		if(!GetPoolConfig(i, pc))
+		{
+			printer::inst()->print_msg(L0, "Failover pool %llu has invalid config.", int_port(i));
+			return false;
+		}
+
+#ifdef CONF_NO_TLS
+		if(pc.bTlsMode)
+		{
+			printer::inst()->print_msg(L0,
+				"Invalid config file. TLS enabled while the application has been compiled without TLS support.");
+			return false;
+		}
 #endif // CONF_NO_TLS
+	}
 
 #ifdef _WIN32
 	if(GetSlowMemSetting() == no_mlck)
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdlib.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 class jconf
 {
@@ -15,6 +17,7 @@ public:
 
 	struct thd_cfg {
 		bool bDoubleMode;
+		bool bAdaptive; // low_power_mode "auto", the executor switches bDoubleMode at runtime
 		int iVariant;
 		int iAsmVersion;
 		long long iCpuAff;
@@ -28,11 +31,29 @@ public:
 		unknown_value
 	};
 
+	enum coexist_cfg {
+		coexist_off,
+		coexist_idle,
+		coexist_park,
+		coexist_release,
+		coexist_unknown
+	};
+
 	size_t GetThreadCount();
 	bool GetThreadConfig(size_t id, thd_cfg &cfg);
 	bool NeedsAutoconf();
+	// Replaces cpu_threads_conf for the following thread starts, the autotuner uses this to try layouts
+	void SetThreadConfig(const std::vector<thd_cfg>& vCfg);
+	void ClearThreadConfig();
+	int GetAsmVersion();
+	int GetVariant();
 
 	slow_mem_cfg GetSlowMemSetting();
+	coexist_cfg GetCoexistMode();
+	uint32_t GetDutyCycle();
+	bool ThreadWatchdog();
+	bool PerfCounters();
+	double GetCpuTdp();
 
 	bool GetTlsSetting();
 	bool TlsSecureAlgos();
@@ -42,6 +63,18 @@ public:
 	const char* GetPoolPwd();
 	const char* GetWalletAddress();
 
+	struct pool_cfg {
+		const char* sPoolAddr;
+		const char* sWalletAddr;
+		const char* sPoolPwd;
+		bool bTlsMode;
+		const char* sTlsFingerprint;
+	};
+
+	// Pool 0 is the main pool, the rest are the failover pools in config order
+	size_t GetPoolCount();
+	bool GetPoolConfig(size_t id, pool_cfg& cfg);
+
 	uint64_t GetVerboseLevel();
 	uint64_t GetAutohashTime();
 
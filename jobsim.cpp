@@ -0,0 +1,413 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "jobsim.h"
+#include "minethd.h"
+#include "jconf.h"
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+static bool hex2bin(const std::string& sHex, std::vector<uint8_t>& vOut)
+{
+	if(sHex.size() % 2 != 0)
+		return false;
+
+	vOut.clear();
+	for(size_t i = 0; i < sHex.size(); i += 2)
+	{
+		char* pEnd;
+		std::string sByte = sHex.substr(i, 2);
+		unsigned long iByte = strtoul(sByte.c_str(), &pEnd, 16);
+		if(*pEnd != '\0')
+			return false;
+		vOut.push_back(uint8_t(iByte));
+	}
+	return true;
+}
+
+static std::string bin2hex(const std::vector<uint8_t>& vIn)
+{
+	static const char sHexDigits[] = "0123456789abcdef";
+	std::string sOut;
+	sOut.reserve(vIn.size() * 2);
+	for(uint8_t b : vIn)
+	{
+		sOut.push_back(sHexDigits[b >> 4]);
+		sOut.push_back(sHexDigits[b & 0xF]);
+	}
+	return sOut;
+}
+
+bool jobsim::load_stream(const char* sFilename)
+{
+	std::ifstream f(sFilename);
+	if(!f.is_open())
+	{
+		printer::inst()->print_msg(L0, "Job simulator: failed to open %s.", sFilename);
+		return false;
+	}
+
+	vEvents.clear();
+	std::string sLine;
+	size_t iLine = 0;
+	while(std::getline(f, sLine))
+	{
+		iLine++;
+		size_t iComment = sLine.find('#');
+		if(iComment != std::string::npos)
+			sLine.resize(iComment);
+
+		std::istringstream ss(sLine);
+		sim_event ev;
+		std::string sType;
+		if(!(ss >> ev.iDelayMs))
+			continue; //empty line
+
+		ev.iTarget = 0;
+		ev.iSlot = 0;
+		ev.iVariant = jconf::inst()->GetVariant();
+		if(!(ss >> sType))
+			sType.clear();
+
+		if(sType == "stall")
+		{
+			ev.bStall = true;
+			ss >> ev.iSlot;
+		}
+		else if(sType == "job")
+		{
+			std::string sTarget, sBlob;
+			ev.bStall = false;
+			if(!(ss >> ev.sJobID >> sTarget >> sBlob) || !hex2bin(sBlob, ev.vBlob) ||
+				ev.vBlob.size() > sizeof(minethd::miner_work::bWorkBlob) || ev.sJobID.size() >= 64)
+			{
+				printer::inst()->print_msg(L0, "Job simulator: %s:%llu malformed job.", sFilename, int_port(iLine));
+				return false;
+			}
+
+			ev.iTarget = strtoull(sTarget.c_str(), nullptr, 16);
+			if(ss >> ev.iVariant)
+				ss >> ev.iSlot;
+		}
+		else
+		{
+			printer::inst()->print_msg(L0, "Job simulator: %s:%llu unknown event.", sFilename, int_port(iLine));
+			return false;
+		}
+
+		if(ev.iSlot >= minethd::iMaxSlots)
+		{
+			printer::inst()->print_msg(L0, "Job simulator: %s:%llu slot out of range.", sFilename, int_port(iLine));
+			return false;
+		}
+
+		vEvents.push_back(std::move(ev));
+	}
+
+	printer::inst()->print_msg(L0, "Job simulator: loaded %llu events from %s.", int_port(vEvents.size()), sFilename);
+	return true;
+}
+
+bool jobsim::save_stream(const char* sFilename)
+{
+	FILE* f = fopen(sFilename, "wb");
+	if(f == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Job simulator: failed to create %s.", sFilename);
+		return false;
+	}
+
+	fputs("# delay_ms job <job_id> <target_hex> <blob_hex> [variant [slot]]\n# delay_ms stall [slot]\n", f);
+	for(const sim_event& ev : vEvents)
+	{
+		if(ev.bStall)
+			fprintf(f, "%llu stall %llu\n", int_port(ev.iDelayMs), int_port(ev.iSlot));
+		else
+			fprintf(f, "%llu job %s %016llx %s %d %llu\n", int_port(ev.iDelayMs), ev.sJobID.c_str(),
+				(long long unsigned int)ev.iTarget, bin2hex(ev.vBlob).c_str(), ev.iVariant, int_port(ev.iSlot));
+	}
+
+	fclose(f);
+	return true;
+}
+
+bool jobsim::set_split(const std::vector<uint32_t>& vWeights, bool bPartition)
+{
+	uint64_t iTotal = 0;
+	for(uint32_t w : vWeights)
+		iTotal += w;
+
+	if(vWeights.empty() || vWeights.size() > minethd::iMaxSlots || iTotal == 0)
+	{
+		printer::inst()->print_msg(L0, "Job simulator: a split needs 1 to %llu weights, not all of them 0.",
+			int_port(minethd::iMaxSlots));
+		return false;
+	}
+
+	this->vWeights = vWeights;
+	this->bPartition = bPartition;
+	return true;
+}
+
+void jobsim::make_slot_stream(const synth_cfg& cfg, size_t iSlot, std::vector<std::pair<uint64_t, sim_event>>& vOut)
+{
+	// Slot 0 keeps the seed, so a stream without a split doesn't change
+	std::mt19937_64 rng(cfg.iSeed + iSlot);
+	std::exponential_distribution<double> interval(1.0 / std::max<uint64_t>(cfg.iMeanIntervalMs, 1));
+	std::uniform_int_distribution<uint32_t> pct(0, 99);
+	std::uniform_int_distribution<uint32_t> byte(0, 255);
+
+	int iVariant = jconf::inst()->GetVariant();
+	uint64_t iTarget = cfg.iDifficulty > 1 ? uint64_t(-1) / cfg.iDifficulty : uint64_t(-1);
+	uint64_t iTotalMs = cfg.iSeconds * 1000;
+	uint64_t iTimeMs = 0;
+	uint64_t iJobNo = 0;
+	uint32_t iBurstLeft = 0;
+	bool bStalled = false;
+	bool bFirst = true;
+
+	while(true)
+	{
+		sim_event ev;
+		uint64_t iDelayMs;
+
+		// Clean job bursts arrive within a few milliseconds of each other
+		if(bFirst)
+			iDelayMs = 0;
+		else if(bStalled)
+			iDelayMs = cfg.iStallMs;
+		else if(iBurstLeft > 0)
+		{
+			iDelayMs = 1 + byte(rng) % 20;
+			iBurstLeft--;
+		}
+		else
+			iDelayMs = uint64_t(interval(rng));
+
+		if(iTimeMs + iDelayMs >= iTotalMs)
+			break;
+		iTimeMs += iDelayMs;
+
+		ev.bStall = !bStalled && iBurstLeft == 0 && !bFirst && pct(rng) < cfg.iStallPct;
+		ev.iSlot = iSlot;
+		ev.iVariant = iVariant;
+		ev.iTarget = iTarget;
+		bStalled = ev.bStall;
+		bFirst = false;
+
+		if(!ev.bStall)
+		{
+			char sJobID[32];
+			if(vWeights.size() > 1)
+				snprintf(sJobID, sizeof(sJobID), "sim%llu_%llu", int_port(iSlot), int_port(iJobNo++));
+			else
+				snprintf(sJobID, sizeof(sJobID), "sim%llu", int_port(iJobNo++));
+			ev.sJobID = sJobID;
+
+			// Block major version first so variant_auto picks the configured variant
+			ev.vBlob.resize(76);
+			for(uint8_t& b : ev.vBlob)
+				b = uint8_t(byte(rng));
+			ev.vBlob[0] = iVariant == 1 ? 7 : (iVariant == 0 ? 6 : 8);
+
+			if(iBurstLeft == 0 && pct(rng) < cfg.iBurstPct)
+				iBurstLeft = cfg.iBurstLen;
+		}
+
+		vOut.emplace_back(iTimeMs, std::move(ev));
+	}
+
+	// Every stream ends with a stall, that's the end of the measurement
+	sim_event ev;
+	ev.bStall = true;
+	ev.iSlot = iSlot;
+	ev.iTarget = 0;
+	ev.iVariant = iVariant;
+	vOut.emplace_back(iTotalMs, std::move(ev));
+}
+
+void jobsim::make_synthetic(const synth_cfg& cfg)
+{
+	std::vector<std::pair<uint64_t, sim_event>> vTimed;
+	size_t iSlots = std::max<size_t>(vWeights.size(), 1);
+	for(size_t i = 0; i < iSlots; i++)
+		make_slot_stream(cfg, i, vTimed);
+
+	std::stable_sort(vTimed.begin(), vTimed.end(),
+		[](const std::pair<uint64_t, sim_event>& a, const std::pair<uint64_t, sim_event>& b) { return a.first < b.first; });
+
+	vEvents.clear();
+	uint64_t iTimeMs = 0;
+	for(auto& timed : vTimed)
+	{
+		timed.second.iDelayMs = timed.first - iTimeMs;
+		iTimeMs = timed.first;
+		vEvents.push_back(std::move(timed.second));
+	}
+
+	printer::inst()->print_msg(L0, "Job simulator: generated %llu events over %llu seconds.",
+		int_port(vEvents.size()), int_port(cfg.iSeconds));
+}
+
+static inline double percentile(const std::vector<uint32_t>& v, double fPct)
+{
+	if(v.empty())
+		return 0.0;
+	size_t idx = size_t(fPct / 100.0 * (v.size() - 1) + 0.5);
+	return v[idx] / 1000.0;
+}
+
+bool jobsim::run()
+{
+	if(vEvents.empty())
+	{
+		printer::inst()->print_msg(L0, "Job simulator: the job stream is empty.");
+		return false;
+	}
+
+	minethd::bTrackSwitches = true;
+	minethd::miner_work oWork;
+	std::vector<minethd*>* pvThreads = minethd::thread_starter(oWork);
+	minethd::sync_work();
+
+	// Without a split every slot the stream uses gets the same weight
+	std::vector<uint32_t> vSlotWeights = vWeights;
+	if(vSlotWeights.empty())
+	{
+		for(const sim_event& ev : vEvents)
+		{
+			if(ev.iSlot >= vSlotWeights.size())
+				vSlotWeights.resize(ev.iSlot + 1, 1);
+		}
+	}
+	minethd::set_slot_weights(vSlotWeights.data(), vSlotWeights.size(),
+		bPartition ? minethd::sched_partition : minethd::sched_time_slice);
+
+	printer::inst()->print_msg(L0, "Job simulator: replaying %llu events on %llu threads...",
+		int_port(vEvents.size()), int_port(pvThreads->size()));
+
+	uint64_t iStart = minethd::get_usec();
+	uint64_t iSchedule = iStart;
+	uint64_t iBlockedUsec = 0;
+	size_t iJobCnt = 0, iStallCnt = 0;
+
+	for(const sim_event& ev : vEvents)
+	{
+		iSchedule += ev.iDelayMs * 1000;
+		uint64_t iNow = minethd::get_usec();
+		if(iSchedule > iNow)
+			std::this_thread::sleep_for(std::chrono::microseconds(iSchedule - iNow));
+
+		if(ev.bStall)
+		{
+			oWork = minethd::miner_work();
+			iStallCnt++;
+		}
+		else
+		{
+			char sJobID[64] = { 0 };
+			memcpy(sJobID, ev.sJobID.c_str(), ev.sJobID.size());
+			oWork = minethd::miner_work(sJobID, ev.vBlob.data(), uint32_t(ev.vBlob.size()), 0, ev.iTarget,
+				jconf::inst()->NiceHashMode(), 0);
+			oWork.iVariant = ev.iVariant;
+			iJobCnt++;
+		}
+
+		// switch_work blocks until every thread took the previous job
+		iNow = minethd::get_usec();
+		minethd::switch_work(ev.iSlot, oWork);
+		iBlockedUsec += minethd::get_usec() - iNow;
+	}
+
+	minethd::sync_work();
+	uint64_t iEnd = minethd::get_usec();
+	double fTime = (iEnd - iStart) / 1000000.0;
+
+	uint64_t iTotalHashes = 0, iStaleHashes = 0, iResults = 0, iStallUsec = 0, iSlotSwitches = 0;
+	std::vector<uint32_t> vLatency;
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		minethd* thd = pvThreads->at(i);
+		uint64_t iHashes = thd->iHashCount.load();
+		uint64_t iStale = thd->iStaleCount.load();
+
+		printer::inst()->print_msg(L0, "Thread %llu: %.1f H/S effective, %llu stale hashes, %.1f%% stalled",
+			int_port(i), (iHashes - iStale) / fTime, int_port(iStale), thd->iStallUsec.load() / 10000.0 / fTime);
+
+		iTotalHashes += iHashes;
+		iStaleHashes += iStale;
+		iResults += thd->iResultCount.load();
+		iStallUsec += thd->iStallUsec.load();
+		iSlotSwitches += thd->iSlotSwitchCnt.load();
+		vLatency.insert(vLatency.end(), thd->vSwitchUsec.begin(), thd->vSwitchUsec.end());
+	}
+	std::sort(vLatency.begin(), vLatency.end());
+
+	printer::inst()->print_msg(L0, "Jobs: %llu, stalls: %llu, run time: %.1f s", int_port(iJobCnt), int_port(iStallCnt), fTime);
+	printer::inst()->print_msg(L0, "Raw: %.1f H/S, effective: %.1f H/S, stale: %.2f%%", iTotalHashes / fTime,
+		(iTotalHashes - iStaleHashes) / fTime, iTotalHashes != 0 ? 100.0 * iStaleHashes / iTotalHashes : 0.0);
+	printer::inst()->print_msg(L0, "Results below target: %llu", int_port(iResults));
+	printer::inst()->print_msg(L0, "Job switch latency (ms): p50 %.2f, p90 %.2f, p99 %.2f, max %.2f (%llu switches)",
+		percentile(vLatency, 50), percentile(vLatency, 90), percentile(vLatency, 99), percentile(vLatency, 100),
+		int_port(vLatency.size()));
+	printer::inst()->print_msg(L0, "Stalled: %.2f%% of thread time, publisher blocked for %.1f ms",
+		100.0 * iStallUsec / (iEnd - iStart) / pvThreads->size(), iBlockedUsec / 1000.0);
+
+	if(vSlotWeights.size() > 1)
+	{
+		uint64_t iWeightSum = 0, iSlotSum = 0;
+		for(size_t i = 0; i < vSlotWeights.size(); i++)
+		{
+			iWeightSum += vSlotWeights[i];
+			iSlotSum += minethd::get_slot_hashes(i);
+		}
+
+		// The split error is the largest distance between the share a slot got and its weight
+		double fMaxError = 0.0;
+		for(size_t i = 0; i < vSlotWeights.size(); i++)
+		{
+			uint64_t iHashes = minethd::get_slot_hashes(i);
+			double fShare = iSlotSum != 0 ? 100.0 * iHashes / iSlotSum : 0.0;
+			double fWant = 100.0 * vSlotWeights[i] / iWeightSum;
+			fMaxError = std::max(fMaxError, std::abs(fShare - fWant));
+
+			printer::inst()->print_msg(L0, "Slot %llu: weight %u, %llu hashes, %.2f%% of the total (target %.2f%%)",
+				int_port(i), vSlotWeights[i], int_port(iHashes), fShare, fWant);
+		}
+
+		printer::inst()->print_msg(L0, "Split (%s): max error %.2f%%, %llu slot switches, %.2f per thread and second",
+			bPartition ? "partition" : "time slice", fMaxError, int_port(iSlotSwitches),
+			iSlotSwitches / fTime / pvThreads->size());
+	}
+
+	return true;
+}
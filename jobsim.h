@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Feeds a recorded or synthetic job stream through minethd::switch_work and measures
+// how much of the hashing power ends up on current jobs.
+//
+// Stream files are plain text, one event per line, '#' starts a comment:
+//   <delay_ms> job <job_id> <target_hex> <blob_hex> [variant [slot]]
+//   <delay_ms> stall [slot]
+// The delay is counted from the previous event. The slot is the scheduler slot of the job
+// (see minethd::iMaxSlots), with a split set the run also reports how the hashes were shared.
+class jobsim
+{
+public:
+	struct sim_event
+	{
+		uint64_t iDelayMs;
+		bool bStall;
+		size_t iSlot;
+		std::string sJobID;
+		uint64_t iTarget;
+		int iVariant;
+		std::vector<uint8_t> vBlob;
+	};
+
+	struct synth_cfg
+	{
+		uint64_t iSeconds;
+		uint64_t iMeanIntervalMs;  // mean of the exponential inter-arrival time
+		uint32_t iBurstPct;        // chance that a job is followed by a burst of clean jobs
+		uint32_t iBurstLen;
+		uint32_t iStallPct;        // chance of a pool outage instead of a job
+		uint64_t iStallMs;
+		uint64_t iDifficulty;
+		uint64_t iSeed;
+	};
+
+	bool load_stream(const char* sFilename);
+	bool save_stream(const char* sFilename);
+	// One synthetic stream per weight is merged, the weights go to minethd::set_slot_weights
+	void make_synthetic(const synth_cfg& cfg);
+	bool set_split(const std::vector<uint32_t>& vWeights, bool bPartition);
+
+	bool run();
+
+private:
+	void make_slot_stream(const synth_cfg& cfg, size_t iSlot, std::vector<std::pair<uint64_t, sim_event>>& vOut);
+
+	std::vector<sim_event> vEvents;
+	std::vector<uint32_t> vWeights;
+	bool bPartition = false;
+};
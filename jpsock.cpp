@@ -0,0 +1,796 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jpsock.h"
+#include "sockpoll.hpp"
+#include "console.h"
+#include "version.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "jext.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifndef CONF_NO_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#endif
+
+using namespace rapidjson;
+
+typedef GenericDocument<UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<>> MemDocument;
+
+/*
+ * Jobs are parsed in-situ - rapidjson terminates the strings inside our receive buffer and
+ * the blob is decoded from there straight into the job. The DOM itself lives in two fixed
+ * buffers, so a job notification doesn't touch the heap at all.
+ */
+struct jpsock::opaque_private
+{
+	char sParseBuffer[8 * 1024];
+	char sStackBuffer[4 * 1024];
+
+	MemoryPoolAllocator<> oParseAllocator;
+	MemoryPoolAllocator<> oStackAllocator;
+	MemDocument jsonDoc;
+
+	opaque_private() :
+		oParseAllocator(sParseBuffer, sizeof(sParseBuffer)),
+		oStackAllocator(sStackBuffer, sizeof(sStackBuffer)),
+		jsonDoc(&oParseAllocator, sizeof(sStackBuffer) / 2, &oStackAllocator)
+	{
+	}
+};
+
+static inline uint64_t get_usec()
+{
+	return minethd::get_usec();
+}
+
+// Pools send a 32 bit target as the difficulty, which maps to the top 32 bits of the hash
+static inline uint64_t t32_to_t64(uint32_t t)
+{
+	return 0xFFFFFFFFFFFFFFFFULL / (0xFFFFFFFFULL / ((uint64_t)t));
+}
+
+jpsock::jpsock(size_t id, const jconf::pool_cfg& cfg, bool tls_secure_algo) :
+	iConnectStamp(0), iRetryStamp(0), iFailCount(0), iJobCnt(0), iJobDiff(0), iSharesGood(0), iSharesBad(0),
+	iRttSumUsec(0), iRttMaxUsec(0), iRttCnt(0), iPoolId(id), sPoolAddr(cfg.sPoolAddr), sWalletAddr(cfg.sWalletAddr),
+	sPoolPwd(cfg.sPoolPwd), sTlsFingerprint(cfg.sTlsFingerprint), bTls(cfg.bTlsMode), bTlsSecureAlgo(tls_secure_algo),
+	bTlsWantWrite(false), hSocket(INVALID_SOCKET), iState(net_disconnected), iConnectUsec(0), iRecvPos(0), iSendPos(0), iNextCallId(2),
+	bHaveJob(false), bNewJob(false), bJobDelivered(false)
+{
+	sMinerId[0] = '\0';
+	prv = new opaque_private();
+
+#ifndef CONF_NO_TLS
+	ctx = nullptr;
+	ssl = nullptr;
+#endif
+}
+
+jpsock::~jpsock()
+{
+	disconnect();
+	delete prv;
+}
+
+bool jpsock::set_socket_error(const char* sError)
+{
+	sSocketError = sError;
+	return false;
+}
+
+bool jpsock::set_socket_error_strerr(const char* sPrefix)
+{
+	char sSockErrText[512];
+	sSocketError = sPrefix;
+	sSocketError += sock_strerror(sSockErrText, sizeof(sSockErrText));
+	return false;
+}
+
+bool jpsock::connect()
+{
+	char sAddr[256];
+	addrinfo hints = {};
+	addrinfo *pAddrRoot = nullptr;
+	addrinfo *pAddr;
+
+	disconnect();
+	sSocketError.clear();
+
+	size_t iColon = sPoolAddr.rfind(':');
+	if(iColon == std::string::npos || iColon == 0 || iColon + 1 == sPoolAddr.size() || sPoolAddr.size() >= sizeof(sAddr))
+		return set_socket_error("CONNECT error: Pool port number not specified, please use format <hostname>:<port>.");
+
+	memcpy(sAddr, sPoolAddr.c_str(), sPoolAddr.size() + 1);
+	sAddr[iColon] = '\0';
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	// Name resolution is the one blocking call we have, it only happens on (re)connect
+	int err = getaddrinfo(sAddr, sAddr + iColon + 1, &hints, &pAddrRoot);
+	if(err != 0)
+	{
+		char sSockErrText[512];
+		sSocketError = "CONNECT error: GetAddrInfo: ";
+		sSocketError += sock_gai_strerror(err, sSockErrText, sizeof(sSockErrText));
+		return false;
+	}
+
+	addrinfo *ipv4 = nullptr, *ipv6 = nullptr;
+	for(pAddr = pAddrRoot; pAddr != nullptr; pAddr = pAddr->ai_next)
+	{
+		if(ipv4 == nullptr && pAddr->ai_family == AF_INET)
+			ipv4 = pAddr;
+		if(ipv6 == nullptr && pAddr->ai_family == AF_INET6)
+			ipv6 = pAddr;
+	}
+
+	if(ipv4 == nullptr && ipv6 == nullptr)
+	{
+		freeaddrinfo(pAddrRoot);
+		return set_socket_error("CONNECT error: I found some DNS records but no IPv4 or IPv6 addresses.");
+	}
+
+	if(ipv4 != nullptr && (ipv6 == nullptr || jconf::inst()->PreferIpv4()))
+		pAddr = ipv4;
+	else
+		pAddr = ipv6;
+
+	hSocket = socket(pAddr->ai_family, pAddr->ai_socktype, pAddr->ai_protocol);
+	if(hSocket == INVALID_SOCKET)
+	{
+		freeaddrinfo(pAddrRoot);
+		return set_socket_error_strerr("CONNECT error: ");
+	}
+
+	// Submits are tiny and we want them on the wire right away
+	int iFlag = 1;
+	setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&iFlag, sizeof(iFlag));
+
+	if(!sock_set_nonblock(hSocket))
+	{
+		freeaddrinfo(pAddrRoot);
+		set_socket_error_strerr("CONNECT error: ");
+		disconnect();
+		return false;
+	}
+
+	iState = net_connecting;
+	iConnectUsec = get_usec();
+	int ret = ::connect(hSocket, pAddr->ai_addr, (int)pAddr->ai_addrlen);
+	freeaddrinfo(pAddrRoot);
+
+	if(ret != 0 && !sock_would_block())
+	{
+		set_socket_error_strerr("CONNECT error: ");
+		disconnect();
+		return false;
+	}
+
+	// Even an immediate connect gets reported as writable, on_sock_event takes it from there
+	return true;
+}
+
+void jpsock::disconnect()
+{
+#ifndef CONF_NO_TLS
+	if(ssl != nullptr)
+	{
+		SSL_free(ssl);
+		ssl = nullptr;
+	}
+
+	if(ctx != nullptr)
+	{
+		SSL_CTX_free(ctx);
+		ctx = nullptr;
+	}
+#endif
+
+	if(hSocket != INVALID_SOCKET)
+	{
+		sock_close(hSocket);
+		hSocket = INVALID_SOCKET;
+	}
+
+	iState = net_disconnected;
+	bTlsWantWrite = false;
+	iRecvPos = 0;
+	sSendBuf.clear();
+	iSendPos = 0;
+	vPendingCalls.clear();
+	sMinerId[0] = '\0';
+
+	// A job is only good for the connection it came from
+	bHaveJob = false;
+	bNewJob = false;
+}
+
+bool jpsock::on_sock_event(uint32_t iEvents)
+{
+	switch(iState)
+	{
+	case net_disconnected:
+		return true;
+
+	case net_connecting:
+	{
+		if((iEvents & (sock_poller::ev_write | sock_poller::ev_error)) == 0)
+			return true;
+
+		int iSockErr = 0;
+		socklen_t iLen = sizeof(iSockErr);
+		if(getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)&iSockErr, &iLen) != 0)
+			return set_socket_error_strerr("CONNECT error: ");
+
+		if(iSockErr != 0)
+		{
+			errno = iSockErr;
+#ifdef _WIN32
+			WSASetLastError(iSockErr);
+#endif
+			return set_socket_error_strerr("CONNECT error: ");
+		}
+
+		return on_connected();
+	}
+
+	case net_tls_handshake:
+		return tls_handshake();
+
+	default:
+		break;
+	}
+
+	if((iEvents & (sock_poller::ev_read | sock_poller::ev_error)) != 0 && !do_recv())
+		return false;
+
+	// Anything queued while processing the input goes out right away
+	return do_send();
+}
+
+bool jpsock::on_connected()
+{
+	iConnectStamp = time(nullptr);
+
+#ifndef CONF_NO_TLS
+	if(bTls)
+	{
+		ctx = SSL_CTX_new(SSLv23_method());
+		if(ctx == nullptr)
+			return set_socket_error("TLS error: Failed to create the context.");
+
+		if(bTlsSecureAlgo)
+		{
+			SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+			if(SSL_CTX_set_cipher_list(ctx, "HIGH:!aNULL:!PSK:!SRP:!MD5:!RC4:!SHA1") != 1)
+				return set_socket_error("TLS error: Failed to set the cipher list.");
+		}
+
+		ssl = SSL_new(ctx);
+		if(ssl == nullptr || SSL_set_fd(ssl, (int)hSocket) != 1)
+			return set_socket_error("TLS error: Failed to set up the connection.");
+
+		std::string sHost = sPoolAddr.substr(0, sPoolAddr.rfind(':'));
+		SSL_set_tlsext_host_name(ssl, sHost.c_str());
+		SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		SSL_set_connect_state(ssl);
+
+		iState = net_tls_handshake;
+		return tls_handshake();
+	}
+#endif
+
+	return cmd_login();
+}
+
+bool jpsock::cmd_login()
+{
+	iState = net_login;
+
+	char cmd_buffer[2048];
+	int iLen = snprintf(cmd_buffer, sizeof(cmd_buffer),
+		"{\"method\":\"login\",\"params\":{\"login\":\"%s\",\"pass\":\"%s\",\"agent\":\"" XMR_STAK_NAME "/" XMR_STAK_VERSION "\"},\"id\":%llu}\n",
+		sWalletAddr.c_str(), sPoolPwd.c_str(), int_port(iLoginCallId));
+
+	if(iLen <= 0 || size_t(iLen) >= sizeof(cmd_buffer))
+		return set_socket_error("CALL error: Login is too long.");
+
+	return queue_call(iLoginCallId, cmd_buffer, iLen) && do_send();
+}
+
+bool jpsock::tls_handshake()
+{
+#ifndef CONF_NO_TLS
+	bTlsWantWrite = false;
+	int ret = SSL_do_handshake(ssl);
+	if(ret != 1)
+	{
+		int err = SSL_get_error(ssl, ret);
+		if(err == SSL_ERROR_WANT_READ)
+			return true;
+		if(err == SSL_ERROR_WANT_WRITE)
+		{
+			bTlsWantWrite = true;
+			return true;
+		}
+
+		char sErr[256];
+		ERR_error_string_n(ERR_get_error(), sErr, sizeof(sErr));
+		sSocketError = "TLS error: Handshake failed: ";
+		sSocketError += sErr;
+		return false;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	X509* cert = SSL_get1_peer_certificate(ssl);
+#else
+	X509* cert = SSL_get_peer_certificate(ssl);
+#endif
+	if(cert == nullptr)
+		return set_socket_error("TLS error: Server didn't send a certificate.");
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int iMdLen = 0;
+	bool bDigest = X509_digest(cert, EVP_sha256(), md, &iMdLen) == 1;
+	X509_free(cert);
+
+	if(!bDigest)
+		return set_socket_error("TLS error: Failed to calculate the server's fingerprint.");
+
+	unsigned char b64[EVP_MAX_MD_SIZE * 2];
+	EVP_EncodeBlock(b64, md, iMdLen);
+
+	if(sTlsFingerprint.empty())
+	{
+		printer::inst()->print_msg(L1, "TLS fingerprint [%s] %.*s", sPoolAddr.c_str(), (int)sizeof(b64), (char*)b64);
+	}
+	else if(sTlsFingerprint != (char*)b64)
+	{
+		printer::inst()->print_msg(L0, "TLS fingerprint [%s] %.*s", sPoolAddr.c_str(), (int)sizeof(b64), (char*)b64);
+		return set_socket_error("TLS error: Server fingerprint doesn't match the configured one.");
+	}
+
+	return cmd_login();
+#else
+	return set_socket_error("TLS error: Compiled without TLS support.");
+#endif
+}
+
+bool jpsock::do_recv()
+{
+	while(true)
+	{
+		if(iRecvPos == iSockBufferSize - 1)
+			return set_socket_error("RECEIVE error: data overflow");
+
+		int ret;
+#ifndef CONF_NO_TLS
+		if(ssl != nullptr)
+		{
+			ret = SSL_read(ssl, sRecvBuf + iRecvPos, int(iSockBufferSize - 1 - iRecvPos));
+			if(ret <= 0)
+			{
+				int err = SSL_get_error(ssl, ret);
+				if(err == SSL_ERROR_WANT_READ)
+					return true;
+				if(err == SSL_ERROR_WANT_WRITE)
+				{
+					bTlsWantWrite = true;
+					return true;
+				}
+				if(err == SSL_ERROR_ZERO_RETURN)
+					return set_socket_error("RECEIVE error: socket closed");
+
+				char sErr[256];
+				ERR_error_string_n(ERR_get_error(), sErr, sizeof(sErr));
+				sSocketError = "RECEIVE error: ";
+				sSocketError += sErr;
+				return false;
+			}
+		}
+		else
+#endif
+		{
+			ret = recv(hSocket, sRecvBuf + iRecvPos, int(iSockBufferSize - 1 - iRecvPos), 0);
+			if(ret == 0)
+				return set_socket_error("RECEIVE error: socket closed");
+			if(ret < 0)
+			{
+				if(sock_would_block())
+					return true;
+				return set_socket_error_strerr("RECEIVE error: ");
+			}
+		}
+
+		size_t iScan = iRecvPos;
+		iRecvPos += ret;
+
+		// Every complete line is one JSON message, parse them in place
+		char* lnstart = sRecvBuf;
+		char* lnend;
+		while((lnend = (char*)memchr(sRecvBuf + iScan, '\n', iRecvPos - iScan)) != nullptr)
+		{
+			*lnend = '\0';
+			iScan = lnend - sRecvBuf + 1;
+
+			if(lnend != lnstart && !process_line(lnstart))
+				return false;
+
+			lnstart = lnend + 1;
+		}
+
+		size_t iUsed = lnstart - sRecvBuf;
+		if(iUsed > 0)
+		{
+			memmove(sRecvBuf, lnstart, iRecvPos - iUsed);
+			iRecvPos -= iUsed;
+		}
+	}
+}
+
+bool jpsock::do_send()
+{
+	bTlsWantWrite = false;
+	while(iSendPos < sSendBuf.size())
+	{
+		int ret;
+#ifndef CONF_NO_TLS
+		if(ssl != nullptr)
+		{
+			ret = SSL_write(ssl, sSendBuf.data() + iSendPos, int(sSendBuf.size() - iSendPos));
+			if(ret <= 0)
+			{
+				int err = SSL_get_error(ssl, ret);
+				if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+				{
+					bTlsWantWrite = err == SSL_ERROR_WANT_WRITE;
+					return true;
+				}
+				return set_socket_error("SEND error: TLS write failed");
+			}
+		}
+		else
+#endif
+		{
+			ret = send(hSocket, sSendBuf.data() + iSendPos, int(sSendBuf.size() - iSendPos), MSG_NOSIGNAL);
+			if(ret < 0)
+			{
+				if(sock_would_block())
+					return true;
+				return set_socket_error_strerr("SEND error: ");
+			}
+		}
+
+		iSendPos += ret;
+	}
+
+	sSendBuf.clear();
+	iSendPos = 0;
+	return true;
+}
+
+bool jpsock::queue_call(uint64_t iCallId, const char* sCmd, size_t iLen)
+{
+	pending_call call = { iCallId, get_usec() };
+	vPendingCalls.push_back(call);
+	sSendBuf.append(sCmd, iLen);
+	return true;
+}
+
+bool jpsock::check_call_timeout(uint64_t iNowUsec, uint64_t iTimeoutUsec)
+{
+	if(iState == net_connecting || iState == net_tls_handshake)
+	{
+		if(iNowUsec - iConnectUsec > iTimeoutUsec)
+			return set_socket_error("CONNECT error: Timeout while connecting to the pool.");
+		return true;
+	}
+
+	// Calls are answered in order, the first one is the oldest
+	if(!vPendingCalls.empty() && iNowUsec - vPendingCalls.front().iSentUsec > iTimeoutUsec)
+		return set_socket_error("CALL error: Timeout while waiting for a reply");
+
+	return true;
+}
+
+bool jpsock::process_line(char* sLine)
+{
+	MemDocument& doc = prv->jsonDoc;
+
+	// Drop the previous DOM before we reuse the buffers
+	doc.SetNull();
+	prv->oParseAllocator.Clear();
+
+	if(doc.ParseInsitu(sLine).HasParseError())
+	{
+		sSocketError = "PARSE error: Invalid JSON - ";
+		sSocketError += GetParseError_En(doc.GetParseError());
+		return false;
+	}
+
+	if(!doc.IsObject())
+		return set_socket_error("PARSE error: Invalid root");
+
+	const Value* mt = GetObjectMember(doc, "method");
+	if(mt != nullptr)
+	{
+		if(!mt->IsString())
+			return set_socket_error("PARSE error: Protocol error 1");
+
+		if(strcmp(mt->GetString(), "job") != 0)
+			return true; //Unknown notifications are harmless
+
+		const Value* params = GetObjectMember(doc, "params");
+		if(params == nullptr || !params->IsObject())
+			return set_socket_error("PARSE error: Job error 1");
+
+		return process_pool_job(params);
+	}
+
+	const Value* id = GetObjectMember(doc, "id");
+	if(id == nullptr || !id->IsUint64())
+		return set_socket_error("PARSE error: Protocol error 2");
+
+	return process_call_reply(id->GetUint64(), GetObjectMember(doc, "error"), GetObjectMember(doc, "result"));
+}
+
+bool jpsock::process_pool_job(const void* pParams)
+{
+	const Value* params = (const Value*)pParams;
+	const Value *blob, *jobid, *target, *variant;
+	jobid = GetObjectMember(*params, "job_id");
+	blob = GetObjectMember(*params, "blob");
+	target = GetObjectMember(*params, "target");
+	variant = GetObjectMember(*params, "variant");
+
+	if(jobid == nullptr || blob == nullptr || target == nullptr ||
+		!jobid->IsString() || !blob->IsString() || !target->IsString())
+		return set_socket_error("PARSE error: Job error 2");
+
+	if(jobid->GetStringLength() >= sizeof(oCurrentJob.sJobID))
+		return set_socket_error("PARSE error: Job error 3");
+
+	size_t iBlobLen = blob->GetStringLength();
+	if(iBlobLen % 2 != 0 || iBlobLen / 2 < minethd::iDefaultNonceOffset + 4 || iBlobLen / 2 > sizeof(oCurrentJob.bWorkBlob))
+		return set_socket_error("PARSE error: Invalid job length. Are you sure you are mining the correct coin?");
+
+	uint64_t iTarget;
+	size_t iTargetLen = target->GetStringLength();
+	if(iTargetLen <= 8)
+	{
+		uint32_t iTempInt = 0;
+		char sTempStr[] = "00000000"; // Little-endian CPU FTW
+		memcpy(sTempStr, target->GetString(), iTargetLen);
+		if(!hex2bin(sTempStr, 8, (uint8_t*)&iTempInt) || iTempInt == 0)
+			return set_socket_error("PARSE error: Invalid target");
+
+		iTarget = t32_to_t64(iTempInt);
+	}
+	else if(iTargetLen <= 16)
+	{
+		iTarget = 0;
+		char sTempStr[] = "0000000000000000";
+		memcpy(sTempStr, target->GetString(), iTargetLen);
+		if(!hex2bin(sTempStr, 16, (uint8_t*)&iTarget) || iTarget == 0)
+			return set_socket_error("PARSE error: Invalid target");
+	}
+	else
+		return set_socket_error("PARSE error: Job error 5");
+
+	minethd::miner_work& oJob = oCurrentJob;
+	if(!hex2bin(blob->GetString(), iBlobLen, oJob.bWorkBlob))
+	{
+		bHaveJob = false;
+		return set_socket_error("PARSE error: Job error 4");
+	}
+
+	memset(oJob.sJobID, 0, sizeof(oJob.sJobID));
+	memcpy(oJob.sJobID, jobid->GetString(), jobid->GetStringLength());
+	oJob.iWorkSize = uint32_t(iBlobLen / 2);
+	oJob.iResumeCnt = 0;
+	oJob.iNonceOffset = minethd::iDefaultNonceOffset;
+	oJob.iProfile = minethd::cn_profile_full;
+	oJob.iTarget = iTarget;
+	oJob.bNiceHash = jconf::inst()->NiceHashMode();
+	oJob.bStall = false;
+	oJob.iPoolId = iPoolId;
+
+	// Pools that announce the variant win over the config, -1 in the config means we read it from the blob
+	if(variant != nullptr && variant->IsInt() && variant->GetInt() >= 0 && variant->GetInt() < minethd::iVariantCnt)
+		oJob.iVariant = variant->GetInt();
+	else
+		oJob.iVariant = jconf::inst()->GetVariant();
+
+	iJobDiff = t32_to_t64(0xFFFFFFFF) / iTarget;
+	iJobCnt++;
+	bHaveJob = true;
+	bNewJob = true;
+	bJobDelivered = false;
+	return true;
+}
+
+bool jpsock::process_call_reply(uint64_t iCallId, const void* pError, const void* pResult)
+{
+	const Value* error = (const Value*)pError;
+	const Value* result = (const Value*)pResult;
+
+	size_t i;
+	for(i = 0; i < vPendingCalls.size(); i++)
+	{
+		if(vPendingCalls[i].iCallId == iCallId)
+			break;
+	}
+
+	if(i == vPendingCalls.size())
+		return true; //Late reply to a call from before a reconnect, nothing to do
+
+	uint64_t iRtt = get_usec() - vPendingCalls[i].iSentUsec;
+	vPendingCalls.erase(vPendingCalls.begin() + i);
+
+	const char* sError = nullptr;
+	if(error != nullptr && !error->IsNull())
+	{
+		const Value* msg = error->IsObject() ? GetObjectMember(*error, "message") : nullptr;
+		sError = (msg != nullptr && msg->IsString()) ? msg->GetString() : "Unknown error";
+	}
+
+	if(iCallId == iLoginCallId)
+	{
+		if(sError != nullptr)
+		{
+			sSocketError = "CALL error: Login failed - ";
+			sSocketError += sError;
+			return false;
+		}
+
+		if(result == nullptr || !result->IsObject())
+			return set_socket_error("PARSE error: Login protocol error 1");
+
+		const Value* id = GetObjectMember(*result, "id");
+		const Value* job = GetObjectMember(*result, "job");
+		if(id == nullptr || job == nullptr || !id->IsString() || !job->IsObject())
+			return set_socket_error("PARSE error: Login protocol error 2");
+
+		if(id->GetStringLength() >= sizeof(sMinerId))
+			return set_socket_error("PARSE error: Login protocol error 3");
+
+		memcpy(sMinerId, id->GetString(), id->GetStringLength() + 1);
+		iState = net_ready;
+		iFailCount = 0;
+		return process_pool_job(job);
+	}
+
+	iRttSumUsec += iRtt;
+	iRttCnt++;
+	if(iRtt > iRttMaxUsec)
+		iRttMaxUsec = iRtt;
+
+	if(sError != nullptr)
+	{
+		iSharesBad++;
+		sLastReject = sError;
+		printer::inst()->print_msg(L0, "[%s] Result rejected by the pool: %s", sPoolAddr.c_str(), sError);
+	}
+	else
+	{
+		iSharesGood++;
+		printer::inst()->print_msg(L3, "[%s] Result accepted by the pool (%.1f ms).", sPoolAddr.c_str(), iRtt / 1000.0);
+	}
+
+	return true;
+}
+
+bool jpsock::cmd_submit(const char* sJobID, uint32_t iNonce, const uint8_t* bResult)
+{
+	if(iState != net_ready)
+		return set_socket_error("SUBMIT error: Not connected");
+
+	char sNonce[9];
+	char sResult[65];
+	bin2hex((const uint8_t*)&iNonce, 4, sNonce);
+	bin2hex(bResult, 32, sResult);
+
+	char cmd_buffer[512];
+	uint64_t iCallId = iNextCallId++;
+	int iLen = snprintf(cmd_buffer, sizeof(cmd_buffer),
+		"{\"method\":\"submit\",\"params\":{\"id\":\"%s\",\"job_id\":\"%s\",\"nonce\":\"%s\",\"result\":\"%s\"},\"id\":%llu}\n",
+		sMinerId, sJobID, sNonce, sResult, int_port(iCallId));
+
+	if(iLen <= 0 || size_t(iLen) >= sizeof(cmd_buffer))
+		return set_socket_error("SUBMIT error: Call is too long");
+
+	// We don't wait for earlier submits, the reply is matched by id whenever it comes
+	return queue_call(iCallId, cmd_buffer, iLen) && do_send();
+}
+
+bool jpsock::get_job(minethd::miner_work& oWork)
+{
+	if(!bHaveJob)
+		return false;
+
+	if(bJobDelivered)
+		oCurrentJob.iResumeCnt++;
+
+	oWork = oCurrentJob;
+	bNewJob = false;
+	bJobDelivered = true;
+	return true;
+}
+
+inline unsigned char hf_hex2bin(char c, bool &err)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 0xA;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 0xA;
+
+	err = true;
+	return 0;
+}
+
+bool jpsock::hex2bin(const char* in, size_t len, uint8_t* out)
+{
+	bool error = false;
+	for (size_t i = 0; i < len; i += 2)
+	{
+		out[i / 2] = (hf_hex2bin(in[i], error) << 4) | hf_hex2bin(in[i + 1], error);
+		if (error) return false;
+	}
+	return true;
+}
+
+inline char hf_bin2hex(unsigned char c)
+{
+	if (c <= 0x9)
+		return '0' + c;
+	else
+		return 'a' - 0xA + c;
+}
+
+void jpsock::bin2hex(const uint8_t* in, size_t len, char* out)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		out[i * 2] = hf_bin2hex((in[i] & 0xF0) >> 4);
+		out[i * 2 + 1] = hf_bin2hex(in[i] & 0x0F);
+	}
+	out[len * 2] = '\0';
+}
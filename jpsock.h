@@ -0,0 +1,124 @@
+#pragma once
+#include "minethd.h"
+#include "jconf.h"
+#include "socks.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef CONF_NO_TLS
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+#endif
+
+/* Our pool can read and write a JSON-RPC stream over a non-blocking socket. It never waits
+   for anything - the executor tells it when the socket is ready through on_sock_event() and
+   picks up new jobs with get_job(). Calls are pipelined: a submit goes out as soon as we
+   have a result, replies are matched to calls by id whenever they arrive. */
+class jpsock
+{
+public:
+	enum net_state { net_disconnected, net_connecting, net_tls_handshake, net_login, net_ready };
+
+	jpsock(size_t id, const jconf::pool_cfg& cfg, bool tls_secure_algo);
+	~jpsock();
+
+	// Starts a non-blocking connect, the rest of the handshake is driven by on_sock_event
+	bool connect();
+	void disconnect();
+
+	// Returns false when the connection died, get_error() says why
+	bool on_sock_event(uint32_t iEvents);
+	bool check_call_timeout(uint64_t iNowUsec, uint64_t iTimeoutUsec);
+
+	bool cmd_submit(const char* sJobID, uint32_t iNonce, const uint8_t* bResult);
+
+	// Copies the current job, every further copy of the same job is a resume (see miner_work::iResumeCnt)
+	bool get_job(minethd::miner_work& oWork);
+	inline bool have_job() { return bHaveJob; }
+	inline bool have_new_job() { return bNewJob; }
+
+	inline SOCKET get_socket() { return hSocket; }
+	inline net_state get_state() { return iState; }
+	inline bool is_ready() { return iState == net_ready; }
+	inline bool want_write() { return iState == net_connecting || iSendPos < sSendBuf.size() || bTlsWantWrite; }
+	inline const char* get_error() { return sSocketError.c_str(); }
+	inline const char* get_pool_addr() { return sPoolAddr.c_str(); }
+	inline size_t get_pool_id() { return iPoolId; }
+
+	static bool hex2bin(const char* in, size_t len, uint8_t* out);
+	static void bin2hex(const uint8_t* in, size_t len, char* out);
+
+	// Connection stats, only touched by the executor thread
+	uint64_t iConnectStamp;
+	uint64_t iRetryStamp;   // usec timestamp of the next connection attempt
+	uint64_t iFailCount;
+	uint64_t iJobCnt;
+	uint64_t iJobDiff;
+	uint64_t iSharesGood;
+	uint64_t iSharesBad;
+	uint64_t iRttSumUsec;
+	uint64_t iRttMaxUsec;
+	uint64_t iRttCnt;
+	std::string sLastReject;
+
+private:
+	struct pending_call
+	{
+		uint64_t iCallId;
+		uint64_t iSentUsec;
+	};
+
+	static constexpr size_t iSockBufferSize = 16 * 1024;
+	static constexpr uint64_t iLoginCallId = 1;
+
+	bool set_socket_error(const char* sError);
+	bool set_socket_error_strerr(const char* sPrefix);
+
+	bool on_connected();
+	bool cmd_login();
+	bool tls_handshake();
+	bool do_recv();
+	bool do_send();
+	bool process_line(char* sLine);
+	bool process_pool_job(const void* pParams);
+	bool process_call_reply(uint64_t iCallId, const void* pError, const void* pResult);
+	bool queue_call(uint64_t iCallId, const char* sCmd, size_t iLen);
+
+	size_t iPoolId;
+	std::string sPoolAddr;
+	std::string sWalletAddr;
+	std::string sPoolPwd;
+	std::string sTlsFingerprint;
+	bool bTls;
+	bool bTlsSecureAlgo;
+	bool bTlsWantWrite;
+
+	SOCKET hSocket;
+	net_state iState;
+	uint64_t iConnectUsec;
+	std::string sSocketError;
+
+	char sRecvBuf[iSockBufferSize];
+	size_t iRecvPos;
+	std::string sSendBuf;
+	size_t iSendPos;
+
+	uint64_t iNextCallId;
+	std::vector<pending_call> vPendingCalls;
+
+	char sMinerId[64];
+	bool bHaveJob;
+	bool bNewJob;
+	bool bJobDelivered;
+	minethd::miner_work oCurrentJob;
+
+	struct opaque_private;
+	opaque_private* prv;
+
+#ifndef CONF_NO_TLS
+	SSL_CTX* ctx;
+	SSL* ssl;
+#endif
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Log-linear (HDR style) histogram of hash latencies. Values below 64 have a bucket each, above
+// that every power of two is split into 32 buckets, so a percentile is within 1/32 of the real
+// value whatever the unit. One thread records without locks, others read it at any time and
+// merge what they read into a merged histogram - per kernel, over threads or as the difference
+// of two snapshots.
+class latencyHist
+{
+public:
+	static constexpr uint32_t iSubBits = 6;
+	static constexpr uint64_t iSubCnt = 1 << iSubBits;
+	static constexpr uint64_t iHalfCnt = iSubCnt / 2;
+	static constexpr size_t iBucketCnt = iSubCnt + (64 - iSubBits) * iHalfCnt;
+
+	latencyHist()
+	{
+		for(size_t i = 0; i < iBucketCnt; i++)
+			aCounts[i].store(0, std::memory_order_relaxed);
+		iMax.store(0, std::memory_order_relaxed);
+	}
+
+	// Only the owning thread calls this, a plain load and store is enough for the counters
+	void record(uint64_t iVal)
+	{
+		std::atomic<uint64_t>& c = aCounts[index(iVal)];
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if(iVal > iMax.load(std::memory_order_relaxed))
+			iMax.store(iVal, std::memory_order_relaxed);
+	}
+
+	static size_t index(uint64_t iVal)
+	{
+		if(iVal < iSubCnt)
+			return size_t(iVal);
+		uint32_t iShift = msb(iVal) - (iSubBits - 1);
+		return size_t(iSubCnt + (iShift - 1) * iHalfCnt + ((iVal >> iShift) - iHalfCnt));
+	}
+
+	// Lowest value and width of a bucket
+	static uint64_t bucket_low(size_t i)
+	{
+		if(i < iSubCnt)
+			return i;
+		uint32_t iShift = uint32_t((i - iSubCnt) / iHalfCnt) + 1;
+		return (iHalfCnt + (i - iSubCnt) % iHalfCnt) << iShift;
+	}
+
+	static uint64_t bucket_width(size_t i)
+	{
+		return i < iSubCnt ? 1 : uint64_t(1) << (uint32_t((i - iSubCnt) / iHalfCnt) + 1);
+	}
+
+	struct merged
+	{
+		std::vector<uint64_t> vCounts;
+		uint64_t iCount = 0;
+		uint64_t iMax = 0; // exact for merges, the top of the highest bucket after a sub
+
+		merged() : vCounts(iBucketCnt, 0) {}
+
+		void add(const latencyHist& h)
+		{
+			for(size_t i = 0; i < iBucketCnt; i++)
+			{
+				uint64_t n = h.aCounts[i].load(std::memory_order_relaxed);
+				vCounts[i] += n;
+				iCount += n;
+			}
+			iMax = std::max(iMax, h.iMax.load(std::memory_order_relaxed));
+		}
+
+		void add(const merged& m)
+		{
+			for(size_t i = 0; i < iBucketCnt; i++)
+				vCounts[i] += m.vCounts[i];
+			iCount += m.iCount;
+			iMax = std::max(iMax, m.iMax);
+		}
+
+		// What was recorded since the snapshot older was taken
+		void sub(const merged& older)
+		{
+			size_t iTop = 0;
+			iCount = 0;
+			for(size_t i = 0; i < iBucketCnt; i++)
+			{
+				vCounts[i] -= older.vCounts[i];
+				iCount += vCounts[i];
+				if(vCounts[i] != 0)
+					iTop = i;
+			}
+			if(iCount == 0)
+				iMax = 0;
+			else if(index(iMax) != iTop)
+				iMax = bucket_low(iTop) + bucket_width(iTop) - 1;
+		}
+
+		// q in [0, 1], the middle of the bucket the value falls in, 0 if there is nothing
+		uint64_t percentile(double q) const
+		{
+			if(iCount == 0)
+				return 0;
+
+			uint64_t iRank = uint64_t(q * double(iCount - 1)) + 1;
+			uint64_t iSeen = 0;
+			for(size_t i = 0; i < iBucketCnt; i++)
+			{
+				iSeen += vCounts[i];
+				if(iSeen >= iRank)
+					return std::min(bucket_low(i) + bucket_width(i) / 2, iMax);
+			}
+			return iMax;
+		}
+	};
+
+private:
+	static uint32_t msb(uint64_t iVal)
+	{
+#ifdef _MSC_VER
+		unsigned long iBit;
+		_BitScanReverse64(&iBit, iVal);
+		return uint32_t(iBit);
+#else
+		return 63 - uint32_t(__builtin_clzll(iVal));
+#endif
+	}
+
+	std::atomic<uint64_t> aCounts[iBucketCnt];
+	std::atomic<uint64_t> iMax;
+};
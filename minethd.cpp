@@ -26,8 +26,10 @@
 #include <chrono>
 #include <cstring>
 #include <thread>
+#include <algorithm>
 #include <bitset>
 #include <fstream>
+#include <new>
 #include "console.h"
 
 #ifdef _WIN32
@@ -39,6 +41,8 @@ void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id)
 }
 #else
 #include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
 
 #if defined(__APPLE__)
 #include <mach/thread_policy.h>
@@ -70,120 +74,182 @@ void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id)
 }
 #endif // _WIN32
 
+// Lowest priority the OS has, everything else on the host gets the CPU first
+static void thd_setidle()
+{
+#if defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+	sched_param param = { 0 };
+	if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+		setpriority(PRIO_PROCESS, 0, 19);
+#else
+	// Elsewhere the nice value is per process, which is fine as mining is all we do
+	setpriority(PRIO_PROCESS, 0, 19);
+#endif
+}
+
 #include "minethd.h"
 #include "jconf.h"
+#include "executor.h"
 #include "crypto/cryptonight_aesni.h"
 #include "hwlocMemory.hpp"
+#include "cgroupLimits.hpp"
 
-telemetry::telemetry(size_t iThd)
+telemetry::telemetry(size_t iThd, size_t iSampleMs) : iSampleMs(iSampleMs)
 {
-	ppHashCounts = new uint64_t*[iThd];
-	ppTimestamps = new uint64_t*[iThd];
-	iBucketTop = new uint32_t[iThd];
+	// new[] only aligns to 16 bytes, the padding needs each ring to start a cache line
+	pRings = (ring*)_mm_malloc(sizeof(ring) * iThd, 64);
 
 	for (size_t i = 0; i < iThd; i++)
 	{
-		ppHashCounts[i] = new uint64_t[iBucketSize];
-		ppTimestamps[i] = new uint64_t[iBucketSize];
-		iBucketTop[i] = 0;
-		memset(ppHashCounts[0], 0, sizeof(uint64_t) * iBucketSize);
-		memset(ppTimestamps[0], 0, sizeof(uint64_t) * iBucketSize);
+		new(&pRings[i]) ring();
+		pRings[i].pSamples = new sample[iBucketSize];
+		pRings[i].iPushed = 0;
+		memset(pRings[i].pSamples, 0, sizeof(sample) * iBucketSize);
 	}
 }
 
-double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread)
+// Samples between the ends of the window, 0 if the ring doesn't reach that far back
+size_t telemetry::window_samples(size_t iLastMilisec) const
 {
-	using namespace std::chrono;
-	uint64_t iTimeNow = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
+	size_t iCnt = std::max<size_t>((iLastMilisec + iSampleMs / 2) / iSampleMs, 1);
+	// Keep clear of the slot the sampler writes next
+	return iCnt < iBucketSize - 1 ? iCnt : 0;
+}
 
-	uint64_t iEarliestHashCnt = 0;
-	uint64_t iEarliestStamp = 0;
-	uint64_t iLastestStamp = 0;
-	uint64_t iLastestHashCnt = 0;
-	bool bHaveFullSet = false;
+double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread)
+{
+	const ring& r = pRings[iThread];
+	uint64_t iPushed = r.iPushed.load(std::memory_order_acquire);
+	size_t iCnt = window_samples(iLastMilisec);
 
-	//Start at 1, buckettop points to next empty
-	for (size_t i = 1; i < iBucketSize; i++)
-	{
-		size_t idx = (iBucketTop[iThread] - i) & iBucketMask; //overflow expected here
+	if(iCnt == 0 || iPushed <= iCnt)
+		return nan("");
 
-		if (ppTimestamps[iThread][idx] == 0)
-			break; //That means we don't have the data yet
+	const sample& oLast = r.pSamples[(iPushed - 1) & iBucketMask];
+	const sample& oFirst = r.pSamples[(iPushed - 1 - iCnt) & iBucketMask];
 
-		if (iLastestStamp == 0)
-		{
-			iLastestStamp = ppTimestamps[iThread][idx];
-			iLastestHashCnt = ppHashCounts[iThread][idx];
-		}
+	// Zero means the thread didn't start yet, the same stamp that it's hung
+	if(oFirst.iTimestamp == 0 || oLast.iTimestamp <= oFirst.iTimestamp)
+		return nan("");
 
-		if (iTimeNow - ppTimestamps[iThread][idx] > iLastMilisec)
-		{
-			bHaveFullSet = true;
-			break; //We are out of the requested time period
-		}
+	double fHashes, fTime;
+	fHashes = oLast.iHashCount - oFirst.iHashCount;
+	fTime = oLast.iTimestamp - oFirst.iTimestamp;
+	fTime /= 1000.0;
 
-		iEarliestStamp = ppTimestamps[iThread][idx];
-		iEarliestHashCnt = ppHashCounts[iThread][idx];
-	}
+	return fHashes / fTime;
+}
 
-	if (!bHaveFullSet || iEarliestStamp == 0 || iLastestStamp == 0)
-		return nan("");
+// Mean of the clock samples in the window, NaN if there are none
+double telemetry::calc_clock_mhz(size_t iLastMilisec, size_t iThread)
+{
+	const ring& r = pRings[iThread];
+	uint64_t iPushed = r.iPushed.load(std::memory_order_acquire);
+	size_t iCnt = window_samples(iLastMilisec);
 
-	//Don't think that can happen, but just in case
-	if (iLastestStamp - iEarliestStamp == 0)
+	if(iCnt == 0 || iPushed == 0)
 		return nan("");
 
-	double fHashes, fTime;
-	fHashes = iLastestHashCnt - iEarliestHashCnt;
-	fTime = iLastestStamp - iEarliestStamp;
-	fTime /= 1000.0;
+	const sample& oLast = r.pSamples[(iPushed - 1) & iBucketMask];
+	uint64_t iSum = oLast.iMhzSum, iNum = oLast.iMhzCnt;
+	if(iPushed > iCnt)
+	{
+		const sample& oFirst = r.pSamples[(iPushed - 1 - iCnt) & iBucketMask];
+		iSum -= oFirst.iMhzSum;
+		iNum -= oFirst.iMhzCnt;
+	}
 
-	return fHashes / fTime;
+	return iNum != 0 ? double(iSum) / iNum : nan("");
 }
 
-void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp)
+void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp, uint32_t iMhz)
 {
-	size_t iTop = iBucketTop[iThd];
-	ppHashCounts[iThd][iTop] = iHashCount;
-	ppTimestamps[iThd][iTop] = iTimestamp;
+	ring& r = pRings[iThd];
+	uint64_t iPushed = r.iPushed.load(std::memory_order_relaxed);
+	sample& s = r.pSamples[iPushed & iBucketMask];
+
+	s.iHashCount = iHashCount;
+	s.iTimestamp = iTimestamp;
+	s.iMhzSum = iMhz;
+	s.iMhzCnt = iMhz != 0 ? 1 : 0;
+	if(iPushed != 0)
+	{
+		const sample& prev = r.pSamples[(iPushed - 1) & iBucketMask];
+		s.iMhzSum += prev.iMhzSum;
+		s.iMhzCnt += prev.iMhzCnt;
+	}
 
-	iBucketTop[iThd] = (iTop + 1) & iBucketMask;
+	r.iPushed.store(iPushed + 1, std::memory_order_release);
 }
 
-minethd::minethd(miner_work& pWork, size_t iNo, bool double_work, int variant, int asm_version, int64_t affinity)
+minethd::minethd(miner_work& pWork, size_t iNo, bool double_work, bool adaptive, int asm_version, int64_t affinity, size_t huge_ctx) :
+	bAdaptive(adaptive)
 {
 	oWork = pWork;
-	bQuit = 0;
-	iThreadNo = (uint8_t)iNo;
+	bQuit = false;
+	iThreadNo = iNo;
 	iJobNo = 0;
+	iSlot = iMaxSlots;
+	iWorkJobNo = 0;
+	memset(iSlotJobNo, 0, sizeof(iSlotJobNo));
+	iChunkSize = iChunkMin;
 	iHashCount = 0;
 	iTimestamp = 0;
-	iVariant = variant;
+	iStaleCount = 0;
+	iResultCount = 0;
+	iStallUsec = 0;
+	for(size_t i = 0; i < cn_profile_cnt * iVariantCnt * 2; i++)
+		(&pLatency[0][0][0])[i] = nullptr;
+	bPerfOpen = false;
+	iSlotSwitchCnt = 0;
+	bDoubleMode = double_work;
+	bParked = false;
+	iRestUsec = 0;
+	bYield = false;
 	iAsmVersion = asm_version;
+	iHugeCtx = huge_ctx;
 	this->affinity = affinity;
 	thdHandle = 0;
+	build_func_tables();
 
-	if(double_work)
-		oWorkThd = std::thread(&minethd::double_work_main, this);
-	else
-		oWorkThd = std::thread(&minethd::work_main, this);
+	oWorkThd = std::thread(&minethd::work_main, this);
 
 	thdHandle = oWorkThd.native_handle();
 	if (affinity >= 0) //-1 means no affinity
 		pin_thd_affinity();
 }
 
+minethd::job_slot minethd::oSlots[minethd::iMaxSlots];
 std::atomic<uint64_t> minethd::iGlobalJobNo;
-std::atomic<uint64_t> minethd::iConsumeCnt; //Threads get jobs as they are initialized
-minethd::miner_work minethd::oGlobalWork;
+std::atomic<minethd::sched_mode> minethd::iSchedMode;
+bool minethd::bTrackSwitches = false;
+std::atomic<uint32_t> minethd::iDutyPct(100);
+std::vector<int32_t> minethd::vCoreOfCpu;
+size_t minethd::iCoreCnt = 0;
 uint64_t minethd::iThreadCount = 0;
-
-cryptonight_ctx* minethd_alloc_ctx()
+std::atomic<uint64_t> minethd::iCtxCount(0);
+std::atomic<uint64_t> minethd::iHugeCtxCount(0);
+uint64_t minethd::iClockTsc = 0;
+uint64_t minethd::iClockMs = 0;
+std::atomic<double> minethd::fMsPerTick(0.0);
+double minethd::fTickMs = 0.0;
+
+static cryptonight_ctx* alloc_ctx_mem(bool bHugeRoom)
 {
 	cryptonight_ctx* ctx;
 	alloc_msg msg = { 0 };
 
-	switch (jconf::inst()->GetSlowMemSetting())
+	// Past the hugetlb limit of the cgroup the mmap fails, or the page faults kill us
+	jconf::slow_mem_cfg iSlowMem = jconf::inst()->GetSlowMemSetting();
+	if(iSlowMem != jconf::always_use && !bHugeRoom)
+	{
+		printer::inst()->print_msg(L0, "MEMORY ALLOC FAILED: hugetlb limit of the cgroup reached");
+		return iSlowMem == jconf::print_warning ? cryptonight_alloc_ctx(0, 0, NULL) : NULL;
+	}
+
+	switch (iSlowMem)
 	{
 	case jconf::never_use:
 		ctx = cryptonight_alloc_ctx(1, 1, &msg);
@@ -215,6 +281,17 @@ cryptonight_ctx* minethd_alloc_ctx()
 	return nullptr; //Should never happen
 }
 
+cryptonight_ctx* minethd_alloc_ctx(bool bHugeRoom)
+{
+	cryptonight_ctx* ctx = alloc_ctx_mem(bHugeRoom);
+	if(ctx != nullptr)
+	{
+		minethd::iCtxCount++;
+		minethd::iHugeCtxCount += ctx->ctx_info[0];
+	}
+	return ctx;
+}
+
 static void print_hash(const char* input, const char* hash)
 {
 	printf("HASH(\"%s\") = ", input);
@@ -225,13 +302,27 @@ static void print_hash(const char* input, const char* hash)
 	printf("\n");
 }
 
-bool minethd::self_test()
+void minethd::init_variant1_table()
 {
 	for (int i = 0; i < 256; ++i)
 	{
 		const uint64_t index = (((i >> 3) & 6) | (i & 1)) << 1;
 		variant1_table[i] = i ^ ((0x75310 >> index) & 0x30);
 	}
+}
+
+void minethd::restore_rounding()
+{
+#ifdef _MSC_VER
+	_control87(RC_NEAR, MCW_RC);
+#else
+	std::fesetround(FE_TONEAREST);
+#endif
+}
+
+bool minethd::self_test()
+{
+	init_variant1_table();
 
 	alloc_msg msg = { 0 };
 	size_t res;
@@ -275,10 +366,11 @@ bool minethd::self_test()
 		return false;
 	}
 
+	size_t iHugeRoom = cgroupLimits::hugetlbRoom(MEMORY);
 	cryptonight_ctx *ctx0, *ctx1;
-	if((ctx0 = minethd_alloc_ctx()) == nullptr)
+	if((ctx0 = minethd_alloc_ctx(iHugeRoom > 0)) == nullptr)
 		return false;
-	if ((ctx1 = minethd_alloc_ctx()) == nullptr)
+	if ((ctx1 = minethd_alloc_ctx(iHugeRoom > 1)) == nullptr)
 		return false;
 
 	std::string prev_input;
@@ -379,6 +471,7 @@ bool minethd::self_test()
 	}
 
 	cryptonight_free_ctx(ctx0);
+	restore_rounding();
 
 	printer::inst()->print_msg(L0, "Cryptonight hash self-test passed.");
 	return true;
@@ -389,8 +482,9 @@ int minethd::pgo_instrument()
 {
 	printer::inst()->print_msg(L0, "Started instrumenting cryptonight_hash()");
 
-	cryptonight_ctx *ctx0 = minethd_alloc_ctx();
-	cryptonight_ctx *ctx1 = minethd_alloc_ctx();
+	size_t iHugeRoom = cgroupLimits::hugetlbRoom(MEMORY);
+	cryptonight_ctx *ctx0 = minethd_alloc_ctx(iHugeRoom > 0);
+	cryptonight_ctx *ctx1 = minethd_alloc_ctx(iHugeRoom > 1);
 	if (!ctx0 || !ctx1)
 	{
 		printer::inst()->print_msg(L0, "Failed to allocate memory");
@@ -431,54 +525,519 @@ int minethd::pgo_instrument()
 }
 #endif
 
+minethd::~minethd()
+{
+	for(size_t i = 0; i < cn_profile_cnt * iVariantCnt * 2; i++)
+		delete (&pLatency[0][0][0])[i].load();
+}
+
 std::vector<minethd*>* minethd::thread_starter(miner_work& pWork)
 {
-	iGlobalJobNo = 0;
-	iConsumeCnt = 0;
 	std::vector<minethd*>* pvThreads = new std::vector<minethd*>;
 
+	if(!check_work(pWork))
+		pWork = miner_work();
+
+	//Threads get the job of every slot as they are initialized
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		job_slot& slot = oSlots[i];
+		if(i == 0)
+			slot.aWork[0] = pWork;
+		else
+			slot.aWork[0] = miner_work();
+		for(size_t b = 0; b < iWorkBufs; b++)
+			slot.aReaders[b] = 0;
+		slot.aWorkJobNo[0] = 1;
+		slot.iPublished = 0;
+		slot.iJobNo = 1;
+		slot.iConsumed = uint64_t(1) << iConsumeBits;
+		slot.iNonce = 0;
+		slot.iExhaustedJobNo = 0;
+		slot.iClaimed = 0;
+		slot.iHashCount = 0;
+		slot.iSwitchStamp = 0;
+		slot.iWeight = i == 0 ? 1 : 0;
+	}
+	iSchedMode = sched_time_slice;
+	iGlobalJobNo = 1;
+	iDutyPct = jconf::inst()->GetDutyCycle();
+	init_clock();
+
 	//Launch the requested number of single and double threads, to distribute
 	//load evenly we need to alternate single and double threads
 	size_t i, n = jconf::inst()->GetThreadCount();
 	pvThreads->reserve(n);
+	iThreadCount = n;
+
+	// The threads allocate at the same time, each asking the cgroup for room would let all of them
+	// see the same free pages. So the huge pages are handed out here, in thread order.
+	size_t iHugeRoom = cgroupLimits::hugetlbRoom(MEMORY);
 
 	jconf::thd_cfg cfg;
 	for (i = 0; i < n; i++)
 	{
 		jconf::inst()->GetThreadConfig(i, cfg);
 
-		minethd* thd = new minethd(pWork, i, cfg.bDoubleMode, cfg.iVariant, cfg.iAsmVersion, cfg.iCpuAff);
+		size_t iHugeCtx = std::min<size_t>(cfg.bAdaptive || cfg.bDoubleMode ? 2 : 1, iHugeRoom);
+		iHugeRoom -= iHugeCtx;
+
+		minethd* thd = new minethd(pWork, i, cfg.bDoubleMode, cfg.bAdaptive, cfg.iAsmVersion, cfg.iCpuAff, iHugeCtx);
 		pvThreads->push_back(thd);
 
+		const char* sMode = cfg.bAdaptive ? "adaptive" : cfg.bDoubleMode ? "double" : "single";
 		if(cfg.iCpuAff >= 0)
-			printer::inst()->print_msg(L1, "Starting %s thread, affinity: %d.", cfg.bDoubleMode ? "double" : "single", (int)cfg.iCpuAff);
+			printer::inst()->print_msg(L1, "Starting %s thread, affinity: %d.", sMode, (int)cfg.iCpuAff);
 		else
-			printer::inst()->print_msg(L1, "Starting %s thread, no affinity.", cfg.bDoubleMode ? "double" : "single");
+			printer::inst()->print_msg(L1, "Starting %s thread, no affinity.", sMode);
 	}
 
-	iThreadCount = n;
 	return pvThreads;
 }
 
-void minethd::switch_work(miner_work& pWork)
+void minethd::thread_stopper(std::vector<minethd*>* pvThreads)
+{
+	for(minethd* thd : *pvThreads)
+		thd->bQuit = true;
+
+	// Any new job moves every thread out of its hash loop, where it sees bQuit
+	miner_work oStall;
+	switch_work(0, oStall);
+
+	for(minethd* thd : *pvThreads)
+	{
+		thd->oWorkThd.join();
+		delete thd;
+	}
+
+	delete pvThreads;
+	iThreadCount = 0;
+}
+
+// Compares the time slicing pass of two slots, the nonces they claimed per unit of weight
+static inline bool slot_pass_less(uint64_t iClaimedA, uint32_t iWeightA, uint64_t iClaimedB, uint32_t iWeightB)
 {
-	// iConsumeCnt is a basic lock-like polling mechanism just in case we happen to push work
+	return double(iClaimedA) * iWeightB < double(iClaimedB) * iWeightA;
+}
+
+void minethd::switch_work(size_t iSlot, miner_work& pWork)
+{
+	assert(iSlot < iMaxSlots);
+	job_slot& slot = oSlots[iSlot];
+
+	// iConsumed is a basic lock-like polling mechanism just in case we happen to push work
 	// faster than threads can consume them. This should never happen in real life.
 	// Pool cant physically send jobs faster than every 250ms or so due to net latency.
 
-	while (iConsumeCnt.load(std::memory_order_seq_cst) < iThreadCount)
+	// In coexist mode the threads run at idle priority and can be starved for seconds, that must
+	// not hold up the pools. A late thread copies the slot again as soon as it sees the new job number.
+	bool bBounded = jconf::inst()->GetCoexistMode() != jconf::coexist_off;
+	for (size_t i = 0; (slot.iConsumed.load(std::memory_order_seq_cst) & iConsumeMask) < iThreadCount && (!bBounded || i < 2); i++)
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-	oGlobalWork = pWork;
-	iConsumeCnt.store(0, std::memory_order_seq_cst);
+	// Only we write iPublished, the buffer it points to is ours to read
+	uint32_t iOld = slot.iPublished.load(std::memory_order_relaxed);
+	bool bWasIdle = slot.aWork[iOld].bStall || slot.iExhaustedJobNo.load() == slot.iJobNo.load();
+
+	uint32_t iBuf = (iOld + 1) % iWorkBufs;
+	while(slot.aReaders[iBuf].load(std::memory_order_seq_cst) != 0)
+	{
+		iBuf = (iBuf + 1) % iWorkBufs;
+		if(iBuf == iOld)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			iBuf = (iBuf + 1) % iWorkBufs;
+		}
+	}
+
+	miner_work& oWork = slot.aWork[iBuf];
+	oWork = pWork;
+	if(!check_work(oWork))
+		oWork = miner_work();
+
+	// A slot coming back from a stall joins at the pass of the others instead of
+	// taking all the threads until it caught up with the time it was away
+	uint32_t iWeight = slot.iWeight.load();
+	if(bWasIdle && !oWork.bStall && iWeight != 0)
+	{
+		size_t iMin = iMaxSlots;
+		for(size_t i = 0; i < iMaxSlots; i++)
+		{
+			job_slot& other = oSlots[i];
+			if(i == iSlot || other.iWeight.load() == 0 || other.aWork[other.iPublished.load()].bStall ||
+				other.iExhaustedJobNo.load() == other.iJobNo.load())
+				continue;
+
+			if(iMin == iMaxSlots || slot_pass_less(other.iClaimed.load(), other.iWeight.load(),
+				oSlots[iMin].iClaimed.load(), oSlots[iMin].iWeight.load()))
+				iMin = i;
+		}
+
+		if(iMin != iMaxSlots)
+		{
+			uint64_t iPass = uint64_t(double(oSlots[iMin].iClaimed.load()) * iWeight / oSlots[iMin].iWeight.load());
+			if(slot.iClaimed.load() < iPass)
+				slot.iClaimed.store(iPass);
+		}
+	}
+
+	uint64_t iJob = slot.iJobNo.load() + 1;
+	slot.aWorkJobNo[iBuf] = iJob;
+	slot.iConsumed.store(iJob << iConsumeBits, std::memory_order_seq_cst);
+	slot.iNonce.store(0, std::memory_order_seq_cst);
+	slot.iSwitchStamp.store(get_usec(), std::memory_order_seq_cst);
+	slot.iPublished.store(iBuf, std::memory_order_seq_cst);
+	slot.iJobNo.store(iJob, std::memory_order_seq_cst);
 	iGlobalJobNo++;
 }
 
+void minethd::set_slot_weights(const uint32_t* pWeights, size_t iCnt, sched_mode mode)
+{
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		oSlots[i].iWeight.store(i < iCnt ? pWeights[i] : 0, std::memory_order_seq_cst);
+		oSlots[i].iClaimed.store(0, std::memory_order_seq_cst);
+	}
+	iSchedMode.store(mode, std::memory_order_seq_cst);
+	iGlobalJobNo++;
+}
+
+uint64_t minethd::get_slot_hashes(size_t iSlot)
+{
+	return oSlots[iSlot].iHashCount.load(std::memory_order_relaxed);
+}
+
+void minethd::sync_work()
+{
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		while ((oSlots[i].iConsumed.load(std::memory_order_seq_cst) & iConsumeMask) < iThreadCount)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+uint64_t minethd::get_usec()
+{
+	using namespace std::chrono;
+	return time_point_cast<microseconds>(high_resolution_clock::now()).time_since_epoch().count();
+}
+
+static uint64_t get_sys_msec()
+{
+	using namespace std::chrono;
+	return time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
+}
+
+uint64_t minethd::get_msec()
+{
+	double fScale = fMsPerTick.load(std::memory_order_relaxed);
+	if(fScale == 0.0)
+		return get_sys_msec();
+	return iClockMs + uint64_t(double(__rdtsc() - iClockTsc) * fScale);
+}
+
+// A first scale from a short measurement, so the hash loops don't wait for the executor
+void minethd::init_clock()
+{
+	if(fTickMs != 0.0)
+		return;
+
+	using namespace std::chrono;
+	uint64_t iStartUs = get_usec();
+	uint64_t iStartTsc = __rdtsc();
+	std::this_thread::sleep_for(milliseconds(20));
+	uint64_t iTsc = __rdtsc();
+	uint64_t iUs = get_usec();
+	if(iTsc <= iStartTsc || iUs <= iStartUs)
+		return;
+	fTickMs = double(iUs - iStartUs) / 1000.0 / double(iTsc - iStartTsc);
+
+	// Without an invariant TSC the rate changes with the clock of the core
+	int32_t cpu_info[4];
+	jconf::cpuid(0x80000000, 0, cpu_info);
+	if(uint32_t(cpu_info[0]) < 0x80000007)
+		return;
+	jconf::cpuid(0x80000007, 0, cpu_info);
+	if((cpu_info[3] & (1 << 8)) == 0)
+		return;
+
+	iClockTsc = iStartTsc;
+	iClockMs = iStartUs / 1000;
+	fMsPerTick.store(fTickMs, std::memory_order_relaxed);
+}
+
+double minethd::tick_usec()
+{
+	double fScale = fMsPerTick.load(std::memory_order_relaxed);
+	return (fScale != 0.0 ? fScale : fTickMs) * 1000.0;
+}
+
+// The longer the time since the anchor, the better the scale
+void minethd::calibrate_clock()
+{
+	if(fMsPerTick.load(std::memory_order_relaxed) == 0.0)
+		return;
+
+	uint64_t iTsc = __rdtsc();
+	uint64_t iMs = get_sys_msec();
+	if(iTsc > iClockTsc && iMs > iClockMs + 1000)
+		fMsPerTick.store(double(iMs - iClockMs) / double(iTsc - iClockTsc), std::memory_order_relaxed);
+}
+
+latencyHist* minethd::latency_hist(bool bDouble)
+{
+	std::atomic<latencyHist*>& p = pLatency[oWork.iProfile][oWork.iVariant][bDouble ? 1 : 0];
+	latencyHist* pHist = p.load(std::memory_order_relaxed);
+	if(pHist == nullptr)
+	{
+		pHist = new latencyHist();
+		p.store(pHist, std::memory_order_release);
+	}
+	return pHist;
+}
+
+bool minethd::get_latency(cn_profile iProfile, int iVariant, bool bDouble, latencyHist::merged& out) const
+{
+	latencyHist* pHist = pLatency[iProfile][iVariant][bDouble ? 1 : 0].load(std::memory_order_acquire);
+	if(pHist == nullptr)
+		return false;
+	out.add(*pHist);
+	return true;
+}
+
+void minethd::wait_for_job()
+{
+	uint64_t iStart = get_usec();
+	while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	iStallUsec.store(iStallUsec.load(std::memory_order_relaxed) + get_usec() - iStart, std::memory_order_relaxed);
+}
+
+int minethd::variant_from_blob(const uint8_t* bWorkBlob, uint32_t iWorkSize)
+{
+	// Blobs start with the block major version as a varint, Monero forked to v1 at 7 and to v2 at 8
+	uint64_t iMajor = 0;
+	for(uint32_t i = 0, iShift = 0; i < iWorkSize && iShift < 63; i++, iShift += 7)
+	{
+		iMajor |= uint64_t(bWorkBlob[i] & 0x7F) << iShift;
+		if((bWorkBlob[i] & 0x80) == 0)
+			break;
+	}
+
+	if(iMajor >= 8)
+		return 2;
+	if(iMajor == 7)
+		return 1;
+	return 0;
+}
+
+bool minethd::check_work(miner_work& pWork)
+{
+	if(pWork.bStall)
+		return true;
+
+	if(pWork.iVariant == variant_auto)
+		pWork.iVariant = variant_from_blob(pWork.bWorkBlob, pWork.iWorkSize);
+
+	const char* sError = nullptr;
+	if(pWork.iVariant < 0 || pWork.iVariant >= iVariantCnt)
+		sError = "unknown variant";
+	else if(pWork.iProfile >= cn_profile_cnt)
+		sError = "unknown scratchpad profile";
+	else if(pWork.iWorkSize > sizeof(miner_work::bWorkBlob) || pWork.iNonceOffset + 4 > pWork.iWorkSize)
+		sError = "nonce outside of the blob";
+	else if(pWork.iVariant == 1 && pWork.iWorkSize < 43)
+		sError = "variant 1 needs a blob of at least 43 bytes";
+
+	if(sError != nullptr)
+	{
+		printer::inst()->print_msg(L0, "Job %.16s rejected: %s.", pWork.sJobID, sError);
+		return false;
+	}
+
+	return true;
+}
+
+bool minethd::verify_result(const miner_work& oWork, uint32_t iNonce, const uint8_t* bResult, cryptonight_ctx* ctx)
+{
+	uint8_t bWorkBlob[sizeof(miner_work::bWorkBlob)];
+	uint8_t bHashOut[32];
+
+	int iVariant = oWork.iVariant == variant_auto ? variant_from_blob(oWork.bWorkBlob, oWork.iWorkSize) : oWork.iVariant;
+	if(iVariant < 0 || iVariant >= iVariantCnt || oWork.iNonceOffset + 4 > oWork.iWorkSize)
+		return false;
+
+	memcpy(bWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
+	memcpy(bWorkBlob + oWork.iNonceOffset, &iNonce, sizeof(iNonce));
+
+	cn_hash_fun hash_fun = func_selector(jconf::inst()->HaveHardwareAes(), iVariant, 0, oWork.iProfile);
+	hash_fun(bWorkBlob, oWork.iWorkSize, bHashOut, ctx);
+	restore_rounding();
+	return memcmp(bHashOut, bResult, sizeof(bHashOut)) == 0;
+}
+
+void minethd::build_func_tables()
+{
+	bool bHaveAes = jconf::inst()->HaveHardwareAes();
+	for(uint32_t p = 0; p < cn_profile_cnt; p++)
+	{
+		for(int v = 0; v < iVariantCnt; v++)
+		{
+			oHashFuns[p][v] = func_selector(bHaveAes, v, iAsmVersion, cn_profile(p));
+			oHashFunsDbl[p][v] = func_dbl_selector(bHaveAes, v, iAsmVersion, cn_profile(p));
+		}
+	}
+}
+
 void minethd::consume_work()
 {
-	memcpy(&oWork, &oGlobalWork, sizeof(miner_work));
-	iJobNo++;
-	iConsumeCnt++;
+	// Read the generation first, a slot that changes after this is picked up next time
+	iJobNo = iGlobalJobNo.load(std::memory_order_seq_cst);
+
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		job_slot& slot = oSlots[i];
+		uint64_t iSlotJob = slot.iJobNo.load(std::memory_order_seq_cst);
+		if(iSlotJob == iSlotJobNo[i])
+			continue;
+
+		// The jobs we get at startup aren't switches
+		if(bTrackSwitches && iSlotJobNo[i] != 0)
+			vSwitchUsec.push_back(uint32_t(get_usec() - slot.iSwitchStamp.load(std::memory_order_relaxed)));
+
+		// Pin the published buffer. If the executor published another one in between, ours may
+		// be written to already, so let go of it and look again.
+		uint32_t iBuf;
+		while(true)
+		{
+			iBuf = slot.iPublished.load(std::memory_order_seq_cst);
+			slot.aReaders[iBuf].fetch_add(1, std::memory_order_seq_cst);
+			if(slot.iPublished.load(std::memory_order_seq_cst) == iBuf)
+				break;
+			slot.aReaders[iBuf].fetch_sub(1, std::memory_order_seq_cst);
+		}
+
+		oSlotWork[i] = slot.aWork[iBuf];
+		iSlotJob = slot.aWorkJobNo[iBuf];
+		slot.aReaders[iBuf].fetch_sub(1, std::memory_order_seq_cst);
+		iSlotJobNo[i] = iSlotJob;
+
+		// We only count for the job we copied, a late thread leaves the count of a newer one alone
+		uint64_t iCnt = slot.iConsumed.load(std::memory_order_seq_cst);
+		while((iCnt & ~iConsumeMask) == (iSlotJob << iConsumeBits) &&
+			!slot.iConsumed.compare_exchange_weak(iCnt, iCnt + 1, std::memory_order_seq_cst))
+			;
+	}
+}
+
+size_t minethd::pick_slot()
+{
+	size_t iBest = iMaxSlots;
+	uint64_t iBestClaimed = 0;
+	uint32_t iBestWeight = 0;
+	uint64_t iTotal = 0;
+
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		job_slot& slot = oSlots[i];
+		uint32_t iWeight = slot.iWeight.load(std::memory_order_relaxed);
+		if(iWeight == 0 || oSlotWork[i].bStall || slot.iExhaustedJobNo.load(std::memory_order_relaxed) == iSlotJobNo[i])
+			continue;
+
+		uint64_t iClaimed = slot.iClaimed.load(std::memory_order_relaxed);
+		if(iBest == iMaxSlots || slot_pass_less(iClaimed, iWeight, iBestClaimed, iBestWeight))
+		{
+			iBest = i;
+			iBestClaimed = iClaimed;
+			iBestWeight = iWeight;
+		}
+		iTotal += iWeight;
+	}
+
+	if(iBest == iMaxSlots || iSchedMode.load(std::memory_order_relaxed) == sched_time_slice)
+		return iBest;
+
+	// Partitioning puts the middle of our share of the thread list on the weight scale,
+	// threads are only as equal as their hashrates, so this needs a few threads per slot
+	uint64_t iPos = (2 * iThreadNo + 1) * iTotal / (2 * iThreadCount);
+	for(size_t i = 0; i < iMaxSlots; i++)
+	{
+		uint32_t iWeight = oSlots[i].iWeight.load(std::memory_order_relaxed);
+		if(iWeight == 0 || oSlotWork[i].bStall || oSlots[i].iExhaustedJobNo.load(std::memory_order_relaxed) == iSlotJobNo[i])
+			continue;
+
+		if(iPos < iWeight)
+			return i;
+		iPos -= iWeight;
+	}
+	return iBest;
+}
+
+bool minethd::select_slot(size_t iNext)
+{
+	if(iNext == iSlot && iSlotJobNo[iNext] == iWorkJobNo)
+		return false;
+
+	if(iNext != iSlot && iSlot != iMaxSlots)
+		iSlotSwitchCnt.store(iSlotSwitchCnt.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	oWork = oSlotWork[iNext];
+	iSlot = iNext;
+	iWorkJobNo = iSlotJobNo[iNext];
+	load_work_nonce();
+	return true;
+}
+
+void minethd::load_work_nonce()
+{
+	if(oWork.bStall)
+		return;
+
+	// NiceHash owns the top byte of the nonce
+	uint32_t iPoolNonce;
+	memcpy(&iPoolNonce, oWork.bWorkBlob + oWork.iNonceOffset, sizeof(iPoolNonce));
+	iNiceHashByte = iPoolNonce & 0xFF000000;
+}
+
+bool minethd::fetch_nonce_chunk(nonce_chunk& chunk)
+{
+	if(bYield)
+		std::this_thread::yield();
+
+	uint64_t iStamp = get_msec();
+
+	// Aim for a new chunk every iChunkTargetMs, big enough to keep the shared counter cold,
+	// small enough that a slow thread doesn't hold on to much of the space at the end of a job
+	if(chunk.iSize != 0)
+	{
+		uint64_t iTime = iStamp - chunk.iStamp;
+		if(iTime < iChunkTargetMs / 2 && iChunkSize < iChunkMax)
+			iChunkSize <<= 1;
+		else if(iTime > iChunkTargetMs * 2 && iChunkSize > iChunkMin)
+			iChunkSize >>= 1;
+	}
+
+	job_slot& slot = oSlots[iSlot];
+	uint32_t iBits = calc_space_bits();
+	uint64_t iPos = slot.iNonce.fetch_add(iChunkSize, std::memory_order_relaxed);
+	uint64_t iEnd = std::min(iPos + iChunkSize, uint64_t(1) << iBits);
+
+	if(iPos >= iEnd)
+	{
+		// Only the first thread to run out reports it
+		if(slot.iExhaustedJobNo.exchange(iWorkJobNo, std::memory_order_relaxed) != iWorkJobNo)
+			printer::inst()->print_msg(L1, "Nonce space of job %.16s is exhausted, waiting for a new job.", oWork.sJobID);
+
+		chunk.iSize = 0;
+		return false;
+	}
+
+	slot.iClaimed.fetch_add(iEnd - iPos, std::memory_order_relaxed);
+	chunk.iPos = iPos;
+	chunk.iEnd = iEnd;
+	chunk.iSize = iEnd - iPos;
+	chunk.iStamp = iStamp;
+	return true;
 }
 
 extern "C"
@@ -493,7 +1052,8 @@ extern "C"
 }
 
 #ifdef PERFORMANCE_TUNING
-uint64_t t1, t2;
+// Per thread, every hash loop compares its own main loop time to the minimum
+thread_local uint64_t t1, t2;
 uint64_t min_cycles = uint64_t(-1);
 #endif
 
@@ -613,14 +1173,14 @@ void cryptonight_double_hash_v2_asm(const void* input1, size_t len1, void* outpu
 	extra_hashes[ctx1->hash_state[0] & 3](ctx1->hash_state, 200, (char*)output2);
 }
 
-minethd::cn_hash_fun minethd::func_selector(bool bHaveAes, int variant, int asm_version)
+minethd::cn_hash_fun minethd::func_selector(bool bHaveAes, int variant, int asm_version, cn_profile profile)
 {
 	// We have two independent flag bits in the functions
 	// therefore we will build a binary digit and select the
 	// function as a two digit binary
 	// Digit order SOFT_AES, NO_PREFETCH, SHUFFLE, INT_MATH
 
-	if (asm_version > 0)
+	if (asm_version > 0 && profile == cn_profile_full)
 	{
 		if (!bHaveAes)
 		{
@@ -652,7 +1212,7 @@ minethd::cn_hash_fun minethd::func_selector(bool bHaveAes, int variant, int asm_
 		}
 	}
 
-	static const cn_hash_fun func_table[8] = {
+	static const cn_hash_fun func_table[16] = {
 		cryptonight_hash<0x80000, MEMORY, false, 0>,
 		cryptonight_hash<0x80000, MEMORY, false, 1>,
 		cryptonight_hash<0x80000, MEMORY, false, 2>,
@@ -662,9 +1222,19 @@ minethd::cn_hash_fun minethd::func_selector(bool bHaveAes, int variant, int asm_
 		cryptonight_hash<0x80000, MEMORY, true, 1>,
 		cryptonight_hash<0x80000, MEMORY, true, 2>,
 		cryptonight_hash<0x80000, MEMORY, true, 3>,
+
+		cryptonight_hash<0x40000, MEMORY_LITE, false, 0>,
+		cryptonight_hash<0x40000, MEMORY_LITE, false, 1>,
+		cryptonight_hash<0x40000, MEMORY_LITE, false, 2>,
+		cryptonight_hash<0x40000, MEMORY_LITE, false, 3>,
+
+		cryptonight_hash<0x40000, MEMORY_LITE, true, 0>,
+		cryptonight_hash<0x40000, MEMORY_LITE, true, 1>,
+		cryptonight_hash<0x40000, MEMORY_LITE, true, 2>,
+		cryptonight_hash<0x40000, MEMORY_LITE, true, 3>,
 	};
 
-	return func_table[variant + (bHaveAes ? 0 : 4)];
+	return func_table[variant + (bHaveAes ? 0 : 4) + (profile == cn_profile_lite ? 8 : 0)];
 }
 
 void minethd::pin_thd_affinity()
@@ -679,77 +1249,232 @@ void minethd::pin_thd_affinity()
 	thd_setaffinity(thdHandle.load(), affinity);
 }
 
+void minethd::repin(uint32_t iCpu)
+{
+	affinity = iCpu;
+	if(thdHandle.load() != 0)
+		thd_setaffinity(thdHandle.load(), iCpu);
+}
+
 void minethd::work_main()
 {
 	if(affinity >= 0) //-1 means no affinity
 		pin_thd_affinity();
 
+	if(jconf::inst()->PerfCounters())
+	{
+		bool bOpen = oPerf.open();
+		if(!bOpen)
+			printer::inst()->print_msg(L1, "Thread %llu: perf_event_open failed, no performance counters.", int_port(iThreadNo));
+		else if(!oPerf.hardware())
+			printer::inst()->print_msg(L1, "Thread %llu: no hardware performance counters, only the software ones.", int_port(iThreadNo));
+		bPerfOpen.store(bOpen, std::memory_order_release);
+	}
+
+	if(jconf::inst()->GetCoexistMode() != jconf::coexist_off)
+	{
+		thd_setidle();
+		bYield = true;
+	}
+
+	// Threads without affinity or a known core get a phase of their own
+	if(affinity >= 0 && size_t(affinity) < vCoreOfCpu.size() && vCoreOfCpu[affinity] >= 0)
+		iDutyPhaseUsec = iDutyPeriodUsec * vCoreOfCpu[affinity] / iCoreCnt;
+	else
+		iDutyPhaseUsec = iDutyPeriodUsec * iThreadNo / std::max<uint64_t>(iThreadCount, 1);
+
+	cryptonight_ctx* ctx0 = minethd_alloc_ctx(iHugeCtx > 0);
+	cryptonight_ctx* ctx1 = bAdaptive || bDoubleMode ? minethd_alloc_ctx(iHugeCtx > 1) : nullptr;
+
+	consume_work();
+
+	while (bQuit == 0)
+	{
+		if (bParked.load(std::memory_order_relaxed))
+			park(ctx0, ctx1);
+		else if (bDoubleMode.load(std::memory_order_relaxed))
+			double_hash_loop(ctx0, ctx1);
+		else
+			hash_loop(ctx0);
+	}
+
+	if (ctx0 != nullptr)
+		cryptonight_free_ctx(ctx0);
+	if (ctx1 != nullptr)
+		cryptonight_free_ctx(ctx1);
+}
+
+void minethd::set_core_map(const std::vector<std::vector<uint32_t>>& vCores)
+{
+	vCoreOfCpu.clear();
+	for(size_t i = 0; i < vCores.size(); i++)
+	{
+		for(uint32_t cpu : vCores[i])
+		{
+			if(cpu >= vCoreOfCpu.size())
+				vCoreOfCpu.resize(cpu + 1, -1);
+			vCoreOfCpu[cpu] = int32_t(i);
+		}
+	}
+	iCoreCnt = vCores.size();
+}
+
+// Called after every hash while the duty cycle is below 100%, sleeps if our core is past its burst
+void minethd::duty_rest()
+{
+	uint64_t iBurst = iDutyPeriodUsec * iDutyPct.load(std::memory_order_relaxed) / 100;
+	uint64_t iNow = get_usec();
+	uint64_t iPos = (iNow + iDutyPhaseUsec) % iDutyPeriodUsec;
+	if(iPos < iBurst)
+		return;
+
+	std::this_thread::sleep_for(std::chrono::microseconds(iDutyPeriodUsec - iPos));
+	iRestUsec.store(iRestUsec.load(std::memory_order_relaxed) + get_usec() - iNow, std::memory_order_relaxed);
+}
+
+void minethd::park(cryptonight_ctx*& ctx0, cryptonight_ctx*& ctx1)
+{
+	bool bRelease = jconf::inst()->GetCoexistMode() == jconf::coexist_release;
+	bool bHadCtx1 = ctx1 != nullptr;
+
+	if(bRelease)
+	{
+		cryptonight_free_ctx(ctx0);
+		if(bHadCtx1)
+			cryptonight_free_ctx(ctx1);
+		ctx0 = ctx1 = nullptr;
+	}
+
+	while(bQuit == 0)
+	{
+		// switch_work waits for every thread to take the job, parked ones included
+		if(iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
+			consume_work();
+
+		// Keeps the telemetry at 0 H/s instead of no data
+		iTimestamp.store(get_msec(), std::memory_order_relaxed);
+
+		if(!bParked.load(std::memory_order_relaxed))
+		{
+			// A failed allocation keeps us parked, the co-tenant may have the memory right now
+			if(ctx0 == nullptr)
+				ctx0 = minethd_alloc_ctx(iHugeCtx > 0);
+			if(bHadCtx1 && ctx1 == nullptr)
+				ctx1 = minethd_alloc_ctx(iHugeCtx > 1);
+			if(ctx0 != nullptr && (!bHadCtx1 || ctx1 != nullptr))
+				break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+// Returns on bQuit or when the executor moved us to double mode
+void minethd::hash_loop(cryptonight_ctx* ctx)
+{
 	cn_hash_fun hash_fun;
-	cryptonight_ctx* ctx;
-	uint64_t iCount = 0;
+	uint64_t iCount = iHashCount.load(std::memory_order_relaxed);
+	uint64_t* piHashVal;
 	uint32_t* piNonce;
 	uint8_t bHashOut[32];
+	nonce_chunk chunk = {};
+	bool bFirst = true;
+	latencyHist* pHist = nullptr;
 
-	hash_fun = func_selector(jconf::inst()->HaveHardwareAes(), iVariant, iAsmVersion);
-	ctx = minethd_alloc_ctx();
+	piHashVal = (uint64_t*)(bHashOut + 24);
 
-	piNonce = (uint32_t*)(oWork.bWorkBlob + 39);
-	iConsumeCnt++;
+	hash_fun = nullptr;
+	piNonce = nullptr;
 
-	while (bQuit == 0)
+	while (bQuit == 0 && !bDoubleMode.load(std::memory_order_relaxed) && !bParked.load(std::memory_order_relaxed))
 	{
-		if (oWork.bStall)
+		if (iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
+			consume_work();
+
+		size_t iNext = pick_slot();
+		if (iNext == iMaxSlots)
 		{
 			/*  We are stalled here because the executor didn't find a job for us yet,
 			    either because of network latency, or a socket problem. Since we are
 			    raison d'etre of this software it us sensible to just wait until we have something*/
 
-			while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-			consume_work();
+			wait_for_job();
 			continue;
 		}
 
-		while(iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+		if (select_slot(iNext) || bFirst)
+		{
+			hash_fun = oHashFuns[oWork.iProfile][oWork.iVariant];
+			pHist = latency_hist(false);
+			piNonce = (uint32_t*)(oWork.bWorkBlob + oWork.iNonceOffset);
+			bFirst = false;
+		}
+
+		if(!fetch_nonce_chunk(chunk))
+			continue;
+
+		uint64_t iChunkStart = iCount;
+		while(chunk.iPos < chunk.iEnd && iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo &&
+			!bDoubleMode.load(std::memory_order_relaxed) && !bParked.load(std::memory_order_relaxed))
 		{
 			if ((iCount & 0xF) == 0) //Store stats every 16 hashes
 			{
-				using namespace std::chrono;
-				uint64_t iStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
 				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
+				iTimestamp.store(get_msec(), std::memory_order_relaxed);
 			}
 			iCount++;
 
+			*piNonce = calc_nonce(chunk.iPos++);
+			uint64_t iStartTsc = __rdtsc();
 			hash_fun(oWork.bWorkBlob, oWork.iWorkSize, bHashOut, ctx);
+			pHist->record(__rdtsc() - iStartTsc);
 #ifdef PERFORMANCE_TUNING
 			if (t2 - t1 < min_cycles)
 			{
 				min_cycles = t2 - t1;
 			}
 #endif
+
+			if (*piHashVal < oWork.iTarget)
+			{
+				iResultCount.store(iResultCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				executor::inst()->push_event(ex_event(job_result(oWork.sJobID, *piNonce, bHashOut), oWork.iPoolId));
+			}
+
+			// A new job for our slot arrived while we were hashing
+			if (iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo && oSlots[iSlot].iJobNo.load(std::memory_order_relaxed) != iWorkJobNo)
+				iStaleCount.store(iStaleCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+			if (iDutyPct.load(std::memory_order_relaxed) < 100)
+				duty_rest();
 		}
 
-		consume_work();
-	}
+		oSlots[iSlot].iHashCount.fetch_add(iCount - iChunkStart, std::memory_order_relaxed);
+		iHashCount.store(iCount, std::memory_order_relaxed);
 
-	cryptonight_free_ctx(ctx);
+		// An interrupted chunk says nothing about our hashrate, and the time slicing
+		// shouldn't charge the slot for the nonces we dropped
+		if(chunk.iPos != chunk.iEnd)
+		{
+			oSlots[iSlot].iClaimed.fetch_sub(chunk.iEnd - chunk.iPos, std::memory_order_relaxed);
+			chunk.iSize = 0;
+		}
+	}
 }
 
-minethd::cn_hash_fun_dbl minethd::func_dbl_selector(bool bHaveAes, int variant, int asm_version)
+minethd::cn_hash_fun_dbl minethd::func_dbl_selector(bool bHaveAes, int variant, int asm_version, cn_profile profile)
 {
 	// We have two independent flag bits in the functions
 	// therefore we will build a binary digit and select the
 	// function as a two digit binary
 	// Digit order SOFT_AES, NO_PREFETCH, SHUFFLE, INT_MATH
 
-	if (bHaveAes && (variant == 2) && (asm_version > 0))
+	if (bHaveAes && (variant == 2) && (asm_version > 0) && profile == cn_profile_full)
 	{
 		return cryptonight_double_hash_v2_asm;
 	}
 
-	static const cn_hash_fun_dbl func_table[8] = {
+	static const cn_hash_fun_dbl func_table[16] = {
 		cryptonight_double_hash<0x80000, MEMORY, false, 0>,
 		cryptonight_double_hash<0x80000, MEMORY, false, 1>,
 		cryptonight_double_hash<0x80000, MEMORY, false, 2>,
@@ -759,90 +1484,123 @@ minethd::cn_hash_fun_dbl minethd::func_dbl_selector(bool bHaveAes, int variant,
 		cryptonight_double_hash<0x80000, MEMORY, true, 1>,
 		cryptonight_double_hash<0x80000, MEMORY, true, 2>,
 		cryptonight_double_hash<0x80000, MEMORY, true, 3>,
+
+		cryptonight_double_hash<0x40000, MEMORY_LITE, false, 0>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, false, 1>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, false, 2>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, false, 3>,
+
+		cryptonight_double_hash<0x40000, MEMORY_LITE, true, 0>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, true, 1>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, true, 2>,
+		cryptonight_double_hash<0x40000, MEMORY_LITE, true, 3>,
 	};
 
-	return func_table[variant + (bHaveAes ? 0 : 4)];
+	return func_table[variant + (bHaveAes ? 0 : 4) + (profile == cn_profile_lite ? 8 : 0)];
 }
 
-void minethd::double_work_main()
+// Returns on bQuit or when the executor moved us to single mode
+void minethd::double_hash_loop(cryptonight_ctx* ctx0, cryptonight_ctx* ctx1)
 {
-	if(affinity >= 0) //-1 means no affinity
-		pin_thd_affinity();
-
 	cn_hash_fun_dbl hash_fun;
-	cryptonight_ctx* ctx0;
-	cryptonight_ctx* ctx1;
-	uint64_t iCount = 0;
+	uint64_t iCount = iHashCount.load(std::memory_order_relaxed);
 	uint64_t *piHashVal0, *piHashVal1;
 	uint32_t *piNonce0, *piNonce1;
 	uint8_t bDoubleHashOut[64];
 	uint8_t	bDoubleWorkBlob[sizeof(miner_work::bWorkBlob) * 2];
-	uint32_t iNonce;
-
-	hash_fun = func_dbl_selector(jconf::inst()->HaveHardwareAes(), iVariant, iAsmVersion);
-	ctx0 = minethd_alloc_ctx();
-	ctx1 = minethd_alloc_ctx();
+	nonce_chunk chunk = {};
+	bool bFirst = true;
+	latencyHist* pHist = nullptr;
 
 	piHashVal0 = (uint64_t*)(bDoubleHashOut + 24);
 	piHashVal1 = (uint64_t*)(bDoubleHashOut + 32 + 24);
-	piNonce0 = (uint32_t*)(bDoubleWorkBlob + 39);
-	piNonce1 = (uint32_t*)(bDoubleWorkBlob + oWork.iWorkSize + 39);
 
-	iConsumeCnt++;
+	hash_fun = nullptr;
+	piNonce0 = piNonce1 = nullptr;
 
-	while (bQuit == 0)
+	while (bQuit == 0 && bDoubleMode.load(std::memory_order_relaxed) && !bParked.load(std::memory_order_relaxed))
 	{
-		if (oWork.bStall)
+		if (iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
+			consume_work();
+
+		size_t iNext = pick_slot();
+		if (iNext == iMaxSlots)
 		{
 			/*	We are stalled here because the executor didn't find a job for us yet,
 			either because of network latency, or a socket problem. Since we are
 			raison d'etre of this software it us sensible to just wait until we have something*/
 
-			while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			wait_for_job();
+			continue;
+		}
 
-			consume_work();
+		if (select_slot(iNext) || bFirst)
+		{
+			bFirst = false;
 			memcpy(bDoubleWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
 			memcpy(bDoubleWorkBlob + oWork.iWorkSize, oWork.bWorkBlob, oWork.iWorkSize);
-			piNonce1 = (uint32_t*)(bDoubleWorkBlob + oWork.iWorkSize + 39);
-			continue;
+			hash_fun = oHashFunsDbl[oWork.iProfile][oWork.iVariant];
+			pHist = latency_hist(true);
+			piNonce0 = (uint32_t*)(bDoubleWorkBlob + oWork.iNonceOffset);
+			piNonce1 = (uint32_t*)(bDoubleWorkBlob + oWork.iWorkSize + oWork.iNonceOffset);
 		}
 
-		if(oWork.bNiceHash)
-			iNonce = calc_nicehash_nonce(*piNonce0, oWork.iResumeCnt);
-		else
-			iNonce = calc_start_nonce(oWork.iResumeCnt);
+		if(!fetch_nonce_chunk(chunk))
+			continue;
 
-		while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+		uint64_t iChunkStart = iCount;
+		while (chunk.iPos < chunk.iEnd && iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo &&
+			bDoubleMode.load(std::memory_order_relaxed) && !bParked.load(std::memory_order_relaxed))
 		{
-			if ((iCount & 0x7) == 0) //Store stats every 16 hashes
+			if ((iCount & 0x6) == 0) //Store stats every 8 hashes, the count is odd after a switch from single mode
 			{
-				using namespace std::chrono;
-				uint64_t iStamp = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
 				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
+				iTimestamp.store(get_msec(), std::memory_order_relaxed);
 			}
 
 			iCount += 2;
 
-			*piNonce0 = ++iNonce;
-			*piNonce1 = ++iNonce;
+			*piNonce0 = calc_nonce(chunk.iPos++);
+			*piNonce1 = calc_nonce(chunk.iPos++);
 
+			uint64_t iStartTsc = __rdtsc();
 			hash_fun(bDoubleWorkBlob, oWork.iWorkSize, bDoubleHashOut, bDoubleWorkBlob + oWork.iWorkSize, oWork.iWorkSize, bDoubleHashOut + 32, ctx0, ctx1);
+			pHist->record(__rdtsc() - iStartTsc);
 #ifdef PERFORMANCE_TUNING
 			if (t2 - t1 < min_cycles)
 			{
 				min_cycles = t2 - t1;
 			}
 #endif
+
+			if (*piHashVal0 < oWork.iTarget)
+			{
+				iResultCount.store(iResultCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				executor::inst()->push_event(ex_event(job_result(oWork.sJobID, *piNonce0, bDoubleHashOut), oWork.iPoolId));
+			}
+			if (*piHashVal1 < oWork.iTarget)
+			{
+				iResultCount.store(iResultCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				executor::inst()->push_event(ex_event(job_result(oWork.sJobID, *piNonce1, bDoubleHashOut + 32), oWork.iPoolId));
+			}
+
+			// A new job for our slot arrived while we were hashing
+			if (iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo && oSlots[iSlot].iJobNo.load(std::memory_order_relaxed) != iWorkJobNo)
+				iStaleCount.store(iStaleCount.load(std::memory_order_relaxed) + 2, std::memory_order_relaxed);
+
+			if (iDutyPct.load(std::memory_order_relaxed) < 100)
+				duty_rest();
 		}
 
-		consume_work();
-		memcpy(bDoubleWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
-		memcpy(bDoubleWorkBlob + oWork.iWorkSize, oWork.bWorkBlob, oWork.iWorkSize);
-		piNonce1 = (uint32_t*)(bDoubleWorkBlob + oWork.iWorkSize + 39);
-	}
+		oSlots[iSlot].iHashCount.fetch_add(iCount - iChunkStart, std::memory_order_relaxed);
+		iHashCount.store(iCount, std::memory_order_relaxed);
 
-	cryptonight_free_ctx(ctx0);
-	cryptonight_free_ctx(ctx1);
+		// An interrupted chunk says nothing about our hashrate, and the time slicing
+		// shouldn't charge the slot for the nonces we dropped
+		if(chunk.iPos != chunk.iEnd)
+		{
+			oSlots[iSlot].iClaimed.fetch_sub(chunk.iEnd - chunk.iPos, std::memory_order_relaxed);
+			chunk.iSize = 0;
+		}
+	}
 }
@@ -3,46 +3,92 @@
 #include <atomic>
 #include <assert.h>
 #include <vector>
+#include <string.h>
 #include "crypto/cryptonight.h"
+#include "latencyHist.hpp"
+#include "perfCounters.hpp"
 
 class telemetry
 {
 public:
-	telemetry(size_t iThd);
-	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp);
+	// The executor timer is the sampler, it pushes the counters of every thread each iSampleMs
+	telemetry(size_t iThd, size_t iSampleMs);
+	// iMhz is the clock of the CPU the thread is pinned to, 0 if unknown
+	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp, uint32_t iMhz = 0);
+	// Both are O(1), the window is a fixed number of samples back. NaN until the thread
+	// has a full window or when it didn't update its counters during the window.
 	double calc_telemetry_data(size_t iLastMilisec, size_t iThread);
+	double calc_clock_mhz(size_t iLastMilisec, size_t iThread);
 
 private:
 	constexpr static size_t iBucketSize = 2 << 11; //Power of 2 to simplify calculations
 	constexpr static size_t iBucketMask = iBucketSize - 1;
-	uint32_t* iBucketTop;
-	uint64_t** ppHashCounts;
-	uint64_t** ppTimestamps;
+
+	// The hash count is a running total already, the clock gets prefix sums
+	// so the mean over a window is a difference of two samples as well
+	struct sample
+	{
+		uint64_t iHashCount;
+		uint64_t iTimestamp;
+		uint64_t iMhzSum;
+		uint64_t iMhzCnt; // samples with a known clock
+	};
+
+	// One writer (the sampler), the readers load iPushed first and only touch older samples.
+	// The padding keeps the rings of neighbouring threads off each other's cache line.
+	struct ring
+	{
+		sample* pSamples;
+		std::atomic<uint64_t> iPushed;
+		char pad[64 - sizeof(sample*) - sizeof(uint64_t)];
+	};
+
+	size_t window_samples(size_t iLastMilisec) const;
+
+	size_t iSampleMs;
+	ring* pRings;
 };
 
 class minethd
 {
 public:
+	// Scratchpad size and iteration count of the kernel, the asm kernels only exist for cn_profile_full
+	enum cn_profile : uint32_t { cn_profile_full, cn_profile_lite, cn_profile_cnt };
+
+	static constexpr int iVariantCnt = 4;
+	static constexpr int variant_auto = -1;
+	static constexpr uint32_t iDefaultNonceOffset = 39;
+
 	struct miner_work
 	{
 		char        sJobID[64];
-		uint8_t     bWorkBlob[112];
+		uint8_t     bWorkBlob[128];
 		uint32_t    iWorkSize;
 		uint32_t    iResumeCnt;
+		uint32_t    iNonceOffset;
+		int         iVariant;
+		cn_profile  iProfile;
 		uint64_t    iTarget;
 		bool        bNiceHash;
 		bool        bStall;
 		size_t      iPoolId;
 
-		miner_work() : iWorkSize(0), bStall(true), iPoolId(0) { }
+		miner_work() : iWorkSize(0), iResumeCnt(0), iNonceOffset(iDefaultNonceOffset), iVariant(0),
+			iProfile(cn_profile_full), iTarget(0), bNiceHash(false), bStall(true), iPoolId(0)
+		{
+			memset(sJobID, 0, sizeof(sJobID));
+			memset(bWorkBlob, 0, sizeof(bWorkBlob));
+		}
 
 		miner_work(const char* sJobID, const uint8_t* bWork, uint32_t iWorkSize, uint32_t iResumeCnt,
-			uint64_t iTarget, bool bNiceHash, size_t iPoolId) : iWorkSize(iWorkSize), iResumeCnt(iResumeCnt),
-			iTarget(iTarget), bNiceHash(bNiceHash), bStall(false), iPoolId(iPoolId)
+			uint64_t iTarget, bool bNiceHash, size_t iPoolId) : iWorkSize(iWorkSize),
+			iResumeCnt(iResumeCnt), iNonceOffset(iDefaultNonceOffset), iVariant(variant_auto),
+			iProfile(cn_profile_full), iTarget(iTarget), bNiceHash(bNiceHash), bStall(false), iPoolId(iPoolId)
 		{
 			assert(iWorkSize <= sizeof(bWorkBlob));
 			memcpy(this->sJobID, sJobID, sizeof(miner_work::sJobID));
 			memcpy(this->bWorkBlob, bWork, iWorkSize);
+			memset(this->bWorkBlob + iWorkSize, 0, sizeof(bWorkBlob) - iWorkSize);
 		}
 
 		miner_work(miner_work const&) = delete;
@@ -53,6 +99,9 @@ public:
 
 			iWorkSize = from.iWorkSize;
 			iResumeCnt = from.iResumeCnt;
+			iNonceOffset = from.iNonceOffset;
+			iVariant = from.iVariant;
+			iProfile = from.iProfile;
 			iTarget = from.iTarget;
 			bNiceHash = from.bNiceHash;
 			bStall = from.bStall;
@@ -65,12 +114,14 @@ public:
 			return *this;
 		}
 
-		miner_work(miner_work&& from) : iWorkSize(from.iWorkSize), iTarget(from.iTarget),
+		miner_work(miner_work&& from) : iWorkSize(from.iWorkSize), iResumeCnt(from.iResumeCnt),
+			iNonceOffset(from.iNonceOffset), iVariant(from.iVariant),
+			iProfile(from.iProfile), iTarget(from.iTarget), bNiceHash(from.bNiceHash),
 			bStall(from.bStall), iPoolId(from.iPoolId)
 		{
 			assert(iWorkSize <= sizeof(bWorkBlob));
 			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
+			memcpy(bWorkBlob, from.bWorkBlob, sizeof(bWorkBlob));
 		}
 
 		miner_work& operator=(miner_work&& from)
@@ -79,6 +130,9 @@ public:
 
 			iWorkSize = from.iWorkSize;
 			iResumeCnt = from.iResumeCnt;
+			iNonceOffset = from.iNonceOffset;
+			iVariant = from.iVariant;
+			iProfile = from.iProfile;
 			iTarget = from.iTarget;
 			bNiceHash = from.bNiceHash;
 			bStall = from.bStall;
@@ -92,57 +146,234 @@ public:
 		}
 	};
 
-	static void switch_work(miner_work& pWork);
+	// Several jobs can be mined at the same time, each one lives in a slot with a weight. Slot 0
+	// starts with weight 1 and the others with 0, so switch_work(pWork) alone behaves like a
+	// single job miner. A slot gets hashes only while its job isn't stalled or exhausted.
+	static constexpr size_t iMaxSlots = 4;
+
+	// sched_time_slice - every thread hands its chunks to the slot furthest behind its share
+	// sched_partition - the threads are dealt out to the slots, each thread mines one job
+	enum sched_mode { sched_time_slice, sched_partition };
+
+	static void switch_work(miner_work& pWork) { switch_work(0, pWork); }
+	static void switch_work(size_t iSlot, miner_work& pWork);
+	static void set_slot_weights(const uint32_t* pWeights, size_t iCnt, sched_mode mode);
+	// Hashes finished on the jobs of a slot, stale ones included
+	static uint64_t get_slot_hashes(size_t iSlot);
+	// Wait until every thread picked up the last job of every slot
+	static void sync_work();
 	static std::vector<minethd*>* thread_starter(miner_work& pWork);
+	// Stops, joins and frees the threads, nothing may be mining on them anymore
+	static void thread_stopper(std::vector<minethd*>* pvThreads);
+	typedef void (*cn_hash_fun)(const void*, size_t, void*, cryptonight_ctx*);
+	typedef void(*cn_hash_fun_dbl)(const void*, size_t, void*, const void*, size_t, void*, cryptonight_ctx* __restrict, cryptonight_ctx* __restrict);
+
+	// The kernel a thread would run, asm versions without a kernel for the variant fall back to the C one.
+	// xmr-stak-bench calls them directly, the threads resolve them once in build_func_tables.
+	static cn_hash_fun func_selector(bool bHaveAes, int variant, int asm_version, cn_profile profile = cn_profile_full);
+	static cn_hash_fun_dbl func_dbl_selector(bool bHaveAes, int variant, int asm_version, cn_profile profile = cn_profile_full);
+	// The variant 1 kernels need the table, self_test fills it
+	static void init_variant1_table();
+	static int variant_from_blob(const uint8_t* bWorkBlob, uint32_t iWorkSize);
 	static bool self_test();
+	// The variant 2 kernels switch the rounding mode of the calling thread for their square root and
+	// leave it that way, threads that go on with floating point math after hashing put it back
+	static void restore_rounding();
+
+	// Duty cycle - threads hash for iPct of every iDutyPeriodUsec and sleep for the rest. Siblings
+	// of a core share their phase so the core rests as a whole, the cores are spread over the period
+	// so the load of the package stays flat. vCores are the logical CPUs of every core.
+	static void set_duty_cycle(uint32_t iPct) { iDutyPct.store(iPct, std::memory_order_relaxed); }
+	static uint32_t get_duty_cycle() { return iDutyPct.load(std::memory_order_relaxed); }
+	static void set_core_map(const std::vector<std::vector<uint32_t>>& vCores);
+	// Hashes oWork with iNonce on the calling thread and compares the result, ctx has to fit iProfile
+	static bool verify_result(const miner_work& oWork, uint32_t iNonce, const uint8_t* bResult, cryptonight_ctx* ctx);
 #ifdef PGO_BUILD
 	static int pgo_instrument();
 #endif
 
+	// Written every few hashes and read by the sampler, they get a cache line of their own
+	// whatever the alignment of the object is. iTimestamp is in get_msec milliseconds.
+	char pad0[64];
 	std::atomic<uint64_t> iHashCount;
 	std::atomic<uint64_t> iTimestamp;
+	char pad1[64];
+
+	// Job accounting - only the owning thread writes these, they are exact
+	// once the thread consumed the next job (see sync_work)
+	std::atomic<uint64_t> iStaleCount;  // hashes finished after a newer job was published
+	std::atomic<uint64_t> iResultCount; // hashes below the job target
+	std::atomic<uint64_t> iStallUsec;   // time spent waiting without a job
+	std::atomic<uint64_t> iSlotSwitchCnt; // times the thread moved to the job of another slot
+	std::vector<uint32_t> vSwitchUsec;  // job switch latencies, filled only if bTrackSwitches is set
+	static bool bTrackSwitches;
+
+	// Adaptive threads keep both scratchpads for their whole life, so the executor can flip
+	// bDoubleMode at any time and the thread only leaves its hash loop to take the other one
+	const bool bAdaptive;
+	std::atomic<bool> bDoubleMode;
+
+	// Coexist mode - the executor parks threads while the host is busy, a parked thread
+	// sleeps (with its scratchpads freed in coexist_release) until it is unparked
+	std::atomic<bool> bParked;
+
+	std::atomic<uint64_t> iRestUsec; // time slept by the duty cycle
+
+	// Latency of every hash (of every pair in double mode) in TSC ticks, by the profile, variant
+	// and double mode it ran with. The thread allocates them on first use and records without locks.
+	std::atomic<latencyHist*> pLatency[cn_profile_cnt][iVariantCnt][2];
+	// Everything the thread recorded for one kernel, false if it never ran it
+	bool get_latency(cn_profile iProfile, int iVariant, bool bDouble, latencyHist::merged& out) const;
+	static double tick_usec(); // length of a TSC tick
+
+	// Totals of the perf counters the thread opened for itself with perf_counters set,
+	// false until it did or if none opened. Meant to be read every few seconds.
+	bool read_perf(perfCounters::sample& out) const
+	{
+		return bPerfOpen.load(std::memory_order_acquire) && oPerf.read(out);
+	}
+
+	// Scratchpads allocated since the start and how many of them got huge pages
+	static std::atomic<uint64_t> iCtxCount;
+	static std::atomic<uint64_t> iHugeCtxCount;
+
+	int64_t get_affinity() const { return affinity.load(std::memory_order_relaxed); } // -1 if the thread isn't pinned
+	// Moves a running thread to another CPU, the scratchpads stay where they are
+	void repin(uint32_t iCpu);
+
+	~minethd();
+
+	static uint64_t get_usec();
+	// Millisecond clock for the hash loops, rdtsc scaled to the system clock if the TSC is
+	// invariant. calibrate_clock refines the scale against the anchor taken at the start.
+	static uint64_t get_msec();
+	static void calibrate_clock();
 
 private:
-	typedef void (*cn_hash_fun)(const void*, size_t, void*, cryptonight_ctx*);
-	typedef void(*cn_hash_fun_dbl)(const void*, size_t, void*, const void*, size_t, void*, cryptonight_ctx* __restrict, cryptonight_ctx* __restrict);
+	minethd(miner_work& pWork, size_t iNo, bool double_work, bool adaptive, int asm_version, int64_t affinity, size_t huge_ctx);
+
+	// Nonces are handed out in chunks from a per-job counter shared by all threads, so the
+	// thread count is unlimited and fast threads simply come back for more work sooner.
+	// The counter is 64 bit so it can't wrap when threads keep asking after the nonce space
+	// of the job ran out, the job stalls until the pool sends a new one.
+	struct nonce_chunk
+	{
+		uint64_t iPos;
+		uint64_t iEnd;
+		uint64_t iSize;
+		uint64_t iStamp;
+	};
 
-	minethd(miner_work& pWork, size_t iNo, bool double_work, int variant, int asm_version, int64_t affinity);
+	static constexpr uint64_t iChunkMin = 16;
+	static constexpr uint64_t iChunkMax = 1 << 16;
+	static constexpr uint64_t iChunkTargetMs = 500;
 
-	// We use the top 10 bits of the nonce for thread and resume
-	// This allows us to resume up to 128 threads 4 times before
-	// we get nonce collisions
-	// Bottom 22 bits allow for an hour of work at 1000 H/s
-	inline uint32_t calc_start_nonce(uint32_t resume)
-		{ return (resume * iThreadCount + iThreadNo) << 22; }
+	// Top 2 bits of the nonce space are used for resume (up to 4 times before we get
+	// nonce collisions), NiceHash mode leaves us only the bottom 24 bits to play with
+	inline uint32_t calc_space_bits() { return oWork.bNiceHash ? 24 : 32; }
 
-	// Limited version of the nonce calc above
-	inline uint32_t calc_nicehash_nonce(uint32_t start, uint32_t resume)
-		{ return start | (resume * iThreadCount + iThreadNo) << 18; }
+	inline uint32_t calc_nonce(uint64_t iPos)
+	{
+		uint32_t iBits = calc_space_bits();
+		uint64_t iMask = (uint64_t(1) << iBits) - 1;
+		uint64_t iStart = uint64_t(oWork.iResumeCnt & 3) << (iBits - 2);
+		uint32_t iNonce = uint32_t((iStart + iPos) & iMask);
 
-	static cn_hash_fun func_selector(bool bHaveAes, int variant, int asm_version);
-	static cn_hash_fun_dbl func_dbl_selector(bool bHaveAes, int variant, int asm_version);
+		if(oWork.bNiceHash)
+			iNonce |= iNiceHashByte;
+		return iNonce;
+	}
+
+	void load_work_nonce();
+	bool fetch_nonce_chunk(nonce_chunk& chunk);
+	size_t pick_slot();
+	bool select_slot(size_t iNext);
+
+	static bool check_work(miner_work& pWork);
+
+	// Every kernel a job can ask for is resolved when the thread starts,
+	// so a job switch is just a table lookup
+	void build_func_tables();
+	cn_hash_fun oHashFuns[cn_profile_cnt][iVariantCnt];
+	cn_hash_fun_dbl oHashFunsDbl[cn_profile_cnt][iVariantCnt];
 
 	void work_main();
-	void double_work_main();
+	void park(cryptonight_ctx*& ctx0, cryptonight_ctx*& ctx1);
+	void duty_rest();
+	void hash_loop(cryptonight_ctx* ctx);
+	void double_hash_loop(cryptonight_ctx* ctx0, cryptonight_ctx* ctx1);
 	void consume_work();
+	void wait_for_job();
 
+	// The executor never writes a job over one a thread may be copying. It fills a buffer nobody
+	// reads and publishes its index, a thread pins the buffer it copies with the reader count.
+	// A thread starved in coexist mode pins at most one old buffer, there are enough to go round.
+	static constexpr size_t iWorkBufs = 4;
+	// iConsumed is the job number above iConsumeBits and the threads that copied it below
+	static constexpr uint32_t iConsumeBits = 24;
+	static constexpr uint64_t iConsumeMask = (uint64_t(1) << iConsumeBits) - 1;
+
+	struct job_slot
+	{
+		miner_work aWork[iWorkBufs];
+		uint64_t aWorkJobNo[iWorkBufs];
+		std::atomic<uint32_t> aReaders[iWorkBufs];
+		std::atomic<uint32_t> iPublished;
+		std::atomic<uint64_t> iJobNo;
+		std::atomic<uint64_t> iConsumed;
+		std::atomic<uint64_t> iNonce;
+		std::atomic<uint64_t> iExhaustedJobNo;
+		std::atomic<uint64_t> iClaimed;   // nonces handed out since the weights were set
+		std::atomic<uint64_t> iHashCount;
+		std::atomic<uint64_t> iSwitchStamp;
+		std::atomic<uint32_t> iWeight;
+	};
+
+	// iGlobalJobNo changes with every job of every slot and with the weights,
+	// so the hash loop still has only one counter to watch
+	static job_slot oSlots[iMaxSlots];
 	static std::atomic<uint64_t> iGlobalJobNo;
-	static std::atomic<uint64_t> iConsumeCnt;
+	static std::atomic<sched_mode> iSchedMode;
 	static uint64_t iThreadCount;
 	uint64_t iJobNo;
 
-	static miner_work oGlobalWork;
+	static constexpr uint64_t iDutyPeriodUsec = 200000;
+	static std::atomic<uint32_t> iDutyPct;
+	static std::vector<int32_t> vCoreOfCpu;
+	static size_t iCoreCnt;
+	uint64_t iDutyPhaseUsec;
+
+	// get_msec is iClockMs + (rdtsc - iClockTsc) * fMsPerTick, 0.0 falls back to the system clock.
+	// The anchor is taken once before the first thread starts and never changes after that.
+	static uint64_t iClockTsc;
+	static uint64_t iClockMs;
+	static std::atomic<double> fMsPerTick;
+	static double fTickMs; // measured at the start even if the TSC isn't invariant
+	static void init_clock();
+
+	latencyHist* latency_hist(bool bDouble);
+
+	perfCounters oPerf;
+	std::atomic<bool> bPerfOpen;
+
+	miner_work oSlotWork[iMaxSlots];
+	uint64_t iSlotJobNo[iMaxSlots];
+	size_t iSlot;        // slot oWork was copied from
+	uint64_t iWorkJobNo; // and the slot job it belongs to
 	miner_work oWork;
 
 	void pin_thd_affinity();
 
 	std::thread oWorkThd;
 	std::atomic<std::thread::native_handle_type> thdHandle;
-	uint8_t iThreadNo;
-	int64_t affinity;
+	size_t iThreadNo;
+	uint32_t iNiceHashByte;
+	uint64_t iChunkSize;
+	std::atomic<int64_t> affinity;
 
-	bool bQuit;
-	int iVariant;
+	std::atomic<bool> bQuit;
+	bool bYield; // give the CPU away at every nonce chunk, coexist mode only
 	int iAsmVersion;
+	size_t iHugeCtx; // scratchpads of ours thread_starter found room for in the cgroup hugetlb limit
 };
 
@@ -0,0 +1,476 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "mockpool.h"
+#include "minethd.h"
+#include "jpsock.h"
+#include "jconf.h"
+#include "console.h"
+
+#include "rapidjson/document.h"
+#include "jext.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <set>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#endif
+
+using namespace rapidjson;
+
+struct mockpool::client
+{
+	SOCKET hSocket;
+	char sRecvBuf[16 * 1024];
+	size_t iRecvPos;
+	std::string sSendBuf;
+	size_t iSendPos;
+	std::deque<std::pair<uint64_t, std::string>> qDelayed;
+	bool bLoggedIn;
+	bool bClosed;
+	char sSessionId[32];
+
+	client(SOCKET s) : hSocket(s), iRecvPos(0), iSendPos(0), bLoggedIn(false), bClosed(false) { sSessionId[0] = '\0'; }
+};
+
+struct mockpool::mock_job
+{
+	minethd::miner_work oWork;
+	uint32_t iTarget32;
+	std::set<uint32_t> vNonces;
+};
+
+// Same conversion as the client does, we check shares against exactly what the miner sees
+static inline uint64_t t32_to_t64(uint32_t t)
+{
+	return 0xFFFFFFFFFFFFFFFFULL / (0xFFFFFFFFULL / ((uint64_t)t));
+}
+
+static inline uint64_t xorshift64(uint64_t& s)
+{
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+void mockpool::new_job()
+{
+	mock_job* job = new mock_job();
+	minethd::miner_work& oWork = job->oWork;
+
+	char sJobID[64] = { 0 };
+	snprintf(sJobID, sizeof(sJobID), "mock%llu", int_port(iJobNo++));
+
+	uint8_t bBlob[76];
+	for(size_t i = 0; i < sizeof(bBlob); i++)
+		bBlob[i] = uint8_t(xorshift64(iRngState));
+
+	// Block major version first so variant_auto on the miner picks the configured variant
+	int iVariant = jconf::inst()->GetVariant();
+	bBlob[0] = iVariant == 1 ? 7 : (iVariant == 0 ? 6 : 8);
+	memset(bBlob + minethd::iDefaultNonceOffset, 0, 4);
+
+	job->iTarget32 = uint32_t(0xFFFFFFFFULL / std::max<uint64_t>(cfg.iDifficulty, 1));
+	oWork = minethd::miner_work(sJobID, bBlob, sizeof(bBlob), 0, t32_to_t64(job->iTarget32), false, 0);
+	oWork.iVariant = iVariant;
+
+	vJobs.push_back(job);
+	if(vJobs.size() > 4)
+	{
+		delete vJobs.front();
+		vJobs.erase(vJobs.begin());
+	}
+
+	std::string sMsg = "{\"jsonrpc\":\"2.0\",\"method\":\"job\",\"params\":" + job_json(*job) + "}\n";
+	for(client* c : vClients)
+	{
+		if(c->bLoggedIn && !c->bClosed)
+			send_msg(c, sMsg);
+	}
+}
+
+std::string mockpool::job_json(const mock_job& job)
+{
+	char sBlob[sizeof(minethd::miner_work::bWorkBlob) * 2 + 1];
+	char sTarget[9];
+
+	jpsock::bin2hex(job.oWork.bWorkBlob, job.oWork.iWorkSize, sBlob);
+	jpsock::bin2hex((const uint8_t*)&job.iTarget32, 4, sTarget);
+
+	std::string sOut = "{\"blob\":\"";
+	sOut += sBlob;
+	sOut += "\",\"job_id\":\"";
+	sOut += job.oWork.sJobID;
+	sOut += "\",\"target\":\"";
+	sOut += sTarget;
+	sOut += "\"}";
+	return sOut;
+}
+
+void mockpool::send_msg(client* c, const std::string& sMsg)
+{
+	if(cfg.iLatencyMs == 0)
+	{
+		c->sSendBuf += sMsg;
+		if(!flush(c))
+			c->bClosed = true;
+	}
+	else
+		c->qDelayed.push_back(std::make_pair(iNow + cfg.iLatencyMs * 1000, sMsg));
+}
+
+bool mockpool::flush(client* c)
+{
+	while(c->iSendPos < c->sSendBuf.size())
+	{
+		int ret = send(c->hSocket, c->sSendBuf.data() + c->iSendPos, int(c->sSendBuf.size() - c->iSendPos), MSG_NOSIGNAL);
+		if(ret < 0)
+		{
+			if(sock_would_block())
+				break;
+			return false;
+		}
+		c->iSendPos += ret;
+	}
+
+	if(c->iSendPos == c->sSendBuf.size())
+	{
+		c->sSendBuf.clear();
+		c->iSendPos = 0;
+	}
+
+	oPoller.modify(c->hSocket, c, sock_poller::ev_read | (c->sSendBuf.empty() ? sock_poller::ev_none : sock_poller::ev_write));
+	return true;
+}
+
+bool mockpool::do_recv(client* c)
+{
+	while(true)
+	{
+		if(c->iRecvPos == sizeof(c->sRecvBuf) - 1)
+			return false;
+
+		int ret = recv(c->hSocket, c->sRecvBuf + c->iRecvPos, int(sizeof(c->sRecvBuf) - 1 - c->iRecvPos), 0);
+		if(ret == 0)
+			return false;
+		if(ret < 0)
+			return sock_would_block();
+
+		size_t iScan = c->iRecvPos;
+		c->iRecvPos += ret;
+
+		char* lnstart = c->sRecvBuf;
+		char* lnend;
+		while((lnend = (char*)memchr(c->sRecvBuf + iScan, '\n', c->iRecvPos - iScan)) != nullptr)
+		{
+			*lnend = '\0';
+			iScan = lnend - c->sRecvBuf + 1;
+
+			if(lnend != lnstart && !process_line(c, lnstart))
+				return false;
+			lnstart = lnend + 1;
+		}
+
+		size_t iUsed = lnstart - c->sRecvBuf;
+		memmove(c->sRecvBuf, lnstart, c->iRecvPos - iUsed);
+		c->iRecvPos -= iUsed;
+	}
+}
+
+bool mockpool::process_line(client* c, char* sLine)
+{
+	Document doc;
+	if(doc.ParseInsitu(sLine).HasParseError() || !doc.IsObject())
+		return false;
+
+	const Value* method = GetObjectMember(doc, "method");
+	const Value* id = GetObjectMember(doc, "id");
+	const Value* params = GetObjectMember(doc, "params");
+	if(method == nullptr || id == nullptr || params == nullptr || !method->IsString() || !id->IsUint64() || !params->IsObject())
+		return false;
+
+	char sHead[64];
+	snprintf(sHead, sizeof(sHead), "{\"id\":%llu,\"jsonrpc\":\"2.0\",", int_port(id->GetUint64()));
+	std::string sReply = sHead;
+
+	if(strcmp(method->GetString(), "login") == 0)
+	{
+		snprintf(c->sSessionId, sizeof(c->sSessionId), "session%llu", int_port(iSessionNo++));
+		c->bLoggedIn = true;
+		iLogins++;
+
+		const Value* login = GetObjectMember(*params, "login");
+		printer::inst()->print_msg(L1, "Mock pool: login from %s as %s.",
+			login != nullptr && login->IsString() ? login->GetString() : "?", c->sSessionId);
+
+		sReply += "\"error\":null,\"result\":{\"id\":\"";
+		sReply += c->sSessionId;
+		sReply += "\",\"job\":" + job_json(*vJobs.back()) + ",\"status\":\"OK\"}}\n";
+		send_msg(c, sReply);
+		return true;
+	}
+
+	if(!c->bLoggedIn)
+		return false;
+
+	if(strcmp(method->GetString(), "keepalived") == 0)
+	{
+		send_msg(c, sReply + "\"error\":null,\"result\":{\"status\":\"KEEPALIVED\"}}\n");
+		return true;
+	}
+
+	if(strcmp(method->GetString(), "submit") != 0)
+	{
+		send_msg(c, sReply + "\"error\":{\"code\":-1,\"message\":\"Unknown method\"}}\n");
+		return true;
+	}
+
+	const Value *jobid, *nonce, *result;
+	jobid = GetObjectMember(*params, "job_id");
+	nonce = GetObjectMember(*params, "nonce");
+	result = GetObjectMember(*params, "result");
+
+	uint32_t iNonce;
+	uint8_t bResult[32];
+	if(jobid == nullptr || nonce == nullptr || result == nullptr || !jobid->IsString() || !nonce->IsString() ||
+		!result->IsString() || nonce->GetStringLength() != 8 || result->GetStringLength() != 64 ||
+		!jpsock::hex2bin(nonce->GetString(), 8, (uint8_t*)&iNonce) || !jpsock::hex2bin(result->GetString(), 64, bResult))
+	{
+		iSharesInvalid++;
+		send_msg(c, sReply + "\"error\":{\"code\":-1,\"message\":\"Malformed share\"}}\n");
+		return true;
+	}
+
+	mock_job* job = nullptr;
+	for(mock_job* j : vJobs)
+	{
+		if(strcmp(j->oWork.sJobID, jobid->GetString()) == 0)
+			job = j;
+	}
+
+	const char* sError = nullptr;
+	if(job == nullptr)
+	{
+		iSharesInvalid++;
+		sError = "Unknown job";
+	}
+	else if(job != vJobs.back())
+	{
+		iSharesStale++;
+		sError = "Block expired";
+	}
+	else if(!job->vNonces.insert(iNonce).second)
+	{
+		iSharesDup++;
+		sError = "Duplicate share";
+	}
+	else
+	{
+		uint64_t iStart = minethd::get_usec();
+		bool bValid = minethd::verify_result(job->oWork, iNonce, bResult, ctx);
+		iVerifyUsec += minethd::get_usec() - iStart;
+
+		if(!bValid)
+		{
+			iSharesInvalid++;
+			sError = "Invalid result";
+		}
+		else if(*(uint64_t*)(bResult + 24) >= job->oWork.iTarget)
+		{
+			iSharesLow++;
+			sError = "Low difficulty share";
+		}
+	}
+
+	if(sError != nullptr)
+	{
+		printer::inst()->print_msg(L3, "Mock pool: %s rejected - %s.", c->sSessionId, sError);
+		send_msg(c, sReply + "\"error\":{\"code\":-1,\"message\":\"" + sError + "\"}}\n");
+	}
+	else
+	{
+		iSharesGood++;
+		printer::inst()->print_msg(L3, "Mock pool: %s share accepted.", c->sSessionId);
+		send_msg(c, sReply + "\"error\":null,\"result\":{\"status\":\"OK\"}}\n");
+	}
+
+	return true;
+}
+
+void mockpool::print_stats()
+{
+	uint64_t iChecked = iSharesGood + iSharesInvalid + iSharesLow;
+	printer::inst()->print_msg(L0, "Mock pool: %llu clients, %llu jobs, shares: %llu good, %llu stale, %llu duplicate, %llu low, %llu invalid, %.1f ms avg check",
+		int_port(vClients.size()), int_port(iJobNo), int_port(iSharesGood), int_port(iSharesStale), int_port(iSharesDup),
+		int_port(iSharesLow), int_port(iSharesInvalid), iChecked != 0 ? iVerifyUsec / 1000.0 / iChecked : 0.0);
+}
+
+bool mockpool::run(const mock_cfg& cfg)
+{
+	this->cfg = cfg;
+	iJobNo = iSessionNo = 0;
+	iLogins = iSharesGood = iSharesStale = iSharesDup = iSharesLow = iSharesInvalid = iVerifyUsec = 0;
+	iRngState = cfg.iSeed | 1;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	sock_init();
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(cfg.iPort);
+
+	int iFlag = 1;
+	hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(hListen == INVALID_SOCKET || !oPoller.init())
+	{
+		printer::inst()->print_msg(L0, "Mock pool: failed to create the socket.");
+		return false;
+	}
+
+	setsockopt(hListen, SOL_SOCKET, SO_REUSEADDR, (const char*)&iFlag, sizeof(iFlag));
+	if(bind(hListen, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(hListen, 16) != 0 || !sock_set_nonblock(hListen))
+	{
+		char sErr[256];
+		printer::inst()->print_msg(L0, "Mock pool: failed to listen on port %u: %s", (unsigned)cfg.iPort, sock_strerror(sErr, sizeof(sErr)));
+		sock_close(hListen);
+		return false;
+	}
+	oPoller.add(hListen, this, sock_poller::ev_read);
+
+	ctx = cryptonight_alloc_ctx(0, 0, nullptr);
+	iStart = iNow = minethd::get_usec();
+	new_job();
+
+	printer::inst()->print_msg(L0, "Mock pool: listening on port %u, difficulty %llu, new job every %llu ms, %llu ms latency.",
+		(unsigned)cfg.iPort, int_port(cfg.iDifficulty), int_port(cfg.iJobIntervalMs), int_port(cfg.iLatencyMs));
+
+	uint64_t iNextJob = iNow + cfg.iJobIntervalMs * 1000;
+	uint64_t iNextStats = iNow + 10000000;
+	uint64_t iEnd = cfg.iSeconds != 0 ? iNow + cfg.iSeconds * 1000000 : uint64_t(-1);
+	sock_poller::event evs[sock_poller::iMaxEvents];
+
+	while(iNow < iEnd)
+	{
+		uint64_t iWake = std::min(std::min(iNextJob, iNextStats), iEnd);
+		for(client* c : vClients)
+		{
+			if(!c->qDelayed.empty())
+				iWake = std::min(iWake, c->qDelayed.front().first);
+		}
+
+		int n = oPoller.wait(evs, iWake > iNow ? int((iWake - iNow + 999) / 1000) : 0);
+		iNow = minethd::get_usec();
+
+		for(int i = 0; i < n; i++)
+		{
+			if(evs[i].pData == this)
+			{
+				SOCKET s;
+				while((s = accept(hListen, nullptr, nullptr)) != INVALID_SOCKET)
+				{
+					sock_set_nonblock(s);
+					setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&iFlag, sizeof(iFlag));
+					client* c = new client(s);
+					vClients.push_back(c);
+					oPoller.add(s, c, sock_poller::ev_read);
+				}
+				continue;
+			}
+
+			client* c = (client*)evs[i].pData;
+			if(c->bClosed)
+				continue;
+
+			if((evs[i].iEvents & (sock_poller::ev_read | sock_poller::ev_error)) != 0 && !do_recv(c))
+				c->bClosed = true;
+			else if((evs[i].iEvents & sock_poller::ev_write) != 0 && !flush(c))
+				c->bClosed = true;
+		}
+
+		for(client* c : vClients)
+		{
+			while(!c->bClosed && !c->qDelayed.empty() && c->qDelayed.front().first <= iNow)
+			{
+				c->sSendBuf += c->qDelayed.front().second;
+				c->qDelayed.pop_front();
+				if(!flush(c))
+					c->bClosed = true;
+			}
+		}
+
+		if(iNow >= iNextJob)
+		{
+			new_job();
+			iNextJob = iNow + cfg.iJobIntervalMs * 1000;
+		}
+
+		// Closed clients are only freed here, events for them may still be in the batch above
+		for(size_t i = 0; i < vClients.size(); )
+		{
+			client* c = vClients[i];
+			if(c->bClosed)
+			{
+				printer::inst()->print_msg(L1, "Mock pool: %s disconnected.", c->sSessionId[0] != '\0' ? c->sSessionId : "client");
+				oPoller.remove(c->hSocket);
+				sock_close(c->hSocket);
+				delete c;
+				vClients.erase(vClients.begin() + i);
+			}
+			else
+				i++;
+		}
+
+		if(iNow >= iNextStats && iNow < iEnd)
+		{
+			print_stats();
+			iNextStats = iNow + 10000000;
+		}
+	}
+
+	print_stats();
+
+	for(client* c : vClients)
+	{
+		sock_close(c->hSocket);
+		delete c;
+	}
+	vClients.clear();
+
+	for(mock_job* job : vJobs)
+		delete job;
+	vJobs.clear();
+
+	sock_close(hListen);
+	cryptonight_free_ctx(ctx);
+	return true;
+}
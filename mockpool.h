@@ -0,0 +1,61 @@
+#pragma once
+#include "sockpoll.hpp"
+#include "crypto/cryptonight.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A local Stratum pool for tests and latency measurements. It hands out random jobs on a timer,
+// checks every submitted share with the real hash function and answers like a real pool would,
+// optionally after an artificial delay that stands in for the network round trip.
+class mockpool
+{
+public:
+	struct mock_cfg
+	{
+		uint16_t iPort;
+		uint64_t iJobIntervalMs;
+		uint64_t iDifficulty;
+		uint64_t iLatencyMs;  // added before everything we send
+		uint64_t iSeconds;    // 0 means run until killed
+		uint64_t iSeed;
+	};
+
+	bool run(const mock_cfg& cfg);
+
+private:
+	struct client;
+	struct mock_job;
+
+	void new_job();
+	void send_msg(client* c, const std::string& sMsg);
+	bool flush(client* c);
+	bool do_recv(client* c);
+	bool process_line(client* c, char* sLine);
+	void print_stats();
+
+	std::string job_json(const mock_job& job);
+
+	mock_cfg cfg;
+	uint64_t iNow;
+	uint64_t iStart;
+	uint64_t iJobNo;
+	uint64_t iSessionNo;
+	uint64_t iRngState;
+
+	std::vector<client*> vClients;
+	std::vector<mock_job*> vJobs;  // newest last, older ones only exist to tell stale shares apart
+
+	uint64_t iLogins;
+	uint64_t iSharesGood;
+	uint64_t iSharesStale;
+	uint64_t iSharesDup;
+	uint64_t iSharesLow;
+	uint64_t iSharesInvalid;
+	uint64_t iVerifyUsec;
+
+	cryptonight_ctx* ctx;
+	sock_poller oPoller;
+	SOCKET hListen;
+};
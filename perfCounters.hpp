@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Performance counters of one thread through perf_event_open. The thread opens them itself and
+// another one reads them every few seconds, there is nothing in the hash loop. The counters come
+// in groups the PMU schedules together, so the ratios within a group are exact and a group that
+// had to share the PMU gets scaled by the time it ran. VMs and containers often have no PMU or
+// don't let us use it, the software group (task clock, page faults, context switches, migrations)
+// works wherever perf_event_open is allowed at all. There is no generic L2 miss event, the LLC
+// misses stand in for it. Nothing opens outside Linux.
+class perfCounters
+{
+public:
+	enum counter { cycles, instructions, stalled_front, stalled_back, l1d_miss, llc_miss, dtlb_miss, itlb_miss,
+		task_clock, page_faults, ctx_switches, migrations, counter_cnt };
+
+	struct sample
+	{
+		uint64_t aVal[counter_cnt]; // task_clock in ns
+		bool aHave[counter_cnt];
+	};
+
+	static const char* name(counter c)
+	{
+		static const char* sNames[counter_cnt] = { "cycles", "instructions", "stalled_frontend", "stalled_backend",
+			"l1d_misses", "llc_misses", "dtlb_misses", "itlb_misses", "task_clock_ns", "page_faults", "context_switches",
+			"migrations" };
+		return sNames[c];
+	}
+
+	// What happened between two samples, a counter is only there if both had it
+	static sample delta(const sample& from, const sample& to)
+	{
+		sample d;
+		for(size_t i = 0; i < counter_cnt; i++)
+		{
+			d.aHave[i] = from.aHave[i] && to.aHave[i] && to.aVal[i] >= from.aVal[i];
+			d.aVal[i] = d.aHave[i] ? to.aVal[i] - from.aVal[i] : 0;
+		}
+		return d;
+	}
+
+	perfCounters()
+	{
+		for(size_t g = 0; g < iGroupCnt; g++)
+		{
+			aLeader[g] = -1;
+			aMembers[g] = 0;
+		}
+	}
+
+	~perfCounters() { close(); }
+
+	// Counts the calling thread from now on, false if not a single counter opened
+	bool open()
+	{
+		close();
+#ifdef __linux__
+		static const counter aGroups[iGroupCnt][iGroupMax] = {
+			{ cycles, instructions, stalled_front, stalled_back },
+			{ l1d_miss, llc_miss, dtlb_miss, itlb_miss },
+			{ task_clock, page_faults, ctx_switches, migrations } };
+
+		bool bAny = false;
+		for(size_t g = 0; g < iGroupCnt; g++)
+		{
+			// The first counter the kernel accepts leads the group, the others are left out
+			for(size_t i = 0; i < iGroupMax; i++)
+			{
+				int fd = open_event(aGroups[g][i], aLeader[g]);
+				if(fd < 0)
+					continue;
+				if(aLeader[g] < 0)
+					aLeader[g] = fd;
+				else
+					aFollowers[g][aMembers[g] - 1] = fd;
+				aOrder[g][aMembers[g]++] = aGroups[g][i];
+				bAny = true;
+			}
+		}
+		return bAny;
+#else
+		return false;
+#endif
+	}
+
+	// True if the PMU counts for us, the software group alone doesn't count
+	bool hardware() const
+	{
+		return aLeader[0] >= 0 || aLeader[1] >= 0;
+	}
+
+	// Totals since open, false if nothing is open
+	bool read(sample& out) const
+	{
+		memset(&out, 0, sizeof(out));
+#ifdef __linux__
+		bool bAny = false;
+		for(size_t g = 0; g < iGroupCnt; g++)
+		{
+			if(aLeader[g] < 0)
+				continue;
+
+			// nr, time enabled, time running, a value per member
+			uint64_t aBuf[3 + iGroupMax];
+			ssize_t iLen = ::read(aLeader[g], aBuf, sizeof(aBuf));
+			if(iLen < ssize_t(3 * sizeof(uint64_t)) || aBuf[0] != aMembers[g] || aBuf[2] == 0)
+				continue;
+
+			double fScale = aBuf[2] < aBuf[1] ? double(aBuf[1]) / double(aBuf[2]) : 1.0;
+			for(size_t i = 0; i < aMembers[g]; i++)
+			{
+				out.aVal[aOrder[g][i]] = uint64_t(double(aBuf[3 + i]) * fScale);
+				out.aHave[aOrder[g][i]] = true;
+			}
+			bAny = true;
+		}
+		return bAny;
+#else
+		return false;
+#endif
+	}
+
+	void close()
+	{
+#ifdef __linux__
+		for(size_t g = 0; g < iGroupCnt; g++)
+		{
+			for(size_t i = 1; i < aMembers[g]; i++)
+				::close(aFollowers[g][i - 1]);
+			if(aLeader[g] >= 0)
+				::close(aLeader[g]);
+			aLeader[g] = -1;
+			aMembers[g] = 0;
+		}
+#endif
+	}
+
+private:
+	static constexpr size_t iGroupCnt = 3;
+	static constexpr size_t iGroupMax = 4;
+
+#ifdef __linux__
+	static int open_event(counter c, int iGroupFd)
+	{
+		static const uint64_t iRead = uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8;
+		static const uint64_t iMiss = uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16;
+
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		switch(c)
+		{
+		case cycles:        attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case instructions:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case stalled_front: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_STALLED_CYCLES_FRONTEND; break;
+		case stalled_back:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND; break;
+		case l1d_miss:      attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_L1D | iRead | iMiss; break;
+		case llc_miss:      attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_LL | iRead | iMiss; break;
+		case dtlb_miss:     attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_DTLB | iRead | iMiss; break;
+		case itlb_miss:     attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_ITLB | iRead | iMiss; break;
+		case task_clock:    attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+		case page_faults:   attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+		case ctx_switches:  attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+		case migrations:    attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_CPU_MIGRATIONS; break;
+		default: return -1;
+		}
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_hv = 1;
+
+		// Page faults and context switches happen in the kernel, but perf_event_paranoid 2 (the
+		// default) only allows user space counting to unprivileged users
+		int fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, iGroupFd, 0));
+		if(fd < 0)
+		{
+			attr.exclude_kernel = 1;
+			fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, iGroupFd, 0));
+		}
+		return fd;
+	}
+
+	int aFollowers[iGroupCnt][iGroupMax - 1];
+#endif
+
+	int aLeader[iGroupCnt];
+	size_t aMembers[iGroupCnt];
+	counter aOrder[iGroupCnt][iGroupMax];
+};
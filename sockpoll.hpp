@@ -0,0 +1,232 @@
+#pragma once
+#include "socks.h"
+#include <stdint.h>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#include <netinet/in.h>
+#endif
+
+// Readiness notification for a handful of non-blocking sockets - epoll on Linux, poll everywhere else.
+// wait() returns the opaque pointer registered with each ready socket. wake() can be called from
+// any thread and makes a blocked wait() return early, that's how other threads hand us work.
+class sock_poller
+{
+public:
+	enum : uint32_t { ev_none = 0, ev_read = 1, ev_write = 2, ev_error = 4 };
+
+	struct event
+	{
+		void* pData;
+		uint32_t iEvents;
+	};
+
+	static constexpr int iMaxEvents = 32;
+
+#if defined(__linux__)
+	sock_poller() : iEpollFd(-1), iWakeFd(-1) {}
+
+	~sock_poller()
+	{
+		if(iWakeFd != -1)
+			close(iWakeFd);
+		if(iEpollFd != -1)
+			close(iEpollFd);
+	}
+
+	bool init()
+	{
+		iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+		iWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(iEpollFd == -1 || iWakeFd == -1)
+			return false;
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		return epoll_ctl(iEpollFd, EPOLL_CTL_ADD, iWakeFd, &ev) == 0;
+	}
+
+	bool add(SOCKET s, void* pData, uint32_t iEvents)
+	{
+		epoll_event ev = {};
+		ev.events = to_epoll(iEvents);
+		ev.data.ptr = pData;
+		return epoll_ctl(iEpollFd, EPOLL_CTL_ADD, s, &ev) == 0;
+	}
+
+	bool modify(SOCKET s, void* pData, uint32_t iEvents)
+	{
+		epoll_event ev = {};
+		ev.events = to_epoll(iEvents);
+		ev.data.ptr = pData;
+		return epoll_ctl(iEpollFd, EPOLL_CTL_MOD, s, &ev) == 0;
+	}
+
+	void remove(SOCKET s)
+	{
+		epoll_event ev = {};
+		epoll_ctl(iEpollFd, EPOLL_CTL_DEL, s, &ev);
+	}
+
+	// Returns the number of events stored in pOut, 0 on timeout or wake-up
+	int wait(event* pOut, int iTimeoutMs)
+	{
+		epoll_event evs[iMaxEvents];
+		int n = epoll_wait(iEpollFd, evs, iMaxEvents, iTimeoutMs);
+		int iOut = 0;
+
+		for(int i = 0; i < n; i++)
+		{
+			if(evs[i].data.ptr == nullptr)
+			{
+				uint64_t iVal;
+				while(read(iWakeFd, &iVal, sizeof(iVal)) > 0) {}
+				continue;
+			}
+
+			pOut[iOut].pData = evs[i].data.ptr;
+			pOut[iOut].iEvents = ((evs[i].events & EPOLLIN) ? ev_read : ev_none) |
+				((evs[i].events & EPOLLOUT) ? ev_write : ev_none) |
+				((evs[i].events & (EPOLLERR | EPOLLHUP)) ? ev_error : ev_none);
+			iOut++;
+		}
+
+		return iOut;
+	}
+
+	void wake()
+	{
+		uint64_t iVal = 1;
+		if(write(iWakeFd, &iVal, sizeof(iVal)) < 0) {}
+	}
+
+private:
+	static inline uint32_t to_epoll(uint32_t iEvents)
+	{
+		return ((iEvents & ev_read) ? uint32_t(EPOLLIN) : 0) | ((iEvents & ev_write) ? uint32_t(EPOLLOUT) : 0);
+	}
+
+	int iEpollFd;
+	int iWakeFd;
+
+#else
+	// Without eventfd we wake ourselves up with a datagram sent to a loopback UDP socket
+	sock_poller() : hWake(INVALID_SOCKET) {}
+
+	~sock_poller()
+	{
+		if(hWake != INVALID_SOCKET)
+			sock_close(hWake);
+	}
+
+	bool init()
+	{
+		sockaddr_in addr = {};
+		socklen_t iAddrLen = sizeof(addr);
+
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+
+		hWake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if(hWake == INVALID_SOCKET)
+			return false;
+
+		if(bind(hWake, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+			getsockname(hWake, (sockaddr*)&addr, &iAddrLen) != 0 ||
+			connect(hWake, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+			!sock_set_nonblock(hWake))
+			return false;
+
+		return add(hWake, nullptr, ev_read);
+	}
+
+	bool add(SOCKET s, void* pData, uint32_t iEvents)
+	{
+		pollfd fd = {};
+		fd.fd = s;
+		fd.events = to_poll(iEvents);
+		vFds.push_back(fd);
+		vData.push_back(pData);
+		return true;
+	}
+
+	bool modify(SOCKET s, void* pData, uint32_t iEvents)
+	{
+		for(size_t i = 0; i < vFds.size(); i++)
+		{
+			if(vFds[i].fd == s)
+			{
+				vFds[i].events = to_poll(iEvents);
+				vData[i] = pData;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void remove(SOCKET s)
+	{
+		for(size_t i = 0; i < vFds.size(); i++)
+		{
+			if(vFds[i].fd == s)
+			{
+				vFds.erase(vFds.begin() + i);
+				vData.erase(vData.begin() + i);
+				return;
+			}
+		}
+	}
+
+	int wait(event* pOut, int iTimeoutMs)
+	{
+#ifdef _WIN32
+		int n = WSAPoll(vFds.data(), (ULONG)vFds.size(), iTimeoutMs);
+#else
+		int n = poll(vFds.data(), vFds.size(), iTimeoutMs);
+#endif
+		int iOut = 0;
+
+		for(size_t i = 0; n > 0 && i < vFds.size() && iOut < iMaxEvents; i++)
+		{
+			short iRev = vFds[i].revents;
+			if(iRev == 0)
+				continue;
+
+			if(vData[i] == nullptr)
+			{
+				char buf[16];
+				while(recv(hWake, buf, sizeof(buf), 0) > 0) {}
+				continue;
+			}
+
+			pOut[iOut].pData = vData[i];
+			pOut[iOut].iEvents = ((iRev & POLLIN) ? ev_read : ev_none) | ((iRev & POLLOUT) ? ev_write : ev_none) |
+				((iRev & (POLLERR | POLLHUP | POLLNVAL)) ? ev_error : ev_none);
+			iOut++;
+		}
+
+		return iOut;
+	}
+
+	void wake()
+	{
+		send(hWake, "", 1, 0);
+	}
+
+private:
+	static inline short to_poll(uint32_t iEvents)
+	{
+		return ((iEvents & ev_read) ? POLLIN : 0) | ((iEvents & ev_write) ? POLLOUT : 0);
+	}
+
+	SOCKET hWake;
+	std::vector<pollfd> vFds;
+	std::vector<void*> vData;
+#endif
+};
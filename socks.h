@@ -51,6 +51,21 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 	return buf;
 }
 
+inline bool sock_set_nonblock(SOCKET s)
+{
+	u_long iMode = 1;
+	return ioctlsocket(s, FIONBIO, &iMode) == 0;
+}
+
+// True if the last call failed only because it would have to wait
+inline bool sock_would_block()
+{
+	int err = WSAGetLastError();
+	return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+#define MSG_NOSIGNAL 0
+
 #else
 
 /* Assume that any non-Windows platform uses POSIX-style sockets instead. */
@@ -60,6 +75,7 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 #include <unistd.h> /* Needed for close() */
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #if defined(__FreeBSD__)
 #include <netinet/in.h> /* Needed for IPPROTO_TCP */
 #endif
@@ -94,4 +110,20 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 	buf[0] = '\0';
 	return gai_strerror(err);
 }
+
+inline bool sock_set_nonblock(SOCKET s)
+{
+	int iFlags = fcntl(s, F_GETFL, 0);
+	return iFlags != -1 && fcntl(s, F_SETFL, iFlags | O_NONBLOCK) == 0;
+}
+
+// True if the last call failed only because it would have to wait
+inline bool sock_would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 #endif
@@ -0,0 +1,250 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "sweep.h"
+#include "minethd.h"
+#include "jconf.h"
+#include "energy.h"
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+void sweep::measure(step& s, uint64_t iSeconds)
+{
+	std::vector<jconf::thd_cfg> vCfg;
+	for(uint32_t cpu : s.vCpus)
+	{
+		jconf::thd_cfg cfg;
+		cfg.bDoubleMode = s.iWays == 2;
+		cfg.bAdaptive = false;
+		cfg.iVariant = jconf::inst()->GetVariant();
+		cfg.iAsmVersion = iAsmVersion;
+		cfg.iCpuAff = cpu;
+		vCfg.push_back(cfg);
+	}
+	jconf::inst()->SetThreadConfig(vCfg);
+
+	// The constructor copies the whole job id, a short literal would be read past its end
+	char sJobId[sizeof(minethd::miner_work::sJobID)] = "sweep";
+	uint8_t work[76] = {0};
+	minethd::miner_work oWork = minethd::miner_work(sJobId, work, sizeof(work), 0, 0, false, 0);
+	oWork.iVariant = iVariant;
+	std::vector<minethd*>* pvThreads = minethd::thread_starter(oWork);
+	size_t iCnt = pvThreads->size();
+	minethd::set_duty_cycle(s.iDuty);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(iWarmupMs));
+	double fCpuStart = energymeter::process_cpu_sec();
+	double fJoulesStart = energymeter::inst()->read_joules();
+
+	// The counters are only updated every few hashes, each one comes with its own timestamp
+	std::vector<uint64_t> vFirstCount(iCnt), vFirstStamp(iCnt), vCount(iCnt), vStamp(iCnt);
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		vFirstCount[i] = vCount[i] = (*pvThreads)[i]->iHashCount.load();
+		vFirstStamp[i] = vStamp[i] = (*pvThreads)[i]->iTimestamp.load();
+	}
+
+	std::vector<double> vSamples;
+	for(uint64_t sec = 0; sec < iSeconds; sec++)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		double fHps = 0.0;
+		for(size_t i = 0; i < iCnt; i++)
+		{
+			uint64_t iCount = (*pvThreads)[i]->iHashCount.load();
+			uint64_t iStamp = (*pvThreads)[i]->iTimestamp.load();
+			if(iStamp > vStamp[i])
+				fHps += (iCount - vCount[i]) * 1000.0 / (iStamp - vStamp[i]);
+			vCount[i] = iCount;
+			vStamp[i] = iStamp;
+		}
+		vSamples.push_back(fHps);
+	}
+
+	double fCpuSec = energymeter::process_cpu_sec() - fCpuStart;
+	double fJoules = energymeter::inst()->read_joules() - fJoulesStart;
+	minethd::thread_stopper(pvThreads);
+	jconf::inst()->ClearThreadConfig();
+
+	uint64_t iHashes = 0;
+	s.vThreadHps.assign(iCnt, 0.0);
+	s.fHps = 0.0;
+	for(size_t i = 0; i < iCnt; i++)
+	{
+		if(vStamp[i] > vFirstStamp[i])
+			s.vThreadHps[i] = (vCount[i] - vFirstCount[i]) * 1000.0 / (vStamp[i] - vFirstStamp[i]);
+		s.fHps += s.vThreadHps[i];
+		iHashes += vCount[i] - vFirstCount[i];
+	}
+	s.fHpcs = fCpuSec > 0.0 ? iHashes / fCpuSec : 0.0;
+	s.fWatts = fJoules / iSeconds;
+	s.fHpj = fJoules > 0.0 ? iHashes / fJoules : 0.0;
+
+	double fMean = 0.0, fVar = 0.0;
+	for(double f : vSamples)
+		fMean += f;
+	fMean /= vSamples.size();
+	for(double f : vSamples)
+		fVar += (f - fMean) * (f - fMean);
+	s.fStdDev = vSamples.size() > 1 ? sqrt(fVar / (vSamples.size() - 1)) : 0.0;
+}
+
+bool sweep::run(const std::vector<autotune::cache_domain>& vDomains, const char* sOutFile, uint64_t iSeconds)
+{
+	vSteps.clear();
+
+	// Cores first inside a domain, then the next domain
+	std::vector<uint32_t> vOrder;
+	for(const autotune::cache_domain& dom : vDomains)
+	{
+		for(size_t pu = 0; ; pu++)
+		{
+			bool bFound = false;
+			for(const std::vector<uint32_t>& core : dom.vCores)
+			{
+				if(pu < core.size())
+				{
+					vOrder.push_back(core[pu]);
+					bFound = true;
+				}
+			}
+
+			if(!bFound)
+				break;
+		}
+	}
+
+	if(vOrder.empty())
+	{
+		printer::inst()->print_msg(L0, "Sweep failed: no CPU topology.");
+		return false;
+	}
+
+	iVariant = jconf::inst()->GetVariant();
+	if(iVariant < 0)
+		iVariant = 2;
+	iAsmVersion = jconf::inst()->GetAsmVersion();
+
+	std::vector<std::vector<uint32_t>> vCores;
+	for(const autotune::cache_domain& dom : vDomains)
+		vCores.insert(vCores.end(), dom.vCores.begin(), dom.vCores.end());
+	minethd::set_core_map(vCores);
+
+	printer::inst()->print_msg(L0, "Sweep: 1 to %llu threads in single and double mode, then duty cycles, %llu seconds each.",
+		int_port(vOrder.size()), int_port(iSeconds));
+
+	double fBase[3] = { 0.0 };
+	auto run_step = [&](size_t iThreads, size_t iWays, uint32_t iDuty)
+	{
+		step s;
+		s.iThreads = iThreads;
+		s.iWays = iWays;
+		s.iDuty = iDuty;
+		s.vCpus.assign(vOrder.begin(), vOrder.begin() + iThreads);
+		measure(s, iSeconds);
+
+		if(iThreads == 1 && iDuty == 100)
+			fBase[iWays] = s.fHps;
+		s.fEfficiency = fBase[iWays] > 0.0 ? s.fHps * 100.0 / (fBase[iWays] * iThreads * iDuty) : 0.0;
+
+		printer::inst()->print_msg(L0, "Sweep: %llu threads x %llu ways at %u%% - %.1f H/S (sd %.1f), %.1f per thread, %.1f per CPU second, efficiency %.1f%%, %.1f W, %.2f H/J",
+			int_port(iThreads), int_port(iWays), iDuty, s.fHps, s.fStdDev, s.fHps / iThreads, s.fHpcs, s.fEfficiency * 100.0, s.fWatts, s.fHpj);
+		vSteps.push_back(s);
+	};
+
+	for(size_t iWays = 1; iWays <= 2; iWays++)
+	{
+		for(size_t iThreads = 1; iThreads <= vOrder.size(); iThreads++)
+			run_step(iThreads, iWays, 100);
+	}
+
+	// Same CPU budgets as dropping threads, but every core keeps hashing
+	for(uint32_t iDuty = 80; iDuty >= 20; iDuty -= 20)
+		run_step(vOrder.size(), 1, iDuty);
+
+	size_t iLen = strlen(sOutFile);
+	bool bJson = iLen >= 5 && strcmp(sOutFile + iLen - 5, ".json") == 0;
+	if(!(bJson ? write_json(sOutFile) : write_csv(sOutFile)))
+	{
+		printer::inst()->print_msg(L0, "Sweep: failed to write %s.", sOutFile);
+		return false;
+	}
+
+	printer::inst()->print_msg(L0, "Sweep: results written to %s.", sOutFile);
+	return true;
+}
+
+bool sweep::write_csv(const char* sOutFile)
+{
+	FILE* f = fopen(sOutFile, "w");
+	if(f == nullptr)
+		return false;
+
+	// Lists inside a field are separated by spaces, so they don't need quoting
+	fprintf(f, "threads,ways,duty,hashes,cpus,hps,hps_stddev,hps_per_thread,hps_per_cpu_sec,efficiency,watts,hps_per_joule,thread_hps\n");
+	for(const step& s : vSteps)
+	{
+		fprintf(f, "%llu,%llu,%u,%llu,", int_port(s.iThreads), int_port(s.iWays), s.iDuty, int_port(s.iThreads * s.iWays));
+		for(size_t i = 0; i < s.vCpus.size(); i++)
+			fprintf(f, i == 0 ? "%u" : " %u", s.vCpus[i]);
+		fprintf(f, ",%.2f,%.2f,%.2f,%.2f,%.4f,%.2f,%.3f,", s.fHps, s.fStdDev, s.fHps / s.iThreads, s.fHpcs, s.fEfficiency, s.fWatts, s.fHpj);
+		for(size_t i = 0; i < s.vThreadHps.size(); i++)
+			fprintf(f, i == 0 ? "%.2f" : " %.2f", s.vThreadHps[i]);
+		fprintf(f, "\n");
+	}
+
+	return fclose(f) == 0;
+}
+
+bool sweep::write_json(const char* sOutFile)
+{
+	FILE* f = fopen(sOutFile, "w");
+	if(f == nullptr)
+		return false;
+
+	fprintf(f, "{\n\t\"variant\" : %d,\n\t\"asm_version\" : %d,\n\t\"energy_source\" : \"%s\",\n\t\"steps\" : [\n",
+		iVariant, iAsmVersion, energymeter::inst()->get_source_name());
+	for(size_t n = 0; n < vSteps.size(); n++)
+	{
+		const step& s = vSteps[n];
+		fprintf(f, "\t\t{ \"threads\" : %llu, \"ways\" : %llu, \"duty\" : %u, \"hashes\" : %llu, \"cpus\" : [",
+			int_port(s.iThreads), int_port(s.iWays), s.iDuty, int_port(s.iThreads * s.iWays));
+		for(size_t i = 0; i < s.vCpus.size(); i++)
+			fprintf(f, i == 0 ? "%u" : ", %u", s.vCpus[i]);
+		fprintf(f, "], \"hps\" : %.2f, \"hps_stddev\" : %.2f, \"hps_per_thread\" : %.2f, \"hps_per_cpu_sec\" : %.2f, \"efficiency\" : %.4f, \"watts\" : %.2f, \"hps_per_joule\" : %.3f, \"thread_hps\" : [",
+			s.fHps, s.fStdDev, s.fHps / s.iThreads, s.fHpcs, s.fEfficiency, s.fWatts, s.fHpj);
+		for(size_t i = 0; i < s.vThreadHps.size(); i++)
+			fprintf(f, i == 0 ? "%.2f" : ", %.2f", s.vThreadHps[i]);
+		fprintf(f, "] }%s\n", n + 1 < vSteps.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+
+	return fclose(f) == 0;
+}
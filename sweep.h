@@ -0,0 +1,43 @@
+#pragma once
+#include "autotune.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Runs the configured kernel on 1 to N threads, in single and in double mode, and writes how
+// the hashrate scales to a CSV or JSON file. Threads are added in the order autoconf uses them:
+// cache domain by cache domain, the first PU of every core before any of its siblings.
+// The last steps keep all threads and lower the duty cycle instead, hashes per CPU second
+// tell which of the two ways to save CPU costs less hashrate, hashes per joule which one saves power.
+class sweep
+{
+public:
+	bool run(const std::vector<autotune::cache_domain>& vDomains, const char* sOutFile, uint64_t iSeconds);
+
+private:
+	struct step
+	{
+		size_t iThreads;
+		size_t iWays;      // hashes per thread, 2 is double mode
+		uint32_t iDuty;    // percent
+		std::vector<uint32_t> vCpus;
+		double fHps;       // sum of the thread rates over the whole step
+		double fStdDev;    // of the one second samples
+		double fEfficiency; // fHps / (iThreads * iDuty% * fHps of the one thread step with the same ways)
+		double fHpcs;      // hashes per CPU second of the whole process
+		double fWatts;     // 0 without an energy source
+		double fHpj;       // hashes per joule
+		std::vector<double> vThreadHps;
+	};
+
+	static constexpr uint64_t iWarmupMs = 2000;
+
+	void measure(step& s, uint64_t iSeconds);
+	bool write_csv(const char* sOutFile);
+	bool write_json(const char* sOutFile);
+
+	std::vector<step> vSteps;
+	int iVariant;
+	int iAsmVersion;
+};
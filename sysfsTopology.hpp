@@ -0,0 +1,286 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <dirent.h>
+
+// Linux CPU topology read from sysfs, for builds without hwloc. The objects form the same tree
+// hwloc gives us - package, caches from the top level down, core, PU - so autoAdjust can walk
+// it the same way. --sysfs-root reads a copy of /sys taken on another machine instead.
+class sysfsTopology
+{
+public:
+	enum obj_type { obj_machine, obj_package, obj_cache, obj_core, obj_pu };
+
+	struct topo_obj
+	{
+		obj_type iType;
+		uint32_t iOsIndex;         // package, core and PU ids
+		uint32_t iLevel;           // caches only
+		size_t iSize;              // caches only, bytes
+		int32_t iNode;             // NUMA node of the first PU below, -1 if unknown
+		std::vector<uint32_t> vCpus; // every PU below, sorted
+		std::vector<topo_obj> vChildren;
+	};
+
+	static std::string& root()
+	{
+		static std::string sRoot = "/sys";
+		return sRoot;
+	}
+
+	bool load()
+	{
+		std::string sCpuDir = root() + "/devices/system/cpu";
+		std::vector<uint32_t> vOnline;
+		if(!readList(sCpuDir + "/online", vOnline) || vOnline.empty())
+			return false;
+
+		readNodes();
+
+		struct cache_key { uint32_t iLevel; std::vector<uint32_t> vCpus; size_t iSize; };
+		std::vector<cache_key> vCaches;
+		std::map<std::tuple<uint32_t, uint32_t, uint32_t>, std::vector<uint32_t>> mCores;
+		std::map<uint32_t, std::vector<uint32_t>> mPackages;
+
+		for(uint32_t cpu : vOnline)
+		{
+			std::string sDir = sCpuDir + "/cpu" + std::to_string(cpu);
+			uint32_t iPackage = 0, iDie = 0, iCore = cpu;
+			readUint(sDir + "/topology/physical_package_id", iPackage);
+			readUint(sDir + "/topology/die_id", iDie);
+			readUint(sDir + "/topology/core_id", iCore);
+
+			mPackages[iPackage].push_back(cpu);
+			mCores[std::make_tuple(iPackage, iDie, iCore)].push_back(cpu);
+
+			for(uint32_t idx = 0; ; idx++)
+			{
+				std::string sCache = sDir + "/cache/index" + std::to_string(idx);
+				cache_key key;
+				std::string sType, sSize;
+				if(!readUint(sCache + "/level", key.iLevel))
+					break;
+
+				if(!readString(sCache + "/type", sType) || sType == "Instruction" ||
+					!readString(sCache + "/size", sSize) || !readList(sCache + "/shared_cpu_list", key.vCpus))
+					continue;
+
+				key.iSize = parseSize(sSize);
+				bool bKnown = false;
+				for(const cache_key& c : vCaches)
+					bKnown |= c.iLevel == key.iLevel && c.vCpus == key.vCpus;
+				if(!bKnown && key.iSize != 0)
+					vCaches.push_back(key);
+			}
+		}
+
+		oMachine = makeObj(obj_machine, 0, vOnline);
+
+		for(auto& pkg : mPackages)
+			oMachine.vChildren.push_back(makeObj(obj_package, pkg.first, pkg.second));
+
+		// Bigger caches first, so every cache finds the one it sits in
+		std::stable_sort(vCaches.begin(), vCaches.end(),
+			[](const cache_key& a, const cache_key& b) { return a.iLevel > b.iLevel; });
+
+		for(const cache_key& c : vCaches)
+		{
+			topo_obj obj = makeObj(obj_cache, 0, c.vCpus);
+			obj.iLevel = c.iLevel;
+			obj.iSize = c.iSize;
+			insert(oMachine, obj);
+		}
+
+		for(auto& core : mCores)
+		{
+			topo_obj obj = makeObj(obj_core, std::get<2>(core.first), core.second);
+			for(uint32_t cpu : obj.vCpus)
+				obj.vChildren.push_back(makeObj(obj_pu, cpu, { cpu }));
+			insert(oMachine, obj);
+		}
+
+		sortChildren(oMachine);
+		return true;
+	}
+
+	const topo_obj& machine() const { return oMachine; }
+
+	static std::string formatList(const std::vector<uint32_t>& vCpus)
+	{
+		std::string sOut;
+		for(size_t i = 0; i < vCpus.size(); )
+		{
+			size_t j = i;
+			while(j + 1 < vCpus.size() && vCpus[j + 1] == vCpus[j] + 1)
+				j++;
+
+			if(!sOut.empty())
+				sOut += ",";
+			sOut += std::to_string(vCpus[i]);
+			if(j > i)
+				sOut += "-" + std::to_string(vCpus[j]);
+			i = j + 1;
+		}
+		return sOut;
+	}
+
+	// Kernel cpu lists look like "0-3,8,10-11"
+	static bool readList(const std::string& sFile, std::vector<uint32_t>& vOut)
+	{
+		std::string sList;
+		if(!readString(sFile, sList))
+			return false;
+
+		vOut.clear();
+		const char* p = sList.c_str();
+		while(*p != '\0')
+		{
+			char* pEnd;
+			unsigned long iFirst = strtoul(p, &pEnd, 10);
+			if(pEnd == p)
+				return false;
+
+			unsigned long iLast = iFirst;
+			if(*pEnd == '-')
+			{
+				p = pEnd + 1;
+				iLast = strtoul(p, &pEnd, 10);
+				if(pEnd == p || iLast < iFirst)
+					return false;
+			}
+
+			for(unsigned long i = iFirst; i <= iLast; i++)
+				vOut.push_back(uint32_t(i));
+
+			p = pEnd;
+			if(*p == ',')
+				p++;
+			else if(*p != '\0')
+				return false;
+		}
+		return true;
+	}
+
+private:
+	topo_obj oMachine;
+	std::map<uint32_t, int32_t> mCpuNode;
+
+	topo_obj makeObj(obj_type iType, uint32_t iOsIndex, std::vector<uint32_t> vCpus)
+	{
+		topo_obj obj;
+		std::sort(vCpus.begin(), vCpus.end());
+		obj.iType = iType;
+		obj.iOsIndex = iOsIndex;
+		obj.iLevel = 0;
+		obj.iSize = 0;
+		auto it = mCpuNode.find(vCpus.empty() ? 0 : vCpus[0]);
+		obj.iNode = it != mCpuNode.end() ? it->second : -1;
+		obj.vCpus = std::move(vCpus);
+		return obj;
+	}
+
+	static bool contains(const topo_obj& parent, const topo_obj& obj)
+	{
+		return std::includes(parent.vCpus.begin(), parent.vCpus.end(), obj.vCpus.begin(), obj.vCpus.end());
+	}
+
+	// Puts obj below the deepest object that holds all of its PUs
+	static void insert(topo_obj& parent, const topo_obj& obj)
+	{
+		for(topo_obj& child : parent.vChildren)
+		{
+			if(child.iType != obj_core && child.iType != obj_pu && contains(child, obj))
+			{
+				// A cache shared by the same PUs as a bigger one goes below it, not into it twice
+				if(child.iType == obj_cache && obj.iType == obj_cache && child.iLevel <= obj.iLevel)
+					continue;
+				insert(child, obj);
+				return;
+			}
+		}
+		parent.vChildren.push_back(obj);
+	}
+
+	static void sortChildren(topo_obj& obj)
+	{
+		std::sort(obj.vChildren.begin(), obj.vChildren.end(),
+			[](const topo_obj& a, const topo_obj& b) { return a.vCpus < b.vCpus; });
+		for(topo_obj& child : obj.vChildren)
+			sortChildren(child);
+	}
+
+	void readNodes()
+	{
+		std::string sNodeDir = root() + "/devices/system/node";
+		DIR* dir = opendir(sNodeDir.c_str());
+		if(dir == nullptr)
+			return;
+
+		struct dirent* ent;
+		while((ent = readdir(dir)) != nullptr)
+		{
+			char* pEnd;
+			if(strncmp(ent->d_name, "node", 4) != 0)
+				continue;
+			long iNode = strtol(ent->d_name + 4, &pEnd, 10);
+			if(pEnd == ent->d_name + 4 || *pEnd != '\0')
+				continue;
+
+			std::vector<uint32_t> vCpus;
+			if(readList(sNodeDir + "/" + ent->d_name + "/cpulist", vCpus))
+			{
+				for(uint32_t cpu : vCpus)
+					mCpuNode[cpu] = int32_t(iNode);
+			}
+		}
+		closedir(dir);
+	}
+
+	static bool readString(const std::string& sFile, std::string& sOut)
+	{
+		std::ifstream f(sFile);
+		if(!f.is_open() || !std::getline(f, sOut))
+			return false;
+
+		while(!sOut.empty() && (sOut.back() == '\n' || sOut.back() == '\r' || sOut.back() == ' '))
+			sOut.pop_back();
+		return true;
+	}
+
+	static bool readUint(const std::string& sFile, uint32_t& iOut)
+	{
+		std::string sVal;
+		char* pEnd;
+		if(!readString(sFile, sVal) || sVal.empty())
+			return false;
+
+		// Offline or hotplugged CPUs can report -1 ids
+		long iVal = strtol(sVal.c_str(), &pEnd, 10);
+		if(*pEnd != '\0' || iVal < 0)
+			return false;
+		iOut = uint32_t(iVal);
+		return true;
+	}
+
+	static size_t parseSize(const std::string& sSize)
+	{
+		char* pEnd;
+		size_t iSize = strtoull(sSize.c_str(), &pEnd, 10);
+		switch(*pEnd)
+		{
+		case 'K': return iSize * 1024;
+		case 'M': return iSize * 1024 * 1024;
+		case 'G': return iSize * 1024 * 1024 * 1024;
+		default: return iSize;
+		}
+	}
+};
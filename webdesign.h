@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+
+// Static parts of the http reports, the tables themselves are made by the executor
+
+static const char sHtmlCssEtag[] = "\"00000006\"";
+
+static const char sHtmlCssFile[] =
+	"body {"
+		"font-family: Tahoma, Arial, sans-serif;"
+		"font-size: 80%;"
+		"background-color: rgb(240, 240, 240);"
+	"}"
+	"a {"
+		"color: rgb(44, 55, 66);"
+	"}"
+	".links {"
+		"padding: 7px;"
+		"text-align: center;"
+		"background-color: rgb(215, 215, 215);"
+		"box-shadow: 0px 1px 3px 0px rgba(0, 0, 0, 0.5);"
+	"}"
+	".links a {"
+		"padding: 7px 20px;"
+		"text-decoration: none;"
+	"}"
+	".data pre {"
+		"margin: 20px auto;"
+		"max-width: 700px;"
+		"padding: 10px;"
+		"background-color: rgb(255, 255, 255);"
+		"box-shadow: 0px 1px 3px 0px rgba(0, 0, 0, 0.3);"
+	"}";
+
+static const size_t sHtmlCssSize = sizeof(sHtmlCssFile) - 1;
+
+static const char sHtmlCommonHeader[] =
+	"<!DOCTYPE html>"
+	"<html>"
+	"<head><meta name='viewport' content='width=device-width' />"
+	"<link rel='stylesheet' href='style.css' /><title>%s</title></head>"
+	"<body>"
+	"<div class='links'>"
+		"<a href='/h'>Hashrate</a>"
+		"<a href='/r'>Results</a>"
+		"<a href='/c'>Connection</a>"
+	"</div>"
+	"<div class='data'><pre>";
+
+static const char sHtmlCommonFooter[] =
+	"</pre></div>"
+	"</body>"
+	"</html>";